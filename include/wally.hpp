@@ -94,6 +94,10 @@ template <> inline auto get_p(const std::nullptr_t& p) {
         return ::N(WALLYB(i1), i321, out); \
 }
 
+#define WALLY_FN_B3BBB_A(F, N) template <class I1, class I2, class I3, class I4, class O> inline int F(const I1 &i1, uint32_t i321, const I2 &i2, const I3 &i3, const I4 &i4, O * *out) { \
+        return ::N(WALLYB(i1), i321, WALLYB(i2), WALLYB(i3), WALLYB(i4), out); \
+}
+
 #define WALLY_FN_B3_BS(F, N) template <class I1, class O> inline int F(const I1 &i1, uint32_t i321, O & out, size_t * written = 0) { \
         size_t n; \
         int ret = ::N(WALLYB(i1), i321, WALLYO(out), written ? written : &n); \
@@ -132,6 +136,10 @@ template <> inline auto get_p(const std::nullptr_t& p) {
         return written || ret != WALLY_OK ? ret : n == static_cast<size_t>(out.size()) ? WALLY_OK : WALLY_EINVAL; \
 }
 
+#define WALLY_FN_BBB(F, N) template <class I1, class I2, class I3> inline int F(const I1 &i1, const I2 &i2, const I3 &i3) { \
+        return ::N(WALLYB(i1), WALLYB(i2), WALLYB(i3)); \
+}
+
 #define WALLY_FN_BB_B(F, N) template <class I1, class I2, class O> inline int F(const I1 &i1, const I2 &i2, O & out) { \
         return ::N(WALLYB(i1), WALLYB(i2), WALLYO(out)); \
 }
@@ -188,8 +196,8 @@ template <> inline auto get_p(const std::nullptr_t& p) {
         return ::N(WALLYP(p1), i321, i322, out); \
 }
 
-#define WALLY_FN_P3B(F, N) template <class P1, class I1, class O> inline int F(const P1 &p1, uint32_t i321, const I1 &i1, O & out) { \
-        return ::N(WALLYP(p1), i321, WALLYB(i1), WALLYO(out)); \
+#define WALLY_FN_P3B(F, N) template <class P1, class I1> inline int F(const P1 &p1, uint32_t i321, const I1 &i1) { \
+        return ::N(WALLYP(p1), i321, WALLYB(i1)); \
 }
 
 #define WALLY_FN_P3B633_B(F, N) template <class P1, class I1, class O> inline int F(const P1 &p1, uint32_t i321, const I1 &i1, uint64_t i641, uint32_t i322, uint32_t i323, O & out) { \
@@ -280,6 +288,10 @@ template <> inline auto get_p(const std::nullptr_t& p) {
         return ::N(WALLYP(p1), WALLYB(i1), i321, out); \
 }
 
+#define WALLY_FN_PB_B(F, N) template <class P1, class I1, class O> inline int F(const P1 &p1, const I1 &i1, O & out) { \
+        return ::N(WALLYP(p1), WALLYB(i1), WALLYO(out)); \
+}
+
 #define WALLY_FN_PB_A(F, N) template <class P1, class I1, class O> inline int F(const P1 &p1, const I1 &i1, O * *out) { \
         return ::N(WALLYP(p1), WALLYB(i1), out); \
 }
@@ -320,6 +332,10 @@ template <> inline auto get_p(const std::nullptr_t& p) {
         return ::N(WALLYP(p1), out); \
 }
 
+#define WALLY_FN_P_B(F, N) template <class P1, class O> inline int F(const P1 &p1, O & out) { \
+        return ::N(WALLYP(p1), WALLYO(out)); \
+}
+
 #define WALLY_FN_P_BS(F, N) template <class P1, class O> inline int F(const P1 &p1, O & out, size_t * written = 0) { \
         size_t n; \
         int ret = ::N(WALLYP(p1), WALLYO(out), written ? written : &n); \
@@ -347,6 +363,7 @@ WALLY_FN_6B_A(tx_output_init_alloc, wally_tx_output_init_alloc)
 WALLY_FN_B(ec_private_key_verify, wally_ec_private_key_verify)
 WALLY_FN_B(ec_public_key_verify, wally_ec_public_key_verify)
 WALLY_FN_B(secp_randomize, wally_secp_randomize)
+WALLY_FN_B(secp_thread_init, wally_secp_thread_init)
 WALLY_FN_B33BP_A(tx_input_init_alloc, wally_tx_input_init_alloc)
 WALLY_FN_B33_A(bip32_key_from_parent_alloc, bip32_key_from_parent_alloc)
 WALLY_FN_B33_A(bip32_key_from_seed_alloc, bip32_key_from_seed_alloc)
@@ -357,6 +374,7 @@ WALLY_FN_B33_BS(scriptpubkey_multisig_from_bytes, wally_scriptpubkey_multisig_fr
 WALLY_FN_B33_P(bip32_key_from_seed, bip32_key_from_seed)
 WALLY_FN_B3_A(base58_from_bytes, wally_base58_from_bytes)
 WALLY_FN_B3_A(tx_from_bytes, wally_tx_from_bytes)
+WALLY_FN_B3BBB_A(musig_session_init_alloc, wally_musig_session_init_alloc)
 WALLY_FN_B3_BS(format_bitcoin_message, wally_format_bitcoin_message)
 WALLY_FN_B3_BS(script_push_from_bytes, wally_script_push_from_bytes)
 WALLY_FN_B3_BS(scriptpubkey_p2pkh_from_bytes, wally_scriptpubkey_p2pkh_from_bytes)
@@ -369,9 +387,11 @@ WALLY_FN_BB3_B(bip38_raw_from_private_key, bip38_raw_from_private_key)
 WALLY_FN_BB3_B(bip38_raw_to_private_key, bip38_raw_to_private_key)
 WALLY_FN_BB3_B(ec_sig_from_bytes, wally_ec_sig_from_bytes)
 WALLY_FN_BB3_B(ec_sig_verify, wally_ec_sig_verify)
+WALLY_FN_BB3_B(ecdh_batch, wally_ecdh_batch)
 WALLY_FN_BB3_BS(scriptsig_p2pkh_from_sig, wally_scriptsig_p2pkh_from_sig)
 WALLY_FN_BBB3_BS(aes_cbc, wally_aes_cbc)
 WALLY_FN_BBB3_BS(scriptsig_multisig_from_bytes, wally_scriptsig_multisig_from_bytes)
+WALLY_FN_BBB(schnorr_draft_sig_verify_batch, wally_schnorr_draft_sig_verify_batch)
 WALLY_FN_BB_B(hmac_sha256, wally_hmac_sha256)
 WALLY_FN_BB_B(hmac_sha512, wally_hmac_sha512)
 WALLY_FN_BB_B(ecdh, wally_ecdh)
@@ -381,7 +401,9 @@ WALLY_FN_B_A(bip32_key_unserialize_alloc, bip32_key_unserialize_alloc)
 WALLY_FN_B_A(hex_from_bytes, wally_hex_from_bytes)
 WALLY_FN_B_B(ec_public_key_decompress, wally_ec_public_key_decompress)
 WALLY_FN_B_B(ec_public_key_from_private_key, wally_ec_public_key_from_private_key)
+WALLY_FN_B3_B(ec_public_key_from_private_key_batch, wally_ec_public_key_from_private_key_batch)
 WALLY_FN_B_B(ec_sig_from_der, wally_ec_sig_from_der)
+WALLY_FN_B_B(musig_pubkey_combine, wally_musig_pubkey_combine)
 WALLY_FN_B_B(ec_sig_normalize, wally_ec_sig_normalize)
 WALLY_FN_B_B(hash160, wally_hash160)
 WALLY_FN_B_B(sha256, wally_sha256)
@@ -395,6 +417,7 @@ WALLY_FN_BB33_B(pbkdf2_hmac_sha512, wally_pbkdf2_hmac_sha512)
 WALLY_FN_P(bip32_key_free, bip32_key_free)
 WALLY_FN_P(get_operations, wally_get_operations)
 WALLY_FN_P(set_operations, wally_set_operations)
+WALLY_FN_P(musig_session_free, wally_musig_session_free)
 WALLY_FN_P(tx_free, wally_tx_free)
 WALLY_FN_P(tx_input_free, wally_tx_input_free)
 WALLY_FN_P(tx_output_free, wally_tx_output_free)
@@ -402,6 +425,7 @@ WALLY_FN_P(tx_witness_stack_free, wally_tx_witness_stack_free)
 WALLY_FN_P3(tx_witness_stack_add_dummy, wally_tx_witness_stack_add_dummy)
 WALLY_FN_P3(tx_witness_stack_set_dummy, wally_tx_witness_stack_set_dummy)
 WALLY_FN_P33_P(bip32_key_from_parent, bip32_key_from_parent)
+WALLY_FN_P3B(musig_partial_sig_verify, wally_musig_partial_sig_verify)
 WALLY_FN_P3B(tx_witness_stack_set, wally_tx_witness_stack_set)
 WALLY_FN_P3B633_B(tx_get_btc_signature_hash, wally_tx_get_btc_signature_hash)
 WALLY_FN_P3BB36333_B(tx_get_signature_hash, wally_tx_get_signature_hash)
@@ -416,11 +440,15 @@ WALLY_FN_P3_BS(wif_to_public_key, wally_wif_to_public_key)
 WALLY_FN_P3_S(tx_get_length, wally_tx_get_length)
 WALLY_FN_P33_A(wif_to_address, wally_wif_to_address)
 WALLY_FN_P6B3(tx_add_raw_output, wally_tx_add_raw_output)
+WALLY_FN_PB(musig_session_set_message, wally_musig_session_set_message)
+WALLY_FN_PB(musig_session_set_nonces, wally_musig_session_set_nonces)
 WALLY_FN_PB(tx_witness_stack_add, wally_tx_witness_stack_add)
 WALLY_FN_PB33BP3(tx_add_raw_input, wally_tx_add_raw_input)
 WALLY_FN_PB3_A(bip32_key_from_parent_path_alloc, bip32_key_from_parent_path_alloc)
 WALLY_FN_PB3_B(bip38_to_private_key, bip38_to_private_key)
 WALLY_FN_PB3_P(bip32_key_from_parent_path, bip32_key_from_parent_path)
+WALLY_FN_PB_B(musig_partial_sig_combine, wally_musig_partial_sig_combine)
+WALLY_FN_PB_B(musig_session_get_nonce, wally_musig_session_get_nonce)
 WALLY_FN_PB_A(bip39_mnemonic_from_bytes, bip39_mnemonic_from_bytes)
 WALLY_FN_PP(bip39_mnemonic_validate, bip39_mnemonic_validate)
 WALLY_FN_PP(tx_add_input, wally_tx_add_input)
@@ -436,6 +464,8 @@ WALLY_FN_PS_A(bip39_get_word, bip39_get_word)
 WALLY_FN_P_A(bip32_key_from_base58_alloc, bip32_key_from_base58_alloc)
 WALLY_FN_P_A(bip39_get_languages, bip39_get_languages)
 WALLY_FN_P_A(bip39_get_wordlist, bip39_get_wordlist)
+WALLY_FN_P_B(musig_partial_sign, wally_musig_partial_sign)
+WALLY_FN_P_B(musig_session_get_nonce_commitment, wally_musig_session_get_nonce_commitment)
 WALLY_FN_P_BS(hex_to_bytes, wally_hex_to_bytes)
 WALLY_FN_P_S(base58_get_length, wally_base58_get_length)
 WALLY_FN_P_S(wif_is_uncompressed, wally_wif_is_uncompressed)
@@ -450,6 +480,14 @@ inline struct secp256k1_context_struct *get_secp_context() {
     return ::wally_get_secp_context();
 }
 
+inline int secp_get_ecmult_window(size_t *written) {
+    return ::wally_secp_get_ecmult_window(written);
+}
+
+inline int secp_get_context_size(size_t *written) {
+    return ::wally_secp_get_context_size(written);
+}
+
 inline int free_string(char *str) {
     return ::wally_free_string(str);
 }
@@ -15,6 +15,9 @@ extern "C" {
 /** Length of an ext_key serialized using BIP32 format */
 #define BIP32_SERIALIZED_LEN 78
 
+/** Buffer length for a base58 encoded ext_key, including the nul terminator */
+#define BIP32_BASE58_LEN 113
+
 /** Child number of the first hardened child */
 #define BIP32_INITIAL_HARDENED_CHILD 0x80000000
 
@@ -295,6 +298,30 @@ WALLY_CORE_API int bip32_key_to_base58(
     uint32_t flags,
     char **output);
 
+#ifndef SWIG
+/**
+ * Convert an array of extended keys to base58 without allocating.
+ *
+ * :param hdkeys: The extended keys to convert.
+ * :param num_keys: The number of extended keys in ``hdkeys``.
+ * :param flags: ``BIP32_FLAG_KEY_`` Flags indicating which key to serialize,
+ *|    as for `bip32_key_to_base58`.
+ * :param output: Destination for the nul-terminated base58 keys. Key ``i``
+ *|    is written at offset ``i * BIP32_BASE58_LEN``.
+ * :param len: The length of ``output`` in bytes. Must be ``BIP32_BASE58_LEN``
+ *|    times ``num_keys``.
+ *
+ * .. note:: If any key cannot be serialized, ``output`` is cleared and
+ *|    ``WALLY_EINVAL`` is returned.
+ */
+WALLY_CORE_API int bip32_keys_to_base58(
+    const struct ext_key *hdkeys,
+    size_t num_keys,
+    uint32_t flags,
+    char *output,
+    size_t len);
+#endif
+
 #ifndef SWIG
 /**
  * Convert a base58 encoded extended key to an extended key.
@@ -87,9 +87,12 @@ WALLY_CORE_API int wally_free_string(
  * The caller should call this function before using any functions that rely on
  * libsecp256k1 (i.e. Anything using public/private keys).
  *
- * As wally is not currently threadsafe, this function should either be
- * called before threads are created or access to wally functions wrapped
- * in an application level mutex.
+ * When built with thread support, the internal context is shared and is
+ * never modified. Instead, the calling thread is given its own copy of it
+ * which is randomized and used for all subsequent calls made from that
+ * thread. This function is therefore safe to call from any thread at any
+ * time, but must be called from each thread that should use a randomized
+ * context. Calling it again re-randomizes the thread's existing context.
  *
  * :param bytes: Entropy to use.
  * :param bytes_len: Size of ``bytes`` in bytes. Must be ``WALLY_SECP_RANDOMIZE_LEN``.
@@ -98,6 +101,48 @@ WALLY_CORE_API int wally_secp_randomize(
     const unsigned char *bytes,
     size_t bytes_len);
 
+/**
+ * Give the calling thread its own randomized libsecp256k1 context.
+ *
+ * This is equivalent to `wally_secp_randomize`.
+ *
+ * :param bytes: Entropy to use.
+ * :param bytes_len: Size of ``bytes`` in bytes. Must be ``WALLY_SECP_RANDOMIZE_LEN``.
+ */
+WALLY_CORE_API int wally_secp_thread_init(
+    const unsigned char *bytes,
+    size_t bytes_len);
+
+/**
+ * Free the calling thread's libsecp256k1 context, if any.
+ *
+ * Contexts are also freed automatically when their thread exits.
+ */
+WALLY_CORE_API int wally_secp_thread_cleanup(void);
+
+/**
+ * Get the libsecp256k1 verification precomputation window size.
+ *
+ * This is set when building with ``--with-ecmult-window``.
+ *
+ * :param written: Destination for the window size.
+ */
+WALLY_CORE_API int wally_secp_get_ecmult_window(
+    size_t *written);
+
+/**
+ * Get the memory used by each libsecp256k1 context, including its
+ * precomputation tables.
+ *
+ * Each thread using `wally_secp_thread_init` allocates a context of
+ * this size. If the signing table is compiled into the library
+ * with ``--enable-ecmult-static-precomputation``, it is not included.
+ *
+ * :param written: Destination for the size of a context in bytes.
+ */
+WALLY_CORE_API int wally_secp_get_context_size(
+    size_t *written);
+
 /**
  * Convert bytes to a (lower-case) hexadecimal string.
  *
@@ -286,8 +286,14 @@ WALLY_CORE_API int wally_pbkdf2_hmac_sha512(
 
 /** Indicates that a signature using ECDSA/secp256k1 is required */
 #define EC_FLAG_ECDSA 0x1
-/** Indicates that a signature using EC-Schnorr-SHA256 is required */
-#define EC_FLAG_SCHNORR 0x2
+/**
+ * Indicates that a signature using the BIP-schnorr draft/secp256k1 is required.
+ *
+ * This is the pre-BIP340 draft, which signs with 33 byte compressed public
+ * keys and uses a different nonce and challenge hash. Its signatures are
+ * NOT compatible with BIP340 or taproot.
+ */
+#define EC_FLAG_SCHNORR_DRAFT 0x2
 /** Indicates that the signature nonce should be incremented until the signature is low-R */
 #define EC_FLAG_GRIND_R 0x4
 /** Indicates that the signature is recoverable */
@@ -329,6 +335,32 @@ WALLY_CORE_API int wally_ec_public_key_from_private_key(
     unsigned char *bytes_out,
     size_t len);
 
+/**
+ * Create public keys from a batch of private keys.
+ *
+ * :param priv_key: The concatenated private keys to create public keys from.
+ * :param priv_key_len: The length of ``priv_key`` in bytes. Must be a
+ *|    non-zero multiple of ``EC_PRIVATE_KEY_LEN``.
+ * :param num_threads: The maximum number of threads to create keys with,
+ *|    including the calling thread. Pass 0 or 1 to create keys on the
+ *|    calling thread only.
+ * :param bytes_out: Destination for the concatenated public keys, in the
+ *|    same order as ``priv_key``.
+ * :param len: The length of ``bytes_out`` in bytes. Must be either
+ *|    ``EC_PUBLIC_KEY_LEN`` or ``EC_PUBLIC_KEY_UNCOMPRESSED_LEN`` times the
+ *|    number of private keys, which determines whether compressed or
+ *|    uncompressed public keys are written.
+ *
+ * .. note:: If any private key is invalid, no public keys are created and
+ *|    ``WALLY_EINVAL`` is returned.
+ */
+WALLY_CORE_API int wally_ec_public_key_from_private_key_batch(
+    const unsigned char *priv_key,
+    size_t priv_key_len,
+    uint32_t num_threads,
+    unsigned char *bytes_out,
+    size_t len);
+
 /**
  * Create an uncompressed public key from a compressed public key.
  *
@@ -357,6 +389,32 @@ WALLY_CORE_API int wally_ec_public_key_negate(
     unsigned char *bytes_out,
     size_t len);
 
+/**
+ * Compute the sum of public keys, optionally multiplying each by a scalar.
+ *
+ * :param pub_key: The concatenated public keys to sum.
+ * :param pub_key_len: The length of ``pub_key`` in bytes. Must be a non-zero
+ *|    multiple of ``EC_PUBLIC_KEY_LEN``.
+ * :param bytes: The concatenated 32 byte big-endian scalars to multiply
+ *|    each public key by, or NULL to sum the keys unmodified.
+ * :param bytes_len: The length of ``bytes`` in bytes. Must be
+ *|    ``EC_PRIVATE_KEY_LEN`` times the number of public keys, or 0 if
+ *|    ``bytes`` is NULL.
+ * :param bytes_out: Destination for the resulting public key.
+ * :param len: The length of ``bytes_out`` in bytes. Must be ``EC_PUBLIC_KEY_LEN``.
+ *
+ * .. note:: When ``bytes`` is given, all keys are multiplied and summed in
+ *|    a single variable time multi-scalar multiplication. The scalars
+ *|    must therefore not be secret.
+ */
+WALLY_CORE_API int wally_ec_public_key_combine(
+    const unsigned char *pub_key,
+    size_t pub_key_len,
+    const unsigned char *bytes,
+    size_t bytes_len,
+    unsigned char *bytes_out,
+    size_t len);
+
 /**
  * Sign a message hash with a private key, producing a compact signature.
  *
@@ -443,6 +501,70 @@ WALLY_CORE_API int wally_ec_sig_verify(
     const unsigned char *sig,
     size_t sig_len);
 
+/**
+ * Verify a batch of signed message hashes, optionally using multiple threads.
+ *
+ * :param pub_key: The concatenated public keys to verify with.
+ * :param pub_key_len: The length of ``pub_key`` in bytes. Must be a non-zero
+ *|    multiple of ``EC_PUBLIC_KEY_LEN``.
+ * :param bytes: The concatenated message hashes to verify.
+ * :param bytes_len: The length of ``bytes`` in bytes. Must be
+ *|    ``EC_MESSAGE_HASH_LEN`` times the number of public keys.
+ * :param flags: EC_FLAG_ flag values indicating desired behavior.
+ * :param sig: The concatenated compact signatures of the message hashes.
+ * :param sig_len: The length of ``sig`` in bytes. Must be
+ *|    ``EC_SIGNATURE_LEN`` times the number of public keys.
+ * :param num_threads: The maximum number of threads to verify with,
+ *|    including the calling thread. Pass 0 or 1 to verify on the calling
+ *|    thread only.
+ * :param bytes_out: Destination for the result bitmap. Bit ``i % 8`` of
+ *|    byte ``i / 8`` is set if signature ``i`` is valid.
+ * :param len: The length of ``bytes_out`` in bytes. Must be at least the
+ *|    number of public keys divided by 8, rounded up.
+ * :param written: Destination for the number of valid signatures.
+ */
+WALLY_CORE_API int wally_ec_sig_verify_batch(
+    const unsigned char *pub_key,
+    size_t pub_key_len,
+    const unsigned char *bytes,
+    size_t bytes_len,
+    uint32_t flags,
+    const unsigned char *sig,
+    size_t sig_len,
+    uint32_t num_threads,
+    unsigned char *bytes_out,
+    size_t len,
+    size_t *written);
+
+/**
+ * Verify a batch of BIP-schnorr draft signatures at once.
+ *
+ * See ``EC_FLAG_SCHNORR_DRAFT``; these are not BIP340 signatures.
+ *
+ * All signatures are checked together using a single multi-scalar
+ * multiplication, which is considerably faster than verifying each
+ * signature with `wally_ec_sig_verify`. The result does not indicate
+ * which signature(s) failed verification; use `wally_ec_sig_verify_batch`
+ * to find them.
+ *
+ * :param pub_key: The concatenated public keys to verify with.
+ * :param pub_key_len: The length of ``pub_key`` in bytes. Must be a non-zero
+ *|    multiple of ``EC_PUBLIC_KEY_LEN``.
+ * :param bytes: The concatenated message hashes to verify.
+ * :param bytes_len: The length of ``bytes`` in bytes. Must be
+ *|    ``EC_MESSAGE_HASH_LEN`` times the number of public keys.
+ * :param sig: The concatenated compact signatures of the message hashes.
+ * :param sig_len: The length of ``sig`` in bytes. Must be
+ *|    ``EC_SIGNATURE_LEN`` times the number of public keys.
+ */
+WALLY_CORE_API int wally_schnorr_draft_sig_verify_batch(
+    const unsigned char *pub_key,
+    size_t pub_key_len,
+    const unsigned char *bytes,
+    size_t bytes_len,
+    const unsigned char *sig,
+    size_t sig_len);
+
 /**
  * Recover compressed public key from a recoverable signature.
  *
@@ -490,6 +612,62 @@ WALLY_CORE_API int wally_format_bitcoin_message(const unsigned char *bytes,
                                                 size_t len,
                                                 size_t *written);
 
+#ifndef SWIG
+/**
+ * Recover the public keys from a batch of bitcoin signed messages.
+ *
+ * Each message is formatted and hashed as for `wally_format_bitcoin_message`
+ * with ``BITCOIN_MESSAGE_FLAG_HASH``, then its public key is recovered from
+ * the corresponding recoverable signature.
+ *
+ * :param messages: Array of pointers to the message strings that were signed.
+ * :param message_lens: Array of the lengths of each of ``messages``. Each
+ *|    must be non-zero and less than or equal to BITCOIN_MESSAGE_MAX_LEN.
+ * :param num_messages: The number of items in ``messages`` and ``message_lens``.
+ * :param sig: The concatenated recoverable compact signatures of the messages.
+ * :param sig_len: The length of ``sig`` in bytes. Must be
+ *|    ``EC_SIGNATURE_RECOVERABLE_LEN`` times ``num_messages``.
+ * :param hashes: The concatenated ``HASH160_LEN`` expected address hashes
+ *|    of the signers, or NULL to only recover the public keys. The header
+ *|    byte of each signature determines the hash compared: 27-30 for the
+ *|    P2PKH hash of an uncompressed key, 31-34 for the P2PKH hash of a
+ *|    compressed key, 35-38 for a P2SH-P2WPKH script hash and 39-42 for
+ *|    a P2WPKH witness program.
+ * :param hashes_len: The length of ``hashes`` in bytes. Must be
+ *|    ``HASH160_LEN`` times ``num_messages`` if ``hashes`` is non-NULL,
+ *|    otherwise 0.
+ * :param num_threads: The maximum number of threads to recover with,
+ *|    including the calling thread. Pass 0 or 1 to recover on the calling
+ *|    thread only.
+ * :param pub_keys_out: Destination for the concatenated compressed public
+ *|    keys recovered. The keys of messages whose bit is not set in
+ *|    ``bytes_out`` are zeroed. May be NULL.
+ * :param pub_keys_len: The length of ``pub_keys_out`` in bytes. Must be
+ *|    ``EC_PUBLIC_KEY_LEN`` times ``num_messages`` if ``pub_keys_out`` is
+ *|    non-NULL, otherwise 0.
+ * :param bytes_out: Destination for the result bitmap. Bit ``i % 8`` of
+ *|    byte ``i / 8`` is set if the public key of message ``i`` was recovered
+ *|    and, if ``hashes`` is given, matched its expected hash.
+ * :param len: The length of ``bytes_out`` in bytes. Must be at least
+ *|    ``num_messages`` divided by 8, rounded up.
+ * :param written: Destination for the number of bits set in ``bytes_out``.
+ */
+WALLY_CORE_API int wally_bitcoin_message_recover_batch(
+    const unsigned char *const *messages,
+    const size_t *message_lens,
+    size_t num_messages,
+    const unsigned char *sig,
+    size_t sig_len,
+    const unsigned char *hashes,
+    size_t hashes_len,
+    uint32_t num_threads,
+    unsigned char *pub_keys_out,
+    size_t pub_keys_len,
+    unsigned char *bytes_out,
+    size_t len,
+    size_t *written);
+#endif /* SWIG */
+
 /**
  *
  * Compute an EC Diffie-Hellman secret in constant time
@@ -508,6 +686,256 @@ WALLY_CORE_API int wally_ecdh(const unsigned char *pub_key,
                               unsigned char *bytes_out,
                               size_t len);
 
+/**
+ * Compute EC Diffie-Hellman secrets for many public keys against one private key.
+ *
+ * :param pub_key: The concatenated public keys.
+ * :param pub_key_len: The length of ``pub_key`` in bytes. Must be a non-zero
+ *|    multiple of ``EC_PUBLIC_KEY_LEN``.
+ * :param bytes: The private key.
+ * :param bytes_len: The length of ``bytes`` in bytes. Must be ``EC_PRIVATE_KEY_LEN``.
+ * :param num_threads: The maximum number of threads to compute with,
+ *|    including the calling thread. Pass 0 or 1 to compute on the calling
+ *|    thread only.
+ * :param bytes_out: Destination for the concatenated shared secrets, in
+ *|    the same order as ``pub_key``.
+ * :param len: The length of ``bytes_out`` in bytes. Must be ``SHA256_LEN``
+ *|    times the number of public keys.
+ *
+ * .. note:: If any public key is invalid, no secrets are computed and
+ *|    ``WALLY_EINVAL`` is returned.
+ */
+WALLY_CORE_API int wally_ecdh_batch(
+    const unsigned char *pub_key,
+    size_t pub_key_len,
+    const unsigned char *bytes,
+    size_t bytes_len,
+    uint32_t num_threads,
+    unsigned char *bytes_out,
+    size_t len);
+
+/** The length of the salt used to key the signature verification cache */
+#define EC_SIG_CACHE_SALT_LEN 32
+
+/**
+ * Enable caching of successful signature verifications.
+ *
+ * Once enabled, `wally_ec_sig_verify` returns immediately for signatures
+ * it has already verified. The cache is shared by all threads and is
+ * replaced if this function is called again.
+ *
+ * :param bytes: Random bytes used to salt the cache keys. These should be
+ *|    generated from a secure source and kept private.
+ * :param bytes_len: The length of ``bytes`` in bytes. Must be ``EC_SIG_CACHE_SALT_LEN``.
+ * :param max_entries: The maximum number of verifications to cache. The
+ *|    cache uses 32 bytes per entry. Must be at least 8.
+ */
+WALLY_CORE_API int wally_ec_sig_cache_enable(
+    const unsigned char *bytes,
+    size_t bytes_len,
+    size_t max_entries);
+
+/**
+ * Disable signature verification caching and free the cache.
+ */
+WALLY_CORE_API int wally_ec_sig_cache_disable(void);
+
+/**
+ * Get statistics for the signature verification cache.
+ *
+ * :param hits: Destination for the number of verifications served from
+ *|    the cache since it was enabled.
+ * :param written: Destination for the number of cache entries in use.
+ *
+ * .. note:: Both values are zero if the cache is not enabled.
+ */
+WALLY_CORE_API int wally_ec_sig_cache_get_stats(
+    size_t *hits,
+    size_t *written);
+
+/** The length of a unique MuSig session id */
+#define MUSIG_SESSION_ID_LEN 32
+/** The length of a MuSig nonce commitment */
+#define MUSIG_NONCE_COMMITMENT_LEN 32
+/** The length of a MuSig public nonce */
+#define MUSIG_NONCE_LEN 33
+/** The length of a MuSig partial signature */
+#define MUSIG_PARTIAL_SIG_LEN 32
+
+struct wally_musig_session;
+
+/**
+ * Compute the MuSig combined public key for a set of signers.
+ *
+ * :param pub_key: The signers' public keys concatenated together, in
+ *|    signing order. Changing the order changes the combined key.
+ * :param pub_key_len: The length of ``pub_key`` in bytes. Must be a
+ *|    non-zero multiple of ``EC_PUBLIC_KEY_LEN``.
+ * :param bytes_out: Destination for the resulting compressed public key.
+ * :param len: The length of ``bytes_out`` in bytes. Must be ``EC_PUBLIC_KEY_LEN``.
+ *
+ * .. note:: The combined key verifies signatures created with
+ *|    `wally_musig_partial_sig_combine` using `wally_ec_sig_verify`
+ *|    and ``EC_FLAG_SCHNORR_DRAFT``.
+ */
+WALLY_CORE_API int wally_musig_pubkey_combine(
+    const unsigned char *pub_key,
+    size_t pub_key_len,
+    unsigned char *bytes_out,
+    size_t len);
+
+/**
+ * Start a MuSig signing session for one signer.
+ *
+ * :param pub_key: The signers' public keys concatenated together, in
+ *|    signing order, as passed to `wally_musig_pubkey_combine`.
+ * :param pub_key_len: The length of ``pub_key`` in bytes. Must be a
+ *|    non-zero multiple of ``EC_PUBLIC_KEY_LEN``.
+ * :param index: The index of this signer's public key in ``pub_key``.
+ * :param priv_key: This signer's private key.
+ * :param priv_key_len: The length of ``priv_key`` in bytes. Must be ``EC_PRIVATE_KEY_LEN``.
+ * :param entropy: A unique session id. This must never be reused for
+ *|    another session with the same private key, or the private key
+ *|    will be revealed. It should be generated from a secure source.
+ * :param entropy_len: The length of ``entropy`` in bytes. Must be ``MUSIG_SESSION_ID_LEN``.
+ * :param bytes: The message hash to sign, or NULL if it will be
+ *|    given later with `wally_musig_session_set_message`.
+ * :param bytes_len: The length of ``bytes`` in bytes. Must be ``EC_MESSAGE_HASH_LEN``.
+ * :param output: Destination for the resulting session. The session
+ *|    must be freed with `wally_musig_session_free`.
+ */
+WALLY_CORE_API int wally_musig_session_init_alloc(
+    const unsigned char *pub_key,
+    size_t pub_key_len,
+    uint32_t index,
+    const unsigned char *priv_key,
+    size_t priv_key_len,
+    const unsigned char *entropy,
+    size_t entropy_len,
+    const unsigned char *bytes,
+    size_t bytes_len,
+    struct wally_musig_session **output);
+
+/**
+ * Free a MuSig session allocated by `wally_musig_session_init_alloc`.
+ *
+ * :param session: The session to free.
+ */
+WALLY_CORE_API int wally_musig_session_free(
+    struct wally_musig_session *session);
+
+/**
+ * Get this signer's nonce commitment, to be sent to the other signers.
+ *
+ * :param session: The signing session.
+ * :param bytes_out: Destination for the nonce commitment.
+ * :param len: The length of ``bytes_out`` in bytes. Must be ``MUSIG_NONCE_COMMITMENT_LEN``.
+ */
+WALLY_CORE_API int wally_musig_session_get_nonce_commitment(
+    const struct wally_musig_session *session,
+    unsigned char *bytes_out,
+    size_t len);
+
+/**
+ * Record all signers' nonce commitments and get this signer's public nonce.
+ *
+ * The public nonce is only revealed once every commitment is known.
+ *
+ * :param session: The signing session.
+ * :param commitment: The nonce commitments of every signer concatenated
+ *|    together in signing order, including this signer's own.
+ * :param commitment_len: The length of ``commitment`` in bytes. Must be
+ *|    ``MUSIG_NONCE_COMMITMENT_LEN`` multiplied by the number of signers.
+ * :param bytes_out: Destination for this signer's public nonce.
+ * :param len: The length of ``bytes_out`` in bytes. Must be ``MUSIG_NONCE_LEN``.
+ */
+WALLY_CORE_API int wally_musig_session_get_nonce(
+    struct wally_musig_session *session,
+    const unsigned char *commitment,
+    size_t commitment_len,
+    unsigned char *bytes_out,
+    size_t len);
+
+/**
+ * Set the message hash to sign, if it was not given when starting a session.
+ *
+ * :param session: The signing session.
+ * :param bytes: The message hash to sign.
+ * :param bytes_len: The length of ``bytes`` in bytes. Must be ``EC_MESSAGE_HASH_LEN``.
+ */
+WALLY_CORE_API int wally_musig_session_set_message(
+    struct wally_musig_session *session,
+    const unsigned char *bytes,
+    size_t bytes_len);
+
+/**
+ * Check all signers' public nonces against their commitments and combine them.
+ *
+ * :param session: The signing session.
+ * :param nonce: The public nonces of every signer concatenated together
+ *|    in signing order, including this signer's own.
+ * :param nonce_len: The length of ``nonce`` in bytes. Must be
+ *|    ``MUSIG_NONCE_LEN`` multiplied by the number of signers.
+ *
+ * .. note:: Returns ``WALLY_EINVAL`` if any nonce does not match its
+ *|    commitment. In this case the session must be abandoned.
+ */
+WALLY_CORE_API int wally_musig_session_set_nonces(
+    struct wally_musig_session *session,
+    const unsigned char *nonce,
+    size_t nonce_len);
+
+/**
+ * Create this signer's partial signature.
+ *
+ * :param session: The signing session. All nonces and the message
+ *|    must have been set.
+ * :param bytes_out: Destination for the partial signature.
+ * :param len: The length of ``bytes_out`` in bytes. Must be ``MUSIG_PARTIAL_SIG_LEN``.
+ */
+WALLY_CORE_API int wally_musig_partial_sign(
+    const struct wally_musig_session *session,
+    unsigned char *bytes_out,
+    size_t len);
+
+/**
+ * Verify another signer's partial signature.
+ *
+ * :param session: The signing session. All nonces and the message
+ *|    must have been set.
+ * :param index: The index of the signer who created ``sig``.
+ * :param sig: The partial signature to verify.
+ * :param sig_len: The length of ``sig`` in bytes. Must be ``MUSIG_PARTIAL_SIG_LEN``.
+ */
+WALLY_CORE_API int wally_musig_partial_sig_verify(
+    const struct wally_musig_session *session,
+    uint32_t index,
+    const unsigned char *sig,
+    size_t sig_len);
+
+/**
+ * Combine all signers' partial signatures into a BIP-schnorr draft signature.
+ *
+ * :param session: The signing session. All nonces and the message
+ *|    must have been set.
+ * :param sig: The partial signatures of every signer concatenated
+ *|    together in signing order.
+ * :param sig_len: The length of ``sig`` in bytes. Must be
+ *|    ``MUSIG_PARTIAL_SIG_LEN`` multiplied by the number of signers.
+ * :param bytes_out: Destination for the resulting signature.
+ * :param len: The length of ``bytes_out`` in bytes. Must be ``EC_SIGNATURE_LEN``.
+ *
+ * .. note:: Partial signatures are not verified. Use
+ *|    `wally_musig_partial_sig_verify` or verify the result against
+ *|    the combined public key to detect an invalid partial signature.
+ */
+WALLY_CORE_API int wally_musig_partial_sig_combine(
+    const struct wally_musig_session *session,
+    const unsigned char *sig,
+    size_t sig_len,
+    unsigned char *bytes_out,
+    size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,6 +8,9 @@
 extern "C" {
 #endif
 
+struct ext_key;
+struct wally_psbt_view;
+
 #define WALLY_PSBT_SEPARATOR 0x00
 
 #define WALLY_PSBT_GLOBAL_UNSIGNED_TX 0x00
@@ -34,6 +37,7 @@ struct wally_unknowns_map;
 struct wally_psbt_input;
 struct wally_psbt_output;
 struct wally_psbt;
+struct wally_psbt_view_item;
 #else
 
 /** Key origin data. Contains a BIP 32 fingerprint and the derivation path */
@@ -123,6 +127,15 @@ struct wally_psbt {
     size_t outputs_allocation_len;
     struct wally_unknowns_map *unknowns;
 };
+
+/** A key-value pair from a map of a serialized PSBT, as found by a PSBT view.
+ * The key excludes its leading type byte. Points into the serialized PSBT */
+struct wally_psbt_view_item {
+    const unsigned char *key;
+    size_t key_len;
+    const unsigned char *value;
+    size_t value_len;
+};
 #endif /* SWIG */
 
 /**
@@ -521,6 +534,9 @@ WALLY_CORE_API int wally_psbt_to_bytes(
  *
  * :param string: Base64 string to create the psbt from.
  * :param output: Destination for the resulting psbt.
+ *
+ * The string is decoded and parsed one map at a time, so the decoded PSBT
+ * is never held in memory all at once.
  */
 WALLY_CORE_API int wally_psbt_from_base64(
     const char *string,
@@ -548,6 +564,25 @@ WALLY_CORE_API int wally_combine_psbts(
     size_t psbts_len,
     struct wally_psbt **output);
 
+/**
+ * Combine the metadata from multiple PSBTs into one, consuming them.
+ *
+ * :param psbts: Array of pointers to the PSBTs to combine. Each PSBT
+ *|    must appear only once
+ * :param psbts_len: Number of PSBTs in psbts
+ * :param output: Destination for resulting psbt
+ *
+ * Metadata is moved rather than copied into the first PSBT, which becomes
+ * the result. On success the remaining PSBTs are freed and every pointer
+ * in ``psbts`` is set to NULL. If the PSBTs do not share the same unsigned
+ * transaction they are left untouched; on any other failure they may be
+ * partially consumed but must still be freed by the caller.
+ */
+WALLY_CORE_API int wally_combine_psbts_consume(
+    struct wally_psbt **psbts,
+    size_t psbts_len,
+    struct wally_psbt **output);
+
 /**
  * Sign a PSBT using the simple signer algorithm: https://github.com/bitcoin/bips/blob/master/bip-0174.mediawiki#simple-signer-algorithm
  *
@@ -560,6 +595,43 @@ WALLY_CORE_API int wally_sign_psbt(
     const unsigned char *key,
     size_t key_len);
 
+/**
+ * Sign a PSBT with several private keys in a single pass.
+ *
+ * :param psbt: PSBT to sign. Directly modifies this PSBT
+ * :param keys: Private keys to sign PSBT with, concatenated
+ * :param keys_len: Length of keys in bytes. Must be a non-zero multiple of ``EC_PRIVATE_KEY_LEN``
+ *
+ * Each input's signature hash is computed at most once, regardless of
+ * how many of the keys sign it. The result is the same as calling
+ * `wally_sign_psbt` once for each key, except that signatures are added
+ * in keypath order.
+ */
+WALLY_CORE_API int wally_sign_psbt_keys(
+    struct wally_psbt *psbt,
+    const unsigned char *keys,
+    size_t keys_len);
+
+/**
+ * Sign a PSBT with private keys derived from a BIP32 root key.
+ *
+ * :param psbt: PSBT to sign. Directly modifies this PSBT
+ * :param hdkey: The private master key whose fingerprint appears in the
+ *|    PSBT keypaths. Must have a depth of 0: keypath origins are given from
+ *|    the master key, so a derived (e.g. account) key cannot be matched
+ *|    against them and is rejected with ``WALLY_EINVAL``.
+ *
+ * Keypaths whose fingerprint matches ``hdkey`` are derived and signed
+ * with. Derived keys are cached along the most recently used path, so
+ * keypaths sharing a prefix (e.g. an account) only derive the steps
+ * that differ. Each input's signature hash is computed at most once.
+ * An input that already has a signature from a derived key, in either
+ * its compressed or uncompressed form, is not signed by it again.
+ */
+WALLY_CORE_API int wally_sign_psbt_bip32(
+    struct wally_psbt *psbt,
+    const struct ext_key *hdkey);
+
 /**
  * Finalize a PSBT
  *
@@ -578,6 +650,246 @@ WALLY_CORE_API int wally_extract_psbt(
     struct wally_psbt *psbt,
     struct wally_tx **output);
 
+/**
+ * Finalize a PSBT and extract the network transaction from it.
+ *
+ * :param psbt: PSBT to finalize and extract from. Directly modifies this PSBT
+ * :param num_threads: The maximum number of threads to finalize inputs with,
+ *|    including the calling thread. Pass 0 or 1 to finalize on the
+ *|    calling thread only.
+ * :param output: Destination for the resulting transaction
+ *
+ * Inputs are finalized concurrently. Every input must be finalizable.
+ * On success the final scriptSigs and witnesses are moved into ``output``
+ * rather than copied, so they are removed from ``psbt``.
+ */
+WALLY_CORE_API int wally_finalize_and_extract_psbt(
+    struct wally_psbt *psbt,
+    uint32_t num_threads,
+    struct wally_tx **output);
+
+/**
+ * Get the length of the delta between a PSBT and an earlier version of it.
+ *
+ * :param base: The earlier version of the PSBT.
+ * :param psbt: The PSBT to get the delta of.
+ * :param written: Destination for the length of the delta in bytes.
+ */
+WALLY_CORE_API int wally_psbt_get_delta_length(
+    const struct wally_psbt *base,
+    const struct wally_psbt *psbt,
+    size_t *written);
+
+/**
+ * Serialize the delta between a PSBT and an earlier version of it.
+ *
+ * :param base: The earlier version of the PSBT.
+ * :param psbt: The PSBT to get the delta of.
+ * :param bytes_out: Destination for the serialized delta.
+ * :param len: Size of ``bytes_out`` in bytes.
+ * :param written: Destination for the length of the delta.
+ *
+ * Both PSBTs must have the same unsigned transaction. The delta holds only
+ * the fields and map items of ``psbt`` that ``base`` lacks, such as new
+ * partial signatures, and identifies the transaction by its txid, so it is
+ * typically far smaller than ``psbt``. Use `wally_psbt_apply_delta` to
+ * apply it to a copy of ``base``.
+ */
+WALLY_CORE_API int wally_psbt_get_delta(
+    const struct wally_psbt *base,
+    const struct wally_psbt *psbt,
+    unsigned char *bytes_out,
+    size_t len,
+    size_t *written);
+
+/**
+ * Apply a delta from `wally_psbt_get_delta` to a PSBT.
+ *
+ * :param psbt: The PSBT to update. Directly modifies this PSBT.
+ * :param bytes: The serialized delta.
+ * :param bytes_len: Length of ``bytes`` in bytes.
+ *
+ * The delta must be for the unsigned transaction of ``psbt``. Fields and
+ * map items are merged as `wally_combine_psbts` does, keeping any values
+ * already in ``psbt``. If the delta is invalid or memory cannot be
+ * allocated, ``psbt`` is left unchanged.
+ */
+WALLY_CORE_API int wally_psbt_apply_delta(
+    struct wally_psbt *psbt,
+    const unsigned char *bytes,
+    size_t bytes_len);
+
+/**
+ * Get the serialized length, estimated final vsize and fee of a PSBT.
+ *
+ * :param psbt: The PSBT to summarize.
+ * :param length: Destination for the serialized length of the PSBT, as
+ *|    returned by `wally_psbt_get_length`.
+ * :param vsize: Destination for the vsize of the final transaction.
+ * :param total_in: Destination for the total amount of the inputs.
+ * :param total_out: Destination for the total amount of the outputs.
+ * :param fee: Destination for the fee, i.e. ``total_in - total_out``.
+ *
+ * The PSBT is traversed once. Finalized inputs contribute their actual
+ * scriptSig and witness sizes. Other inputs are estimated from their UTXO
+ * script type, assuming maximum length signatures, for P2PKH, P2WPKH,
+ * P2SH-P2WPKH and P2SH, P2WSH or P2SH-P2WSH multisig. Every input must
+ * have a UTXO and be finalized or of an estimable type.
+ */
+WALLY_CORE_API int wally_psbt_get_summary(
+    const struct wally_psbt *psbt,
+    size_t *length,
+    size_t *vsize,
+    uint64_t *total_in,
+    uint64_t *total_out,
+    uint64_t *fee);
+
+#ifndef SWIG
+/**
+ * Create a read-only view of a serialized PSBT.
+ *
+ * :param bytes: Bytes to create the view from.
+ * :param bytes_len: Length of ``bytes`` in bytes.
+ * :param output: Destination for the resulting view.
+ *
+ * The view indexes ``bytes`` in place without copying any PSBT data, so
+ * ``bytes`` must remain valid and unmodified until the view is freed.
+ * The structure and field lengths of the PSBT are validated, but duplicate
+ * keypath, partial signature and unknown keys are not detected; use
+ * `wally_psbt_from_bytes` where full validation is required.
+ */
+WALLY_CORE_API int wally_psbt_view_init_alloc(
+    const unsigned char *bytes,
+    size_t bytes_len,
+    struct wally_psbt_view **output);
+
+/**
+ * Free a PSBT view allocated by `wally_psbt_view_init_alloc`.
+ *
+ * :param view: The view to free.
+ */
+WALLY_CORE_API int wally_psbt_view_free(
+    struct wally_psbt_view *view);
+
+/**
+ * Get the number of inputs of the unsigned transaction in a PSBT view.
+ *
+ * :param view: The view to get the number of inputs from.
+ * :param written: Destination for the number of inputs.
+ */
+WALLY_CORE_API int wally_psbt_view_get_num_inputs(
+    const struct wally_psbt_view *view,
+    size_t *written);
+
+/**
+ * Get the number of outputs of the unsigned transaction in a PSBT view.
+ *
+ * :param view: The view to get the number of outputs from.
+ * :param written: Destination for the number of outputs.
+ */
+WALLY_CORE_API int wally_psbt_view_get_num_outputs(
+    const struct wally_psbt_view *view,
+    size_t *written);
+
+/**
+ * Get an output of the unsigned transaction in a PSBT view.
+ *
+ * :param view: The view to get the output from.
+ * :param index: The zero-based index of the output.
+ * :param satoshi: Destination for the output amount.
+ * :param script: Destination for a pointer to the output script.
+ * :param script_len: Destination for the length of the output script.
+ */
+WALLY_CORE_API int wally_psbt_view_get_tx_output(
+    const struct wally_psbt_view *view,
+    size_t index,
+    uint64_t *satoshi,
+    const unsigned char **script,
+    size_t *script_len);
+
+/**
+ * Get the previous output spent by an input of a PSBT view.
+ *
+ * :param view: The view to get the previous output from.
+ * :param index: The zero-based index of the input.
+ * :param satoshi: Destination for the previous output amount.
+ * :param script: Destination for a pointer to the previous output script.
+ * :param script_len: Destination for the length of the previous output script.
+ *
+ * The witness UTXO is used if present. Otherwise the output is taken from
+ * the non-witness UTXO, whose txid must match the input's prevout.
+ */
+WALLY_CORE_API int wally_psbt_view_get_input_utxo(
+    const struct wally_psbt_view *view,
+    size_t index,
+    uint64_t *satoshi,
+    const unsigned char **script,
+    size_t *script_len);
+
+/**
+ * Get the number of items of a given type in an input map of a PSBT view.
+ *
+ * :param view: The view to count items in.
+ * :param index: The zero-based index of the input.
+ * :param type: The ``WALLY_PSBT_IN_`` type of item to count.
+ * :param written: Destination for the number of items.
+ */
+WALLY_CORE_API int wally_psbt_view_get_input_num_items(
+    const struct wally_psbt_view *view,
+    size_t index,
+    uint32_t type,
+    size_t *written);
+
+/**
+ * Get an item of a given type from an input map of a PSBT view.
+ *
+ * :param view: The view to get the item from.
+ * :param index: The zero-based index of the input.
+ * :param type: The ``WALLY_PSBT_IN_`` type of item to get.
+ * :param item_index: The zero-based index of the item amongst items of ``type``.
+ * :param output: Destination for the item.
+ *
+ * For example, ``WALLY_PSBT_IN_BIP32_DERIVATION`` items have the public key
+ * as their key and the fingerprint and path as their value.
+ */
+WALLY_CORE_API int wally_psbt_view_get_input_item(
+    const struct wally_psbt_view *view,
+    size_t index,
+    uint32_t type,
+    size_t item_index,
+    struct wally_psbt_view_item *output);
+
+/**
+ * Get the number of items of a given type in an output map of a PSBT view.
+ *
+ * :param view: The view to count items in.
+ * :param index: The zero-based index of the output.
+ * :param type: The ``WALLY_PSBT_OUT_`` type of item to count.
+ * :param written: Destination for the number of items.
+ */
+WALLY_CORE_API int wally_psbt_view_get_output_num_items(
+    const struct wally_psbt_view *view,
+    size_t index,
+    uint32_t type,
+    size_t *written);
+
+/**
+ * Get an item of a given type from an output map of a PSBT view.
+ *
+ * :param view: The view to get the item from.
+ * :param index: The zero-based index of the output.
+ * :param type: The ``WALLY_PSBT_OUT_`` type of item to get.
+ * :param item_index: The zero-based index of the item amongst items of ``type``.
+ * :param output: Destination for the item.
+ */
+WALLY_CORE_API int wally_psbt_view_get_output_item(
+    const struct wally_psbt_view *view,
+    size_t index,
+    uint32_t type,
+    size_t item_index,
+    struct wally_psbt_view_item *output);
+#endif /* SWIG */
+
 #ifdef __cplusplus
 }
 #endif
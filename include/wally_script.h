@@ -165,6 +165,15 @@ extern "C" {
 
 #define OP_INVALIDOPCODE 0xff
 
+#ifndef SWIG
+/** An allocation-free iterator over the opcodes of a script */
+struct wally_script_iter {
+    const unsigned char *script;
+    size_t script_len;
+    size_t offset;
+};
+#endif
+
 /**
  * Determine the type of a scriptPubkey script.
  *
@@ -483,6 +492,80 @@ WALLY_CORE_API int wally_witness_program_from_bytes(
     size_t len,
     size_t *written);
 
+#ifndef SWIG
+/**
+ * Initialize an iterator over the opcodes of a script.
+ *
+ * :param iter: The iterator to initialize.
+ * :param bytes: The script to iterate over. The script is not copied and
+ *|    must remain valid while ``iter`` is in use.
+ * :param bytes_len: Length of ``bytes`` in bytes.
+ */
+WALLY_CORE_API int wally_script_iter_init(
+    struct wally_script_iter *iter,
+    const unsigned char *bytes,
+    size_t bytes_len);
+
+/**
+ * Read the next opcode from a script iterator.
+ *
+ * :param iter: The iterator to read from.
+ * :param op_out: Destination for the opcode.
+ * :param push_out: Destination for a pointer to the pushed data inside the
+ *|    script, or NULL if the opcode is not a push. May be NULL.
+ * :param push_len_out: Destination for the length of the pushed data, or 0
+ *|    if the opcode is not a push. May be NULL.
+ *
+ * Returns ``WALLY_ERROR`` once the end of the script has been reached and
+ * ``WALLY_EINVAL`` if the next opcode is a truncated push, in which case
+ * the iterator is not advanced.
+ */
+WALLY_CORE_API int wally_script_iter_next(
+    struct wally_script_iter *iter,
+    unsigned char *op_out,
+    const unsigned char **push_out,
+    size_t *push_len_out);
+
+/**
+ * Determine the types of an array of scriptPubkey scripts.
+ *
+ * :param scripts: Array of pointers to the scriptPubkeys to classify.
+ * :param script_lens: Array of the lengths of each of ``scripts``.
+ * :param num_scripts: The number of items in ``scripts`` and ``script_lens``.
+ * :param types_out: Destination for the ``WALLY_SCRIPT_TYPE_`` type of
+ *|    each script. Empty scripts are classified as ``WALLY_SCRIPT_TYPE_UNKNOWN``.
+ * :param offsets_out: Destination for the offset of the hash or witness
+ *|    program within each P2PKH, P2SH, P2WPKH or P2WSH script, or 0 for
+ *|    other script types. May be NULL.
+ * :param len: The number of items in ``types_out`` and ``offsets_out``. Must
+ *|    be at least ``num_scripts``.
+ */
+WALLY_CORE_API int wally_scriptpubkey_get_types(
+    const unsigned char *const *scripts,
+    const size_t *script_lens,
+    size_t num_scripts,
+    size_t *types_out,
+    size_t *offsets_out,
+    size_t len);
+
+/**
+ * Determine the types of the output scripts of a transaction.
+ *
+ * :param tx: The transaction whose output scripts should be classified.
+ * :param types_out: Destination for the ``WALLY_SCRIPT_TYPE_`` type of
+ *|    each output script.
+ * :param offsets_out: Destination for the hash or witness program offsets
+ *|    of each output script, as for `wally_scriptpubkey_get_types`. May be NULL.
+ * :param len: The number of items in ``types_out`` and ``offsets_out``. Must
+ *|    be at least the number of outputs in ``tx``.
+ */
+WALLY_CORE_API int wally_tx_get_output_script_types(
+    const struct wally_tx *tx,
+    size_t *types_out,
+    size_t *offsets_out,
+    size_t len);
+#endif /* SWIG */
+
 #ifdef BUILD_ELEMENTS
 /**
  * Get the pegout script size.
@@ -19,6 +19,21 @@ extern "C" {
 #define WALLY_SATOSHI_PER_BTC 100000000
 #define WALLY_BTC_MAX 21000000
 
+/* Default relay policy limits */
+#define WALLY_TX_MAX_STANDARD_WEIGHT 400000
+#define WALLY_TX_MAX_STANDARD_SIGOP_COST 16000
+#define WALLY_TX_DUST_RELAY_FEE 3000 /* Satoshi per 1000 virtual bytes */
+
+/* Relay policy failures */
+#define WALLY_TX_POLICY_VERSION 0x1 /* Unsupported transaction version */
+#define WALLY_TX_POLICY_WEIGHT 0x2 /* Transaction weight is too large */
+#define WALLY_TX_POLICY_SCRIPTSIG_SIZE 0x4 /* An input scriptSig is too large */
+#define WALLY_TX_POLICY_SCRIPTSIG_NOT_PUSHONLY 0x8 /* An input scriptSig contains non-push opcodes */
+#define WALLY_TX_POLICY_SCRIPTPUBKEY 0x10 /* An output scriptPubKey is non-standard */
+#define WALLY_TX_POLICY_MULTI_OP_RETURN 0x20 /* More than one OP_RETURN output */
+#define WALLY_TX_POLICY_DUST 0x40 /* An output is dust */
+#define WALLY_TX_POLICY_SIGOPS 0x80 /* Too many signature operations */
+
 #define WALLY_TXHASH_LEN 32 /** Size of a transaction hash in bytes */
 
 #define WALLY_TX_FLAG_USE_WITNESS  0x1 /* Encode witness data if present */
@@ -128,6 +143,16 @@ struct wally_tx {
     size_t num_outputs;
     size_t outputs_allocation_len;
 };
+
+/** An input to sign with `wally_tx_sign_inputs` */
+struct wally_tx_sign_input {
+    size_t index;
+    const unsigned char *priv_key;
+    const unsigned char *script;
+    size_t script_len;
+    uint64_t satoshi;
+    uint32_t sighash;
+};
 #endif /* SWIG */
 
 /**
@@ -577,6 +602,90 @@ WALLY_CORE_API int wally_tx_is_coinbase(
     const struct wally_tx *tx,
     size_t *written);
 
+/**
+ * Get the value below which an output is considered dust.
+ *
+ * :param output: The output to compute the dust threshold of.
+ * :param fee_rate: The dust relay fee rate in satoshi per 1000 virtual
+ *|    bytes, e.g. ``WALLY_TX_DUST_RELAY_FEE``.
+ * :param value_out: Destination for the dust threshold in satoshi. Outputs
+ *|    that can never be spent have a threshold of 0.
+ */
+WALLY_CORE_API int wally_tx_output_get_dust_threshold(
+    const struct wally_tx_output *output,
+    uint64_t fee_rate,
+    uint64_t *value_out);
+
+#ifndef SWIG
+/**
+ * Get the signature operation cost of a transaction.
+ *
+ * :param tx: The transaction to compute the sigop cost of.
+ * :param prevout_scripts: Array of the scriptPubKeys spent by each input
+ *|    of ``tx``, or NULL to count only the sigops in ``tx`` itself.
+ * :param prevout_script_lens: Array of the lengths of each of ``prevout_scripts``.
+ * :param num_prevouts: The number of items in ``prevout_scripts``. Must
+ *|    be the number of inputs in ``tx`` if ``prevout_scripts`` is given.
+ * :param written: Destination for the sigop cost, counting legacy sigops
+ *|    four times as per BIP141.
+ */
+WALLY_CORE_API int wally_tx_get_sigop_cost(
+    const struct wally_tx *tx,
+    const unsigned char *const *prevout_scripts,
+    const size_t *prevout_script_lens,
+    size_t num_prevouts,
+    size_t *written);
+
+/**
+ * Check a transaction against the default relay policy.
+ *
+ * :param tx: The transaction to check.
+ * :param prevout_scripts: Array of the scriptPubKeys spent by each input
+ *|    of ``tx``, or NULL to skip checking the sigops of inputs.
+ * :param prevout_script_lens: Array of the lengths of each of ``prevout_scripts``.
+ * :param num_prevouts: The number of items in ``prevout_scripts``. Must
+ *|    be the number of inputs in ``tx`` if ``prevout_scripts`` is given.
+ * :param dust_fee_rate: The dust relay fee rate in satoshi per 1000 virtual
+ *|    bytes, e.g. ``WALLY_TX_DUST_RELAY_FEE``, or 0 to skip dust checks.
+ * :param written: Destination for the ``WALLY_TX_POLICY_`` flags of any
+ *|    checks that failed, or 0 if the transaction is standard.
+ */
+WALLY_CORE_API int wally_tx_get_policy_failures(
+    const struct wally_tx *tx,
+    const unsigned char *const *prevout_scripts,
+    const size_t *prevout_script_lens,
+    size_t num_prevouts,
+    uint64_t dust_fee_rate,
+    size_t *written);
+
+/**
+ * Sign multiple inputs of a transaction.
+ *
+ * Each input is described by a ``wally_tx_sign_input``, giving the index of
+ * the input to sign, its ``EC_PRIVATE_KEY_LEN`` private key, the scriptPubKey
+ * and amount of the output it spends, and its ``WALLY_SIGHASH_`` flags.
+ * P2PKH, P2WPKH and P2SH-wrapped P2WPKH outputs can be spent. The
+ * scriptSig and witness of each input are replaced with the signed ones.
+ * Hashes common to the segwit inputs are computed only once.
+ *
+ * :param tx: The transaction to sign.
+ * :param inputs: The inputs to sign. Each input index must appear at most once.
+ * :param num_inputs: The number of items in ``inputs``.
+ * :param flags: ``EC_FLAG_GRIND_R`` to produce low-R signatures, or 0.
+ * :param num_threads: The maximum number of threads to sign with,
+ *|    including the calling thread. Pass 0 or 1 to sign on the calling
+ *|    thread only.
+ *
+ * .. note:: ``tx`` is not modified if any input fails to sign.
+ */
+WALLY_CORE_API int wally_tx_sign_inputs(
+    struct wally_tx *tx,
+    const struct wally_tx_sign_input *inputs,
+    size_t num_inputs,
+    uint32_t flags,
+    uint32_t num_threads);
+#endif /* SWIG */
+
 #ifdef BUILD_ELEMENTS
 /**
  * Set issuance data on an input.
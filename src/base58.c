@@ -163,8 +163,9 @@ uint32_t base58_get_checksum(const unsigned char *bytes, size_t bytes_len)
 }
 
 
-int wally_base58_from_bytes(const unsigned char *bytes, size_t bytes_len,
-                            uint32_t flags, char **output)
+int base58_from_bytes(const unsigned char *bytes, size_t bytes_len,
+                      uint32_t flags, char *str_out, size_t str_len,
+                      size_t *written)
 {
     uint32_t checksum, *cs_p = NULL;
     unsigned char bn_buf[BIGNUM_BYTES];
@@ -172,10 +173,11 @@ int wally_base58_from_bytes(const unsigned char *bytes, size_t bytes_len,
     size_t bn_bytes = 0, zeros, i, orig_len = bytes_len;
     int ret = WALLY_EINVAL;
 
-    if (output)
-        *output = NULL;
+    if (written)
+        *written = 0;
 
-    if (!bytes || !bytes_len || (flags & ~BASE58_ALL_DEFINED_FLAGS) || !output)
+    if (!bytes || !bytes_len || (flags & ~BASE58_ALL_DEFINED_FLAGS) ||
+        !str_out || !written)
         goto cleanup; /* Invalid argument */
 
     if (flags & BASE58_FLAG_CHECKSUM) {
@@ -191,13 +193,11 @@ int wally_base58_from_bytes(const unsigned char *bytes, size_t bytes_len,
         ; /* no-op*/
 
     if (zeros == bytes_len) {
-        if (!(*output = wally_malloc(zeros + 1))) {
-            ret = WALLY_ENOMEM;
-            goto cleanup;
+        *written = zeros + 1;
+        if (*written <= str_len) {
+            memset(str_out, '1', zeros);
+            str_out[zeros] = '\0';
         }
-
-        memset(*output, '1', zeros);
-        (*output)[zeros] = '\0';
         return WALLY_OK; /* All 0's */
     }
 
@@ -230,16 +230,14 @@ int wally_base58_from_bytes(const unsigned char *bytes, size_t bytes_len,
     /* Copy the result */
     bn_bytes = bn + bn_bytes - top_byte;
 
-    if (!(*output = wally_malloc(zeros + bn_bytes + 1))) {
-        ret = WALLY_ENOMEM;
-        goto cleanup;
+    *written = zeros + bn_bytes + 1;
+    if (*written <= str_len) {
+        memset(str_out, '1', zeros);
+        for (i = 0; i < bn_bytes; ++i)
+            str_out[zeros + i] = byte_to_base58[top_byte[i]];
+        str_out[zeros + bn_bytes] = '\0';
     }
 
-    memset(*output, '1', zeros);
-    for (i = 0; i < bn_bytes; ++i)
-        (*output)[zeros + i] = byte_to_base58[top_byte[i]];
-    (*output)[zeros + bn_bytes] = '\0';
-
     ret = WALLY_OK;
 
 cleanup:
@@ -252,6 +250,35 @@ cleanup:
 #undef b
 }
 
+int wally_base58_from_bytes(const unsigned char *bytes, size_t bytes_len,
+                            uint32_t flags, char **output)
+{
+    size_t str_len, written;
+    int ret;
+
+    if (output)
+        *output = NULL;
+
+    if (!bytes || !bytes_len || (flags & ~BASE58_ALL_DEFINED_FLAGS) || !output)
+        return WALLY_EINVAL;
+
+    /* Allocate for the longest possible encoding, including any checksum */
+    str_len = bytes_len + (flags & BASE58_FLAG_CHECKSUM ? BASE58_CHECKSUM_LEN : 0);
+    str_len = str_len * 138 / 100 + 2;
+
+    if (!(*output = wally_malloc(str_len)))
+        return WALLY_ENOMEM;
+
+    ret = base58_from_bytes(bytes, bytes_len, flags, *output, str_len, &written);
+    if (ret == WALLY_OK && written > str_len)
+        ret = WALLY_ERROR; /* Should never happen */
+    if (ret != WALLY_OK) {
+        wally_free(*output);
+        *output = NULL;
+    }
+    return ret;
+}
+
 
 int wally_base58_get_length(const char *str_in, size_t *written)
 {
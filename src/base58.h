@@ -11,4 +11,23 @@ uint32_t base58_get_checksum(
     const unsigned char *bytes,
     size_t len);
 
+/**
+ * Encode binary data as base58 into a caller supplied buffer.
+ *
+ * @bytes: Binary data to encode.
+ * @bytes_len: The length of @bytes in bytes.
+ * @flags: BASE58_FLAG_ flags, as for wally_base58_from_bytes.
+ * @str_out: Destination for the nul-terminated base58 string.
+ * @str_len: The length of @str_out in bytes.
+ * @written: Destination for the length of the string including the
+ *     nul terminator. If this is greater than @str_len, nothing is written.
+ */
+int base58_from_bytes(
+    const unsigned char *bytes,
+    size_t bytes_len,
+    uint32_t flags,
+    char *str_out,
+    size_t str_len,
+    size_t *written);
+
 #endif /* LIBWALLY_BASE58_H */
@@ -7,6 +7,7 @@
 #include <include/wally_bip32.h>
 #include <include/wally_crypto.h>
 #include "bip32_int.h"
+#include "base58.h"
 #include <stdbool.h>
 
 #define BIP32_ALL_DEFINED_FLAGS (BIP32_FLAG_KEY_PRIVATE | BIP32_FLAG_KEY_PUBLIC | BIP32_FLAG_SKIP_HASH | BIP32_FLAG_KEY_TWEAK_SUM)
@@ -716,6 +717,32 @@ int bip32_key_to_base58(const struct ext_key *hdkey,
     return ret;
 }
 
+int bip32_keys_to_base58(const struct ext_key *hdkeys, size_t num_keys,
+                         uint32_t flags, char *output, size_t len)
+{
+    unsigned char bytes[BIP32_SERIALIZED_LEN];
+    size_t i, written;
+    int ret = WALLY_OK;
+
+    if (!hdkeys || !num_keys || !output || len != num_keys * BIP32_BASE58_LEN)
+        return WALLY_EINVAL;
+
+    for (i = 0; ret == WALLY_OK && i < num_keys; ++i) {
+        ret = bip32_key_serialize(hdkeys + i, flags, bytes, sizeof(bytes));
+        if (ret == WALLY_OK)
+            ret = base58_from_bytes(bytes, sizeof(bytes), BASE58_FLAG_CHECKSUM,
+                                    output + i * BIP32_BASE58_LEN,
+                                    BIP32_BASE58_LEN, &written);
+        if (ret == WALLY_OK && written > BIP32_BASE58_LEN)
+            ret = WALLY_ERROR; /* Should never happen */
+    }
+
+    wally_clear(bytes, sizeof(bytes));
+    if (ret != WALLY_OK)
+        wally_clear(output, len);
+    return ret;
+}
+
 int bip32_key_from_base58(const char *base58,
                           struct ext_key *output)
 {
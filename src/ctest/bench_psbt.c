@@ -0,0 +1,245 @@
+#include "config.h"
+
+#include <wally_core.h>
+#include <wally_crypto.h>
+#include <wally_psbt.h>
+#include <wally_script.h>
+#include <wally_transaction.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* Microbenchmark for PSBT parsing and base64 encoding over large
+ * consolidation PSBTs.
+ * Not run as part of the test suite; run ./bench_psbt [iterations] manually.
+ *
+ * Each PSBT spends many inputs. Every input carries a full previous
+ * transaction as its non_witness_utxo, along with keypaths and partial
+ * signatures from several cosigners, so parsing is dominated by the size
+ * of the serialized PSBT.
+ */
+#define DEFAULT_ITERATIONS 20
+#define NUM_COSIGNERS 3
+
+struct bench_case {
+    const char *name;
+    size_t num_inputs;
+    size_t prev_tx_outputs;
+};
+
+static const struct bench_case cases[] = {
+    { "small psbt",   10,  2 },
+    { "large psbt",  200, 50 },
+    { "huge psbt",  1000, 200 },
+};
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static bool make_prev_tx(size_t num_outputs, struct wally_tx **output)
+{
+    unsigned char txhash[WALLY_TXHASH_LEN], script[WALLY_SCRIPTPUBKEY_P2WPKH_LEN];
+    size_t i;
+
+    memset(txhash, 0x11, sizeof(txhash));
+    memset(script, 0x22, sizeof(script));
+    script[0] = OP_0;
+    script[1] = HASH160_LEN;
+
+    if (wally_tx_init_alloc(2, 0, 1, num_outputs, output) != WALLY_OK ||
+        wally_tx_add_raw_input(*output, txhash, sizeof(txhash), 0, 0xffffffff,
+                               script, sizeof(script), NULL, 0) != WALLY_OK)
+        return false;
+    for (i = 0; i < num_outputs; ++i)
+        if (wally_tx_add_raw_output(*output, 1000 + i, script, sizeof(script), 0) != WALLY_OK)
+            return false;
+    return true;
+}
+
+static bool get_txid(const struct wally_tx *tx, unsigned char *txid)
+{
+    unsigned char *bytes;
+    size_t len, written;
+    bool ok = wally_tx_get_length(tx, 0, &len) == WALLY_OK &&
+              (bytes = malloc(len)) != NULL;
+
+    if (ok) {
+        ok = wally_tx_to_bytes(tx, 0, bytes, len, &written) == WALLY_OK &&
+             wally_sha256d(bytes, written, txid, SHA256_LEN) == WALLY_OK;
+        free(bytes);
+    }
+    return ok;
+}
+
+static bool add_input_maps(struct wally_psbt_input *input, size_t index)
+{
+    unsigned char pub_key[EC_PUBLIC_KEY_LEN], fingerprint[FINGERPRINT_LEN];
+    unsigned char sig[EC_SIGNATURE_DER_MAX_LEN + 1];
+    uint32_t path[] = { 0x80000030, 0x80000000, 0x80000000, 0, 0 };
+    struct wally_keypath_map *keypaths = NULL;
+    struct wally_partial_sigs_map *sigs = NULL;
+    size_t i;
+    bool ok;
+
+    memset(sig, 0x33, sizeof(sig));
+    ok = wally_keypath_map_init_alloc(NUM_COSIGNERS, &keypaths) == WALLY_OK &&
+         wally_partial_sigs_map_init_alloc(NUM_COSIGNERS, &sigs) == WALLY_OK;
+    for (i = 0; ok && i < NUM_COSIGNERS; ++i) {
+        memset(pub_key, 0x40 + i, sizeof(pub_key));
+        pub_key[0] = 0x02;
+        memcpy(pub_key + 1, &index, sizeof(index));
+        memset(fingerprint, i, sizeof(fingerprint));
+        path[4] = index;
+        ok = wally_add_new_keypath(keypaths, pub_key, sizeof(pub_key),
+                                   fingerprint, sizeof(fingerprint),
+                                   path, sizeof(path) / sizeof(path[0])) == WALLY_OK &&
+             wally_add_new_partial_sig(sigs, pub_key, sizeof(pub_key),
+                                       sig, sizeof(sig)) == WALLY_OK;
+    }
+    ok = ok && wally_psbt_input_set_keypaths(input, keypaths) == WALLY_OK &&
+         wally_psbt_input_set_partial_sigs(input, sigs) == WALLY_OK;
+    wally_keypath_map_free(keypaths);
+    wally_partial_sigs_map_free(sigs);
+    return ok;
+}
+
+static bool make_psbt_bytes(const struct bench_case *c,
+                            unsigned char **bytes_out, size_t *len_out)
+{
+    unsigned char txhash[WALLY_TXHASH_LEN], script[WALLY_SCRIPTPUBKEY_P2WPKH_LEN];
+    struct wally_tx *tx = NULL, *prev_tx = NULL;
+    struct wally_psbt *psbt = NULL;
+    size_t i, written;
+    bool ok;
+
+    memset(script, 0x44, sizeof(script));
+    script[0] = OP_0;
+    script[1] = HASH160_LEN;
+
+    ok = make_prev_tx(c->prev_tx_outputs, &prev_tx) &&
+         get_txid(prev_tx, txhash) &&
+         wally_tx_init_alloc(2, 0, c->num_inputs, 1, &tx) == WALLY_OK &&
+         wally_tx_add_raw_output(tx, 1000 * c->num_inputs, script, sizeof(script), 0) == WALLY_OK;
+    for (i = 0; ok && i < c->num_inputs; ++i)
+        ok = wally_tx_add_raw_input(tx, txhash, sizeof(txhash), i % c->prev_tx_outputs,
+                                    0xffffffff, NULL, 0, NULL, 0) == WALLY_OK;
+    ok = ok && wally_psbt_init_alloc(c->num_inputs, 1, 0, &psbt) == WALLY_OK &&
+         wally_psbt_set_global_tx(psbt, tx) == WALLY_OK;
+    for (i = 0; ok && i < c->num_inputs; ++i)
+        ok = wally_psbt_input_set_non_witness_utxo(&psbt->inputs[i], prev_tx) == WALLY_OK &&
+             add_input_maps(&psbt->inputs[i], i);
+
+    *bytes_out = NULL;
+    if (ok && wally_psbt_get_length(psbt, len_out) == WALLY_OK &&
+        (*bytes_out = malloc(*len_out)) != NULL)
+        ok = wally_psbt_to_bytes(psbt, *bytes_out, *len_out, &written) == WALLY_OK &&
+             written == *len_out;
+    else
+        ok = false;
+
+    wally_psbt_free(psbt);
+    wally_tx_free(tx);
+    wally_tx_free(prev_tx);
+    return ok;
+}
+
+static void print_result(const struct bench_case *c, const char *op,
+                         size_t len, double start, size_t iterations)
+{
+    printf("%-12s %-12s %9zu bytes %10.2f us/op\n", c->name, op, len,
+           (now_us() - start) / iterations);
+}
+
+/* Create a view and read every input's partial sigs */
+static bool bench_view(const unsigned char *bytes, size_t len, size_t num_inputs)
+{
+    struct wally_psbt_view *view;
+    struct wally_psbt_view_item item;
+    size_t num_items, i, j;
+    bool ok = wally_psbt_view_init_alloc(bytes, len, &view) == WALLY_OK;
+
+    for (i = 0; ok && i < num_inputs; ++i) {
+        ok = wally_psbt_view_get_input_num_items(view, i, WALLY_PSBT_IN_PARTIAL_SIG, &num_items) == WALLY_OK &&
+             num_items == NUM_COSIGNERS;
+        for (j = 0; ok && j < num_items; ++j)
+            ok = wally_psbt_view_get_input_item(view, i, WALLY_PSBT_IN_PARTIAL_SIG, j, &item) == WALLY_OK;
+    }
+    if (ok)
+        wally_psbt_view_free(view);
+    return ok;
+}
+
+static bool bench_parse(const struct bench_case *c, size_t iterations)
+{
+    unsigned char *bytes;
+    struct wally_psbt *psbt = NULL;
+    char *base64 = NULL;
+    size_t len, i;
+    double start;
+    bool ok;
+
+    if (!make_psbt_bytes(c, &bytes, &len)) {
+        free(bytes);
+        return false;
+    }
+
+    start = now_us();
+    for (i = 0, ok = true; ok && i < iterations; ++i) {
+        ok = wally_psbt_from_bytes(bytes, len, &psbt) == WALLY_OK;
+        if (i + 1 < iterations)
+            wally_psbt_free(psbt);
+    }
+    if (ok)
+        print_result(c, "from_bytes", len, start, iterations);
+
+    start = now_us();
+    for (i = 0; ok && i < iterations; ++i)
+        ok = bench_view(bytes, len, c->num_inputs);
+    if (ok)
+        print_result(c, "view", len, start, iterations);
+
+    start = now_us();
+    for (i = 0; ok && i < iterations; ++i) {
+        wally_free_string(base64);
+        ok = wally_psbt_to_base64(psbt, &base64) == WALLY_OK;
+    }
+    if (ok)
+        print_result(c, "to_base64", len, start, iterations);
+    wally_psbt_free(psbt);
+
+    start = now_us();
+    for (i = 0; ok && i < iterations; ++i) {
+        ok = wally_psbt_from_base64(base64, &psbt) == WALLY_OK;
+        wally_psbt_free(psbt);
+    }
+    if (ok)
+        print_result(c, "from_base64", len, start, iterations);
+
+    wally_free_string(base64);
+    free(bytes);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+    size_t i;
+    bool ok = true;
+
+    if (!iterations)
+        iterations = DEFAULT_ITERATIONS;
+
+    for (i = 0; ok && i < sizeof(cases) / sizeof(cases[0]); ++i)
+        ok = bench_parse(&cases[i], iterations);
+
+    wally_cleanup(0);
+    if (!ok)
+        printf("bench_psbt failed!\n");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
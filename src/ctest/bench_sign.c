@@ -0,0 +1,136 @@
+#include "config.h"
+
+#include <wally_core.h>
+#include <wally_crypto.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* Microbenchmark for wally_ec_sig_from_bytes, wally_ec_sig_verify and
+ * wally_ec_public_key_combine.
+ * Not run as part of the test suite; run ./bench_sign [iterations] manually.
+ */
+#define DEFAULT_ITERATIONS 20000
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static bool bench_sign(const char *name, uint32_t flags, size_t sig_len,
+                       size_t iterations)
+{
+    unsigned char priv_key[EC_PRIVATE_KEY_LEN], msg[EC_MESSAGE_HASH_LEN];
+    unsigned char sig[EC_SIGNATURE_RECOVERABLE_LEN];
+    double start;
+    size_t i;
+
+    memset(priv_key, 0x11, sizeof(priv_key));
+    memset(msg, 0, sizeof(msg));
+
+    start = now_us();
+    for (i = 0; i < iterations; ++i) {
+        /* Vary the message so grinding does not always take the same path */
+        memcpy(msg, &i, sizeof(i));
+        if (wally_ec_sig_from_bytes(priv_key, sizeof(priv_key), msg, sizeof(msg),
+                                    flags, sig, sig_len) != WALLY_OK)
+            return false;
+    }
+    printf("%-24s %8.2f us/op\n", name, (now_us() - start) / iterations);
+    return true;
+}
+
+static bool bench_verify(const char *name, uint32_t flags, size_t iterations)
+{
+    unsigned char priv_key[EC_PRIVATE_KEY_LEN], msg[EC_MESSAGE_HASH_LEN];
+    unsigned char pub_key[EC_PUBLIC_KEY_LEN], sig[EC_SIGNATURE_LEN];
+    double start;
+    size_t i;
+
+    memset(priv_key, 0x11, sizeof(priv_key));
+    memset(msg, 0x22, sizeof(msg));
+    if (wally_ec_public_key_from_private_key(priv_key, sizeof(priv_key),
+                                             pub_key, sizeof(pub_key)) != WALLY_OK ||
+        wally_ec_sig_from_bytes(priv_key, sizeof(priv_key), msg, sizeof(msg),
+                                flags, sig, sizeof(sig)) != WALLY_OK)
+        return false;
+
+    start = now_us();
+    for (i = 0; i < iterations; ++i) {
+        if (wally_ec_sig_verify(pub_key, sizeof(pub_key), msg, sizeof(msg),
+                                flags, sig, sizeof(sig)) != WALLY_OK)
+            return false;
+    }
+    printf("%-24s %8.2f us/op\n", name, (now_us() - start) / iterations);
+    return true;
+}
+
+static bool bench_combine(const char *name, size_t num_keys, size_t iterations)
+{
+    unsigned char priv_key[EC_PRIVATE_KEY_LEN], pub_key[EC_PUBLIC_KEY_LEN];
+    unsigned char *pub_keys, *scalars;
+    double start;
+    size_t i;
+    bool ok = true;
+
+    pub_keys = malloc(num_keys * EC_PUBLIC_KEY_LEN);
+    scalars = malloc(num_keys * EC_PRIVATE_KEY_LEN);
+    if (!pub_keys || !scalars)
+        ok = false;
+
+    for (i = 0; ok && i < num_keys; ++i) {
+        memset(priv_key, 0x11, sizeof(priv_key));
+        memcpy(priv_key, &i, sizeof(i));
+        memcpy(scalars + i * EC_PRIVATE_KEY_LEN, priv_key, sizeof(priv_key));
+        ok = wally_ec_public_key_from_private_key(priv_key, sizeof(priv_key),
+                                                  pub_keys + i * EC_PUBLIC_KEY_LEN,
+                                                  EC_PUBLIC_KEY_LEN) == WALLY_OK;
+    }
+
+    start = now_us();
+    for (i = 0; ok && i < iterations; ++i)
+        ok = wally_ec_public_key_combine(pub_keys, num_keys * EC_PUBLIC_KEY_LEN,
+                                         scalars, num_keys * EC_PRIVATE_KEY_LEN,
+                                         pub_key, sizeof(pub_key)) == WALLY_OK;
+    if (ok)
+        printf("%-24s %8.2f us/op\n", name, (now_us() - start) / iterations);
+    free(pub_keys);
+    free(scalars);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+    size_t window, context_size;
+    bool ok;
+
+    if (!iterations)
+        iterations = DEFAULT_ITERATIONS;
+
+    if (wally_secp_get_ecmult_window(&window) != WALLY_OK ||
+        wally_secp_get_context_size(&context_size) != WALLY_OK)
+        return EXIT_FAILURE;
+    printf("ecmult window %zu, context size %zu bytes\n", window, context_size);
+
+    ok = bench_sign("sign ecdsa", EC_FLAG_ECDSA,
+                    EC_SIGNATURE_LEN, iterations) &&
+         bench_sign("sign ecdsa grind-r", EC_FLAG_ECDSA | EC_FLAG_GRIND_R,
+                    EC_SIGNATURE_LEN, iterations) &&
+         bench_sign("sign ecdsa recoverable", EC_FLAG_ECDSA | EC_FLAG_RECOVERABLE,
+                    EC_SIGNATURE_RECOVERABLE_LEN, iterations) &&
+         bench_sign("sign schnorr draft", EC_FLAG_SCHNORR_DRAFT,
+                    EC_SIGNATURE_LEN, iterations) &&
+         bench_verify("verify ecdsa", EC_FLAG_ECDSA, iterations) &&
+         bench_verify("verify schnorr draft", EC_FLAG_SCHNORR_DRAFT, iterations) &&
+         bench_combine("combine 100 keys", 100, iterations / 100 + 1);
+
+    wally_cleanup(0);
+    if (!ok)
+        printf("bench_sign failed!\n");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
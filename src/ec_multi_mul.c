@@ -0,0 +1,96 @@
+/* Multi-scalar multiplication of public keys.
+ *
+ * libsecp256k1 does not expose its multi-scalar multiplication, so this
+ * file builds it from the library internals. Those must be included
+ * before our own headers, since internal.h redefines malloc and free.
+ */
+#include "secp256k1/include/secp256k1.h"
+#include "secp256k1/src/util.h"
+#include "secp256k1/src/num_impl.h"
+#include "secp256k1/src/field_impl.h"
+#include "secp256k1/src/scalar_impl.h"
+#include "secp256k1/src/group_impl.h"
+#include "secp256k1/src/ecmult_impl.h"
+#include "secp256k1/src/eckey_impl.h"
+#include "secp256k1/src/scratch_impl.h"
+#undef PACKAGE
+#undef PACKAGE_BUGREPORT
+#undef PACKAGE_NAME
+#undef PACKAGE_STRING
+#undef PACKAGE_TARNAME
+#undef PACKAGE_URL
+#undef PACKAGE_VERSION
+#undef VERSION
+#include "internal.h"
+#include <include/wally_crypto.h>
+
+/* Scratch space for the multiplication. If this is too small for the
+ * number of keys given, the keys are processed in batches */
+#define MULTI_MUL_SCRATCH_SIZE (1024 * 1024)
+
+struct multi_mul_data {
+    const unsigned char *pub_keys;
+    const unsigned char *tweaks;
+};
+
+static void multi_mul_error(const char *text, void *data)
+{
+    /* Errors are returned from the operations that raise them */
+    (void)text;
+    (void)data;
+}
+
+static const secp256k1_callback multi_mul_error_callback = {
+    multi_mul_error, NULL
+};
+
+static int multi_mul_callback(secp256k1_scalar *sc, secp256k1_ge *pt,
+                              size_t idx, void *data)
+{
+    const struct multi_mul_data *md = (const struct multi_mul_data *)data;
+
+    secp256k1_scalar_set_b32(sc, md->tweaks + idx * EC_PRIVATE_KEY_LEN, NULL);
+    return secp256k1_eckey_pubkey_parse(pt, md->pub_keys + idx * EC_PUBLIC_KEY_LEN,
+                                        EC_PUBLIC_KEY_LEN);
+}
+
+int pubkey_multi_mul(const unsigned char *pub_keys, const unsigned char *tweaks,
+                     size_t num_keys, unsigned char *bytes_out)
+{
+    struct multi_mul_data md;
+    secp256k1_ecmult_context ecmult_ctx;
+    secp256k1_scratch *scratch;
+    secp256k1_scalar tweak;
+    secp256k1_gej rj;
+    secp256k1_ge r;
+    size_t i, len = EC_PUBLIC_KEY_LEN;
+    int overflow, ok;
+
+    for (i = 0; i < num_keys; ++i) {
+        secp256k1_scalar_set_b32(&tweak, tweaks + i * EC_PRIVATE_KEY_LEN, &overflow);
+        if (overflow || secp256k1_scalar_is_zero(&tweak))
+            return WALLY_EINVAL;
+    }
+
+    if (!(scratch = secp256k1_scratch_create(&multi_mul_error_callback,
+                                             MULTI_MUL_SCRATCH_SIZE)))
+        return WALLY_ENOMEM;
+
+    /* The generator tables are only used when multiplying G, which we
+     * never do, so the context is initialized but not built */
+    secp256k1_ecmult_context_init(&ecmult_ctx);
+    md.pub_keys = pub_keys;
+    md.tweaks = tweaks;
+    ok = secp256k1_ecmult_multi_var(&multi_mul_error_callback, &ecmult_ctx,
+                                    scratch, &rj, NULL, multi_mul_callback,
+                                    &md, num_keys) &&
+         !secp256k1_gej_is_infinity(&rj);
+    secp256k1_scratch_destroy(&multi_mul_error_callback, scratch);
+
+    if (ok) {
+        secp256k1_ge_set_gej(&r, &rj);
+        ok = secp256k1_eckey_pubkey_serialize(&r, bytes_out, &len, 1) &&
+             len == EC_PUBLIC_KEY_LEN;
+    }
+    return ok ? WALLY_OK : WALLY_EINVAL;
+}
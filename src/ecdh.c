@@ -2,6 +2,7 @@
 #include <include/wally_crypto.h>
 #include "secp256k1/include/secp256k1.h"
 #include "secp256k1/include/secp256k1_ecdh.h"
+#include <stdbool.h>
 
 int wally_ecdh(const unsigned char *pub_key, size_t pub_key_len,
                const unsigned char *bytes, size_t bytes_len,
@@ -31,3 +32,78 @@ int wally_ecdh(const unsigned char *pub_key, size_t pub_key_len,
     wally_clear(&pub, sizeof(pub));
     return WALLY_OK;
 }
+
+struct ecdh_batch {
+    const secp256k1_context *ctx;
+    const secp256k1_pubkey *pubs;
+    const unsigned char *priv_key;
+    unsigned char *bytes_out;
+    bool *ok;
+};
+
+static void ecdh_batch_job(void *p, size_t begin, size_t end)
+{
+    const struct ecdh_batch *batch = p;
+    size_t i;
+
+    for (i = begin; i < end; ++i)
+        batch->ok[i] = secp256k1_ecdh(batch->ctx, batch->bytes_out + i * SHA256_LEN,
+                                      &batch->pubs[i], batch->priv_key, NULL, NULL);
+}
+
+int wally_ecdh_batch(const unsigned char *pub_key, size_t pub_key_len,
+                     const unsigned char *bytes, size_t bytes_len,
+                     uint32_t num_threads,
+                     unsigned char *bytes_out, size_t len)
+{
+    const secp256k1_context *ctx = secp_ctx();
+    const size_t num_keys = pub_key_len / EC_PUBLIC_KEY_LEN;
+    secp256k1_pubkey *pubs;
+    struct ecdh_batch batch;
+    size_t i;
+    bool ok = true;
+    int ret;
+
+    if (!ctx)
+        ret = WALLY_ENOMEM;
+    else if (!pub_key || !num_keys || pub_key_len % EC_PUBLIC_KEY_LEN ||
+             !bytes || bytes_len != EC_PRIVATE_KEY_LEN ||
+             !secp256k1_ec_seckey_verify(ctx, bytes) ||
+             !bytes_out || len != num_keys * SHA256_LEN)
+        ret = WALLY_EINVAL;
+    else if (!(pubs = wally_malloc(num_keys * (sizeof(*pubs) + sizeof(bool)))))
+        ret = WALLY_ENOMEM;
+    else
+        ret = WALLY_OK;
+
+    if (ret != WALLY_OK) {
+        if (bytes_out)
+            wally_clear(bytes_out, len);
+        return ret;
+    }
+
+    /* Parse every key up front so no work is wasted on an invalid batch */
+    for (i = 0; ok && i < num_keys; ++i)
+        ok = pubkey_parse(ctx, &pubs[i], pub_key + i * EC_PUBLIC_KEY_LEN,
+                          EC_PUBLIC_KEY_LEN);
+
+    if (!ok)
+        ret = WALLY_EINVAL;
+    else {
+        /* ECDH does not modify the context, so workers can share ours */
+        batch.ctx = ctx;
+        batch.pubs = pubs;
+        batch.priv_key = bytes;
+        batch.bytes_out = bytes_out;
+        batch.ok = (bool *)(pubs + num_keys);
+        ret = wally_run_parallel(ecdh_batch_job, &batch, num_keys, 1, num_threads);
+        for (i = 0; ret == WALLY_OK && i < num_keys; ++i)
+            if (!batch.ok[i])
+                ret = WALLY_ERROR;
+    }
+
+    if (ret != WALLY_OK)
+        wally_clear(bytes_out, len);
+    wally_free(pubs); /* No secrets to clear */
+    return ret;
+}
@@ -1,5 +1,6 @@
 #include "internal.h"
 #include <include/wally_crypto.h>
+#include "secp256k1/include/secp256k1_preallocated.h"
 #include "ccan/ccan/build_assert/build_assert.h"
 #include "ccan/ccan/crypto/ripemd160/ripemd160.h"
 #include "ccan/ccan/crypto/sha256/sha256.h"
@@ -16,17 +17,74 @@
 #undef WIN32_LEAN_AND_MEAN
 #endif
 
-/* Caller is responsible for thread safety */
+/* We own the shared contexts, so are allowed to destroy them */
+#undef secp256k1_context_destroy
+
+/* The shared context is created on first use. Readers load it without
+ * locking where the compiler provides atomics.
+ */
 static secp256k1_context *global_ctx = NULL;
+WALLY_MUTEX_DEFINE(global_ctx_mutex);
 
-const secp256k1_context *secp_ctx(void)
+#if defined(__GNUC__) || defined(__clang__)
+#define ctx_load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ctx_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#else
+#define ctx_load(p) (*(p))
+#define ctx_store(p, v) *(p) = (v)
+#endif
+
+#ifdef WALLY_HAVE_PTHREAD
+/* Per-thread contexts, created when a thread first randomizes. The key
+ * is created along with the first of them, so until then fetching a
+ * context doesn't need to look anything up.
+ */
+static pthread_key_t thread_ctx_key;
+static pthread_once_t thread_ctx_once = PTHREAD_ONCE_INIT;
+static bool thread_ctx_key_ok = false;
+
+static void thread_ctx_destroy(void *ctx)
 {
-    const uint32_t flags = SECP256K1_CONTEXT_VERIFY | SECP256K1_CONTEXT_SIGN;
+    if (ctx)
+        secp256k1_context_destroy(ctx);
+}
 
-    if (!global_ctx)
-        global_ctx = secp256k1_context_create(flags);
+static void thread_ctx_key_init(void)
+{
+    ctx_store(&thread_ctx_key_ok,
+              !pthread_key_create(&thread_ctx_key, thread_ctx_destroy));
+}
 
-    return global_ctx;
+static secp256k1_context *thread_ctx(void)
+{
+    return ctx_load(&thread_ctx_key_ok) ? pthread_getspecific(thread_ctx_key) : NULL;
+}
+#endif
+
+static secp256k1_context *shared_ctx(void)
+{
+    const uint32_t flags = SECP256K1_CONTEXT_VERIFY | SECP256K1_CONTEXT_SIGN;
+    secp256k1_context *ctx = ctx_load(&global_ctx);
+
+    if (!ctx) {
+        wally_mutex_lock(&global_ctx_mutex);
+        if (!(ctx = global_ctx)) {
+            ctx = secp256k1_context_create(flags);
+            ctx_store(&global_ctx, ctx);
+        }
+        wally_mutex_unlock(&global_ctx_mutex);
+    }
+    return ctx;
+}
+
+const secp256k1_context *secp_ctx(void)
+{
+#ifdef WALLY_HAVE_PTHREAD
+    secp256k1_context *ctx = thread_ctx();
+    if (ctx)
+        return ctx;
+#endif
+    return shared_ctx();
 }
 
 #ifndef SWIG
@@ -43,8 +101,26 @@ int wally_secp_randomize(const unsigned char *bytes, size_t bytes_len)
     if (!bytes || bytes_len != WALLY_SECP_RANDOMIZE_LEN)
         return WALLY_EINVAL;
 
-    if (!(ctx = (secp256k1_context *)secp_ctx()))
+#ifdef WALLY_HAVE_PTHREAD
+    /* Other threads may be using the shared context, so never modify it.
+     * Randomize a clone of it owned by this thread instead */
+    if (!(ctx = thread_ctx())) {
+        secp256k1_context *src;
+
+        pthread_once(&thread_ctx_once, thread_ctx_key_init);
+        if (!thread_ctx_key_ok)
+            return WALLY_ERROR;
+        if (!(src = shared_ctx()) || !(ctx = secp256k1_context_clone(src)))
+            return WALLY_ENOMEM;
+        if (pthread_setspecific(thread_ctx_key, ctx)) {
+            secp256k1_context_destroy(ctx);
+            return WALLY_ENOMEM;
+        }
+    }
+#else
+    if (!(ctx = shared_ctx()))
         return WALLY_ENOMEM;
+#endif
 
     if (!secp256k1_context_randomize(ctx, bytes))
         return WALLY_ERROR;
@@ -52,6 +128,45 @@ int wally_secp_randomize(const unsigned char *bytes, size_t bytes_len)
     return WALLY_OK;
 }
 
+int wally_secp_thread_init(const unsigned char *bytes, size_t bytes_len)
+{
+    return wally_secp_randomize(bytes, bytes_len);
+}
+
+int wally_secp_thread_cleanup(void)
+{
+#ifdef WALLY_HAVE_PTHREAD
+    secp256k1_context *ctx = thread_ctx();
+
+    if (ctx) {
+        pthread_setspecific(thread_ctx_key, NULL);
+        secp256k1_context_destroy(ctx);
+    }
+#endif
+    return WALLY_OK;
+}
+
+int wally_secp_get_ecmult_window(size_t *written)
+{
+    if (!written)
+        return WALLY_EINVAL;
+#ifdef ECMULT_WINDOW_SIZE
+    *written = ECMULT_WINDOW_SIZE;
+#else
+    *written = 15; /* The libsecp256k1 default */
+#endif
+    return WALLY_OK;
+}
+
+int wally_secp_get_context_size(size_t *written)
+{
+    if (!written)
+        return WALLY_EINVAL;
+    *written = secp256k1_context_preallocated_size(SECP256K1_CONTEXT_VERIFY |
+                                                   SECP256K1_CONTEXT_SIGN);
+    return WALLY_OK;
+}
+
 int wally_free_string(char *str)
 {
     if (!str)
@@ -245,6 +360,78 @@ char *wally_strdup(const char *str)
     return new_str;
 }
 
+/* Upper limit on the threads used by wally_run_parallel */
+#define WALLY_MAX_THREADS 64
+
+struct parallel_job {
+    wally_job_fn fn;
+    void *ctx;
+    size_t begin, end;
+#ifdef WALLY_HAVE_PTHREAD
+    pthread_t thread;
+    bool started;
+#endif
+};
+
+#ifdef WALLY_HAVE_PTHREAD
+static void *parallel_job_run(void *p)
+{
+    struct parallel_job *job = p;
+    job->fn(job->ctx, job->begin, job->end);
+    return NULL;
+}
+#endif
+
+int wally_run_parallel(wally_job_fn fn, void *ctx, size_t num_items,
+                       size_t granularity, uint32_t num_threads)
+{
+#ifdef WALLY_HAVE_PTHREAD
+    struct parallel_job *jobs;
+    size_t chunk, num_jobs, i;
+
+    if (num_threads > WALLY_MAX_THREADS)
+        num_threads = WALLY_MAX_THREADS;
+    if (!granularity)
+        granularity = 1;
+
+    if (num_threads > 1 && num_items > granularity) {
+        /* Split into at most num_threads chunks of whole granules */
+        chunk = (num_items + num_threads - 1) / num_threads;
+        chunk = (chunk + granularity - 1) / granularity * granularity;
+        num_jobs = (num_items + chunk - 1) / chunk;
+
+        if (num_jobs > 1) {
+            if (!(jobs = wally_malloc(num_jobs * sizeof(*jobs))))
+                return WALLY_ENOMEM;
+
+            for (i = 0; i < num_jobs; ++i) {
+                jobs[i].fn = fn;
+                jobs[i].ctx = ctx;
+                jobs[i].begin = i * chunk;
+                jobs[i].end = i == num_jobs - 1 ? num_items : (i + 1) * chunk;
+                /* The calling thread runs the first chunk itself */
+                jobs[i].started = i && !pthread_create(&jobs[i].thread, NULL,
+                                                       parallel_job_run, jobs + i);
+            }
+            for (i = 0; i < num_jobs; ++i) {
+                if (jobs[i].started)
+                    pthread_join(jobs[i].thread, NULL);
+                else
+                    fn(ctx, jobs[i].begin, jobs[i].end); /* Run inline */
+            }
+            wally_free(jobs);
+            return WALLY_OK;
+        }
+    }
+#else
+    (void)granularity;
+    (void)num_threads;
+#endif
+    if (num_items)
+        fn(ctx, 0, num_items);
+    return WALLY_OK;
+}
+
 const struct wally_operations *wally_ops(void)
 {
     return &_ops;
@@ -347,11 +534,14 @@ int wally_cleanup(uint32_t flags)
 {
     if (flags)
         return WALLY_EINVAL;
+    wally_ec_sig_cache_disable();
+    wally_secp_thread_cleanup();
+    wally_mutex_lock(&global_ctx_mutex);
     if (global_ctx) {
-#undef secp256k1_context_destroy
         secp256k1_context_destroy(global_ctx);
-        global_ctx = NULL;
+        ctx_store(&global_ctx, NULL);
     }
+    wally_mutex_unlock(&global_ctx_mutex);
     return WALLY_OK;
 }
 
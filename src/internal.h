@@ -15,6 +15,7 @@ const secp256k1_context *secp_ctx(void);
 #define pubkey_create     secp256k1_ec_pubkey_create
 #define pubkey_parse      secp256k1_ec_pubkey_parse
 #define pubkey_tweak_add  secp256k1_ec_pubkey_tweak_add
+#define pubkey_tweak_mul  secp256k1_ec_pubkey_tweak_mul
 #define pubkey_serialize  secp256k1_ec_pubkey_serialize
 #define privkey_tweak_add secp256k1_ec_privkey_tweak_add
 #define pubkey_negate      secp256k1_ec_pubkey_negate
@@ -22,6 +23,13 @@ const secp256k1_context *secp_ctx(void);
 #define PUBKEY_COMPRESSED   SECP256K1_EC_COMPRESSED
 #define PUBKEY_UNCOMPRESSED SECP256K1_EC_UNCOMPRESSED
 
+/* Sum num_keys compressed public keys, each multiplied by its 32 byte
+ * tweak, into a compressed public key. Runs in variable time, so the
+ * tweaks must not be secret.
+ */
+int pubkey_multi_mul(const unsigned char *pub_keys, const unsigned char *tweaks,
+                     size_t num_keys, unsigned char *bytes_out);
+
 
 void wally_clear(void *p, size_t len);
 void wally_clear_2(void *p, size_t len, void *p2, size_t len2);
@@ -36,6 +44,29 @@ void wally_clear_6(void *p, size_t len, void *p2, size_t len2,
                    void *p3, size_t len3, void *p4, size_t len4,
                    void *p5, size_t len5, void *p6, size_t len6);
 
+/* Internal locking. Locks are no-ops if built without pthread support.
+ * WALLY_HAVE_PTHREAD is only set by configure, so builds using a hand
+ * written config.h (e.g. MSVC) are single threaded.
+ */
+#ifdef WALLY_HAVE_PTHREAD
+#include <pthread.h>
+#define WALLY_MUTEX_DEFINE(m) static pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER
+#define wally_mutex_lock(m) pthread_mutex_lock(m)
+#define wally_mutex_unlock(m) pthread_mutex_unlock(m)
+#else
+#define WALLY_MUTEX_DEFINE(m) static int m
+#define wally_mutex_lock(m) (void)(m)
+#define wally_mutex_unlock(m) (void)(m)
+#endif
+
+/* Run fn over [0, num_items) split into ranges of whole granules, using up
+ * to num_threads threads including the caller. Runs everything on the
+ * calling thread if built without pthread support.
+ */
+typedef void (*wally_job_fn)(void *ctx, size_t begin, size_t end);
+int wally_run_parallel(wally_job_fn fn, void *ctx, size_t num_items,
+                       size_t granularity, uint32_t num_threads);
+
 /* Fetch our internal operations function pointers */
 const struct wally_operations *wally_ops(void);
 
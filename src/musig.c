@@ -0,0 +1,329 @@
+#include "internal.h"
+#include <include/wally_crypto.h>
+#include "secp256k1/include/secp256k1.h"
+#include "secp256k1/include/secp256k1_schnorrsig.h"
+#include "secp256k1/include/secp256k1_musig.h"
+#include <stdbool.h>
+
+/* Scratch space for combining public keys. libsecp256k1 splits the
+ * multiplication into several when the keys do not fit.
+ */
+#define MUSIG_SCRATCH_SIZE (1024 * 1024)
+
+struct wally_musig_session {
+    secp256k1_musig_session session;
+    secp256k1_musig_session_signer_data *signers;
+    secp256k1_pubkey *pubs;
+    uint32_t num_signers;
+    unsigned char nonce_commitment[MUSIG_NONCE_COMMITMENT_LEN];
+};
+
+static size_t get_num_signers(const unsigned char *pub_key, size_t pub_key_len)
+{
+    const size_t num_signers = pub_key_len / EC_PUBLIC_KEY_LEN;
+    if (!pub_key || !num_signers || pub_key_len % EC_PUBLIC_KEY_LEN ||
+        num_signers > 0xffffffff)
+        return 0;
+    return num_signers;
+}
+
+static bool parse_pub_keys(const secp256k1_context *ctx,
+                           const unsigned char *pub_key, size_t num_signers,
+                           secp256k1_pubkey *pubs)
+{
+    size_t i;
+
+    for (i = 0; i < num_signers; ++i)
+        if (!pubkey_parse(ctx, &pubs[i], pub_key + i * EC_PUBLIC_KEY_LEN,
+                          EC_PUBLIC_KEY_LEN))
+            return false;
+    return true;
+}
+
+static bool pubkey_combine_musig(const secp256k1_context *ctx,
+                                 const secp256k1_pubkey *pubs, size_t num_signers,
+                                 secp256k1_pubkey *combined, unsigned char *pk_hash)
+{
+    secp256k1_scratch_space *scratch;
+    bool ret;
+
+    /* Without a scratch space libsecp256k1 falls back to one
+     * multiplication per key, so a failed allocation is not fatal */
+    scratch = secp256k1_scratch_space_create(ctx, MUSIG_SCRATCH_SIZE);
+    ret = secp256k1_musig_pubkey_combine(ctx, scratch, combined, pk_hash,
+                                         pubs, num_signers);
+    if (scratch)
+        secp256k1_scratch_space_destroy(ctx, scratch);
+    return ret;
+}
+
+int wally_musig_pubkey_combine(const unsigned char *pub_key, size_t pub_key_len,
+                               unsigned char *bytes_out, size_t len)
+{
+    const secp256k1_context *ctx = secp_ctx();
+    const size_t num_signers = get_num_signers(pub_key, pub_key_len);
+    secp256k1_pubkey *pubs, combined;
+    size_t len_in_out = EC_PUBLIC_KEY_LEN;
+    bool ok;
+
+    if (!num_signers || !bytes_out || len != EC_PUBLIC_KEY_LEN)
+        return WALLY_EINVAL;
+
+    if (!ctx)
+        return WALLY_ENOMEM;
+
+    if (!(pubs = wally_malloc(num_signers * sizeof(*pubs))))
+        return WALLY_ENOMEM;
+
+    ok = parse_pub_keys(ctx, pub_key, num_signers, pubs) &&
+         pubkey_combine_musig(ctx, pubs, num_signers, &combined, NULL) &&
+         pubkey_serialize(ctx, bytes_out, &len_in_out, &combined,
+                          PUBKEY_COMPRESSED) &&
+         len_in_out == EC_PUBLIC_KEY_LEN;
+
+    wally_free(pubs); /* No secrets to clear */
+    if (!ok)
+        wally_clear(bytes_out, len);
+    return ok ? WALLY_OK : WALLY_EINVAL;
+}
+
+static size_t session_alloc_len(size_t num_signers)
+{
+    return sizeof(struct wally_musig_session) +
+           num_signers * (sizeof(secp256k1_musig_session_signer_data) +
+                          sizeof(secp256k1_pubkey));
+}
+
+int wally_musig_session_init_alloc(const unsigned char *pub_key, size_t pub_key_len,
+                                   uint32_t index,
+                                   const unsigned char *priv_key, size_t priv_key_len,
+                                   const unsigned char *entropy, size_t entropy_len,
+                                   const unsigned char *bytes, size_t bytes_len,
+                                   struct wally_musig_session **output)
+{
+    const secp256k1_context *ctx = secp_ctx();
+    const size_t num_signers = get_num_signers(pub_key, pub_key_len);
+    struct wally_musig_session *result;
+    secp256k1_pubkey combined;
+    unsigned char pk_hash[SHA256_LEN];
+    bool ok;
+
+    if (output)
+        *output = NULL;
+
+    if (!num_signers || index >= num_signers ||
+        !priv_key || priv_key_len != EC_PRIVATE_KEY_LEN ||
+        !entropy || entropy_len != MUSIG_SESSION_ID_LEN ||
+        (bytes && bytes_len != EC_MESSAGE_HASH_LEN) ||
+        (!bytes && bytes_len) || !output)
+        return WALLY_EINVAL;
+
+    if (!ctx)
+        return WALLY_ENOMEM;
+
+    if (!(result = wally_malloc(session_alloc_len(num_signers))))
+        return WALLY_ENOMEM;
+    wally_clear(result, session_alloc_len(num_signers));
+    result->signers = (secp256k1_musig_session_signer_data *)(result + 1);
+    result->pubs = (secp256k1_pubkey *)(result->signers + num_signers);
+    result->num_signers = (uint32_t)num_signers;
+
+    ok = parse_pub_keys(ctx, pub_key, num_signers, result->pubs) &&
+         pubkey_combine_musig(ctx, result->pubs, num_signers, &combined, pk_hash) &&
+         secp256k1_musig_session_initialize(ctx, &result->session, result->signers,
+                                            result->nonce_commitment, entropy,
+                                            bytes, &combined, pk_hash,
+                                            num_signers, index, priv_key);
+
+    /* The signer's private key must match its position in the key list */
+    if (ok) {
+        secp256k1_pubkey pub;
+        unsigned char pub_bytes[EC_PUBLIC_KEY_LEN];
+        size_t len_in_out = sizeof(pub_bytes);
+        ok = pubkey_create(ctx, &pub, priv_key) &&
+             pubkey_serialize(ctx, pub_bytes, &len_in_out, &pub, PUBKEY_COMPRESSED) &&
+             !memcmp(pub_bytes, pub_key + index * EC_PUBLIC_KEY_LEN, sizeof(pub_bytes));
+        wally_clear(&pub, sizeof(pub));
+    }
+
+    wally_clear(pk_hash, sizeof(pk_hash));
+    if (!ok) {
+        wally_musig_session_free(result);
+        return WALLY_EINVAL;
+    }
+    *output = result;
+    return WALLY_OK;
+}
+
+int wally_musig_session_free(struct wally_musig_session *session)
+{
+    if (session) {
+        wally_clear(session, session_alloc_len(session->num_signers));
+        wally_free(session);
+    }
+    return WALLY_OK;
+}
+
+int wally_musig_session_get_nonce_commitment(const struct wally_musig_session *session,
+                                             unsigned char *bytes_out, size_t len)
+{
+    if (!session || !bytes_out || len != MUSIG_NONCE_COMMITMENT_LEN)
+        return WALLY_EINVAL;
+    memcpy(bytes_out, session->nonce_commitment, len);
+    return WALLY_OK;
+}
+
+int wally_musig_session_get_nonce(struct wally_musig_session *session,
+                                  const unsigned char *commitment, size_t commitment_len,
+                                  unsigned char *bytes_out, size_t len)
+{
+    const secp256k1_context *ctx = secp_ctx();
+    const unsigned char **commitments;
+    secp256k1_pubkey nonce;
+    size_t i, len_in_out = MUSIG_NONCE_LEN;
+    bool ok;
+
+    if (!session || !commitment ||
+        commitment_len != (size_t)session->num_signers * MUSIG_NONCE_COMMITMENT_LEN ||
+        !bytes_out || len != MUSIG_NONCE_LEN)
+        return WALLY_EINVAL;
+
+    if (!ctx)
+        return WALLY_ENOMEM;
+
+    if (!(commitments = wally_malloc(session->num_signers * sizeof(*commitments))))
+        return WALLY_ENOMEM;
+    for (i = 0; i < session->num_signers; ++i)
+        commitments[i] = commitment + i * MUSIG_NONCE_COMMITMENT_LEN;
+
+    ok = secp256k1_musig_session_get_public_nonce(ctx, &session->session,
+                                                  session->signers, &nonce,
+                                                  commitments, session->num_signers) &&
+         pubkey_serialize(ctx, bytes_out, &len_in_out, &nonce, PUBKEY_COMPRESSED) &&
+         len_in_out == MUSIG_NONCE_LEN;
+
+    wally_free(commitments); /* No secrets to clear */
+    if (!ok)
+        wally_clear(bytes_out, len);
+    return ok ? WALLY_OK : WALLY_EINVAL;
+}
+
+int wally_musig_session_set_message(struct wally_musig_session *session,
+                                    const unsigned char *bytes, size_t bytes_len)
+{
+    const secp256k1_context *ctx = secp_ctx();
+
+    if (!session || !bytes || bytes_len != EC_MESSAGE_HASH_LEN)
+        return WALLY_EINVAL;
+
+    if (!ctx)
+        return WALLY_ENOMEM;
+
+    if (!secp256k1_musig_session_set_msg(ctx, &session->session, bytes))
+        return WALLY_EINVAL;
+    return WALLY_OK;
+}
+
+int wally_musig_session_set_nonces(struct wally_musig_session *session,
+                                   const unsigned char *nonce, size_t nonce_len)
+{
+    const secp256k1_context *ctx = secp_ctx();
+    secp256k1_pubkey pub;
+    size_t i;
+    bool ok = true;
+
+    if (!session || !nonce || nonce_len != (size_t)session->num_signers * MUSIG_NONCE_LEN)
+        return WALLY_EINVAL;
+
+    if (!ctx)
+        return WALLY_ENOMEM;
+
+    for (i = 0; ok && i < session->num_signers; ++i)
+        ok = pubkey_parse(ctx, &pub, nonce + i * MUSIG_NONCE_LEN, MUSIG_NONCE_LEN) &&
+             secp256k1_musig_set_nonce(ctx, &session->signers[i], &pub);
+
+    ok = ok && secp256k1_musig_session_combine_nonces(ctx, &session->session,
+                                                      session->signers,
+                                                      session->num_signers,
+                                                      NULL, NULL);
+    return ok ? WALLY_OK : WALLY_EINVAL;
+}
+
+int wally_musig_partial_sign(const struct wally_musig_session *session,
+                             unsigned char *bytes_out, size_t len)
+{
+    const secp256k1_context *ctx = secp_ctx();
+    secp256k1_musig_partial_signature partial_sig;
+    bool ok;
+
+    if (!session || !bytes_out || len != MUSIG_PARTIAL_SIG_LEN)
+        return WALLY_EINVAL;
+
+    if (!ctx)
+        return WALLY_ENOMEM;
+
+    ok = secp256k1_musig_partial_sign(ctx, &session->session, &partial_sig) &&
+         secp256k1_musig_partial_signature_serialize(ctx, bytes_out, &partial_sig);
+
+    wally_clear(&partial_sig, sizeof(partial_sig));
+    if (!ok)
+        wally_clear(bytes_out, len);
+    return ok ? WALLY_OK : WALLY_EINVAL;
+}
+
+int wally_musig_partial_sig_verify(const struct wally_musig_session *session,
+                                   uint32_t index,
+                                   const unsigned char *sig, size_t sig_len)
+{
+    const secp256k1_context *ctx = secp_ctx();
+    secp256k1_musig_partial_signature partial_sig;
+
+    if (!session || index >= session->num_signers ||
+        !sig || sig_len != MUSIG_PARTIAL_SIG_LEN)
+        return WALLY_EINVAL;
+
+    if (!ctx)
+        return WALLY_ENOMEM;
+
+    if (!secp256k1_musig_partial_signature_parse(ctx, &partial_sig, sig) ||
+        !secp256k1_musig_partial_sig_verify(ctx, &session->session,
+                                            &session->signers[index],
+                                            &partial_sig, &session->pubs[index]))
+        return WALLY_EINVAL;
+    return WALLY_OK;
+}
+
+int wally_musig_partial_sig_combine(const struct wally_musig_session *session,
+                                    const unsigned char *sig, size_t sig_len,
+                                    unsigned char *bytes_out, size_t len)
+{
+    const secp256k1_context *ctx = secp_ctx();
+    secp256k1_musig_partial_signature *partial_sigs;
+    secp256k1_schnorrsig sig_secp;
+    size_t i;
+    bool ok = true;
+
+    if (!session || !sig ||
+        sig_len != (size_t)session->num_signers * MUSIG_PARTIAL_SIG_LEN ||
+        !bytes_out || len != EC_SIGNATURE_LEN)
+        return WALLY_EINVAL;
+
+    if (!ctx)
+        return WALLY_ENOMEM;
+
+    if (!(partial_sigs = wally_malloc(session->num_signers * sizeof(*partial_sigs))))
+        return WALLY_ENOMEM;
+
+    for (i = 0; ok && i < session->num_signers; ++i)
+        ok = secp256k1_musig_partial_signature_parse(ctx, &partial_sigs[i],
+                                                     sig + i * MUSIG_PARTIAL_SIG_LEN);
+
+    ok = ok && secp256k1_musig_partial_sig_combine(ctx, &session->session, &sig_secp,
+                                                   partial_sigs, session->num_signers) &&
+         secp256k1_schnorrsig_serialize(ctx, bytes_out, &sig_secp);
+
+    wally_free(partial_sigs); /* No secrets to clear */
+    if (!ok)
+        wally_clear(bytes_out, len);
+    return ok ? WALLY_OK : WALLY_EINVAL;
+}
@@ -2,7 +2,9 @@
 
 #include "ccan/ccan/base64/base64.h"
 #include "ccan/ccan/build_assert/build_assert.h"
+#include "ccan/ccan/crypto/sha256/sha256.h"
 
+#include <include/wally_bip32.h>
 #include <include/wally_crypto.h>
 #include <include/wally_script.h>
 #include <include/wally_transaction.h>
@@ -17,10 +19,228 @@
 const uint8_t WALLY_PSBT_MAGIC[5] = {'p', 's', 'b', 't', 0xff};
 
 
-static bool pubkey_is_compressed(unsigned char pubkey[EC_PUBLIC_KEY_UNCOMPRESSED_LEN]) {
+static bool pubkey_is_compressed(const unsigned char pubkey[EC_PUBLIC_KEY_UNCOMPRESSED_LEN]) {
     return pubkey[0] == 0x02 || pubkey[0] == 0x03;
 }
 
+/* Reallocate an array of map items to hold new_alloc_len items, which
+ * must be more than it currently holds. New items are zeroed */
+static int array_realloc(void **items, size_t *allocation_len, size_t item_size, size_t new_alloc_len)
+{
+    unsigned char *new_items;
+
+    if (!(new_items = wally_malloc(new_alloc_len * item_size))) {
+        return WALLY_ENOMEM;
+    }
+    if (*items) {
+        memcpy(new_items, *items, *allocation_len * item_size);
+    }
+    wally_bzero(new_items + *allocation_len * item_size, (new_alloc_len - *allocation_len) * item_size);
+
+    clear_and_free(*items, *allocation_len * item_size);
+    *items = new_items;
+    *allocation_len = new_alloc_len;
+    return WALLY_OK;
+}
+
+/* Ensure an array of map items has room for one more item, doubling its
+ * allocation if it is full */
+static int array_grow(void **items, size_t num_items, size_t *allocation_len, size_t item_size)
+{
+    if (num_items < *allocation_len) {
+        return WALLY_OK;
+    }
+    return array_realloc(items, allocation_len, item_size, *allocation_len ? *allocation_len * 2 : 1);
+}
+
+/* Ensure an array of map items has room for num_extra more items, so that
+ * growing it by that many cannot fail */
+static int array_reserve(void **items, size_t num_items, size_t *allocation_len, size_t item_size, size_t num_extra)
+{
+    if (num_extra > SIZE_MAX / item_size - num_items) {
+        return WALLY_ENOMEM;
+    }
+    if (num_items + num_extra <= *allocation_len) {
+        return WALLY_OK;
+    }
+    return array_realloc(items, allocation_len, item_size, num_items + num_extra);
+}
+
+/* A transient open-addressed hash index over the keys of a map's items.
+ * Each slot holds an item index + 1, or 0 if empty. The index stores
+ * positions rather than pointers so the items may be reallocated while
+ * it is in use */
+struct map_index {
+    size_t *slots;
+    size_t mask;
+};
+
+typedef void (*map_key_fn)(const void *items, size_t i,
+                           const unsigned char **key, size_t *key_len);
+
+static void keypath_item_key(const void *items, size_t i,
+                             const unsigned char **key, size_t *key_len)
+{
+    *key = ((const struct wally_keypath_item *)items)[i].pubkey;
+    *key_len = EC_PUBLIC_KEY_UNCOMPRESSED_LEN;
+}
+
+static void partial_sig_item_key(const void *items, size_t i,
+                                 const unsigned char **key, size_t *key_len)
+{
+    *key = ((const struct wally_partial_sigs_item *)items)[i].pubkey;
+    *key_len = EC_PUBLIC_KEY_UNCOMPRESSED_LEN;
+}
+
+static void unknowns_item_key(const void *items, size_t i,
+                              const unsigned char **key, size_t *key_len)
+{
+    *key = ((const struct wally_unknowns_item *)items)[i].key;
+    *key_len = ((const struct wally_unknowns_item *)items)[i].key_len;
+}
+
+/* Get the number of slots an index for num_items keys needs, or 0 if
+ * there are too many keys */
+static size_t map_index_num_slots(size_t num_items)
+{
+    size_t num_slots = 8;
+
+    while (num_slots < num_items * 2) {
+        if (num_slots > SIZE_MAX / sizeof(size_t) / 2) {
+            return 0;
+        }
+        num_slots *= 2;
+    }
+    return num_slots;
+}
+
+/* Empty an index, using only the slots that num_items keys need. The index
+ * must have been created with room for at least num_items keys */
+static void map_index_reset(struct map_index *index, size_t num_items)
+{
+    const size_t num_slots = map_index_num_slots(num_items);
+
+    wally_bzero(index->slots, num_slots * sizeof(size_t));
+    index->mask = num_slots - 1;
+}
+
+/* Create an empty index with room for num_items keys */
+static int map_index_init(struct map_index *index, size_t num_items)
+{
+    const size_t num_slots = map_index_num_slots(num_items);
+
+    if (!num_slots || !(index->slots = wally_malloc(num_slots * sizeof(size_t)))) {
+        return WALLY_ENOMEM;
+    }
+    map_index_reset(index, num_items);
+    return WALLY_OK;
+}
+
+static void map_index_free(struct map_index *index)
+{
+    wally_free(index->slots);
+}
+
+/* Return the slot holding key, or the empty slot it should be stored in */
+static size_t *map_index_lookup(const struct map_index *index,
+                                const void *items, map_key_fn key_fn,
+                                const unsigned char *key, size_t key_len)
+{
+    uint64_t hash = 14695981039346656037ull; /* FNV-1a */
+    const unsigned char *item_key;
+    size_t i, item_key_len, *slot;
+
+    for (i = 0; i < key_len; ++i) {
+        hash = (hash ^ key[i]) * 1099511628211ull;
+    }
+    for (i = (size_t)hash & index->mask; ; i = (i + 1) & index->mask) {
+        slot = &index->slots[i];
+        if (!*slot) {
+            return slot;
+        }
+        key_fn(items, *slot - 1, &item_key, &item_key_len);
+        if (item_key_len == key_len && (!key_len || !memcmp(item_key, key, key_len))) {
+            return slot;
+        }
+    }
+}
+
+/* Add the keys of a map's items to an index with room for them */
+static void map_index_add_items(struct map_index *index,
+                                const void *items, size_t num_items,
+                                map_key_fn key_fn)
+{
+    const unsigned char *key;
+    size_t i, key_len, *slot;
+
+    for (i = 0; i < num_items; ++i) {
+        key_fn(items, i, &key, &key_len);
+        slot = map_index_lookup(index, items, key_fn, key, key_len);
+        if (!*slot) {
+            *slot = i + 1;
+        }
+    }
+}
+
+/* Index the existing items of a map, leaving room for num_extra more */
+static int map_index_build(struct map_index *index,
+                           const void *items, size_t num_items,
+                           size_t num_extra, map_key_fn key_fn)
+{
+    int ret;
+
+    if (num_extra > SIZE_MAX - num_items) {
+        return WALLY_ENOMEM;
+    }
+    if ((ret = map_index_init(index, num_items + num_extra)) != WALLY_OK) {
+        return ret;
+    }
+    map_index_add_items(index, items, num_items, key_fn);
+    return WALLY_OK;
+}
+
+/* As map_index_build, but reuse the slots of reserved if it is given. It
+ * must have room for num_items + num_extra keys */
+static int map_index_build_into(struct map_index *index, const struct map_index *reserved,
+                                const void *items, size_t num_items,
+                                size_t num_extra, map_key_fn key_fn)
+{
+    if (!reserved) {
+        return map_index_build(index, items, num_items, num_extra, key_fn);
+    }
+    *index = *reserved;
+    map_index_reset(index, num_items + num_extra);
+    map_index_add_items(index, items, num_items, key_fn);
+    return WALLY_OK;
+}
+
+/* Fail with WALLY_EINVAL if any two items of a map have the same key */
+static int map_check_unique(const void *items, size_t num_items, map_key_fn key_fn)
+{
+    struct map_index index;
+    const unsigned char *key;
+    size_t i, key_len, *slot;
+    int ret;
+
+    if (num_items < 2) {
+        return WALLY_OK;
+    }
+    if ((ret = map_index_init(&index, num_items)) != WALLY_OK) {
+        return ret;
+    }
+    for (i = 0; i < num_items && ret == WALLY_OK; ++i) {
+        key_fn(items, i, &key, &key_len);
+        slot = map_index_lookup(&index, items, key_fn, key, key_len);
+        if (*slot) {
+            ret = WALLY_EINVAL; /* Duplicate key */
+        } else {
+            *slot = i + 1;
+        }
+    }
+    map_index_free(&index);
+    return ret;
+}
+
 
 int wally_keypath_map_init_alloc(size_t alloc_len, struct wally_keypath_map **output)
 {
@@ -99,24 +319,9 @@ int wally_add_new_keypath(struct wally_keypath_map *keypaths,
         return WALLY_EINVAL;
     }
 
-    if (keypaths->num_items == keypaths->items_allocation_len) {
-        struct wally_keypath_item *new_items;
-        size_t new_alloc_len = 1;
-        size_t orig_num_items = keypaths->num_items;
-        if (keypaths->items_allocation_len != 0) {
-            new_alloc_len = keypaths->items_allocation_len * 2;
-        }
-        new_items = wally_malloc(new_alloc_len * sizeof(struct wally_keypath_item));
-        if (!new_items) {
-            return WALLY_ENOMEM;
-        }
-        wally_bzero(new_items, new_alloc_len * sizeof(*new_items));
-        memcpy(new_items, keypaths->items, keypaths->items_allocation_len * sizeof(*keypaths->items));
-
-        clear_and_free(keypaths->items, keypaths->items_allocation_len * sizeof(*keypaths->items));
-        keypaths->items = new_items;
-        keypaths->num_items = orig_num_items;
-        keypaths->items_allocation_len = new_alloc_len;
+    if (array_grow((void **)&keypaths->items, keypaths->num_items,
+                   &keypaths->items_allocation_len, sizeof(*keypaths->items)) != WALLY_OK) {
+        return WALLY_ENOMEM;
     }
 
     latest = keypaths->num_items;
@@ -218,29 +423,14 @@ int wally_add_new_partial_sig(struct wally_partial_sigs_map *sigs,
         return WALLY_EINVAL;
     }
 
-    if (sigs->num_items == sigs->items_allocation_len) {
-        struct wally_partial_sigs_item *new_items;
-        size_t new_alloc_len = 1;
-        size_t orig_num_items = sigs->num_items;
-        if (sigs->items_allocation_len != 0) {
-            new_alloc_len = sigs->items_allocation_len * 2;
-        }
-        new_items = wally_malloc(new_alloc_len * sizeof(struct wally_partial_sigs_item));
-        if (!new_items) {
-            return WALLY_ENOMEM;
-        }
-        wally_bzero(new_items, new_alloc_len * sizeof(*new_items));
-        memcpy(new_items, sigs->items, sigs->items_allocation_len * sizeof(*sigs->items));
-
-        clear_and_free(sigs->items, sigs->items_allocation_len * sizeof(*sigs->items));
-        sigs->items = new_items;
-        sigs->num_items = orig_num_items;
-        sigs->items_allocation_len = new_alloc_len;
+    if (array_grow((void **)&sigs->items, sigs->num_items,
+                   &sigs->items_allocation_len, sizeof(*sigs->items)) != WALLY_OK) {
+        return WALLY_ENOMEM;
     }
 
     latest = sigs->num_items;
 
-    memcpy(&sigs->items[latest].pubkey, pubkey, EC_PUBLIC_KEY_UNCOMPRESSED_LEN);
+    memcpy(&sigs->items[latest].pubkey, pubkey, pubkey_len);
     if (sig) {
         if (!clone_bytes(&sigs->items[latest].sig, sig, sig_len)) {
             return WALLY_ENOMEM;
@@ -338,24 +528,9 @@ int wally_add_new_unknown(struct wally_unknowns_map *unknowns,
 {
     size_t latest;
 
-    if (unknowns->num_items == unknowns->items_allocation_len) {
-        struct wally_unknowns_item *new_items;
-        size_t new_alloc_len = 1;
-        size_t orig_num_items = unknowns->num_items;
-        if (unknowns->items_allocation_len != 0) {
-            new_alloc_len = unknowns->items_allocation_len * 2;
-        }
-        new_items = wally_malloc(new_alloc_len * sizeof(struct wally_unknowns_item));
-        if (!new_items) {
-            return WALLY_ENOMEM;
-        }
-        wally_bzero(new_items, new_alloc_len * sizeof(*new_items));
-        memcpy(new_items, unknowns->items, unknowns->items_allocation_len * sizeof(*unknowns->items));
-
-        clear_and_free(unknowns->items, unknowns->items_allocation_len * sizeof(*unknowns->items));
-        unknowns->items = new_items;
-        unknowns->num_items = orig_num_items;
-        unknowns->items_allocation_len = new_alloc_len;
+    if (array_grow((void **)&unknowns->items, unknowns->num_items,
+                   &unknowns->items_allocation_len, sizeof(*unknowns->items)) != WALLY_OK) {
+        return WALLY_ENOMEM;
     }
 
     latest = unknowns->num_items;
@@ -831,268 +1006,170 @@ fail:
     return ret;
 }
 
-struct psbt_input_counts {
-    size_t num_unknowns;
-    size_t num_keypaths;
-    size_t num_partial_sigs;
-};
-
-struct psbt_output_counts {
-    size_t num_unknowns;
-    size_t num_keypaths;
-};
-
-struct psbt_counts {
-    size_t num_global_unknowns;
-    struct psbt_input_counts *input_counts;
-    size_t num_inputs;
-    struct psbt_output_counts *output_counts;
-    size_t num_outputs;
-};
-
-static void free_psbt_count(struct psbt_counts *counts)
+/* Read a varint, failing if it overruns end */
+static bool psbt_read_varint(const unsigned char **p, const unsigned char *end, uint64_t *v)
 {
-    if (counts) {
-        clear_and_free(counts->input_counts, counts->num_inputs * sizeof(*counts->input_counts));
-        clear_and_free(counts->output_counts, counts->num_outputs * sizeof(*counts->output_counts));
-        clear_and_free(counts, sizeof(*counts));
+    if (*p >= end || (size_t)(end - *p) < varint_length_from_bytes(*p)) {
+        return false;
     }
+    *p += varint_from_bytes(*p, v);
+    return true;
 }
 
-/* Check that the bytes already read + bytes to be read < total len */
-#define CHECK_BUF_BOUNDS(p, i, begin, tl) if ((p - begin) + i > tl) { \
-        ret = WALLY_EINVAL; \
-        goto fail; \
-}
-
-static int count_psbt_parts(
-    const unsigned char *bytes,
-    size_t bytes_len,
-    struct psbt_counts **output)
+/* Read a varint length prefixed buffer, failing if it overruns end */
+static bool psbt_read_varbuff(const unsigned char **p, const unsigned char *end,
+                              const unsigned char **buf, size_t *len)
 {
-    struct psbt_counts *result;
-    size_t i, vl;
-    const unsigned char *key;
-    uint64_t key_len, value_len;
-    uint8_t type;
-    int ret = WALLY_OK;
-    const unsigned char *p = bytes, *end = bytes + bytes_len;
-
-    TX_CHECK_OUTPUT;
-    TX_OUTPUT_ALLOC(struct psbt_counts);
+    uint64_t v;
 
-    result->num_global_unknowns = 0;
-    result->num_inputs = 0;
-    result->num_outputs = 0;
-
-    /* Skip the magic */
-    CHECK_BUF_BOUNDS(p, (size_t)5, bytes, bytes_len)
-    p += 5;
-
-    /* Go through globals and count */
-    while (p < end) {
-        /* Read the key length */
-        vl = varint_from_bytes(p, &key_len);
-        CHECK_BUF_BOUNDS(p, key_len + vl, bytes, bytes_len)
-        p += vl;
-
-        if (key_len == 0) {
-            break;
-        }
-
-        /* Read the key itself */
-        key = p;
-        type = key[0];
-        p += key_len;
+    if (!psbt_read_varint(p, end, &v) || v > (uint64_t)(end - *p)) {
+        return false;
+    }
+    *buf = *p;
+    *len = v;
+    *p += v;
+    return true;
+}
 
-        /* Read value length */
-        vl = varint_from_bytes(p, &value_len);
-        CHECK_BUF_BOUNDS(p, value_len + vl, bytes, bytes_len)
-        p += vl;
+/* Read a key-value pair from a map, failing if it overruns end.
+ * key_len is set to 0 if the map separator was read instead */
+static bool psbt_read_map_item(const unsigned char **p, const unsigned char *end,
+                               const unsigned char **key, size_t *key_len,
+                               const unsigned char **value, size_t *value_len)
+{
+    if (!psbt_read_varbuff(p, end, key, key_len)) {
+        return false;
+    }
+    return !*key_len || psbt_read_varbuff(p, end, value, value_len);
+}
 
-        /* Process based on type */
-        switch (type) {
-        case WALLY_PSBT_GLOBAL_UNSIGNED_TX: {
-            bool expect_wit;
-            if (analyze_tx(p, value_len, 0, &result->num_inputs, &result->num_outputs, &expect_wit) != WALLY_OK) {
-                ret = WALLY_EINVAL;
-                goto fail;
-            }
-            if ((result->input_counts = wally_malloc(result->num_inputs * sizeof(struct psbt_input_counts))) == NULL ||
-                (result->output_counts = wally_malloc(result->num_outputs * sizeof(struct psbt_output_counts))) == NULL) {
-                ret = WALLY_ENOMEM;
-                goto fail;
-            }
-            break;
-        }
-        /* Unknowns */
-        default:
-            result->num_global_unknowns++;
-        }
+/* Parse a BIP32 derivation into a keypath map, allocating the map if needed */
+static int parse_keypath(struct wally_keypath_map **keypaths,
+                         const unsigned char *key, size_t key_len,
+                         const unsigned char *value, size_t value_len)
+{
+    struct wally_keypath_item *item;
+    size_t i, path_len;
+    int ret;
 
-        /* Increment past value length */
-        p += value_len;
+    if (key_len != 66 && key_len != 34) {
+        return WALLY_EINVAL;     /* Size of key is unexpected */
+    }
+    if (value_len % 4 != 0 || value_len == 0) {
+        return WALLY_EINVAL;     /* Invalid length for keypaths */
+    }
+    if (!*keypaths && (ret = wally_keypath_map_init_alloc(1, keypaths)) != WALLY_OK) {
+        return ret;
     }
 
-    /* Go through each input */
-    for (i = 0; i < result->num_inputs && p < end; ++i) {
-        struct psbt_input_counts *input = &result->input_counts[i];
-        input->num_keypaths = 0;
-        input->num_partial_sigs = 0;
-        input->num_unknowns = 0;
-        while (p < end) {
-            /* Read the key length */
-            vl = varint_from_bytes(p, &key_len);
-            CHECK_BUF_BOUNDS(p, key_len + vl, bytes, bytes_len)
-            p += vl;
-
-            if (key_len == 0) {
-                break;
-            }
+    if ((ret = array_grow((void **)&(*keypaths)->items, (*keypaths)->num_items,
+                          &(*keypaths)->items_allocation_len, sizeof(*item))) != WALLY_OK) {
+        return ret;
+    }
+    item = &(*keypaths)->items[(*keypaths)->num_items];
 
-            /* Read the key itself */
-            key = p;
-            type = key[0];
-            p += key_len;
+    path_len = (value_len / 4) - 1;
+    if (path_len && !(item->origin.path = wally_malloc(path_len * sizeof(uint32_t)))) {
+        return WALLY_ENOMEM;
+    }
+    memcpy(item->pubkey, &key[1], key_len - 1);
+    memcpy(item->origin.fingerprint, value, FINGERPRINT_LEN);
+    for (i = 0; i < path_len; ++i) {
+        uint32_from_le_bytes(value + FINGERPRINT_LEN + i * sizeof(uint32_t), &item->origin.path[i]);
+    }
+    item->origin.path_len = path_len;
 
-            /* Read value length */
-            vl = varint_from_bytes(p, &value_len);
-            CHECK_BUF_BOUNDS(p, value_len + vl, bytes, bytes_len)
-            p += vl;
+    (*keypaths)->num_items++;
+    return WALLY_OK;
+}
 
-            /* Process based on type */
-            switch (type) {
-            case WALLY_PSBT_IN_NON_WITNESS_UTXO:
-            case WALLY_PSBT_IN_WITNESS_UTXO:
-            case WALLY_PSBT_IN_SIGHASH_TYPE:
-            case WALLY_PSBT_IN_REDEEM_SCRIPT:
-            case WALLY_PSBT_IN_WITNESS_SCRIPT:
-            case WALLY_PSBT_IN_FINAL_SCRIPTSIG:
-            case WALLY_PSBT_IN_FINAL_SCRIPTWITNESS:
-                break;
-            case WALLY_PSBT_IN_PARTIAL_SIG:
-                input->num_partial_sigs++;
-                break;
-            case WALLY_PSBT_IN_BIP32_DERIVATION:
-                input->num_keypaths++;
-                break;
-            /* Unknowns */
-            default:
-                input->num_unknowns++;
-            }
+/* Parse an unknown key value pair into a map, allocating the map if needed */
+static int parse_unknown(struct wally_unknowns_map **unknowns,
+                         const unsigned char *key, size_t key_len,
+                         const unsigned char *value, size_t value_len)
+{
+    struct wally_unknowns_item *item;
+    int ret;
 
-            /* Increment past value length */
-            p += value_len;
-        }
+    if (!*unknowns && (ret = wally_unknowns_map_init_alloc(1, unknowns)) != WALLY_OK) {
+        return ret;
     }
+    if ((ret = array_grow((void **)&(*unknowns)->items, (*unknowns)->num_items,
+                          &(*unknowns)->items_allocation_len, sizeof(*item))) != WALLY_OK) {
+        return ret;
+    }
+    item = &(*unknowns)->items[(*unknowns)->num_items];
 
-    /* Go through each output */
-    for (i = 0; i < result->num_outputs && p < end; ++i) {
-        struct psbt_output_counts *psbt_output = &result->output_counts[i];
-        psbt_output->num_keypaths = 0;
-        psbt_output->num_unknowns = 0;
-        while (p < end) {
-            /* Read the key length */
-            vl = varint_from_bytes(p, &key_len);
-            CHECK_BUF_BOUNDS(p, key_len + vl, bytes, bytes_len)
-            p += vl;
-
-            if (key_len == 0) {
-                break;
-            }
+    if (!clone_bytes(&item->key, key, key_len) ||
+        !clone_bytes(&item->value, value, value_len)) {
+        clear_and_free(item->key, key_len);
+        item->key = NULL;
+        return WALLY_ENOMEM;
+    }
+    item->key_len = key_len;
+    item->value_len = value_len;
 
-            /* Read the key itself */
-            key = p;
-            type = key[0];
-            p += key_len;
+    (*unknowns)->num_items++;
+    return WALLY_OK;
+}
 
-            /* Read value length */
-            vl = varint_from_bytes(p, &value_len);
-            CHECK_BUF_BOUNDS(p, value_len + vl, bytes, bytes_len)
-            p += vl;
+/* Parse a partial signature into a map, allocating the map if needed */
+static int parse_partial_sig(struct wally_partial_sigs_map **partial_sigs,
+                             const unsigned char *key, size_t key_len,
+                             const unsigned char *value, size_t value_len)
+{
+    struct wally_partial_sigs_item *item;
+    int ret;
 
-            /* Process based on type */
-            switch (type) {
-            case WALLY_PSBT_OUT_REDEEM_SCRIPT:
-            case WALLY_PSBT_OUT_WITNESS_SCRIPT:
-                break;
-            case WALLY_PSBT_OUT_BIP32_DERIVATION:
-                psbt_output->num_keypaths++;
-                break;
-            /* Unknowns */
-            default:
-                psbt_output->num_unknowns++;
-            }
+    if (key_len != 66 && key_len != 34) {
+        return WALLY_EINVAL;     /* Size of key is unexpected */
+    }
+    if (!*partial_sigs && (ret = wally_partial_sigs_map_init_alloc(1, partial_sigs)) != WALLY_OK) {
+        return ret;
+    }
 
-            /* Increment past value length */
-            p += value_len;
-        }
+    if ((ret = array_grow((void **)&(*partial_sigs)->items, (*partial_sigs)->num_items,
+                          &(*partial_sigs)->items_allocation_len, sizeof(*item))) != WALLY_OK) {
+        return ret;
     }
+    item = &(*partial_sigs)->items[(*partial_sigs)->num_items];
 
-    if (p != end) {
-        ret = WALLY_EINVAL;
-        goto fail;
+    if (!clone_bytes(&item->sig, value, value_len)) {
+        return WALLY_ENOMEM;
     }
+    memcpy(item->pubkey, &key[1], key_len - 1);
+    item->sig_len = value_len;
 
+    (*partial_sigs)->num_items++;
     return WALLY_OK;
-
-fail:
-    free_psbt_count(result);
-    *output = NULL;
-    return ret;
 }
 
 static int psbt_input_from_bytes(
     const unsigned char *bytes,
     size_t bytes_len,
-    struct psbt_input_counts counts,
     size_t *bytes_read,
     struct wally_psbt_input *result)
 {
     const unsigned char *p = bytes, *end = bytes + bytes_len, *key, *value;
-    uint64_t key_len, value_len;
+    const unsigned char *vp, *vend;
+    size_t key_len, value_len;
     uint8_t type;
     int ret = WALLY_OK;
-    size_t i, vl;
+    size_t i;
     bool found_sep = false;
 
-    /* Init and alloc the maps */
-    if (counts.num_keypaths > 0) {
-        if ((ret = wally_keypath_map_init_alloc(counts.num_keypaths, &result->keypaths)) != WALLY_OK) {
-            return ret;
-        }
-    }
-    if (counts.num_partial_sigs > 0) {
-        if ((ret = wally_partial_sigs_map_init_alloc(counts.num_partial_sigs, &result->partial_sigs)) != WALLY_OK) {
-            return ret;
-        }
-    }
-    if (counts.num_unknowns > 0) {
-        if ((ret = wally_unknowns_map_init_alloc(counts.num_unknowns, &result->unknowns)) != WALLY_OK) {
-            return ret;
-        }
-    }
-
     /* Read key value pairs */
     while (p < end) {
-        /* Read the key length */
-        vl = varint_from_bytes(p, &key_len);
-        CHECK_BUF_BOUNDS(p, key_len + vl, bytes, bytes_len)
-        p += vl;
-
+        if (!psbt_read_map_item(&p, end, &key, &key_len, &value, &value_len)) {
+            return WALLY_EINVAL; /* Key or value overruns the buffer */
+        }
         if (key_len == 0) {
             found_sep = true;
             break;
         }
-
-        /* Read the key itself */
-        key = p;
         type = key[0];
-        p += key_len;
-
-        /* Pre-read the value length but don't increment for a sanity check */
-        vl = varint_from_bytes(p, &value_len);
-        CHECK_BUF_BOUNDS(p, value_len + vl, bytes, bytes_len)
+        vp = value;
+        vend = value + value_len;
 
         /* Process based on type */
         switch (type) {
@@ -1102,56 +1179,38 @@ static int psbt_input_from_bytes(
             } else if (key_len != 1) {
                 return WALLY_EINVAL;     /* Global tx key is one byte type */
             }
-            p += varint_from_bytes(p, &value_len);
-            value = p;
-            wally_tx_from_bytes(value, value_len, 0, &result->non_witness_utxo);
-            p += value_len;
+            if ((ret = wally_tx_from_bytes(value, value_len, 0, &result->non_witness_utxo)) != WALLY_OK) {
+                return ret;
+            }
             break;
         }
         case WALLY_PSBT_IN_WITNESS_UTXO: {
-            uint64_t amount = -1, script_len;
-            size_t script_len_len;
+            const unsigned char *script;
+            size_t script_len;
+            uint64_t amount;
             if (result->witness_utxo) {
                 return WALLY_EINVAL;     /* We already have a witness utxo */
             } else if (key_len != 1) {
                 return WALLY_EINVAL;     /* Global tx key is one byte type */
             }
-            p += varint_from_bytes(p, &value_len);
-            p += uint64_from_le_bytes(p, &amount);
-            script_len_len = varint_from_bytes(p, &script_len);
-            p += script_len_len;
-            ret = wally_tx_output_init_alloc(amount, p, script_len, &result->witness_utxo);
-            if (ret != WALLY_OK) {
-                return ret;
+            /* amount (8 bytes) + script CSUint + script = value length */
+            if (value_len < sizeof(amount)) {
+                return WALLY_EINVAL;
             }
-            p += script_len;
-            /* amount length (8 bytes) + script CSUint + script length = value length */
-            if (8 + script_len_len + script_len != value_len) {
+            vp += uint64_from_le_bytes(vp, &amount);
+            if (!psbt_read_varbuff(&vp, vend, &script, &script_len) || vp != vend) {
                 return WALLY_EINVAL;
             }
+            ret = wally_tx_output_init_alloc(amount, script, script_len, &result->witness_utxo);
+            if (ret != WALLY_OK) {
+                return ret;
+            }
             break;
         }
         case WALLY_PSBT_IN_PARTIAL_SIG: {
-            struct wally_partial_sigs_map *partial_sigs = result->partial_sigs;
-            if (key_len != 66 && key_len != 34) {
-                return WALLY_EINVAL;     /* Size of key is unexpected */
-            }
-            /* Check for duplicates */
-            for (i = 0; i < partial_sigs->num_items; ++i) {
-                if (memcmp(partial_sigs->items[i].pubkey, &key[1], key_len - 1) == 0) {
-                    return WALLY_EINVAL;     /* Duplicate key */
-                }
+            if ((ret = parse_partial_sig(&result->partial_sigs, key, key_len, value, value_len)) != WALLY_OK) {
+                return ret;
             }
-
-            memcpy(partial_sigs->items[partial_sigs->num_items].pubkey, &key[1], key_len - 1);
-
-            /* Read the signature */
-            p += varint_from_bytes(p, &value_len);
-            clone_bytes(&partial_sigs->items[partial_sigs->num_items].sig, p, value_len);
-            partial_sigs->items[partial_sigs->num_items].sig_len = value_len;
-
-            partial_sigs->num_items++;
-            p += value_len;
             break;
         }
         case WALLY_PSBT_IN_SIGHASH_TYPE: {
@@ -1159,9 +1218,10 @@ static int psbt_input_from_bytes(
                 return WALLY_EINVAL;     /* Sighash already provided */
             } else if (key_len != 1) {
                 return WALLY_EINVAL;     /* Type is more than one byte */
+            } else if (value_len != sizeof(uint32_t)) {
+                return WALLY_EINVAL;     /* Sighash is a 4 byte uint32 */
             }
-            p += varint_from_bytes(p, &value_len);
-            p += uint32_from_le_bytes(p, &result->sighash_type);
+            uint32_from_le_bytes(value, &result->sighash_type);
             break;
         }
         case WALLY_PSBT_IN_REDEEM_SCRIPT: {
@@ -1170,11 +1230,10 @@ static int psbt_input_from_bytes(
             } else if (key_len != 1) {
                 return WALLY_EINVAL;     /* Type is more than one byte */
             }
-            p += varint_from_bytes(p, &value_len);
-            clone_bytes(&result->redeem_script, p, value_len);
+            if (!clone_bytes(&result->redeem_script, value, value_len)) {
+                return WALLY_ENOMEM;
+            }
             result->redeem_script_len = value_len;
-
-            p += value_len;
             break;
         }
         case WALLY_PSBT_IN_WITNESS_SCRIPT: {
@@ -1183,47 +1242,16 @@ static int psbt_input_from_bytes(
             } else if (key_len != 1) {
                 return WALLY_EINVAL;     /* Type is more than one byte */
             }
-            p += varint_from_bytes(p, &value_len);
-            clone_bytes(&result->witness_script, p, value_len);
+            if (!clone_bytes(&result->witness_script, value, value_len)) {
+                return WALLY_ENOMEM;
+            }
             result->witness_script_len = value_len;
-
-            p += value_len;
             break;
         }
         case WALLY_PSBT_IN_BIP32_DERIVATION: {
-            struct wally_keypath_map *keypaths = result->keypaths;
-            size_t path_len;
-            if (key_len != 66 && key_len != 34) {
-                return WALLY_EINVAL;     /* Size of key is unexpected */
-            }
-            /* Check for duplicates */
-            for (i = 0; i < keypaths->num_items; ++i) {
-                if (memcmp(keypaths->items[i].pubkey, &key[1], key_len - 1) == 0) {
-                    return WALLY_EINVAL;     /* Duplicate key */
-                }
+            if ((ret = parse_keypath(&result->keypaths, key, key_len, value, value_len)) != WALLY_OK) {
+                return ret;
             }
-
-            memcpy(keypaths->items[keypaths->num_items].pubkey, &key[1], key_len - 1);
-
-            /* Read the path length */
-            p += varint_from_bytes(p, &value_len);
-            if (value_len % 4 != 0 || value_len == 0) {
-                return WALLY_EINVAL;     /* Invalid length for keypaths */
-            }
-            path_len = (value_len / 4) - 1;
-
-            /* Read the fingerprint */
-            memcpy(keypaths->items[keypaths->num_items].origin.fingerprint, p, 4);
-            p += 4;
-
-            /* Read the path itself */
-            keypaths->items[keypaths->num_items].origin.path = wally_malloc(path_len * sizeof(uint32_t));
-            for (i = 0; i < path_len; ++i) {
-                p += uint32_from_le_bytes(p, &keypaths->items[keypaths->num_items].origin.path[i]);
-            }
-            keypaths->items[keypaths->num_items].origin.path_len = path_len;
-
-            keypaths->num_items++;
             break;
         }
         case WALLY_PSBT_IN_FINAL_SCRIPTSIG: {
@@ -1232,11 +1260,10 @@ static int psbt_input_from_bytes(
             } else if (key_len != 1) {
                 return WALLY_EINVAL;     /* Type is more than one byte */
             }
-            p += varint_from_bytes(p, &value_len);
-            clone_bytes(&result->final_script_sig, p, value_len);
+            if (!clone_bytes(&result->final_script_sig, value, value_len)) {
+                return WALLY_ENOMEM;
+            }
             result->final_script_sig_len = value_len;
-
-            p += value_len;
             break;
         }
         case WALLY_PSBT_IN_FINAL_SCRIPTWITNESS: {
@@ -1246,36 +1273,36 @@ static int psbt_input_from_bytes(
             } else if (key_len != 1) {
                 return WALLY_EINVAL;     /* Type is more than one byte */
             }
-            p += varint_from_bytes(p, &value_len);
-            p += varint_from_bytes(p, &num_witnesses);
+            /* Each witness takes at least one byte for its length */
+            if (!psbt_read_varint(&vp, vend, &num_witnesses) ||
+                num_witnesses > (uint64_t)(vend - vp)) {
+                return WALLY_EINVAL;
+            }
             ret = wally_tx_witness_stack_init_alloc(num_witnesses, &result->final_witness);
             if (ret != WALLY_OK) {
                 return ret;
             }
 
             for (i = 0; i < num_witnesses; ++i) {
-                uint64_t witness_len;
-                p += varint_from_bytes(p, &witness_len);
-                ret = wally_tx_witness_stack_set(result->final_witness, i, p, witness_len);
+                const unsigned char *witness;
+                size_t witness_len;
+                if (!psbt_read_varbuff(&vp, vend, &witness, &witness_len)) {
+                    return WALLY_EINVAL;
+                }
+                ret = wally_tx_witness_stack_set(result->final_witness, i, witness, witness_len);
                 if (ret != WALLY_OK)
                     return ret;
-                p += witness_len;
+            }
+            if (vp != vend) {
+                return WALLY_EINVAL; /* Trailing data in the witness */
             }
             break;
         }
         /* Unknowns */
         default: {
-            struct wally_unknowns_map *unknowns = result->unknowns;
-            clone_bytes(&unknowns->items[unknowns->num_items].key, key, key_len);
-            unknowns->items[unknowns->num_items].key_len = key_len;
-
-            p += varint_from_bytes(p, &value_len);
-            value = p;
-            clone_bytes(&unknowns->items[unknowns->num_items].value, value, value_len);
-            unknowns->items[unknowns->num_items].value_len = value_len;
-
-            unknowns->num_items++;
-            p += value_len;
+            if ((ret = parse_unknown(&result->unknowns, key, key_len, value, value_len)) != WALLY_OK) {
+                return ret;
+            }
             break;
         }
         }
@@ -1285,53 +1312,42 @@ static int psbt_input_from_bytes(
         return WALLY_EINVAL;
     }
 
+    /* Duplicate keys are checked once the whole map has been read */
+    if (result->keypaths &&
+        (ret = map_check_unique(result->keypaths->items, result->keypaths->num_items, keypath_item_key)) != WALLY_OK) {
+        return ret;
+    }
+    if (result->partial_sigs &&
+        (ret = map_check_unique(result->partial_sigs->items, result->partial_sigs->num_items, partial_sig_item_key)) != WALLY_OK) {
+        return ret;
+    }
+
     *bytes_read = p - bytes;
-fail:
     return ret;
 }
 
 static int psbt_output_from_bytes(
     const unsigned char *bytes,
     size_t bytes_len,
-    struct psbt_output_counts counts,
     size_t *bytes_read,
     struct wally_psbt_output *result)
 {
     const unsigned char *p = bytes, *end = bytes + bytes_len, *key, *value;
-    uint64_t key_len, value_len;
+    size_t key_len, value_len;
     uint8_t type;
-    size_t i, vl;
     bool found_sep = false;
     int ret = WALLY_OK;
 
-    /* Init and alloc the maps */
-    if (counts.num_keypaths > 0) {
-        wally_keypath_map_init_alloc(counts.num_keypaths, &result->keypaths);
-    }
-    if (counts.num_unknowns > 0) {
-        wally_unknowns_map_init_alloc(counts.num_unknowns, &result->unknowns);
-    }
-
     /* Read key value pairs */
     while (p < end) {
-        /* Read the key length */
-        vl = varint_from_bytes(p, &key_len);
-        CHECK_BUF_BOUNDS(p, key_len + vl, bytes, bytes_len)
-        p += vl;
-
+        if (!psbt_read_map_item(&p, end, &key, &key_len, &value, &value_len)) {
+            return WALLY_EINVAL; /* Key or value overruns the buffer */
+        }
         if (key_len == 0) {
             found_sep = true;
             break;
         }
-
-        /* Read the key itself */
-        key = p;
         type = key[0];
-        p += key_len;
-
-        /* Pre-read the value length but don't increment for a sanity check */
-        vl = varint_from_bytes(p, &value_len);
-        CHECK_BUF_BOUNDS(p, value_len + vl, bytes, bytes_len)
 
         /* Process based on type */
         switch (type) {
@@ -1341,11 +1357,10 @@ static int psbt_output_from_bytes(
             } else if (key_len != 1) {
                 return WALLY_EINVAL;     /* Type is more than one byte */
             }
-            p += varint_from_bytes(p, &value_len);
-            clone_bytes(&result->redeem_script, p, value_len);
+            if (!clone_bytes(&result->redeem_script, value, value_len)) {
+                return WALLY_ENOMEM;
+            }
             result->redeem_script_len = value_len;
-
-            p += value_len;
             break;
         }
         case WALLY_PSBT_OUT_WITNESS_SCRIPT: {
@@ -1354,62 +1369,23 @@ static int psbt_output_from_bytes(
             } else if (key_len != 1) {
                 return WALLY_EINVAL;     /* Type is more than one byte */
             }
-            p += varint_from_bytes(p, &value_len);
-            clone_bytes(&result->witness_script, p, value_len);
+            if (!clone_bytes(&result->witness_script, value, value_len)) {
+                return WALLY_ENOMEM;
+            }
             result->witness_script_len = value_len;
-
-            p += value_len;
             break;
         }
         case WALLY_PSBT_OUT_BIP32_DERIVATION: {
-            struct wally_keypath_map *keypaths = result->keypaths;
-            size_t path_len;
-            if (key_len != 66 && key_len != 34) {
-                return WALLY_EINVAL;     /* Size of key is unexpected */
-            }
-            /* Check for duplicates */
-            for (i = 0; i < keypaths->num_items; ++i) {
-                if (memcmp(keypaths->items[i].pubkey, &key[1], key_len - 1) == 0) {
-                    return WALLY_EINVAL;     /* Duplicate key */
-                }
-            }
-
-            memcpy(keypaths->items[keypaths->num_items].pubkey, &key[1], key_len - 1);
-
-            /* Read the path length */
-            p += varint_from_bytes(p, &value_len);
-            if (value_len % 4 != 0 || value_len == 0) {
-                return WALLY_EINVAL;     /* Invalid length for keypaths */
-            }
-            path_len = (value_len / 4) - 1;
-
-            /* Read the fingerprint */
-            memcpy(keypaths->items[keypaths->num_items].origin.fingerprint, p, 4);
-            p += 4;
-
-            /* Read the path itself */
-            keypaths->items[keypaths->num_items].origin.path = wally_malloc(path_len * sizeof(uint32_t));
-            for (i = 0; i < path_len; ++i) {
-                p += uint32_from_le_bytes(p, &keypaths->items[keypaths->num_items].origin.path[i]);
+            if ((ret = parse_keypath(&result->keypaths, key, key_len, value, value_len)) != WALLY_OK) {
+                return ret;
             }
-            keypaths->items[keypaths->num_items].origin.path_len = path_len;
-
-            keypaths->num_items++;
             break;
         }
         /* Unknowns */
         default: {
-            struct wally_unknowns_map *unknowns = result->unknowns;
-            clone_bytes(&unknowns->items[unknowns->num_items].key, key, key_len);
-            unknowns->items[unknowns->num_items].key_len = key_len;
-
-            p += varint_from_bytes(p, &value_len);
-            value = p;
-            clone_bytes(&unknowns->items[unknowns->num_items].value, value, value_len);
-            unknowns->items[unknowns->num_items].value_len = value_len;
-
-            unknowns->num_items++;
-            p += value_len;
+            if ((ret = parse_unknown(&result->unknowns, key, key_len, value, value_len)) != WALLY_OK) {
+                return ret;
+            }
             break;
         }
         }
@@ -1419,72 +1395,305 @@ static int psbt_output_from_bytes(
         return WALLY_EINVAL;
     }
 
+    /* Duplicate keys are checked once the whole map has been read */
+    if (result->keypaths &&
+        (ret = map_check_unique(result->keypaths->items, result->keypaths->num_items, keypath_item_key)) != WALLY_OK) {
+        return ret;
+    }
+
     *bytes_read = p - bytes;
-fail:
     return ret;
 }
 
-int wally_psbt_from_bytes(
-    const unsigned char *bytes,
-    size_t bytes_len,
+/* Allocate the input and output maps to match the unsigned tx */
+static int psbt_alloc_maps(struct wally_psbt *psbt)
+{
+    const size_t num_inputs = psbt->tx->num_inputs, num_outputs = psbt->tx->num_outputs;
+
+    if (num_inputs) {
+        if (!(psbt->inputs = wally_malloc(num_inputs * sizeof(*psbt->inputs)))) {
+            return WALLY_ENOMEM;
+        }
+        wally_bzero(psbt->inputs, num_inputs * sizeof(*psbt->inputs));
+        psbt->inputs_allocation_len = num_inputs;
+    }
+    if (num_outputs) {
+        if (!(psbt->outputs = wally_malloc(num_outputs * sizeof(*psbt->outputs)))) {
+            return WALLY_ENOMEM;
+        }
+        wally_bzero(psbt->outputs, num_outputs * sizeof(*psbt->outputs));
+        psbt->outputs_allocation_len = num_outputs;
+    }
+    return WALLY_OK;
+}
+
+/* Decode one group of 4 base64 characters into its 24 bit value, or -1
+ * if any character is invalid. Invalid characters are -1 in the map, so
+ * the entries are checked before shifting to avoid shifting a negative */
+static int32_t psbt_base64_group(const signed char *map, const unsigned char *s)
+{
+    const int32_t a = map[s[0]], b = map[s[1]], c = map[s[2]], d = map[s[3]];
+
+    if ((a | b | c | d) < 0) {
+        return -1;
+    }
+    return (int32_t)(((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6) | (uint32_t)d);
+}
+
+/* Decode base64 into bytes_out, which must hold base64_decoded_length(len)
+ * bytes. If is_final is false, len must be a multiple of 4 and every group
+ * must be complete. Otherwise the last group may be truncated or padded:
+ * as with ccan's base64_decode, trailing '=' padding is optional.
+ * Returns the decoded length or -1 */
+static ssize_t psbt_base64_decode(const char *str, size_t len, bool is_final,
+                                  unsigned char *bytes_out)
+{
+    const signed char *map = base64_maps_rfc4648.decode_map;
+    const unsigned char *p = (const unsigned char *)str;
+    unsigned char *out = bytes_out;
+    unsigned char tail[4];
+    size_t tail_len;
+    int32_t v;
+
+    /* Every group but the last must be complete and unpadded */
+    for (; len > (is_final ? 4u : 0u); p += 4, len -= 4, out += 3) {
+        if ((v = psbt_base64_group(map, p)) < 0) {
+            return -1;
+        }
+        out[0] = v >> 16;
+        out[1] = v >> 8;
+        out[2] = v;
+    }
+    if (!is_final) {
+        return out - bytes_out;
+    }
+
+    /* The last group may be padded with '=' or truncated */
+    for (tail_len = len; tail_len && p[tail_len - 1] == '='; --tail_len) {
+    }
+    if (tail_len == 1) {
+        return -1;
+    }
+    if (tail_len) {
+        memset(tail, 'A', sizeof(tail));
+        memcpy(tail, p, tail_len);
+        if ((v = psbt_base64_group(map, tail)) < 0) {
+            return -1;
+        }
+        out[0] = v >> 16;
+        out[1] = v >> 8;
+        out[2] = v;
+        out += tail_len - 1;
+    }
+    return out - bytes_out;
+}
+
+/* Base64 text is decoded this many characters at a time. A multiple of 4 */
+#define PSBT_B64_CHUNK_LEN 4096
+
+/* The serialized PSBT being parsed. This is either a buffer of bytes, or
+ * base64 text that is decoded a chunk at a time, one map at a time, so
+ * that only the map currently being parsed is held in decoded form */
+struct psbt_source {
+    const unsigned char *p, *end; /* Unparsed bytes, for a buffer */
+    const unsigned char *b64;     /* Undecoded text, or NULL for a buffer */
+    size_t b64_len;
+    unsigned char *chunk;         /* Decoded text not yet read into map */
+    size_t chunk_pos, chunk_len;
+    unsigned char *map;           /* The current decoded map */
+    size_t map_len, map_allocation_len;
+};
+
+/* Decode the next chunk of base64 text. Returns false if it is invalid */
+static bool psbt_source_fill(struct psbt_source *src)
+{
+    const size_t len = src->b64_len > PSBT_B64_CHUNK_LEN ? PSBT_B64_CHUNK_LEN : src->b64_len;
+    const ssize_t decoded = psbt_base64_decode((const char *)src->b64, len,
+                                               len == src->b64_len, src->chunk);
+
+    if (decoded < 0) {
+        return false;
+    }
+    src->b64 += len;
+    src->b64_len -= len;
+    src->chunk_pos = 0;
+    src->chunk_len = decoded;
+    return true;
+}
+
+/* Decode the next len bytes onto the end of the current map */
+static int psbt_source_read(struct psbt_source *src, uint64_t len)
+{
+    const size_t available = src->chunk_len - src->chunk_pos + base64_decoded_length(src->b64_len);
+    unsigned char *new_map;
+    size_t n;
+
+    if (len > available) {
+        return WALLY_EINVAL; /* Truncated */
+    }
+    if (len > src->map_allocation_len - src->map_len) {
+        n = src->map_len + len;
+        if (n < src->map_allocation_len * 2) {
+            n = src->map_allocation_len * 2;
+        }
+        if (!(new_map = wally_malloc(n))) {
+            return WALLY_ENOMEM;
+        }
+        if (src->map_len) {
+            memcpy(new_map, src->map, src->map_len);
+        }
+        clear_and_free(src->map, src->map_allocation_len);
+        src->map = new_map;
+        src->map_allocation_len = n;
+    }
+
+    while (len) {
+        if (src->chunk_pos == src->chunk_len) {
+            if (!src->b64_len || !psbt_source_fill(src)) {
+                return WALLY_EINVAL; /* Truncated or invalid base64 */
+            }
+            continue;
+        }
+        n = src->chunk_len - src->chunk_pos;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(src->map + src->map_len, src->chunk + src->chunk_pos, n);
+        src->map_len += n;
+        src->chunk_pos += n;
+        len -= n;
+    }
+    return WALLY_OK;
+}
+
+/* Decode a varint onto the end of the current map */
+static int psbt_source_read_varint(struct psbt_source *src, uint64_t *v)
+{
+    const size_t start = src->map_len;
+    int ret;
+
+    if ((ret = psbt_source_read(src, 1)) == WALLY_OK &&
+        (ret = psbt_source_read(src, varint_length_from_bytes(src->map + start) - 1)) == WALLY_OK) {
+        varint_from_bytes(src->map + start, v);
+    }
+    return ret;
+}
+
+/* Check and skip the PSBT magic */
+static int psbt_source_read_magic(struct psbt_source *src)
+{
+    if (!src->b64) {
+        if (src->end - src->p <= (ptrdiff_t)sizeof(WALLY_PSBT_MAGIC) ||
+            memcmp(src->p, WALLY_PSBT_MAGIC, sizeof(WALLY_PSBT_MAGIC))) {
+            return WALLY_EINVAL;
+        }
+        src->p += sizeof(WALLY_PSBT_MAGIC);
+        return WALLY_OK;
+    }
+    src->map_len = 0;
+    if (psbt_source_read(src, sizeof(WALLY_PSBT_MAGIC)) != WALLY_OK ||
+        memcmp(src->map, WALLY_PSBT_MAGIC, sizeof(WALLY_PSBT_MAGIC))) {
+        return WALLY_EINVAL;
+    }
+    return WALLY_OK;
+}
+
+/* Get the bytes holding the next map. For a buffer this is all of the
+ * unparsed bytes; for base64 the next map is decoded, up to and including
+ * its separator */
+static int psbt_source_next_map(struct psbt_source *src,
+                                const unsigned char **p, const unsigned char **end)
+{
+    uint64_t len;
+    int ret;
+
+    if (!src->b64) {
+        *p = src->p;
+        *end = src->end;
+        return WALLY_OK;
+    }
+
+    src->map_len = 0;
+    for (;;) {
+        if ((ret = psbt_source_read_varint(src, &len)) != WALLY_OK) {
+            return ret;
+        }
+        if (!len) {
+            break; /* Separator */
+        }
+        if ((ret = psbt_source_read(src, len)) != WALLY_OK ||
+            (ret = psbt_source_read_varint(src, &len)) != WALLY_OK ||
+            (ret = psbt_source_read(src, len)) != WALLY_OK) {
+            return ret;
+        }
+    }
+    *p = src->map;
+    *end = src->map + src->map_len;
+    return WALLY_OK;
+}
+
+/* Mark len bytes of the map from psbt_source_next_map as parsed */
+static void psbt_source_consume(struct psbt_source *src, size_t len)
+{
+    if (!src->b64) {
+        src->p += len;
+    }
+}
+
+/* Return whether any unparsed data remains */
+static bool psbt_source_has_more(struct psbt_source *src)
+{
+    if (!src->b64) {
+        return src->p < src->end;
+    }
+    while (src->chunk_pos == src->chunk_len && src->b64_len) {
+        if (!psbt_source_fill(src)) {
+            return true; /* Invalid base64 remains; fail when it is read */
+        }
+    }
+    return src->chunk_pos < src->chunk_len;
+}
+
+static int psbt_from_source(
+    struct psbt_source *src,
     struct wally_psbt **output)
 {
-    const unsigned char *p = bytes, *end = bytes + bytes_len, *key, *value;
-    uint64_t key_len, value_len;
+    const unsigned char *p, *end, *map, *key, *value;
+    size_t key_len, value_len;
     uint8_t type;
-    size_t i, vl;
+    size_t i;
     int ret = WALLY_OK;
-    struct psbt_counts *counts = NULL;
     struct wally_psbt *result = NULL;
     bool found_sep;
 
-    TX_CHECK_OUTPUT;
-
     /* Check the magic */
-    if (bytes_len <= 5) {
-        ret = WALLY_EINVAL;  /* Not enough bytes */
-        goto fail;
-    }
-    if (memcmp(p, WALLY_PSBT_MAGIC, 5) != 0 ) {
-        ret = WALLY_EINVAL;  /* Invalid Magic */
-        goto fail;
-    }
-    p += 5;
-
-    /* Get a count of the psbt parts */
-    if (count_psbt_parts(bytes, bytes_len, &counts) != WALLY_OK) {
-        ret = WALLY_EINVAL;
+    if ((ret = psbt_source_read_magic(src)) != WALLY_OK) {
         goto fail;
     }
 
-    /* Make the wally_psbt */
-    ret = wally_psbt_init_alloc(counts->num_inputs, counts->num_outputs, counts->num_global_unknowns, &result);
+    /* Make the wally_psbt. Its maps are sized once the unsigned tx is read */
+    ret = wally_psbt_init_alloc(0, 0, 0, &result);
     if (ret != WALLY_OK) {
         goto fail;
     }
     *output = result;
 
     /* Read globals first */
+    if ((ret = psbt_source_next_map(src, &p, &end)) != WALLY_OK) {
+        goto fail;
+    }
+    map = p;
     found_sep = false;
     while (p < end) {
-        /* Read the key length */
-        vl = varint_from_bytes(p, &key_len);
-        CHECK_BUF_BOUNDS(p, key_len + vl, bytes, bytes_len)
-        p += vl;
-
+        if (!psbt_read_map_item(&p, end, &key, &key_len, &value, &value_len)) {
+            ret = WALLY_EINVAL; /* Key or value overruns the buffer */
+            goto fail;
+        }
         if (key_len == 0) {
             found_sep = true;
             break;
         }
-
-        /* Read the key itself */
-        key = p;
         type = key[0];
-        p += key_len;
-
-        /* Pre-read the value length but don't increment for a sanity check */
-        vl = varint_from_bytes(p, &value_len);
-        CHECK_BUF_BOUNDS(p, value_len + vl, bytes, bytes_len)
 
         /* Process based on type */
         switch (type) {
@@ -1497,12 +1706,9 @@ int wally_psbt_from_bytes(
                 ret = WALLY_EINVAL;     /* Global tx key is one byte type */
                 goto fail;
             }
-            p += varint_from_bytes(p, &value_len);
-            value = p;
             if ((ret = wally_tx_from_bytes(value, value_len, 0, &result->tx)) != WALLY_OK) {
                 goto fail;
             }
-            p += value_len;
             /* Make sure there are no scriptSigs and scriptWitnesses */
             for (j = 0; j < result->tx->num_inputs; ++j) {
                 if (result->tx->inputs[j].script_len != 0 || (result->tx->inputs[j].witness && result->tx->inputs[j].witness->num_items != 0)) {
@@ -1510,21 +1716,16 @@ int wally_psbt_from_bytes(
                     goto fail;
                 }
             }
+            if ((ret = psbt_alloc_maps(result)) != WALLY_OK) {
+                goto fail;
+            }
             break;
         }
         /* Unknowns */
         default: {
-            struct wally_unknowns_map *unknowns = result->unknowns;
-            clone_bytes(&unknowns->items[unknowns->num_items].key, key, key_len);
-            unknowns->items[unknowns->num_items].key_len = key_len;
-
-            p += varint_from_bytes(p, &value_len);
-            value = p;
-            clone_bytes(&unknowns->items[unknowns->num_items].value, value, value_len);
-            unknowns->items[unknowns->num_items].value_len = value_len;
-
-            unknowns->num_items++;
-            p += value_len;
+            if ((ret = parse_unknown(&result->unknowns, key, key_len, value, value_len)) != WALLY_OK) {
+                goto fail;
+            }
             break;
         }
         }
@@ -1534,6 +1735,7 @@ int wally_psbt_from_bytes(
         ret = WALLY_EINVAL; /* Missing global separator */
         goto fail;
     }
+    psbt_source_consume(src, p - map);
 
     if (!result->tx) {
         ret = WALLY_EINVAL; /* No global tx */
@@ -1541,15 +1743,18 @@ int wally_psbt_from_bytes(
     }
 
     /* Read inputs */
-    for (i = 0; i < counts->num_inputs && p < end; ++i) {
+    for (i = 0; i < result->inputs_allocation_len && psbt_source_has_more(src); ++i) {
         size_t bytes_read;
 
-        ret = psbt_input_from_bytes(p, end - p, counts->input_counts[i], &bytes_read, &result->inputs[i]);
+        if ((ret = psbt_source_next_map(src, &p, &end)) != WALLY_OK) {
+            goto fail;
+        }
+        ret = psbt_input_from_bytes(p, end - p, &bytes_read, &result->inputs[i]);
+        result->num_inputs++; /* Count partial inputs so they are freed on failure */
         if (ret != WALLY_OK) {
             goto fail;
         }
-        p += bytes_read;
-        result->num_inputs++;
+        psbt_source_consume(src, bytes_read);
     }
 
     /* Make sure that the number of inputs matches the number of inputs in the transaction */
@@ -1559,15 +1764,18 @@ int wally_psbt_from_bytes(
     }
 
     /* Read outputs */
-    for (i = 0; i < counts->num_outputs && p < end; ++i) {
+    for (i = 0; i < result->outputs_allocation_len && psbt_source_has_more(src); ++i) {
         size_t bytes_read;
 
-        ret = psbt_output_from_bytes(p, end - p, counts->output_counts[i], &bytes_read, &result->outputs[i]);
+        if ((ret = psbt_source_next_map(src, &p, &end)) != WALLY_OK) {
+            goto fail;
+        }
+        ret = psbt_output_from_bytes(p, end - p, &bytes_read, &result->outputs[i]);
+        result->num_outputs++; /* Count partial outputs so they are freed on failure */
         if (ret != WALLY_OK) {
             goto fail;
         }
-        p += bytes_read;
-        result->num_outputs++;
+        psbt_source_consume(src, bytes_read);
     }
 
     /* Make sure that the number of outputs matches the number ot outputs in the transaction */
@@ -1576,16 +1784,33 @@ int wally_psbt_from_bytes(
         goto fail;
     }
 
-    free_psbt_count(counts);
+    if (psbt_source_has_more(src)) {
+        ret = WALLY_EINVAL; /* Trailing data */
+        goto fail;
+    }
     return WALLY_OK;
 
 fail:
-    free_psbt_count(counts);
     wally_psbt_free(result);
     *output = NULL;
     return ret;
 }
 
+int wally_psbt_from_bytes(
+    const unsigned char *bytes,
+    size_t bytes_len,
+    struct wally_psbt **output)
+{
+    struct psbt_source src;
+
+    TX_CHECK_OUTPUT;
+
+    memset(&src, 0, sizeof(src));
+    src.p = bytes;
+    src.end = bytes + bytes_len;
+    return psbt_from_source(&src, output);
+}
+
 static int psbt_input_get_length(
     const struct wally_psbt_input *input,
     size_t *len)
@@ -1757,26 +1982,24 @@ static int psbt_output_get_length(
     return WALLY_OK;
 }
 
-int wally_psbt_get_length(
+/* Get the length of the magic and global map, and of the unsigned tx */
+static int psbt_get_global_length(
     const struct wally_psbt *psbt,
-    size_t *len)
+    size_t *len,
+    size_t *tx_len)
 {
     int ret;
-    size_t out, tx_len, i;
-    if (!len) {
-        return WALLY_EINVAL;
-    }
+    size_t out, i;
 
-    *len = 0;
     out = 5; /* Start with 5 byte magic */
 
     /* Global tx */
     out += 2;
-    ret = wally_tx_get_length(psbt->tx, 0, &tx_len);
+    ret = wally_tx_get_length(psbt->tx, 0, tx_len);
     if (ret != WALLY_OK) {
         return ret;
     }
-    out += varbuff_get_length(tx_len);
+    out += varbuff_get_length(*tx_len);
 
     /* Global unknowns */
     if (psbt->unknowns) {
@@ -1790,6 +2013,25 @@ int wally_psbt_get_length(
     /* Separator */
     out += 1;
 
+    *len = out;
+    return WALLY_OK;
+}
+
+int wally_psbt_get_length(
+    const struct wally_psbt *psbt,
+    size_t *len)
+{
+    int ret;
+    size_t out, tx_len, i;
+    if (!len) {
+        return WALLY_EINVAL;
+    }
+
+    *len = 0;
+    if ((ret = psbt_get_global_length(psbt, &out, &tx_len)) != WALLY_OK) {
+        return ret;
+    }
+
     /* Get lengths of each input and output */
     for (i = 0; i < psbt->num_inputs; ++i) {
         struct wally_psbt_input *input = &psbt->inputs[i];
@@ -2122,41 +2364,58 @@ int wally_psbt_to_bytes(
     return WALLY_OK;
 }
 
+/* Base64 encode len bytes stored at offset within buf to the start of buf.
+ * The input must start at least one output group (4 bytes) per input group
+ * past the start of buf, so that each group's output is written after its
+ * input has been read and never overwrites input that is yet to be read */
+static void psbt_base64_encode_in_place(char *buf, size_t offset, size_t len)
+{
+    const char *map = base64_maps_rfc4648.encode_map;
+    const unsigned char *p = (const unsigned char *)buf + offset;
+    char *out = buf;
+    uint32_t v;
+
+    for (; len >= 3; p += 3, len -= 3, out += 4) {
+        v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        out[0] = map[v >> 18];
+        out[1] = map[(v >> 12) & 0x3f];
+        out[2] = map[(v >> 6) & 0x3f];
+        out[3] = map[v & 0x3f];
+    }
+    if (len) {
+        v = ((uint32_t)p[0] << 16) | (len == 2 ? (uint32_t)p[1] << 8 : 0);
+        out[0] = map[v >> 18];
+        out[1] = map[(v >> 12) & 0x3f];
+        out[2] = len == 2 ? map[(v >> 6) & 0x3f] : '=';
+        out[3] = '=';
+        out += 4;
+    }
+    *out = '\0';
+}
+
 int wally_psbt_from_base64(
     const char *string,
     struct wally_psbt **output)
 {
-    char *decoded;
-    size_t safe_len, string_len;
-    ssize_t decoded_len;
+    unsigned char chunk[PSBT_B64_CHUNK_LEN / 4 * 3];
+    struct psbt_source src;
     int ret;
 
+    TX_CHECK_OUTPUT;
+
     if (!string) {
         return WALLY_EINVAL;
     }
 
-    string_len = strlen(string);
-    /* Allocate the decoded buffer */
-    safe_len = base64_decoded_length(string_len);
-    if ((decoded = wally_malloc(safe_len)) == NULL) {
-        ret = WALLY_ENOMEM;
-        goto done;
-    }
-
-    /* Decode the base64 psbt */
-    decoded_len = base64_decode(decoded, safe_len, string, string_len);
-    if (decoded_len <= 5) { /* Make sure we also have enough bytes for the magic */
-        ret = WALLY_EINVAL;
-        goto done;
-    }
-
-    /* Now decode the psbt */
-    ret = wally_psbt_from_bytes((unsigned char *)decoded, decoded_len, output);
+    /* Decode and parse one map at a time */
+    memset(&src, 0, sizeof(src));
+    src.b64 = (const unsigned char *)string;
+    src.b64_len = strlen(string);
+    src.chunk = chunk;
+    ret = psbt_from_source(&src, output);
 
-done:
-    if (decoded) {
-        wally_free(decoded);
-    }
+    clear_and_free(src.map, src.map_allocation_len);
+    wally_bzero(chunk, sizeof(chunk));
     return ret;
 }
 
@@ -2164,11 +2423,9 @@ int wally_psbt_to_base64(
     struct wally_psbt *psbt,
     char **output)
 {
-    unsigned char *buff;
-    char *result = NULL;
-    size_t len, written, b64_safe_len;
-    ssize_t b64_len;
-    int ret = WALLY_OK;
+    char *result;
+    size_t len, written, b64_len, offset;
+    int ret;
 
     if (!output || !psbt) {
         return WALLY_EINVAL;
@@ -2177,36 +2434,21 @@ int wally_psbt_to_base64(
     if ((ret = wally_psbt_get_length(psbt, &len)) != WALLY_OK) {
         return ret;
     }
-    if ((buff = wally_malloc(len)) == NULL) {
-        return WALLY_ENOMEM;
-    }
-
-    /* Get psbt bytes */
-    if ((ret = wally_psbt_to_bytes(psbt, buff, len, &written)) != WALLY_OK) {
-        goto done;
-    }
 
-    /* Base64 encode */
-    b64_safe_len = base64_encoded_length(written) + 1; /* + 1 for null termination */
-    if ((result = wally_malloc(b64_safe_len)) == NULL) {
-        ret = WALLY_ENOMEM;
-        goto done;
+    /* Serialize into the tail of the result and encode it in place, so no
+     * intermediate copy of the serialized PSBT is needed */
+    b64_len = base64_encoded_length(len) + 1; /* + 1 for null termination */
+    if ((result = wally_malloc(b64_len)) == NULL) {
+        return WALLY_ENOMEM;
     }
-    if ((b64_len = base64_encode(result, b64_safe_len, (char *)buff, written)) <= 0) {
-        ret = WALLY_EINVAL;
-        goto done;
+    offset = b64_len - len;
+    if ((ret = wally_psbt_to_bytes(psbt, (unsigned char *)result + offset, len, &written)) != WALLY_OK) {
+        clear_and_free(result, b64_len);
+        return ret;
     }
+    psbt_base64_encode_in_place(result, offset, written);
     *output = result;
-    result = NULL;
-
-done:
-    if (result) {
-        clear_and_free(result, b64_safe_len);
-    }
-    if (buff) {
-        clear_and_free(buff, len);
-    }
-    return ret;
+    return WALLY_OK;
 }
 
 static int get_txid(
@@ -2240,29 +2482,24 @@ static int merge_unknowns_into(
     struct wally_unknowns_map *dst,
     const struct wally_unknowns_map *src)
 {
-    int ret = WALLY_OK;
-    size_t i, j;
+    struct map_index index;
+    size_t i, *slot;
+    int ret;
 
     if (!src || !dst) {
         return WALLY_EINVAL;
     }
 
-    for (i = 0; i < src->num_items; ++i) {
-        bool found = false;
-        for (j = 0; j < dst->num_items; ++j) {
-            if (src->items[i].key_len == dst->items[j].key_len &&
-                memcmp((char *)dst->items[j].key, (char *)src->items[i].key, src->items[i].key_len) == 0) {
-                found = true;
-                break;
-            }
-        }
-        if (found) {
-            continue;
-        }
-        if ((ret = add_unknowns_item(dst, &src->items[i])) != WALLY_OK) {
-            return ret;
+    if ((ret = map_index_build(&index, dst->items, dst->num_items, src->num_items, unknowns_item_key)) != WALLY_OK) {
+        return ret;
+    }
+    for (i = 0; i < src->num_items && ret == WALLY_OK; ++i) {
+        slot = map_index_lookup(&index, dst->items, unknowns_item_key, src->items[i].key, src->items[i].key_len);
+        if (!*slot && (ret = add_unknowns_item(dst, &src->items[i])) == WALLY_OK) {
+            *slot = dst->num_items;
         }
     }
+    map_index_free(&index);
     return ret;
 }
 
@@ -2270,28 +2507,49 @@ static int merge_keypaths_into(
     struct wally_keypath_map *dst,
     const struct wally_keypath_map *src)
 {
-    int ret = WALLY_OK;
-    size_t i, j;
+    struct map_index index;
+    size_t i, *slot;
+    int ret;
 
     if (!src || !dst) {
         return WALLY_EINVAL;
     }
 
-    for (i = 0; i < src->num_items; ++i) {
-        bool found = false;
-        for (j = 0; j < dst->num_items; ++j) {
-            if (memcmp((char *)dst->items[j].pubkey, (char *)src->items[i].pubkey, 65) == 0) {
-                found = true;
-                break;
-            }
-        }
-        if (found) {
-            continue;
+    if ((ret = map_index_build(&index, dst->items, dst->num_items, src->num_items, keypath_item_key)) != WALLY_OK) {
+        return ret;
+    }
+    for (i = 0; i < src->num_items && ret == WALLY_OK; ++i) {
+        slot = map_index_lookup(&index, dst->items, keypath_item_key, src->items[i].pubkey, EC_PUBLIC_KEY_UNCOMPRESSED_LEN);
+        if (!*slot && (ret = add_keypath_item(dst, &src->items[i])) == WALLY_OK) {
+            *slot = dst->num_items;
         }
-        if ((ret = add_keypath_item(dst, &src->items[i])) != WALLY_OK) {
-            return ret;
+    }
+    map_index_free(&index);
+    return ret;
+}
+
+static int merge_partial_sigs_into(
+    struct wally_partial_sigs_map *dst,
+    const struct wally_partial_sigs_map *src)
+{
+    struct map_index index;
+    size_t i, *slot;
+    int ret;
+
+    if (!src || !dst) {
+        return WALLY_EINVAL;
+    }
+
+    if ((ret = map_index_build(&index, dst->items, dst->num_items, src->num_items, partial_sig_item_key)) != WALLY_OK) {
+        return ret;
+    }
+    for (i = 0; i < src->num_items && ret == WALLY_OK; ++i) {
+        slot = map_index_lookup(&index, dst->items, partial_sig_item_key, src->items[i].pubkey, EC_PUBLIC_KEY_UNCOMPRESSED_LEN);
+        if (!*slot && (ret = add_partial_sig_item(dst, &src->items[i])) == WALLY_OK) {
+            *slot = dst->num_items;
         }
     }
+    map_index_free(&index);
     return ret;
 }
 
@@ -2300,7 +2558,6 @@ static int merge_input_into(
     const struct wally_psbt_input *src)
 {
     int ret = WALLY_OK;
-    size_t i, j;
 
     if (!dst->non_witness_utxo && src->non_witness_utxo && (ret = clone_tx(src->non_witness_utxo, &dst->non_witness_utxo)) != WALLY_OK) {
         return ret;
@@ -2316,20 +2573,8 @@ static int merge_input_into(
             }
         }
 
-        for (i = 0; i < src->partial_sigs->num_items; ++i) {
-            bool found = false;
-            for (j = 0; j < dst->partial_sigs->num_items; ++j) {
-                if (memcmp((char *)dst->partial_sigs->items[j].pubkey, (char *)src->partial_sigs->items[i].pubkey, 65) == 0) {
-                    found = true;
-                    break;
-                }
-            }
-            if (found) {
-                continue;
-            }
-            if ((ret = add_partial_sig_item(dst->partial_sigs, &src->partial_sigs->items[i])) != WALLY_OK) {
-                return ret;
-            }
+        if ((ret = merge_partial_sigs_into(dst->partial_sigs, src->partial_sigs)) != WALLY_OK) {
+            return ret;
         }
     }
 
@@ -2515,432 +2760,2387 @@ fail:
     return ret;
 }
 
-int wally_sign_psbt(
-    struct wally_psbt *psbt,
-    const unsigned char *key,
-    size_t key_len)
+/* Return true if two transactions have the same txid, i.e. the same
+ * non-witness serialization, without serializing or hashing them */
+static bool tx_is_same_unsigned(const struct wally_tx *a, const struct wally_tx *b)
 {
-    unsigned char pubkey[EC_PUBLIC_KEY_LEN], uncomp_pubkey[EC_PUBLIC_KEY_UNCOMPRESSED_LEN], sig[EC_SIGNATURE_LEN], der_sig[EC_SIGNATURE_DER_MAX_LEN + 1];
-    size_t i, j, der_sig_len;
+    size_t i;
+
+    if (a->version != b->version || a->locktime != b->locktime ||
+        a->num_inputs != b->num_inputs || a->num_outputs != b->num_outputs) {
+        return false;
+    }
+    for (i = 0; i < a->num_inputs; ++i) {
+        const struct wally_tx_input *in_a = &a->inputs[i], *in_b = &b->inputs[i];
+        if (memcmp(in_a->txhash, in_b->txhash, WALLY_TXHASH_LEN) ||
+            in_a->index != in_b->index || in_a->sequence != in_b->sequence ||
+            in_a->script_len != in_b->script_len ||
+            (in_a->script_len && memcmp(in_a->script, in_b->script, in_a->script_len))) {
+            return false;
+        }
+    }
+    for (i = 0; i < a->num_outputs; ++i) {
+        const struct wally_tx_output *out_a = &a->outputs[i], *out_b = &b->outputs[i];
+        if (out_a->satoshi != out_b->satoshi || out_a->script_len != out_b->script_len ||
+            (out_a->script_len && memcmp(out_a->script, out_b->script, out_a->script_len))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Move the items of src whose keys are not in dst into dst, zeroing them
+ * in src. index covers the items of dst and must have room for the moved
+ * items */
+static int map_move_items(void **dst_items, size_t *dst_num_items, size_t *dst_allocation_len,
+                          void *src_items, size_t src_num_items, size_t item_size,
+                          struct map_index *index, map_key_fn key_fn)
+{
+    unsigned char *src = src_items;
+    const unsigned char *key;
+    size_t i, key_len, *slot;
     int ret;
 
-    if (!psbt || !psbt->tx || !key || key_len != EC_PRIVATE_KEY_LEN) {
-        return WALLY_EINVAL;
+    for (i = 0; i < src_num_items; ++i) {
+        key_fn(src_items, i, &key, &key_len);
+        slot = map_index_lookup(index, *dst_items, key_fn, key, key_len);
+        if (*slot) {
+            continue; /* Duplicate, left to be freed with src */
+        }
+        if ((ret = array_grow(dst_items, *dst_num_items, dst_allocation_len, item_size)) != WALLY_OK) {
+            return ret;
+        }
+        memcpy((unsigned char *)*dst_items + *dst_num_items * item_size, src + i * item_size, item_size);
+        wally_bzero(src + i * item_size, item_size);
+        *slot = ++*dst_num_items;
     }
+    return WALLY_OK;
+}
+
+/* Move the keypaths of all srcs (which may be NULL) into *dst, indexing
+ * *dst once for all of them. If reserved is given, *dst must already have
+ * room for them and reserved is used as the index, so this cannot fail */
+static int move_keypaths_into(struct wally_keypath_map **dst, void **srcs, size_t num_srcs,
+                              const struct map_index *reserved)
+{
+    struct wally_keypath_map *src;
+    struct map_index index;
+    size_t i, total = 0;
+    int ret;
 
-    /* Get the pubkey */
-    if ((ret = wally_ec_public_key_from_private_key(key, key_len, pubkey, EC_PUBLIC_KEY_LEN)) != WALLY_OK) {
+    for (i = 0; i < num_srcs; ++i) {
+        if ((src = srcs[i])) {
+            total += src->num_items;
+        }
+    }
+    if (!total) {
+        return WALLY_OK;
+    }
+    if (!*dst && (ret = wally_keypath_map_init_alloc(total, dst)) != WALLY_OK) {
         return ret;
     }
-    if ((ret = wally_ec_public_key_decompress(pubkey, EC_PUBLIC_KEY_LEN, uncomp_pubkey, EC_PUBLIC_KEY_UNCOMPRESSED_LEN)) != WALLY_OK) {
+    if ((ret = map_index_build_into(&index, reserved, (*dst)->items, (*dst)->num_items,
+                                    total, keypath_item_key)) != WALLY_OK) {
         return ret;
     }
+    for (i = 0; i < num_srcs && ret == WALLY_OK; ++i) {
+        if ((src = srcs[i])) {
+            ret = map_move_items((void **)&(*dst)->items, &(*dst)->num_items, &(*dst)->items_allocation_len,
+                                 src->items, src->num_items, sizeof(*src->items), &index, keypath_item_key);
+        }
+    }
+    if (!reserved) {
+        map_index_free(&index);
+    }
+    return ret;
+}
 
-    /* Go through each of the inputs */
-    for (i = 0; i < psbt->num_inputs; ++i) {
-        struct wally_psbt_input *input = &psbt->inputs[i];
-        struct wally_tx_input *txin = &psbt->tx->inputs[i];
-        unsigned char sighash[SHA256_LEN], *scriptcode, wpkh_sc[WALLY_SCRIPTPUBKEY_P2PKH_LEN];
-        size_t scriptcode_len;
-        bool match = false, comp = false;
-        uint32_t sighash_type = WALLY_SIGHASH_ALL;
+static int move_partial_sigs_into(struct wally_partial_sigs_map **dst, void **srcs, size_t num_srcs,
+                                  const struct map_index *reserved)
+{
+    struct wally_partial_sigs_map *src;
+    struct map_index index;
+    size_t i, total = 0;
+    int ret;
 
-        if (!input->keypaths) {
-            /* Can't do anything without the keypaths */
-            continue;
+    for (i = 0; i < num_srcs; ++i) {
+        if ((src = srcs[i])) {
+            total += src->num_items;
         }
-
-        /* Go through each listed pubkey and see if it matches. */
-        for (j = 0; j < input->keypaths->num_items; ++j) {
-            struct wally_keypath_item *item = &input->keypaths->items[j];
-            if (item->pubkey[0] == 0x04 && memcmp((char *)item->pubkey, (char *)uncomp_pubkey, EC_PUBLIC_KEY_UNCOMPRESSED_LEN) == 0) {
-                match = true;
-                break;
-            } else if (memcmp((char *)item->pubkey, (char *)pubkey, EC_PUBLIC_KEY_LEN) == 0) {
-                match = true;
-                comp = true;
-                break;
-            }
+    }
+    if (!total) {
+        return WALLY_OK;
+    }
+    if (!*dst && (ret = wally_partial_sigs_map_init_alloc(total, dst)) != WALLY_OK) {
+        return ret;
+    }
+    if ((ret = map_index_build_into(&index, reserved, (*dst)->items, (*dst)->num_items,
+                                    total, partial_sig_item_key)) != WALLY_OK) {
+        return ret;
+    }
+    for (i = 0; i < num_srcs && ret == WALLY_OK; ++i) {
+        if ((src = srcs[i])) {
+            ret = map_move_items((void **)&(*dst)->items, &(*dst)->num_items, &(*dst)->items_allocation_len,
+                                 src->items, src->num_items, sizeof(*src->items), &index, partial_sig_item_key);
         }
+    }
+    if (!reserved) {
+        map_index_free(&index);
+    }
+    return ret;
+}
 
-        /* Did not find pubkey, skip */
-        if (!match) {
-            continue;
-        }
+static int move_unknowns_into(struct wally_unknowns_map **dst, void **srcs, size_t num_srcs,
+                              const struct map_index *reserved)
+{
+    struct wally_unknowns_map *src;
+    struct map_index index;
+    size_t i, total = 0;
+    int ret;
 
-        /* Sighash type */
-        if (input->sighash_type > 0) {
-            sighash_type = input->sighash_type;
+    for (i = 0; i < num_srcs; ++i) {
+        if ((src = srcs[i])) {
+            total += src->num_items;
+        }
+    }
+    if (!total) {
+        return WALLY_OK;
+    }
+    if (!*dst && (ret = wally_unknowns_map_init_alloc(total, dst)) != WALLY_OK) {
+        return ret;
+    }
+    if ((ret = map_index_build_into(&index, reserved, (*dst)->items, (*dst)->num_items,
+                                    total, unknowns_item_key)) != WALLY_OK) {
+        return ret;
+    }
+    for (i = 0; i < num_srcs && ret == WALLY_OK; ++i) {
+        if ((src = srcs[i])) {
+            ret = map_move_items((void **)&(*dst)->items, &(*dst)->num_items, &(*dst)->items_allocation_len,
+                                 src->items, src->num_items, sizeof(*src->items), &index, unknowns_item_key);
         }
+    }
+    if (!reserved) {
+        map_index_free(&index);
+    }
+    return ret;
+}
 
-        /* Get scriptcode and sighash */
-        if (input->redeem_script) {
-            unsigned char sh[WALLY_SCRIPTPUBKEY_P2SH_LEN];
-            size_t written;
+/* Move the non-map fields that dst is missing out of src */
+static void move_input_fields_into(struct wally_psbt_input *dst, struct wally_psbt_input *src)
+{
+    if (!dst->non_witness_utxo) {
+        dst->non_witness_utxo = src->non_witness_utxo;
+        src->non_witness_utxo = NULL;
+    }
+    if (!dst->witness_utxo) {
+        dst->witness_utxo = src->witness_utxo;
+        src->witness_utxo = NULL;
+    }
+    if (dst->redeem_script_len == 0 && src->redeem_script_len > 0) {
+        wally_free(dst->redeem_script);
+        dst->redeem_script = src->redeem_script;
+        dst->redeem_script_len = src->redeem_script_len;
+        src->redeem_script = NULL;
+        src->redeem_script_len = 0;
+    }
+    if (dst->witness_script_len == 0 && src->witness_script_len > 0) {
+        wally_free(dst->witness_script);
+        dst->witness_script = src->witness_script;
+        dst->witness_script_len = src->witness_script_len;
+        src->witness_script = NULL;
+        src->witness_script_len = 0;
+    }
+    if (dst->final_script_sig_len == 0 && src->final_script_sig_len > 0) {
+        wally_free(dst->final_script_sig);
+        dst->final_script_sig = src->final_script_sig;
+        dst->final_script_sig_len = src->final_script_sig_len;
+        src->final_script_sig = NULL;
+        src->final_script_sig_len = 0;
+    }
+    if (!dst->final_witness) {
+        dst->final_witness = src->final_witness;
+        src->final_witness = NULL;
+    }
+    if (src->sighash_type > dst->sighash_type) {
+        dst->sighash_type = src->sighash_type;
+    }
+}
 
-            if ((ret = wally_scriptpubkey_p2sh_from_bytes(input->redeem_script, input->redeem_script_len, WALLY_SCRIPT_HASH160, sh, WALLY_SCRIPTPUBKEY_P2SH_LEN, &written)) != WALLY_OK) {
-                return ret;
-            }
-            if (input->non_witness_utxo) {
-                if (input->non_witness_utxo->outputs[txin->index].script_len != WALLY_SCRIPTPUBKEY_P2SH_LEN ||
-                    memcmp(sh, input->non_witness_utxo->outputs[txin->index].script, WALLY_SCRIPTPUBKEY_P2SH_LEN) != 0) {
-                    return WALLY_EINVAL;
-                }
-            } else if (input->witness_utxo) {
-                if (input->witness_utxo->script_len != WALLY_SCRIPTPUBKEY_P2SH_LEN ||
-                    memcmp(sh, input->witness_utxo->script, WALLY_SCRIPTPUBKEY_P2SH_LEN) != 0) {
-                    return WALLY_EINVAL;
-                }
-            } else {
-                continue;
-            }
-            scriptcode = input->redeem_script;
-            scriptcode_len = input->redeem_script_len;
-        } else {
-            if (input->non_witness_utxo) {
-                scriptcode = input->non_witness_utxo->outputs[txin->index].script;
-                scriptcode_len = input->non_witness_utxo->outputs[txin->index].script_len;
-            } else if (input->witness_utxo) {
-                scriptcode = input->witness_utxo->script;
-                scriptcode_len = input->witness_utxo->script_len;
-            } else {
-                continue;
-            }
-        }
+static void move_output_fields_into(struct wally_psbt_output *dst, struct wally_psbt_output *src)
+{
+    if (dst->redeem_script_len == 0 && src->redeem_script_len > 0) {
+        wally_free(dst->redeem_script);
+        dst->redeem_script = src->redeem_script;
+        dst->redeem_script_len = src->redeem_script_len;
+        src->redeem_script = NULL;
+        src->redeem_script_len = 0;
+    }
+    if (dst->witness_script_len == 0 && src->witness_script_len > 0) {
+        wally_free(dst->witness_script);
+        dst->witness_script = src->witness_script;
+        dst->witness_script_len = src->witness_script_len;
+        src->witness_script = NULL;
+        src->witness_script_len = 0;
+    }
+}
 
-        if (input->non_witness_utxo) {
-            unsigned char txid[SHA256_LEN];
+int wally_combine_psbts_consume(
+    struct wally_psbt **psbts,
+    size_t psbts_len,
+    struct wally_psbt **output)
+{
+    struct wally_psbt *result;
+    void **srcs = NULL;
+    const size_t num_srcs = psbts_len ? psbts_len - 1 : 0;
+    size_t i, j;
+    int ret = WALLY_OK;
 
-            if ((ret = get_txid(input->non_witness_utxo, txid, SHA256_LEN)) != WALLY_OK) {
-                return ret;
-            }
-            if (memcmp((char *)txid, (char *)txin->txhash, SHA256_LEN) != 0) {
+    TX_CHECK_OUTPUT;
+
+    if (!psbts || !psbts_len) {
+        return WALLY_EINVAL;
+    }
+    result = psbts[0];
+
+    /* Check every PSBT has the same unsigned tx before moving anything */
+    for (i = 0; i < psbts_len; ++i) {
+        if (!psbts[i] || !psbts[i]->tx || !result->tx ||
+            psbts[i]->num_inputs != result->tx->num_inputs ||
+            psbts[i]->num_outputs != result->tx->num_outputs ||
+            (i && !tx_is_same_unsigned(result->tx, psbts[i]->tx))) {
+            return WALLY_EINVAL;
+        }
+        /* A PSBT passed twice would be moved into itself and double freed */
+        for (j = 0; j < i; ++j) {
+            if (psbts[j] == psbts[i]) {
                 return WALLY_EINVAL;
             }
+        }
+    }
 
-            if ((ret = wally_tx_get_btc_signature_hash(psbt->tx, i, scriptcode, scriptcode_len, 0, sighash_type, 0, sighash, SHA256_LEN)) != WALLY_OK) {
-                return ret;
-            }
-        } else if (input->witness_utxo) {
-            size_t type;
-            if ((ret = wally_scriptpubkey_get_type(scriptcode, scriptcode_len, &type)) != WALLY_OK) {
-                return ret;
-            }
-            if (type == WALLY_SCRIPT_TYPE_P2WPKH) {
-                size_t written;
-                if ((ret = wally_scriptpubkey_p2pkh_from_bytes(&scriptcode[2], HASH160_LEN, 0, wpkh_sc, WALLY_SCRIPTPUBKEY_P2PKH_LEN, &written)) != WALLY_OK) {
-                    return ret;
-                }
-                scriptcode = wpkh_sc;
-                scriptcode_len = WALLY_SCRIPTPUBKEY_P2PKH_LEN;
-            } else if (type == WALLY_SCRIPT_TYPE_P2WSH && input->witness_script) {
-                unsigned char wsh[WALLY_SCRIPTPUBKEY_P2WSH_LEN];
-                size_t written;
+    /* Each map of the result is combined with the same map of every other
+     * PSBT in one pass, so it is only indexed once */
+    if (num_srcs && !(srcs = wally_malloc(num_srcs * sizeof(*srcs)))) {
+        return WALLY_ENOMEM;
+    }
 
-                if ((ret = wally_witness_program_from_bytes(input->witness_script, input->witness_script_len, WALLY_SCRIPT_SHA256, wsh, WALLY_SCRIPTPUBKEY_P2WSH_LEN, &written)) != WALLY_OK) {
-                    return ret;
-                }
-                if (scriptcode_len != WALLY_SCRIPTPUBKEY_P2WSH_LEN ||
-                    memcmp((char *)wsh, (char *)scriptcode, WALLY_SCRIPTPUBKEY_P2WSH_LEN) != 0) {
-                    return WALLY_EINVAL;
-                }
-                scriptcode = input->witness_script;
-                scriptcode_len = input->witness_script_len;
-            } else {
-                /* Not a recognized scriptPubKey type or not enough information */
-                continue;
-            }
+    for (j = 0; j < result->num_inputs && ret == WALLY_OK; ++j) {
+        struct wally_psbt_input *dst = &result->inputs[j];
 
-            if ((ret = wally_tx_get_btc_signature_hash(psbt->tx, i, scriptcode, scriptcode_len, input->witness_utxo->satoshi, sighash_type, WALLY_TX_FLAG_USE_WITNESS, sighash, SHA256_LEN)) != WALLY_OK) {
-                return ret;
-            }
+        for (i = 0; i < num_srcs; ++i) {
+            move_input_fields_into(dst, &psbts[i + 1]->inputs[j]);
+            srcs[i] = psbts[i + 1]->inputs[j].keypaths;
         }
-
-        /* Sign the sighash */
-        if ((ret = wally_ec_sig_from_bytes(key, key_len, sighash, SHA256_LEN, EC_FLAG_ECDSA | EC_FLAG_GRIND_R, sig, EC_SIGNATURE_LEN)) != WALLY_OK) {
-            return ret;
+        if ((ret = move_keypaths_into(&dst->keypaths, srcs, num_srcs, NULL)) != WALLY_OK) {
+            break;
         }
-        if ((ret = wally_ec_sig_normalize(sig, EC_SIGNATURE_LEN, sig, EC_SIGNATURE_LEN)) != WALLY_OK) {
-            return ret;
+        for (i = 0; i < num_srcs; ++i) {
+            srcs[i] = psbts[i + 1]->inputs[j].partial_sigs;
         }
-        if ((ret = wally_ec_sig_to_der(sig, EC_SIGNATURE_LEN, der_sig, EC_SIGNATURE_DER_MAX_LEN, &der_sig_len)) != WALLY_OK) {
-            return ret;
+        if ((ret = move_partial_sigs_into(&dst->partial_sigs, srcs, num_srcs, NULL)) != WALLY_OK) {
+            break;
         }
+        for (i = 0; i < num_srcs; ++i) {
+            srcs[i] = psbts[i + 1]->inputs[j].unknowns;
+        }
+        ret = move_unknowns_into(&dst->unknowns, srcs, num_srcs, NULL);
+    }
 
-        /* Add the sighash type to the end of the sig */
-        der_sig[der_sig_len] = (unsigned char)sighash_type;
-        der_sig_len++;
+    for (j = 0; j < result->num_outputs && ret == WALLY_OK; ++j) {
+        struct wally_psbt_output *dst = &result->outputs[j];
 
-        /* Copy the DER sig into the psbt */
-        if (!input->partial_sigs) {
-            if ((ret = wally_partial_sigs_map_init_alloc(1, &input->partial_sigs)) != WALLY_OK) {
-                return ret;
-            }
+        for (i = 0; i < num_srcs; ++i) {
+            move_output_fields_into(dst, &psbts[i + 1]->outputs[j]);
+            srcs[i] = psbts[i + 1]->outputs[j].keypaths;
         }
-        if ((ret = wally_add_new_partial_sig(input->partial_sigs, comp ? pubkey : uncomp_pubkey, comp ? EC_PUBLIC_KEY_LEN : EC_PUBLIC_KEY_UNCOMPRESSED_LEN, der_sig, der_sig_len)) != WALLY_OK) {
-            return ret;
+        if ((ret = move_keypaths_into(&dst->keypaths, srcs, num_srcs, NULL)) != WALLY_OK) {
+            break;
         }
+        for (i = 0; i < num_srcs; ++i) {
+            srcs[i] = psbts[i + 1]->outputs[j].unknowns;
+        }
+        ret = move_unknowns_into(&dst->unknowns, srcs, num_srcs, NULL);
     }
 
-    return WALLY_OK;
+    if (ret == WALLY_OK) {
+        for (i = 0; i < num_srcs; ++i) {
+            srcs[i] = psbts[i + 1]->unknowns;
+        }
+        ret = move_unknowns_into(&result->unknowns, srcs, num_srcs, NULL);
+    }
+
+    wally_free(srcs);
+    if (ret == WALLY_OK) {
+        for (i = 1; i < psbts_len; ++i) {
+            wally_psbt_free(psbts[i]);
+            psbts[i] = NULL;
+        }
+        psbts[0] = NULL;
+        *output = result;
+    }
+    return ret;
 }
 
-int wally_finalize_psbt(struct wally_psbt *psbt)
+/* Compute the signature hash for an input. Sets *found to false if the
+ * input does not have enough information to be signed */
+static int get_input_signature_hash(
+    const struct wally_psbt *psbt,
+    size_t i,
+    uint32_t sighash_type,
+    unsigned char *sighash,
+    bool *found)
 {
-    size_t i;
+    const struct wally_psbt_input *input = &psbt->inputs[i];
+    const struct wally_tx_input *txin = &psbt->tx->inputs[i];
+    unsigned char *scriptcode, wpkh_sc[WALLY_SCRIPTPUBKEY_P2PKH_LEN];
+    size_t scriptcode_len;
     int ret;
 
-    if (!psbt) {
-        return WALLY_EINVAL;
+    *found = false;
+
+    if (input->non_witness_utxo && txin->index >= input->non_witness_utxo->num_outputs) {
+        return WALLY_EINVAL; /* The UTXO tx doesn't have the spent output */
     }
 
-    for (i = 0; i < psbt->num_inputs; ++i) {
-        struct wally_psbt_input *input = &psbt->inputs[i];
-        struct wally_tx_input *txin = &psbt->tx->inputs[i];
-        unsigned char *out_script; /* Script that determines how we should finalize this input, typically output script */
-        size_t out_script_len, type;
-        bool witness = false, p2sh = false;;
+    /* Get scriptcode and sighash */
+    if (input->redeem_script) {
+        unsigned char sh[WALLY_SCRIPTPUBKEY_P2SH_LEN];
+        size_t written;
 
-        if (input->final_script_sig || input->final_witness) {
-            /* Already finalized */
-            continue;
+        if ((ret = wally_scriptpubkey_p2sh_from_bytes(input->redeem_script, input->redeem_script_len, WALLY_SCRIPT_HASH160, sh, WALLY_SCRIPTPUBKEY_P2SH_LEN, &written)) != WALLY_OK) {
+            return ret;
         }
-
-        if (input->redeem_script) {
-            out_script = input->redeem_script;
-            out_script_len = input->redeem_script_len;
-            p2sh = true;
+        if (input->non_witness_utxo) {
+            if (input->non_witness_utxo->outputs[txin->index].script_len != WALLY_SCRIPTPUBKEY_P2SH_LEN ||
+                memcmp(sh, input->non_witness_utxo->outputs[txin->index].script, WALLY_SCRIPTPUBKEY_P2SH_LEN) != 0) {
+                return WALLY_EINVAL;
+            }
+        } else if (input->witness_utxo) {
+            if (input->witness_utxo->script_len != WALLY_SCRIPTPUBKEY_P2SH_LEN ||
+                memcmp(sh, input->witness_utxo->script, WALLY_SCRIPTPUBKEY_P2SH_LEN) != 0) {
+                return WALLY_EINVAL;
+            }
         } else {
-            out_script = psbt->tx->outputs[txin->index].script;
-            out_script_len = psbt->tx->outputs[txin->index].script_len;
+            return WALLY_OK; /* Not enough information to sign */
         }
-        if (input->witness_script) {
-            out_script = input->witness_script;
-            out_script_len = input->witness_script_len;
-            witness = true;
+        scriptcode = input->redeem_script;
+        scriptcode_len = input->redeem_script_len;
+    } else {
+        if (input->non_witness_utxo) {
+            scriptcode = input->non_witness_utxo->outputs[txin->index].script;
+            scriptcode_len = input->non_witness_utxo->outputs[txin->index].script_len;
+        } else if (input->witness_utxo) {
+            scriptcode = input->witness_utxo->script;
+            scriptcode_len = input->witness_utxo->script_len;
+        } else {
+            return WALLY_OK; /* Not enough information to sign */
         }
+    }
+
+    if (input->non_witness_utxo) {
+        unsigned char txid[SHA256_LEN];
 
-        if ((ret = wally_scriptpubkey_get_type(out_script, out_script_len, &type)) != WALLY_OK) {
+        if ((ret = get_txid(input->non_witness_utxo, txid, SHA256_LEN)) != WALLY_OK) {
             return ret;
         }
+        if (memcmp((char *)txid, (char *)txin->txhash, SHA256_LEN) != 0) {
+            return WALLY_EINVAL;
+        }
 
-        switch(type) {
-        case WALLY_SCRIPT_TYPE_P2PKH:
-        case WALLY_SCRIPT_TYPE_P2WPKH: {
-            struct wally_partial_sigs_item *partial_sig;
-            unsigned char script_sig[WALLY_SCRIPTSIG_P2PKH_MAX_LEN];
-            size_t script_sig_len, pubkey_len = EC_PUBLIC_KEY_UNCOMPRESSED_LEN;
+        if ((ret = wally_tx_get_btc_signature_hash(psbt->tx, i, scriptcode, scriptcode_len, 0, sighash_type, 0, sighash, SHA256_LEN)) != WALLY_OK) {
+            return ret;
+        }
+    } else if (input->witness_utxo) {
+        size_t type;
+        if ((ret = wally_scriptpubkey_get_type(scriptcode, scriptcode_len, &type)) != WALLY_OK) {
+            return ret;
+        }
+        if (type == WALLY_SCRIPT_TYPE_P2WPKH) {
+            size_t written;
+            if ((ret = wally_scriptpubkey_p2pkh_from_bytes(&scriptcode[2], HASH160_LEN, 0, wpkh_sc, WALLY_SCRIPTPUBKEY_P2PKH_LEN, &written)) != WALLY_OK) {
+                return ret;
+            }
+            scriptcode = wpkh_sc;
+            scriptcode_len = WALLY_SCRIPTPUBKEY_P2PKH_LEN;
+        } else if (type == WALLY_SCRIPT_TYPE_P2WSH && input->witness_script) {
+            unsigned char wsh[WALLY_SCRIPTPUBKEY_P2WSH_LEN];
+            size_t written;
 
-            if (!input->partial_sigs || input->partial_sigs->num_items != 1) {
-                /* Must be single key, single sig */
-                continue;
+            if ((ret = wally_witness_program_from_bytes(input->witness_script, input->witness_script_len, WALLY_SCRIPT_SHA256, wsh, WALLY_SCRIPTPUBKEY_P2WSH_LEN, &written)) != WALLY_OK) {
+                return ret;
             }
-            partial_sig = &input->partial_sigs->items[0];
-            if (pubkey_is_compressed(partial_sig->pubkey)) {
-                pubkey_len = EC_PUBLIC_KEY_LEN;
+            if (scriptcode_len != WALLY_SCRIPTPUBKEY_P2WSH_LEN ||
+                memcmp((char *)wsh, (char *)scriptcode, WALLY_SCRIPTPUBKEY_P2WSH_LEN) != 0) {
+                return WALLY_EINVAL;
             }
+            scriptcode = input->witness_script;
+            scriptcode_len = input->witness_script_len;
+        } else {
+            /* Not a recognized scriptPubKey type or not enough information */
+            return WALLY_OK;
+        }
 
-            if (type == WALLY_SCRIPT_TYPE_P2PKH) {
-                if ((ret = wally_scriptsig_p2pkh_from_der(partial_sig->pubkey, pubkey_len, partial_sig->sig, partial_sig->sig_len, script_sig, WALLY_SCRIPTSIG_P2PKH_MAX_LEN, &script_sig_len)) != WALLY_OK) {
-                    return ret;
-                }
-                if (!clone_bytes(&input->final_script_sig, script_sig, script_sig_len)) {
-                    return WALLY_ENOMEM;
-                }
-            } else {
-                if ((ret = wally_witness_p2wpkh_from_der(partial_sig->pubkey, pubkey_len, partial_sig->sig, partial_sig->sig_len, &input->final_witness)) != WALLY_OK) {
-                    return ret;
-                }
-            }
-            break;
+        if ((ret = wally_tx_get_btc_signature_hash(psbt->tx, i, scriptcode, scriptcode_len, input->witness_utxo->satoshi, sighash_type, WALLY_TX_FLAG_USE_WITNESS, sighash, SHA256_LEN)) != WALLY_OK) {
+            return ret;
         }
-        case WALLY_SCRIPT_TYPE_MULTISIG: {
-            unsigned char *script_sig, *sigs, *p = out_script, *end = p + out_script_len;
-            uint32_t *sighashes;
-            size_t n_sigs, n_pks, sig_i = 0, j, k, sigs_len, script_sig_len, written;
+    }
 
-            if (!script_is_op_n(out_script[0], false, &n_sigs)) {
-                /* How did this happen? */
-                return WALLY_ERROR;
-            }
+    *found = true;
+    return WALLY_OK;
+}
 
-            if (!input->partial_sigs || input->partial_sigs->num_items < n_sigs) {
-                continue;
-            }
+/* Sign an input's signature hash and add the signature to its partial sigs */
+static int add_input_signature(
+    struct wally_psbt_input *input,
+    const unsigned char *key,
+    const unsigned char *pubkey,
+    const unsigned char *sighash,
+    uint32_t sighash_type)
+{
+    unsigned char sig[EC_SIGNATURE_LEN], der_sig[EC_SIGNATURE_DER_MAX_LEN + 1];
+    size_t der_sig_len;
+    int ret;
 
-            if (!script_is_op_n(out_script[out_script_len - 2], false, &n_pks)) {
-                /* How did this happen? */
-                return WALLY_ERROR;
-            }
+    if ((ret = wally_ec_sig_from_bytes(key, EC_PRIVATE_KEY_LEN, sighash, SHA256_LEN, EC_FLAG_ECDSA | EC_FLAG_GRIND_R, sig, EC_SIGNATURE_LEN)) != WALLY_OK) {
+        return ret;
+    }
+    if ((ret = wally_ec_sig_normalize(sig, EC_SIGNATURE_LEN, sig, EC_SIGNATURE_LEN)) != WALLY_OK) {
+        return ret;
+    }
+    if ((ret = wally_ec_sig_to_der(sig, EC_SIGNATURE_LEN, der_sig, EC_SIGNATURE_DER_MAX_LEN, &der_sig_len)) != WALLY_OK) {
+        return ret;
+    }
 
-            sigs_len = EC_SIGNATURE_LEN * n_sigs;
-            if (!(sigs = wally_malloc(sigs_len)) || !(sighashes = wally_malloc(n_sigs * sizeof(uint32_t)))) {
-                return WALLY_ENOMEM;
-            }
+    /* Add the sighash type to the end of the sig */
+    der_sig[der_sig_len] = (unsigned char)sighash_type;
+    der_sig_len++;
 
-            /* Go through the multisig script and figure out the order of pubkeys */
-            p++; /* Skip the n_sig item */
-            for (j = 0; j < n_pks && p < end; ++j) {
-                size_t push_size, push_opcode_size, sig_len;
-                unsigned char *pubkey, *sig, compact_sig[EC_SIGNATURE_LEN];
-                bool found = false;
+    /* Copy the DER sig into the psbt */
+    if (!input->partial_sigs) {
+        if ((ret = wally_partial_sigs_map_init_alloc(1, &input->partial_sigs)) != WALLY_OK) {
+            return ret;
+        }
+    }
+    return wally_add_new_partial_sig(input->partial_sigs, (unsigned char *)pubkey,
+                                     pubkey_is_compressed(pubkey) ? EC_PUBLIC_KEY_LEN : EC_PUBLIC_KEY_UNCOMPRESSED_LEN,
+                                     der_sig, der_sig_len);
+}
 
-                if ((ret = script_get_push_size_from_bytes(p, end - p, &push_size)) != WALLY_OK) {
-                    wally_free(sigs);
-                    wally_free(sighashes);
-                    return ret;
-                }
-                if ((ret = script_get_push_opcode_size_from_bytes(p, end - p, &push_opcode_size)) != WALLY_OK) {
-                    wally_free(sigs);
-                    wally_free(sighashes);
-                    return ret;
-                }
-                p += push_opcode_size;
+/* A public key of one of the keys being signed with, in the same zero
+ * padded form as keypath pubkeys */
+struct signing_pubkey {
+    unsigned char pubkey[EC_PUBLIC_KEY_UNCOMPRESSED_LEN];
+    size_t key_index;
+};
 
-                pubkey = p;
-                p += push_size;
+static void signing_pubkey_key(const void *items, size_t i,
+                               const unsigned char **key, size_t *key_len)
+{
+    *key = ((const struct signing_pubkey *)items)[i].pubkey;
+    *key_len = EC_PUBLIC_KEY_UNCOMPRESSED_LEN;
+}
 
-                for (k = 0; k < input->partial_sigs->num_items; ++k) {
-                    if (memcmp(input->partial_sigs->items[k].pubkey, pubkey, push_size) == 0) {
-                        found = true;
-                        break;
-                    }
-                }
+int wally_sign_psbt_keys(
+    struct wally_psbt *psbt,
+    const unsigned char *keys,
+    size_t keys_len)
+{
+    const size_t num_keys = keys_len / EC_PRIVATE_KEY_LEN;
+    struct signing_pubkey *pubkeys = NULL;
+    struct map_index index = { NULL, 0 };
+    size_t i, j, *signed_at = NULL;
+    int ret = WALLY_OK;
 
-                if (!found) {
-                    continue;
-                }
+    if (!psbt || !psbt->tx || !keys || !keys_len || keys_len % EC_PRIVATE_KEY_LEN) {
+        return WALLY_EINVAL;
+    }
+    if (num_keys > SIZE_MAX / 2 / sizeof(*pubkeys)) {
+        return WALLY_ENOMEM;
+    }
 
-                /* Get the signature and sighash separately */
-                sig = input->partial_sigs->items[k].sig;
-                sig_len = input->partial_sigs->items[k].sig_len; /* Has sighash byte at end */
-                if ((ret = wally_ec_sig_from_der(sig, sig_len - 1, compact_sig, EC_SIGNATURE_LEN)) != WALLY_OK) {
-                    wally_free(sigs);
-                    wally_free(sighashes);
-                    return ret;
-                }
-                memcpy(sigs + sig_i * EC_SIGNATURE_LEN, compact_sig, EC_SIGNATURE_LEN);
-                sighashes[sig_i] = (uint32_t)sig[sig_len - 1];
-                sig_i++;
-            }
+    pubkeys = wally_malloc(num_keys * 2 * sizeof(*pubkeys));
+    signed_at = wally_malloc(num_keys * sizeof(*signed_at));
+    if (!pubkeys || !signed_at) {
+        ret = WALLY_ENOMEM;
+        goto cleanup;
+    }
+    wally_bzero(pubkeys, num_keys * 2 * sizeof(*pubkeys));
+    wally_bzero(signed_at, num_keys * sizeof(*signed_at));
 
-            if (witness) {
-                if ((ret = wally_witness_multisig_from_bytes(out_script, out_script_len, sigs, sigs_len, sighashes, n_sigs, 0, &input->final_witness)) != WALLY_OK) {
-                    wally_free(sigs);
-                    wally_free(sighashes);
-                    return ret;
-                }
-            } else {
-                script_sig_len = n_sigs * (EC_SIGNATURE_DER_MAX_LEN + 2) + out_script_len;
-                if (!(script_sig = wally_malloc(script_sig_len))) {
-                    wally_free(sigs);
-                    wally_free(sighashes);
-                    return WALLY_ENOMEM;
-                }
+    /* Index both the compressed and uncompressed pubkey of each key */
+    for (i = 0; i < num_keys; ++i) {
+        struct signing_pubkey *comp = &pubkeys[i * 2], *uncomp = comp + 1;
 
-                if ((ret = wally_scriptsig_multisig_from_bytes(out_script, out_script_len, sigs, sigs_len, sighashes, n_sigs, 0, script_sig, script_sig_len, &written)) != WALLY_OK) {
-                    wally_free(sigs);
-                    wally_free(sighashes);
-                    wally_free(script_sig);
-                    return ret;
-                }
-                input->final_script_sig = script_sig;
-                input->final_script_sig_len = written;
-            }
+        if ((ret = wally_ec_public_key_from_private_key(keys + i * EC_PRIVATE_KEY_LEN, EC_PRIVATE_KEY_LEN,
+                                                        comp->pubkey, EC_PUBLIC_KEY_LEN)) != WALLY_OK ||
+            (ret = wally_ec_public_key_decompress(comp->pubkey, EC_PUBLIC_KEY_LEN,
+                                                  uncomp->pubkey, EC_PUBLIC_KEY_UNCOMPRESSED_LEN)) != WALLY_OK) {
+            goto cleanup;
+        }
+        comp->key_index = uncomp->key_index = i;
+    }
+    if ((ret = map_index_build(&index, pubkeys, num_keys * 2, 0, signing_pubkey_key)) != WALLY_OK) {
+        goto cleanup;
+    }
 
-            wally_free(sigs);
-            wally_free(sighashes);
+    /* Go through each of the inputs, computing its sighash at most once */
+    for (i = 0; i < psbt->num_inputs && ret == WALLY_OK; ++i) {
+        struct wally_psbt_input *input = &psbt->inputs[i];
+        unsigned char sighash[SHA256_LEN];
+        uint32_t sighash_type = input->sighash_type > 0 ? input->sighash_type : WALLY_SIGHASH_ALL;
+        bool have_sighash = false;
 
-            if (witness && p2sh) {
-                /* P2SH wrapped witness requires final scriptsig of pushing the redeemScript */
-                script_sig_len = varint_get_length(input->redeem_script_len) + input->redeem_script_len;
-                input->final_script_sig = wally_malloc(script_sig_len);
-                if ((ret = wally_script_push_from_bytes(input->redeem_script, input->redeem_script_len, 0, input->final_script_sig, script_sig_len, &written)) != WALLY_OK) {
-                    wally_free(input->final_script_sig);
-                    return ret;
+        if (!input->keypaths) {
+            /* Can't do anything without the keypaths */
+            continue;
+        }
+
+        for (j = 0; j < input->keypaths->num_items && ret == WALLY_OK; ++j) {
+            const struct signing_pubkey *match;
+            const size_t *slot = map_index_lookup(&index, pubkeys, signing_pubkey_key,
+                                                  input->keypaths->items[j].pubkey,
+                                                  EC_PUBLIC_KEY_UNCOMPRESSED_LEN);
+            if (!*slot) {
+                continue; /* Not one of our keys */
+            }
+            match = &pubkeys[*slot - 1];
+            if (signed_at[match->key_index] == i + 1) {
+                continue; /* Already signed this input with this key */
+            }
+            if (!have_sighash) {
+                if ((ret = get_input_signature_hash(psbt, i, sighash_type, sighash, &have_sighash)) != WALLY_OK ||
+                    !have_sighash) {
+                    break;
                 }
-                input->final_script_sig_len = written;
             }
+            ret = add_input_signature(input, keys + match->key_index * EC_PRIVATE_KEY_LEN,
+                                      match->pubkey, sighash, sighash_type);
+            signed_at[match->key_index] = i + 1;
+        }
+    }
 
-            break;
+cleanup:
+    map_index_free(&index);
+    wally_free(pubkeys);
+    wally_free(signed_at);
+    return ret;
+}
+
+/* Private keys derived from a BIP32 root along the most recently used
+ * path. Deriving a path that shares a prefix with it only derives the
+ * remaining steps */
+#define PSBT_PATH_CACHE_DEPTH 8
+
+struct path_cache {
+    const struct ext_key *root;
+    struct ext_key keys[PSBT_PATH_CACHE_DEPTH];
+    uint32_t path[PSBT_PATH_CACHE_DEPTH];
+    size_t depth;
+};
+
+/* Derive the private key for path from the cache root. Paths longer than
+ * the cache are finished in tmp */
+static int path_cache_derive(struct path_cache *cache,
+                             const uint32_t *path, size_t path_len,
+                             struct ext_key *tmp, const struct ext_key **key_out)
+{
+    const uint32_t flags = BIP32_FLAG_KEY_PRIVATE | BIP32_FLAG_SKIP_HASH;
+    const size_t depth = path_len < PSBT_PATH_CACHE_DEPTH ? path_len : PSBT_PATH_CACHE_DEPTH;
+    size_t i;
+    int ret;
+
+    /* Skip the part of the path that is already derived */
+    for (i = 0; i < depth && i < cache->depth && cache->path[i] == path[i]; ++i) {
+    }
+    cache->depth = i;
+    for (; i < depth; ++i) {
+        const struct ext_key *parent = i ? &cache->keys[i - 1] : cache->root;
+        if ((ret = bip32_key_from_parent(parent, path[i], flags, &cache->keys[i])) != WALLY_OK) {
+            return ret;
         }
-        default: {
-            /* Skip this because we can't finalize it */
+        cache->path[i] = path[i];
+        cache->depth = i + 1;
+    }
+
+    if (!path_len) {
+        *key_out = cache->root;
+    } else if (path_len == depth) {
+        *key_out = &cache->keys[depth - 1];
+    } else {
+        if ((ret = bip32_key_from_parent_path(&cache->keys[depth - 1], path + depth,
+                                              path_len - depth, flags, tmp)) != WALLY_OK) {
+            return ret;
+        }
+        *key_out = tmp;
+    }
+    return WALLY_OK;
+}
+
+/* Return true if a derived key is the key given in a keypath item */
+static bool derived_key_matches(const struct ext_key *derived,
+                                const struct wally_keypath_item *item)
+{
+    unsigned char uncomp_pubkey[EC_PUBLIC_KEY_UNCOMPRESSED_LEN];
+
+    if (pubkey_is_compressed(item->pubkey)) {
+        return !memcmp(derived->pub_key, item->pubkey, EC_PUBLIC_KEY_LEN);
+    }
+    return wally_ec_public_key_decompress(derived->pub_key, EC_PUBLIC_KEY_LEN,
+                                          uncomp_pubkey, sizeof(uncomp_pubkey)) == WALLY_OK &&
+           !memcmp(uncomp_pubkey, item->pubkey, EC_PUBLIC_KEY_UNCOMPRESSED_LEN);
+}
+
+/* Return true if an input has a signature from pubkey, under either its
+ * compressed or uncompressed form */
+static bool input_has_signature(const struct wally_psbt_input *input,
+                                const unsigned char *pubkey)
+{
+    unsigned char uncomp_pubkey[EC_PUBLIC_KEY_UNCOMPRESSED_LEN];
+    bool have_uncomp = false;
+    size_t i;
+
+    for (i = 0; input->partial_sigs && i < input->partial_sigs->num_items; ++i) {
+        const unsigned char *sig_pubkey = input->partial_sigs->items[i].pubkey;
+
+        if (pubkey_is_compressed(sig_pubkey)) {
+            if (!memcmp(sig_pubkey, pubkey, EC_PUBLIC_KEY_LEN)) {
+                return true;
+            }
             continue;
         }
+        if (!have_uncomp) {
+            if (wally_ec_public_key_decompress(pubkey, EC_PUBLIC_KEY_LEN,
+                                               uncomp_pubkey, sizeof(uncomp_pubkey)) != WALLY_OK) {
+                return false;
+            }
+            have_uncomp = true;
+        }
+        if (!memcmp(sig_pubkey, uncomp_pubkey, EC_PUBLIC_KEY_UNCOMPRESSED_LEN)) {
+            return true;
         }
-
-        /* Clear non-final things */
-        wally_free(input->redeem_script);
-        input->redeem_script_len = 0;
-        input->redeem_script = NULL;
-        wally_free(input->witness_script);
-        input->witness_script_len = 0;
-        input->witness_script = NULL;
-        wally_keypath_map_free(input->keypaths);
-        input->keypaths = NULL;
-        wally_partial_sigs_map_free(input->partial_sigs);
-        input->partial_sigs = NULL;
-        input->sighash_type = 0;
     }
-    return WALLY_OK;
+    return false;
 }
 
-int wally_extract_psbt(
+int wally_sign_psbt_bip32(
     struct wally_psbt *psbt,
-    struct wally_tx **output)
+    const struct ext_key *hdkey)
 {
-    struct wally_tx *result = NULL;
-    size_t i;
+    unsigned char hash160[HASH160_LEN];
+    struct path_cache cache;
+    struct ext_key tmp;
+    size_t i, j;
     int ret = WALLY_OK;
 
-    TX_CHECK_OUTPUT;
-
-    if (!psbt || !psbt->tx || psbt->num_inputs == 0 || psbt->num_outputs == 0) {
+    if (!psbt || !psbt->tx || !hdkey || hdkey->priv_key[0] != BIP32_FLAG_KEY_PRIVATE ||
+        hdkey->depth != 0) {
         return WALLY_EINVAL;
     }
 
-    clone_tx(psbt->tx, &result);
+    /* The root fingerprint is the first 4 bytes of its hash160 */
+    if ((ret = wally_hash160(hdkey->pub_key, EC_PUBLIC_KEY_LEN, hash160, sizeof(hash160))) != WALLY_OK) {
+        return ret;
+    }
+    cache.root = hdkey;
+    cache.depth = 0;
 
-    for (i = 0; i < psbt->num_inputs; ++i) {
+    for (i = 0; i < psbt->num_inputs && ret == WALLY_OK; ++i) {
         struct wally_psbt_input *input = &psbt->inputs[i];
-        struct wally_tx_input *vin = &result->inputs[i];
-        if (!input->final_script_sig && !input->final_witness) {
-            ret = WALLY_EINVAL;
-            goto fail;
+        unsigned char sighash[SHA256_LEN];
+        uint32_t sighash_type = input->sighash_type > 0 ? input->sighash_type : WALLY_SIGHASH_ALL;
+        bool have_sighash = false;
+
+        if (!input->keypaths) {
+            /* Can't do anything without the keypaths */
+            continue;
         }
 
-        if (input->final_script_sig) {
-            if (vin->script) {
-                /* Our global tx shouldn't have a scriptSig */
-                ret = WALLY_EINVAL;
-                goto fail;
+        for (j = 0; j < input->keypaths->num_items && ret == WALLY_OK; ++j) {
+            const struct wally_keypath_item *item = &input->keypaths->items[j];
+            const struct ext_key *derived;
+
+            if (memcmp(item->origin.fingerprint, hash160, FINGERPRINT_LEN)) {
+                continue; /* Not derived from our root */
             }
-            if (!clone_bytes(&vin->script, input->final_script_sig, input->final_script_sig_len)) {
-                ret = WALLY_ENOMEM;
-                goto fail;
+            if ((ret = path_cache_derive(&cache, item->origin.path, item->origin.path_len,
+                                         &tmp, &derived)) != WALLY_OK) {
+                break;
             }
-            vin->script_len = input->final_script_sig_len;
-        }
-        if (input->final_witness) {
-            if (vin->witness) {
-                /* Our global tx shouldn't have a witness */
-                ret = WALLY_EINVAL;
-                goto fail;
+            if (!derived_key_matches(derived, item)) {
+                continue; /* Fingerprint collision or bad keypath */
             }
-            if (!(vin->witness = clone_witness(input->final_witness))) {
-                ret = WALLY_ENOMEM;
-                goto fail;
+            if (input_has_signature(input, derived->pub_key)) {
+                continue; /* Already signed this input with this key */
+            }
+            if (!have_sighash) {
+                if ((ret = get_input_signature_hash(psbt, i, sighash_type, sighash, &have_sighash)) != WALLY_OK ||
+                    !have_sighash) {
+                    break;
+                }
             }
+            ret = add_input_signature(input, derived->priv_key + 1, item->pubkey, sighash, sighash_type);
         }
     }
 
-    *output = result;
+    wally_clear_2(&cache, sizeof(cache), &tmp, sizeof(tmp));
     return ret;
+}
 
-fail:
-    if (result) {
-        wally_tx_free(result);
+int wally_sign_psbt(
+    struct wally_psbt *psbt,
+    const unsigned char *key,
+    size_t key_len)
+{
+    if (!key || key_len != EC_PRIVATE_KEY_LEN) {
+        return WALLY_EINVAL;
+    }
+    return wally_sign_psbt_keys(psbt, key, key_len);
+}
+
+/* Finalize a multisig input, if it has enough signatures */
+static int finalize_multisig_input(
+    struct wally_psbt_input *input,
+    const unsigned char *out_script,
+    size_t out_script_len,
+    bool witness,
+    bool p2sh)
+{
+    const unsigned char *p = out_script, *end = p + out_script_len;
+    unsigned char *sigs = NULL, *script_sig;
+    uint32_t *sighashes = NULL;
+    size_t n_sigs, n_pks, sig_i = 0, j, k, sigs_len, script_sig_len, written;
+    int ret = WALLY_OK;
+
+    if (!script_is_op_n(out_script[0], false, &n_sigs)) {
+        /* How did this happen? */
+        return WALLY_ERROR;
+    }
+
+    if (!input->partial_sigs || input->partial_sigs->num_items < n_sigs) {
+        return WALLY_OK;
+    }
+
+    if (!script_is_op_n(out_script[out_script_len - 2], false, &n_pks)) {
+        /* How did this happen? */
+        return WALLY_ERROR;
+    }
+
+    sigs_len = EC_SIGNATURE_LEN * n_sigs;
+    if (!(sigs = wally_malloc(sigs_len)) || !(sighashes = wally_malloc(n_sigs * sizeof(uint32_t)))) {
+        ret = WALLY_ENOMEM;
+        goto done;
+    }
+
+    /* Go through the multisig script and figure out the order of pubkeys */
+    p++; /* Skip the n_sig item */
+    for (j = 0; j < n_pks && p < end && sig_i < n_sigs; ++j) {
+        size_t push_size, push_opcode_size, sig_len;
+        const unsigned char *pubkey;
+        unsigned char *sig;
+        bool found = false;
+
+        if ((ret = script_get_push_size_from_bytes(p, end - p, &push_size)) != WALLY_OK ||
+            (ret = script_get_push_opcode_size_from_bytes(p, end - p, &push_opcode_size)) != WALLY_OK) {
+            goto done;
+        }
+        p += push_opcode_size;
+
+        pubkey = p;
+        p += push_size;
+
+        for (k = 0; k < input->partial_sigs->num_items && push_size <= EC_PUBLIC_KEY_UNCOMPRESSED_LEN; ++k) {
+            if (memcmp(input->partial_sigs->items[k].pubkey, pubkey, push_size) == 0) {
+                found = true;
+                break;
+            }
+        }
+
+        if (!found) {
+            continue;
+        }
+
+        /* Get the signature and sighash separately */
+        sig = input->partial_sigs->items[k].sig;
+        sig_len = input->partial_sigs->items[k].sig_len; /* Has sighash byte at end */
+        if ((ret = wally_ec_sig_from_der(sig, sig_len - 1, sigs + sig_i * EC_SIGNATURE_LEN, EC_SIGNATURE_LEN)) != WALLY_OK) {
+            goto done;
+        }
+        sighashes[sig_i] = (uint32_t)sig[sig_len - 1];
+        sig_i++;
+    }
+
+    if (sig_i < n_sigs) {
+        /* Not enough of the signatures are for the script's pubkeys */
+        goto done;
+    }
+
+    if (witness) {
+        ret = wally_witness_multisig_from_bytes(out_script, out_script_len, sigs, sigs_len, sighashes, n_sigs, 0, &input->final_witness);
+    } else {
+        script_sig_len = n_sigs * (EC_SIGNATURE_DER_MAX_LEN + 2) + out_script_len;
+        if (!(script_sig = wally_malloc(script_sig_len))) {
+            ret = WALLY_ENOMEM;
+        } else if ((ret = wally_scriptsig_multisig_from_bytes(out_script, out_script_len, sigs, sigs_len, sighashes, n_sigs, 0, script_sig, script_sig_len, &written)) != WALLY_OK) {
+            wally_free(script_sig);
+        } else {
+            input->final_script_sig = script_sig;
+            input->final_script_sig_len = written;
+        }
+    }
+
+    if (ret == WALLY_OK && witness && p2sh) {
+        /* P2SH wrapped witness requires final scriptsig of pushing the redeemScript */
+        script_sig_len = varint_get_length(input->redeem_script_len) + input->redeem_script_len;
+        if (!(script_sig = wally_malloc(script_sig_len))) {
+            ret = WALLY_ENOMEM;
+        } else if ((ret = wally_script_push_from_bytes(input->redeem_script, input->redeem_script_len, 0, script_sig, script_sig_len, &written)) != WALLY_OK) {
+            wally_free(script_sig);
+        } else {
+            input->final_script_sig = script_sig;
+            input->final_script_sig_len = written;
+        }
     }
+
+done:
+    wally_free(sigs);
+    wally_free(sighashes);
     return ret;
 }
+
+/* Finalize an input, if it has enough information to be finalized.
+ * Only touches the input itself, so inputs can be finalized concurrently */
+static int finalize_input(
+    const struct wally_tx *tx,
+    size_t index,
+    struct wally_psbt_input *input)
+{
+    const struct wally_tx_input *txin = &tx->inputs[index];
+    const unsigned char *out_script = NULL; /* Script that determines how we should finalize this input, typically output script */
+    size_t out_script_len = 0, type;
+    bool witness = false, p2sh = false;
+    int ret;
+
+    if (input->final_script_sig || input->final_witness) {
+        /* Already finalized */
+        return WALLY_OK;
+    }
+
+    if (input->redeem_script) {
+        out_script = input->redeem_script;
+        out_script_len = input->redeem_script_len;
+        p2sh = true;
+    } else if (input->witness_utxo) {
+        out_script = input->witness_utxo->script;
+        out_script_len = input->witness_utxo->script_len;
+    } else if (input->non_witness_utxo) {
+        if (txin->index >= input->non_witness_utxo->num_outputs) {
+            return WALLY_EINVAL; /* The utxo doesn't have the spent output */
+        }
+        out_script = input->non_witness_utxo->outputs[txin->index].script;
+        out_script_len = input->non_witness_utxo->outputs[txin->index].script_len;
+    } else if (!input->witness_script) {
+        return WALLY_EINVAL; /* No script to finalize against */
+    }
+    if (input->witness_script) {
+        out_script = input->witness_script;
+        out_script_len = input->witness_script_len;
+        witness = true;
+    }
+
+    if ((ret = wally_scriptpubkey_get_type(out_script, out_script_len, &type)) != WALLY_OK) {
+        return ret;
+    }
+
+    switch(type) {
+    case WALLY_SCRIPT_TYPE_P2PKH:
+    case WALLY_SCRIPT_TYPE_P2WPKH: {
+        struct wally_partial_sigs_item *partial_sig;
+        unsigned char script_sig[WALLY_SCRIPTSIG_P2PKH_MAX_LEN];
+        size_t script_sig_len, pubkey_len = EC_PUBLIC_KEY_UNCOMPRESSED_LEN;
+
+        if (!input->partial_sigs || input->partial_sigs->num_items != 1) {
+            /* Must be single key, single sig */
+            return WALLY_OK;
+        }
+        partial_sig = &input->partial_sigs->items[0];
+        if (pubkey_is_compressed(partial_sig->pubkey)) {
+            pubkey_len = EC_PUBLIC_KEY_LEN;
+        }
+
+        if (type == WALLY_SCRIPT_TYPE_P2PKH) {
+            if ((ret = wally_scriptsig_p2pkh_from_der(partial_sig->pubkey, pubkey_len, partial_sig->sig, partial_sig->sig_len, script_sig, WALLY_SCRIPTSIG_P2PKH_MAX_LEN, &script_sig_len)) != WALLY_OK) {
+                return ret;
+            }
+            if (!clone_bytes(&input->final_script_sig, script_sig, script_sig_len)) {
+                return WALLY_ENOMEM;
+            }
+            input->final_script_sig_len = script_sig_len;
+        } else {
+            if ((ret = wally_witness_p2wpkh_from_der(partial_sig->pubkey, pubkey_len, partial_sig->sig, partial_sig->sig_len, &input->final_witness)) != WALLY_OK) {
+                return ret;
+            }
+        }
+        break;
+    }
+    case WALLY_SCRIPT_TYPE_MULTISIG: {
+        if ((ret = finalize_multisig_input(input, out_script, out_script_len, witness, p2sh)) != WALLY_OK) {
+            return ret;
+        }
+        break;
+    }
+    default: {
+        /* Skip this because we can't finalize it */
+        return WALLY_OK;
+    }
+    }
+
+    if (!input->final_script_sig && !input->final_witness) {
+        /* Not enough signatures to finalize */
+        return WALLY_OK;
+    }
+
+    /* Clear non-final things */
+    wally_free(input->redeem_script);
+    input->redeem_script_len = 0;
+    input->redeem_script = NULL;
+    wally_free(input->witness_script);
+    input->witness_script_len = 0;
+    input->witness_script = NULL;
+    wally_keypath_map_free(input->keypaths);
+    input->keypaths = NULL;
+    wally_partial_sigs_map_free(input->partial_sigs);
+    input->partial_sigs = NULL;
+    input->sighash_type = 0;
+    return WALLY_OK;
+}
+
+int wally_finalize_psbt(struct wally_psbt *psbt)
+{
+    size_t i;
+    int ret;
+
+    if (!psbt) {
+        return WALLY_EINVAL;
+    }
+
+    for (i = 0; i < psbt->num_inputs; ++i) {
+        if ((ret = finalize_input(psbt->tx, i, &psbt->inputs[i])) != WALLY_OK) {
+            return ret;
+        }
+    }
+    return WALLY_OK;
+}
+
+struct finalize_batch {
+    const struct wally_tx *tx;
+    struct wally_psbt_input *inputs;
+    int *rets;
+};
+
+static void finalize_batch_job(void *p, size_t begin, size_t end)
+{
+    const struct finalize_batch *batch = p;
+    size_t i;
+
+    for (i = begin; i < end; ++i) {
+        batch->rets[i] = finalize_input(batch->tx, i, &batch->inputs[i]);
+    }
+}
+
+int wally_finalize_and_extract_psbt(
+    struct wally_psbt *psbt,
+    uint32_t num_threads,
+    struct wally_tx **output)
+{
+    struct finalize_batch batch;
+    struct wally_tx *result = NULL;
+    size_t i;
+    int ret;
+
+    TX_CHECK_OUTPUT;
+
+    if (!psbt || !psbt->tx || psbt->num_inputs == 0 || psbt->num_outputs == 0 ||
+        psbt->num_inputs != psbt->tx->num_inputs) {
+        return WALLY_EINVAL;
+    }
+    for (i = 0; i < psbt->num_inputs; ++i) {
+        if (psbt->tx->inputs[i].script || psbt->tx->inputs[i].witness) {
+            /* Our global tx shouldn't have a scriptSig or witness */
+            return WALLY_EINVAL;
+        }
+    }
+
+    if (!(batch.rets = wally_malloc(psbt->num_inputs * sizeof(*batch.rets)))) {
+        return WALLY_ENOMEM;
+    }
+    batch.tx = psbt->tx;
+    batch.inputs = psbt->inputs;
+    ret = wally_run_parallel(finalize_batch_job, &batch, psbt->num_inputs, 16, num_threads);
+    for (i = 0; ret == WALLY_OK && i < psbt->num_inputs; ++i) {
+        if ((ret = batch.rets[i]) == WALLY_OK &&
+            !psbt->inputs[i].final_script_sig && !psbt->inputs[i].final_witness) {
+            ret = WALLY_EINVAL; /* Input could not be finalized */
+        }
+    }
+    wally_free(batch.rets);
+
+    if (ret == WALLY_OK && (ret = clone_tx(psbt->tx, &result)) == WALLY_OK) {
+        /* Move the final scriptSigs and witnesses into the extracted tx */
+        for (i = 0; i < psbt->num_inputs; ++i) {
+            struct wally_psbt_input *input = &psbt->inputs[i];
+            struct wally_tx_input *vin = &result->inputs[i];
+
+            vin->script = input->final_script_sig;
+            vin->script_len = input->final_script_sig_len;
+            vin->witness = input->final_witness;
+            input->final_script_sig = NULL;
+            input->final_script_sig_len = 0;
+            input->final_witness = NULL;
+        }
+        *output = result;
+    }
+    return ret;
+}
+
+int wally_extract_psbt(
+    struct wally_psbt *psbt,
+    struct wally_tx **output)
+{
+    struct wally_tx *result = NULL;
+    size_t i;
+    int ret = WALLY_OK;
+
+    TX_CHECK_OUTPUT;
+
+    if (!psbt || !psbt->tx || psbt->num_inputs == 0 || psbt->num_outputs == 0) {
+        return WALLY_EINVAL;
+    }
+
+    clone_tx(psbt->tx, &result);
+
+    for (i = 0; i < psbt->num_inputs; ++i) {
+        struct wally_psbt_input *input = &psbt->inputs[i];
+        struct wally_tx_input *vin = &result->inputs[i];
+        if (!input->final_script_sig && !input->final_witness) {
+            ret = WALLY_EINVAL;
+            goto fail;
+        }
+
+        if (input->final_script_sig) {
+            if (vin->script) {
+                /* Our global tx shouldn't have a scriptSig */
+                ret = WALLY_EINVAL;
+                goto fail;
+            }
+            if (!clone_bytes(&vin->script, input->final_script_sig, input->final_script_sig_len)) {
+                ret = WALLY_ENOMEM;
+                goto fail;
+            }
+            vin->script_len = input->final_script_sig_len;
+        }
+        if (input->final_witness) {
+            if (vin->witness) {
+                /* Our global tx shouldn't have a witness */
+                ret = WALLY_EINVAL;
+                goto fail;
+            }
+            if (!(vin->witness = clone_witness(input->final_witness))) {
+                ret = WALLY_ENOMEM;
+                goto fail;
+            }
+        }
+    }
+
+    *output = result;
+    return ret;
+
+fail:
+    if (result) {
+        wally_tx_free(result);
+    }
+    return ret;
+}
+
+/* A read-only view of a serialized PSBT. Holds pointers into the caller's
+ * bytes for the unsigned tx inputs and outputs and the start of each input
+ * and output map, so lookups by index do not need to rescan the PSBT */
+struct wally_psbt_view {
+    const unsigned char *bytes;
+    size_t bytes_len;
+    size_t num_inputs;
+    size_t num_outputs;
+    const unsigned char **tx_inputs;
+    const unsigned char **tx_outputs;
+    const unsigned char **inputs;
+    const unsigned char **outputs;
+};
+
+/* Read a key-value pair from a map. Sets *at_end if the map separator was
+ * read instead */
+static bool view_read_item(const unsigned char **p, const unsigned char *end,
+                           uint32_t *type, struct wally_psbt_view_item *item,
+                           bool *at_end)
+{
+    const unsigned char *key;
+    size_t key_len;
+
+    if (!psbt_read_varbuff(p, end, &key, &key_len)) {
+        return false;
+    }
+    if ((*at_end = key_len == 0)) {
+        return true;
+    }
+    *type = key[0];
+    item->key = key + 1;
+    item->key_len = key_len - 1;
+    return psbt_read_varbuff(p, end, &item->value, &item->value_len);
+}
+
+/* Validate a serialized tx that must fill len bytes exactly. Stores
+ * pointers to the start of each input and output if inputs/outputs are
+ * given. An unsigned tx must have empty scriptSigs and no witnesses */
+static bool view_walk_tx(const unsigned char *tx, size_t len, bool is_unsigned,
+                         size_t *num_inputs, size_t *num_outputs,
+                         const unsigned char **inputs, const unsigned char **outputs)
+{
+    const unsigned char *p = tx + sizeof(uint32_t), *end = tx + len;
+    uint64_t v, num_items;
+    size_t i, j;
+    bool witness;
+
+    /* analyze_tx bounds checks everything except trailing data */
+    if (analyze_tx(tx, len, 0, num_inputs, num_outputs, &witness) != WALLY_OK ||
+        (witness && is_unsigned)) {
+        return false;
+    }
+    if (witness) {
+        p += 2; /* Marker and flag */
+    }
+    p += varint_length_from_bytes(p);
+    for (i = 0; i < *num_inputs; ++i) {
+        if (inputs) {
+            inputs[i] = p;
+        }
+        p += WALLY_TXHASH_LEN + sizeof(uint32_t);
+        p += varint_from_bytes(p, &v);
+        if (v && is_unsigned) {
+            return false; /* Unsigned tx needs empty scriptSigs */
+        }
+        p += v + sizeof(uint32_t);
+    }
+    p += varint_length_from_bytes(p);
+    for (i = 0; i < *num_outputs; ++i) {
+        if (outputs) {
+            outputs[i] = p;
+        }
+        p += sizeof(uint64_t);
+        p += varint_from_bytes(p, &v);
+        p += v;
+    }
+    if (witness) {
+        for (i = 0; i < *num_inputs; ++i) {
+            p += varint_from_bytes(p, &num_items);
+            for (j = 0; j < num_items; ++j) {
+                p += varint_from_bytes(p, &v);
+                p += v;
+            }
+        }
+    }
+    return p + sizeof(uint32_t) == end;
+}
+
+/* Read the amount and script of a serialized tx output */
+static void view_read_tx_output(const unsigned char *p, uint64_t *satoshi,
+                                const unsigned char **script, size_t *script_len)
+{
+    uint64_t v;
+
+    p += uint64_from_le_bytes(p, satoshi);
+    p += varint_from_bytes(p, &v);
+    *script = p;
+    *script_len = v;
+}
+
+/* Validate a serialized witness stack that must fill len bytes exactly */
+static bool view_check_witness(const unsigned char *p, size_t len)
+{
+    const unsigned char *end = p + len, *item;
+    uint64_t num_items, i;
+    size_t item_len;
+
+    if (!psbt_read_varint(&p, end, &num_items)) {
+        return false;
+    }
+    for (i = 0; i < num_items; ++i) {
+        if (!psbt_read_varbuff(&p, end, &item, &item_len)) {
+            return false;
+        }
+    }
+    return p == end;
+}
+
+/* Validate an input or output map, leaving *p after its separator */
+static bool view_check_map(const unsigned char **p, const unsigned char *end, bool is_input)
+{
+    struct wally_psbt_view_item item;
+    const unsigned char *p_script, *script;
+    size_t num_inputs, num_outputs, script_len;
+    uint32_t type, seen = 0;
+    bool at_end, singleton;
+
+    for (;;) {
+        if (!view_read_item(p, end, &type, &item, &at_end)) {
+            return false;
+        }
+        if (at_end) {
+            return true;
+        }
+
+        singleton = true;
+        if (type == (is_input ? WALLY_PSBT_IN_BIP32_DERIVATION : WALLY_PSBT_OUT_BIP32_DERIVATION)) {
+            if ((item.key_len != EC_PUBLIC_KEY_LEN && item.key_len != EC_PUBLIC_KEY_UNCOMPRESSED_LEN) ||
+                !item.value_len || item.value_len % sizeof(uint32_t)) {
+                return false;
+            }
+            singleton = false;
+        } else if (!is_input) {
+            singleton = type == WALLY_PSBT_OUT_REDEEM_SCRIPT || type == WALLY_PSBT_OUT_WITNESS_SCRIPT;
+        } else {
+            switch (type) {
+            case WALLY_PSBT_IN_PARTIAL_SIG:
+                if (item.key_len != EC_PUBLIC_KEY_LEN && item.key_len != EC_PUBLIC_KEY_UNCOMPRESSED_LEN) {
+                    return false;
+                }
+                singleton = false;
+                break;
+            case WALLY_PSBT_IN_NON_WITNESS_UTXO:
+                if (!view_walk_tx(item.value, item.value_len, false, &num_inputs, &num_outputs, NULL, NULL)) {
+                    return false;
+                }
+                break;
+            case WALLY_PSBT_IN_WITNESS_UTXO:
+                p_script = item.value + sizeof(uint64_t);
+                if (item.value_len < sizeof(uint64_t) ||
+                    !psbt_read_varbuff(&p_script, item.value + item.value_len, &script, &script_len) ||
+                    p_script != item.value + item.value_len) {
+                    return false;
+                }
+                break;
+            case WALLY_PSBT_IN_SIGHASH_TYPE:
+                if (item.value_len != sizeof(uint32_t)) {
+                    return false;
+                }
+                break;
+            case WALLY_PSBT_IN_FINAL_SCRIPTWITNESS:
+                if (!view_check_witness(item.value, item.value_len)) {
+                    return false;
+                }
+                break;
+            case WALLY_PSBT_IN_REDEEM_SCRIPT:
+            case WALLY_PSBT_IN_WITNESS_SCRIPT:
+            case WALLY_PSBT_IN_FINAL_SCRIPTSIG:
+                break;
+            default:
+                singleton = false; /* Unknown */
+                break;
+            }
+        }
+
+        if (singleton) {
+            if (item.key_len || (seen & (1u << type))) {
+                return false; /* Unexpected key data or duplicate */
+            }
+            seen |= 1u << type;
+        }
+    }
+}
+
+int wally_psbt_view_init_alloc(
+    const unsigned char *bytes,
+    size_t bytes_len,
+    struct wally_psbt_view **output)
+{
+    const unsigned char *p = bytes, *end = bytes + bytes_len, *tx = NULL;
+    struct wally_psbt_view_item item;
+    struct wally_psbt_view *result;
+    size_t num_inputs, num_outputs, tx_len = 0, i;
+    uint32_t type;
+    bool at_end;
+
+    TX_CHECK_OUTPUT;
+
+    if (!bytes || bytes_len <= sizeof(WALLY_PSBT_MAGIC) ||
+        memcmp(bytes, WALLY_PSBT_MAGIC, sizeof(WALLY_PSBT_MAGIC))) {
+        return WALLY_EINVAL;
+    }
+    p += sizeof(WALLY_PSBT_MAGIC);
+
+    /* Find the unsigned tx in the global map */
+    for (;;) {
+        if (!view_read_item(&p, end, &type, &item, &at_end)) {
+            return WALLY_EINVAL;
+        }
+        if (at_end) {
+            break;
+        }
+        if (type == WALLY_PSBT_GLOBAL_UNSIGNED_TX) {
+            if (tx || item.key_len) {
+                return WALLY_EINVAL; /* Duplicate tx or unexpected key data */
+            }
+            tx = item.value;
+            tx_len = item.value_len;
+        }
+    }
+    if (!tx || !view_walk_tx(tx, tx_len, true, &num_inputs, &num_outputs, NULL, NULL)) {
+        return WALLY_EINVAL;
+    }
+
+    /* The view and its pointers are allocated together */
+    if (num_inputs + num_outputs > (SIZE_MAX - sizeof(*result)) / (2 * sizeof(unsigned char *))) {
+        return WALLY_ENOMEM;
+    }
+    *output = wally_malloc(sizeof(*result) + (num_inputs + num_outputs) * 2 * sizeof(unsigned char *));
+    if (!*output) {
+        return WALLY_ENOMEM;
+    }
+    result = *output;
+    result->bytes = bytes;
+    result->bytes_len = bytes_len;
+    result->num_inputs = num_inputs;
+    result->num_outputs = num_outputs;
+    result->tx_inputs = (const unsigned char **)(result + 1);
+    result->tx_outputs = result->tx_inputs + num_inputs;
+    result->inputs = result->tx_outputs + num_outputs;
+    result->outputs = result->inputs + num_inputs;
+    view_walk_tx(tx, tx_len, true, &num_inputs, &num_outputs,
+                 result->tx_inputs, result->tx_outputs);
+
+    for (i = 0; i < num_inputs; ++i) {
+        result->inputs[i] = p;
+        if (!view_check_map(&p, end, true)) {
+            goto fail;
+        }
+    }
+    for (i = 0; i < num_outputs; ++i) {
+        result->outputs[i] = p;
+        if (!view_check_map(&p, end, false)) {
+            goto fail;
+        }
+    }
+    if (p != end) {
+        goto fail; /* Trailing data */
+    }
+    return WALLY_OK;
+
+fail:
+    wally_free(result);
+    *output = NULL;
+    return WALLY_EINVAL;
+}
+
+int wally_psbt_view_free(struct wally_psbt_view *view)
+{
+    wally_free(view); /* Holds no copies of PSBT data */
+    return WALLY_OK;
+}
+
+int wally_psbt_view_get_num_inputs(const struct wally_psbt_view *view, size_t *written)
+{
+    if (written) {
+        *written = 0;
+    }
+    if (!view || !written) {
+        return WALLY_EINVAL;
+    }
+    *written = view->num_inputs;
+    return WALLY_OK;
+}
+
+int wally_psbt_view_get_num_outputs(const struct wally_psbt_view *view, size_t *written)
+{
+    if (written) {
+        *written = 0;
+    }
+    if (!view || !written) {
+        return WALLY_EINVAL;
+    }
+    *written = view->num_outputs;
+    return WALLY_OK;
+}
+
+int wally_psbt_view_get_tx_output(
+    const struct wally_psbt_view *view,
+    size_t index,
+    uint64_t *satoshi,
+    const unsigned char **script,
+    size_t *script_len)
+{
+    if (!view || index >= view->num_outputs || !satoshi || !script || !script_len) {
+        return WALLY_EINVAL;
+    }
+    view_read_tx_output(view->tx_outputs[index], satoshi, script, script_len);
+    return WALLY_OK;
+}
+
+/* Find the n'th item of a given type in a validated map, or count the items
+ * of that type if item is NULL */
+static bool view_find_item(const unsigned char *p, const unsigned char *end,
+                           uint32_t type, size_t n,
+                           struct wally_psbt_view_item *item, size_t *count)
+{
+    struct wally_psbt_view_item tmp;
+    uint32_t item_type;
+    bool at_end;
+
+    *count = 0;
+    while (view_read_item(&p, end, &item_type, &tmp, &at_end) && !at_end) {
+        if (item_type == type) {
+            if (item && *count == n) {
+                *item = tmp;
+                return true;
+            }
+            ++*count;
+        }
+    }
+    return false;
+}
+
+static int view_get_map_item(const struct wally_psbt_view *view, bool is_input,
+                             size_t index, uint32_t type, size_t n,
+                             struct wally_psbt_view_item *item, size_t *count)
+{
+    const unsigned char *const *maps = is_input ? view->inputs : view->outputs;
+    const size_t num_maps = is_input ? view->num_inputs : view->num_outputs;
+    size_t tmp_count;
+
+    if (index >= num_maps || type > 0xff) {
+        return WALLY_EINVAL;
+    }
+    if (!view_find_item(maps[index], view->bytes + view->bytes_len, type, n,
+                        item, count ? count : &tmp_count) && item) {
+        return WALLY_EINVAL; /* No such item */
+    }
+    return WALLY_OK;
+}
+
+int wally_psbt_view_get_input_num_items(
+    const struct wally_psbt_view *view,
+    size_t index,
+    uint32_t type,
+    size_t *written)
+{
+    if (written) {
+        *written = 0;
+    }
+    if (!view || !written) {
+        return WALLY_EINVAL;
+    }
+    return view_get_map_item(view, true, index, type, 0, NULL, written);
+}
+
+int wally_psbt_view_get_input_item(
+    const struct wally_psbt_view *view,
+    size_t index,
+    uint32_t type,
+    size_t item_index,
+    struct wally_psbt_view_item *output)
+{
+    if (!view || !output) {
+        return WALLY_EINVAL;
+    }
+    return view_get_map_item(view, true, index, type, item_index, output, NULL);
+}
+
+int wally_psbt_view_get_output_num_items(
+    const struct wally_psbt_view *view,
+    size_t index,
+    uint32_t type,
+    size_t *written)
+{
+    if (written) {
+        *written = 0;
+    }
+    if (!view || !written) {
+        return WALLY_EINVAL;
+    }
+    return view_get_map_item(view, false, index, type, 0, NULL, written);
+}
+
+int wally_psbt_view_get_output_item(
+    const struct wally_psbt_view *view,
+    size_t index,
+    uint32_t type,
+    size_t item_index,
+    struct wally_psbt_view_item *output)
+{
+    if (!view || !output) {
+        return WALLY_EINVAL;
+    }
+    return view_get_map_item(view, false, index, type, item_index, output, NULL);
+}
+
+/* Find output vout of a validated serialized tx and compute its txid
+ * without copying it, by hashing around any witness marker and witnesses */
+static bool view_get_prevout(const unsigned char *tx, size_t tx_len, uint32_t vout,
+                             const unsigned char **output, unsigned char *txid)
+{
+    const bool witness = tx[sizeof(uint32_t)] == 0;
+    const unsigned char *body = tx + sizeof(uint32_t) + (witness ? 2 : 0), *p = body;
+    struct sha256_ctx ctx;
+    struct sha256 sha;
+    uint64_t num_inputs, num_outputs, v, i;
+
+    p += varint_from_bytes(p, &num_inputs);
+    for (i = 0; i < num_inputs; ++i) {
+        p += WALLY_TXHASH_LEN + sizeof(uint32_t);
+        p += varint_from_bytes(p, &v);
+        p += v + sizeof(uint32_t);
+    }
+    p += varint_from_bytes(p, &num_outputs);
+    if (vout >= num_outputs) {
+        return false;
+    }
+    for (i = 0; i < num_outputs; ++i) {
+        if (i == vout) {
+            *output = p;
+        }
+        p += sizeof(uint64_t);
+        p += varint_from_bytes(p, &v);
+        p += v;
+    }
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, tx, sizeof(uint32_t));
+    sha256_update(&ctx, body, p - body);
+    sha256_update(&ctx, tx + tx_len - sizeof(uint32_t), sizeof(uint32_t));
+    sha256_done(&ctx, &sha);
+    sha256(&sha, &sha, sizeof(sha));
+    memcpy(txid, &sha, sizeof(sha));
+    return true;
+}
+
+int wally_psbt_view_get_input_utxo(
+    const struct wally_psbt_view *view,
+    size_t index,
+    uint64_t *satoshi,
+    const unsigned char **script,
+    size_t *script_len)
+{
+    struct wally_psbt_view_item item;
+    const unsigned char *txin, *txout = NULL;
+    unsigned char txid[WALLY_TXHASH_LEN];
+    uint32_t vout;
+    size_t count;
+
+    if (satoshi) {
+        *satoshi = 0;
+    }
+    if (script) {
+        *script = NULL;
+    }
+    if (script_len) {
+        *script_len = 0;
+    }
+    if (!view || index >= view->num_inputs || !satoshi || !script || !script_len) {
+        return WALLY_EINVAL;
+    }
+
+    if (view_find_item(view->inputs[index], view->bytes + view->bytes_len,
+                       WALLY_PSBT_IN_WITNESS_UTXO, 0, &item, &count)) {
+        view_read_tx_output(item.value, satoshi, script, script_len);
+        return WALLY_OK;
+    }
+    if (!view_find_item(view->inputs[index], view->bytes + view->bytes_len,
+                        WALLY_PSBT_IN_NON_WITNESS_UTXO, 0, &item, &count)) {
+        return WALLY_EINVAL; /* No UTXO available */
+    }
+
+    /* The non-witness UTXO must be the tx that this input spends */
+    txin = view->tx_inputs[index];
+    uint32_from_le_bytes(txin + WALLY_TXHASH_LEN, &vout);
+    if (!view_get_prevout(item.value, item.value_len, vout, &txout, txid) ||
+        memcmp(txid, txin, WALLY_TXHASH_LEN)) {
+        return WALLY_EINVAL;
+    }
+    view_read_tx_output(txout, satoshi, script, script_len);
+    return WALLY_OK;
+}
+
+/* The items of a PSBT that its base lacks. Inputs, outputs and maps are
+ * shallow copies that point into the PSBT; only the arrays are owned */
+struct psbt_input_delta {
+    struct wally_psbt_input input;
+    struct wally_keypath_map keypaths;
+    struct wally_partial_sigs_map partial_sigs;
+    struct wally_unknowns_map unknowns;
+};
+
+struct psbt_output_delta {
+    struct wally_psbt_output output;
+    struct wally_keypath_map keypaths;
+    struct wally_unknowns_map unknowns;
+};
+
+struct psbt_delta {
+    unsigned char txid[SHA256_LEN];
+    struct wally_unknowns_map unknowns;
+    struct psbt_input_delta *inputs;
+    struct psbt_output_delta *outputs;
+    size_t num_inputs;
+    size_t num_outputs;
+};
+
+static const uint8_t WALLY_PSBT_DELTA_MAGIC[5] = {'p', 's', 'b', 'd', 0xff};
+
+/* Copy the items of src whose keys are not in base into a new array,
+ * without copying the data the items point to */
+static int map_diff_items(const void *base_items, size_t base_num_items,
+                          const void *src_items, size_t src_num_items,
+                          size_t item_size, map_key_fn key_fn,
+                          void **items_out, size_t *num_items_out)
+{
+    struct map_index index;
+    const unsigned char *key;
+    unsigned char *items;
+    size_t i, key_len;
+    int ret;
+
+    *items_out = NULL;
+    *num_items_out = 0;
+    if (!src_num_items) {
+        return WALLY_OK;
+    }
+    if ((ret = map_index_build(&index, base_items, base_num_items, 0, key_fn)) != WALLY_OK) {
+        return ret;
+    }
+    if (!(items = wally_malloc(src_num_items * item_size))) {
+        map_index_free(&index);
+        return WALLY_ENOMEM;
+    }
+    for (i = 0; i < src_num_items; ++i) {
+        key_fn(src_items, i, &key, &key_len);
+        if (!*map_index_lookup(&index, base_items, key_fn, key, key_len)) {
+            memcpy(items + *num_items_out * item_size,
+                   (const unsigned char *)src_items + i * item_size, item_size);
+            ++*num_items_out;
+        }
+    }
+    map_index_free(&index);
+    if (*num_items_out) {
+        *items_out = items;
+    } else {
+        wally_free(items);
+    }
+    return WALLY_OK;
+}
+
+static int keypaths_diff(const struct wally_keypath_map *base,
+                         const struct wally_keypath_map *src,
+                         struct wally_keypath_map *diff,
+                         struct wally_keypath_map **output)
+{
+    void *items;
+    size_t num_items;
+    int ret;
+
+    if (!src) {
+        return WALLY_OK;
+    }
+    ret = map_diff_items(base ? base->items : NULL, base ? base->num_items : 0,
+                         src->items, src->num_items, sizeof(*src->items),
+                         keypath_item_key, &items, &num_items);
+    if (ret == WALLY_OK && num_items) {
+        diff->items = items;
+        diff->num_items = diff->items_allocation_len = num_items;
+        *output = diff;
+    }
+    return ret;
+}
+
+static int partial_sigs_diff(const struct wally_partial_sigs_map *base,
+                             const struct wally_partial_sigs_map *src,
+                             struct wally_partial_sigs_map *diff,
+                             struct wally_partial_sigs_map **output)
+{
+    void *items;
+    size_t num_items;
+    int ret;
+
+    if (!src) {
+        return WALLY_OK;
+    }
+    ret = map_diff_items(base ? base->items : NULL, base ? base->num_items : 0,
+                         src->items, src->num_items, sizeof(*src->items),
+                         partial_sig_item_key, &items, &num_items);
+    if (ret == WALLY_OK && num_items) {
+        diff->items = items;
+        diff->num_items = diff->items_allocation_len = num_items;
+        *output = diff;
+    }
+    return ret;
+}
+
+static int unknowns_diff(const struct wally_unknowns_map *base,
+                         const struct wally_unknowns_map *src,
+                         struct wally_unknowns_map *diff,
+                         struct wally_unknowns_map **output)
+{
+    void *items;
+    size_t num_items;
+    int ret;
+
+    if (!src) {
+        return WALLY_OK;
+    }
+    ret = map_diff_items(base ? base->items : NULL, base ? base->num_items : 0,
+                         src->items, src->num_items, sizeof(*src->items),
+                         unknowns_item_key, &items, &num_items);
+    if (ret == WALLY_OK && num_items) {
+        diff->items = items;
+        diff->num_items = diff->items_allocation_len = num_items;
+        *output = diff;
+    }
+    return ret;
+}
+
+static int psbt_input_delta_init(const struct wally_psbt_input *base,
+                                 const struct wally_psbt_input *src,
+                                 struct psbt_input_delta *delta)
+{
+    struct wally_psbt_input *input = &delta->input;
+    int ret;
+
+    if (!base->non_witness_utxo) {
+        input->non_witness_utxo = src->non_witness_utxo;
+    }
+    if (!base->witness_utxo) {
+        input->witness_utxo = src->witness_utxo;
+    }
+    if (!base->redeem_script) {
+        input->redeem_script = src->redeem_script;
+        input->redeem_script_len = src->redeem_script_len;
+    }
+    if (!base->witness_script) {
+        input->witness_script = src->witness_script;
+        input->witness_script_len = src->witness_script_len;
+    }
+    if (!base->final_script_sig) {
+        input->final_script_sig = src->final_script_sig;
+        input->final_script_sig_len = src->final_script_sig_len;
+    }
+    if (!base->final_witness) {
+        input->final_witness = src->final_witness;
+    }
+    if (src->sighash_type > base->sighash_type) {
+        input->sighash_type = src->sighash_type;
+    }
+    if ((ret = keypaths_diff(base->keypaths, src->keypaths, &delta->keypaths, &input->keypaths)) != WALLY_OK ||
+        (ret = partial_sigs_diff(base->partial_sigs, src->partial_sigs, &delta->partial_sigs, &input->partial_sigs)) != WALLY_OK) {
+        return ret;
+    }
+    return unknowns_diff(base->unknowns, src->unknowns, &delta->unknowns, &input->unknowns);
+}
+
+static int psbt_output_delta_init(const struct wally_psbt_output *base,
+                                  const struct wally_psbt_output *src,
+                                  struct psbt_output_delta *delta)
+{
+    struct wally_psbt_output *output = &delta->output;
+    int ret;
+
+    if (!base->redeem_script) {
+        output->redeem_script = src->redeem_script;
+        output->redeem_script_len = src->redeem_script_len;
+    }
+    if (!base->witness_script) {
+        output->witness_script = src->witness_script;
+        output->witness_script_len = src->witness_script_len;
+    }
+    if ((ret = keypaths_diff(base->keypaths, src->keypaths, &delta->keypaths, &output->keypaths)) != WALLY_OK) {
+        return ret;
+    }
+    return unknowns_diff(base->unknowns, src->unknowns, &delta->unknowns, &output->unknowns);
+}
+
+static void psbt_delta_free(struct psbt_delta *delta)
+{
+    size_t i;
+
+    for (i = 0; i < delta->num_inputs; ++i) {
+        wally_free(delta->inputs[i].keypaths.items);
+        wally_free(delta->inputs[i].partial_sigs.items);
+        wally_free(delta->inputs[i].unknowns.items);
+    }
+    for (i = 0; i < delta->num_outputs; ++i) {
+        wally_free(delta->outputs[i].keypaths.items);
+        wally_free(delta->outputs[i].unknowns.items);
+    }
+    wally_free(delta->inputs);
+    wally_free(delta->outputs);
+    wally_free(delta->unknowns.items);
+}
+
+static int psbt_delta_init(const struct wally_psbt *base,
+                           const struct wally_psbt *psbt,
+                           struct psbt_delta *delta)
+{
+    struct wally_unknowns_map *unknowns = NULL;
+    size_t i;
+    int ret;
+
+    wally_bzero(delta, sizeof(*delta));
+    if (!base || !psbt || !base->tx || !psbt->tx ||
+        !tx_is_same_unsigned(base->tx, psbt->tx) ||
+        base->num_inputs != psbt->num_inputs || base->num_outputs != psbt->num_outputs) {
+        return WALLY_EINVAL;
+    }
+    if ((ret = get_txid(psbt->tx, delta->txid, sizeof(delta->txid))) != WALLY_OK) {
+        return ret;
+    }
+
+    if (psbt->num_inputs) {
+        if (!(delta->inputs = wally_malloc(psbt->num_inputs * sizeof(*delta->inputs)))) {
+            return WALLY_ENOMEM;
+        }
+        wally_bzero(delta->inputs, psbt->num_inputs * sizeof(*delta->inputs));
+    }
+    if (psbt->num_outputs) {
+        if (!(delta->outputs = wally_malloc(psbt->num_outputs * sizeof(*delta->outputs)))) {
+            psbt_delta_free(delta);
+            return WALLY_ENOMEM;
+        }
+        wally_bzero(delta->outputs, psbt->num_outputs * sizeof(*delta->outputs));
+    }
+
+    for (i = 0; i < psbt->num_inputs && ret == WALLY_OK; ++i) {
+        ret = psbt_input_delta_init(&base->inputs[i], &psbt->inputs[i], &delta->inputs[i]);
+        delta->num_inputs++;
+    }
+    for (i = 0; i < psbt->num_outputs && ret == WALLY_OK; ++i) {
+        ret = psbt_output_delta_init(&base->outputs[i], &psbt->outputs[i], &delta->outputs[i]);
+        delta->num_outputs++;
+    }
+    if (ret == WALLY_OK) {
+        ret = unknowns_diff(base->unknowns, psbt->unknowns, &delta->unknowns, &unknowns);
+    }
+    if (ret != WALLY_OK) {
+        psbt_delta_free(delta);
+    }
+    return ret;
+}
+
+static size_t psbt_delta_get_length(const struct psbt_delta *delta)
+{
+    size_t len = sizeof(WALLY_PSBT_DELTA_MAGIC) + sizeof(delta->txid), item_len, i;
+
+    /* Global unknowns and separator */
+    for (i = 0; i < delta->unknowns.num_items; ++i) {
+        len += varbuff_get_length(delta->unknowns.items[i].key_len);
+        len += varbuff_get_length(delta->unknowns.items[i].value_len);
+    }
+    len += 1;
+
+    for (i = 0; i < delta->num_inputs; ++i) {
+        psbt_input_get_length(&delta->inputs[i].input, &item_len);
+        len += item_len;
+    }
+    for (i = 0; i < delta->num_outputs; ++i) {
+        psbt_output_get_length(&delta->outputs[i].output, &item_len);
+        len += item_len;
+    }
+    return len;
+}
+
+int wally_psbt_get_delta_length(
+    const struct wally_psbt *base,
+    const struct wally_psbt *psbt,
+    size_t *written)
+{
+    struct psbt_delta delta;
+    int ret;
+
+    if (written) {
+        *written = 0;
+    }
+    if (!written) {
+        return WALLY_EINVAL;
+    }
+    if ((ret = psbt_delta_init(base, psbt, &delta)) == WALLY_OK) {
+        *written = psbt_delta_get_length(&delta);
+        psbt_delta_free(&delta);
+    }
+    return ret;
+}
+
+int wally_psbt_get_delta(
+    const struct wally_psbt *base,
+    const struct wally_psbt *psbt,
+    unsigned char *bytes_out,
+    size_t len,
+    size_t *written)
+{
+    struct psbt_delta delta;
+    unsigned char *p = bytes_out;
+    size_t item_len, i;
+    int ret;
+
+    if (written) {
+        *written = 0;
+    }
+    if (!bytes_out || !written) {
+        return WALLY_EINVAL;
+    }
+    if ((ret = psbt_delta_init(base, psbt, &delta)) != WALLY_OK) {
+        return ret;
+    }
+    if (psbt_delta_get_length(&delta) > len) {
+        ret = WALLY_EINVAL; /* Buffer is not big enough */
+        goto done;
+    }
+
+    memcpy(p, WALLY_PSBT_DELTA_MAGIC, sizeof(WALLY_PSBT_DELTA_MAGIC));
+    p += sizeof(WALLY_PSBT_DELTA_MAGIC);
+    memcpy(p, delta.txid, sizeof(delta.txid));
+    p += sizeof(delta.txid);
+
+    for (i = 0; i < delta.unknowns.num_items; ++i) {
+        const struct wally_unknowns_item *unknown = &delta.unknowns.items[i];
+        p += varbuff_to_bytes(unknown->key, unknown->key_len, p);
+        p += varbuff_to_bytes(unknown->value, unknown->value_len, p);
+    }
+    *p++ = WALLY_PSBT_SEPARATOR;
+
+    for (i = 0; i < delta.num_inputs && ret == WALLY_OK; ++i) {
+        ret = psbt_input_to_bytes(&delta.inputs[i].input, p, bytes_out + len - p, &item_len);
+        p += item_len;
+    }
+    for (i = 0; i < delta.num_outputs && ret == WALLY_OK; ++i) {
+        ret = psbt_output_to_bytes(&delta.outputs[i].output, p, &item_len);
+        p += item_len;
+    }
+    if (ret == WALLY_OK) {
+        *written = p - bytes_out;
+    }
+
+done:
+    psbt_delta_free(&delta);
+    return ret;
+}
+
+/* Make room in *dst for every item of src, creating *dst if needed, and
+ * track the largest number of items any map may end up with. This only
+ * adds capacity, so the contents of *dst are unchanged */
+static int reserve_keypaths(struct wally_keypath_map **dst, const struct wally_keypath_map *src,
+                            size_t *max_items)
+{
+    int ret;
+
+    if (!src || !src->num_items) {
+        return WALLY_OK;
+    }
+    if (!*dst) {
+        ret = wally_keypath_map_init_alloc(src->num_items, dst);
+    } else {
+        ret = array_reserve((void **)&(*dst)->items, (*dst)->num_items, &(*dst)->items_allocation_len,
+                            sizeof(*src->items), src->num_items);
+    }
+    if (ret == WALLY_OK && (*dst)->num_items + src->num_items > *max_items) {
+        *max_items = (*dst)->num_items + src->num_items;
+    }
+    return ret;
+}
+
+static int reserve_partial_sigs(struct wally_partial_sigs_map **dst, const struct wally_partial_sigs_map *src,
+                                size_t *max_items)
+{
+    int ret;
+
+    if (!src || !src->num_items) {
+        return WALLY_OK;
+    }
+    if (!*dst) {
+        ret = wally_partial_sigs_map_init_alloc(src->num_items, dst);
+    } else {
+        ret = array_reserve((void **)&(*dst)->items, (*dst)->num_items, &(*dst)->items_allocation_len,
+                            sizeof(*src->items), src->num_items);
+    }
+    if (ret == WALLY_OK && (*dst)->num_items + src->num_items > *max_items) {
+        *max_items = (*dst)->num_items + src->num_items;
+    }
+    return ret;
+}
+
+static int reserve_unknowns(struct wally_unknowns_map **dst, const struct wally_unknowns_map *src,
+                            size_t *max_items)
+{
+    int ret;
+
+    if (!src || !src->num_items) {
+        return WALLY_OK;
+    }
+    if (!*dst) {
+        ret = wally_unknowns_map_init_alloc(src->num_items, dst);
+    } else {
+        ret = array_reserve((void **)&(*dst)->items, (*dst)->num_items, &(*dst)->items_allocation_len,
+                            sizeof(*src->items), src->num_items);
+    }
+    if (ret == WALLY_OK && (*dst)->num_items + src->num_items > *max_items) {
+        *max_items = (*dst)->num_items + src->num_items;
+    }
+    return ret;
+}
+
+int wally_psbt_apply_delta(
+    struct wally_psbt *psbt,
+    const unsigned char *bytes,
+    size_t bytes_len)
+{
+    const unsigned char *p = bytes, *end = bytes + bytes_len, *maps;
+    unsigned char txid[SHA256_LEN];
+    struct wally_psbt *delta = NULL;
+    struct wally_psbt_view_item item;
+    struct map_index index = { NULL, 0 };
+    void *src;
+    size_t bytes_read, max_items = 0, i;
+    uint32_t type;
+    bool at_end;
+    int ret;
+
+    if (!psbt || !psbt->tx || !bytes ||
+        bytes_len < sizeof(WALLY_PSBT_DELTA_MAGIC) + sizeof(txid) ||
+        memcmp(p, WALLY_PSBT_DELTA_MAGIC, sizeof(WALLY_PSBT_DELTA_MAGIC))) {
+        return WALLY_EINVAL;
+    }
+    p += sizeof(WALLY_PSBT_DELTA_MAGIC);
+    if ((ret = get_txid(psbt->tx, txid, sizeof(txid))) != WALLY_OK) {
+        return ret;
+    }
+    if (memcmp(p, txid, sizeof(txid))) {
+        return WALLY_EINVAL; /* Delta is for a different transaction */
+    }
+    p += sizeof(txid);
+
+    /* Parse the whole delta before changing psbt, so a malformed delta
+     * leaves it untouched. Allocations that could fail are also made
+     * before changing it below */
+    if ((ret = wally_psbt_init_alloc(psbt->num_inputs, psbt->num_outputs, 0, &delta)) != WALLY_OK) {
+        return ret;
+    }
+    for (;;) {
+        if (!view_read_item(&p, end, &type, &item, &at_end)) {
+            ret = WALLY_EINVAL;
+            goto done;
+        }
+        if (at_end) {
+            break;
+        }
+        if (type == WALLY_PSBT_GLOBAL_UNSIGNED_TX) {
+            ret = WALLY_EINVAL; /* Deltas identify the tx by its txid only */
+            goto done;
+        }
+        if ((ret = parse_unknown(&delta->unknowns, item.key - 1, item.key_len + 1,
+                                 item.value, item.value_len)) != WALLY_OK) {
+            goto done;
+        }
+    }
+    if (delta->unknowns &&
+        (ret = map_check_unique(delta->unknowns->items, delta->unknowns->num_items, unknowns_item_key)) != WALLY_OK) {
+        goto done;
+    }
+
+    /* The delta is untrusted: check every map lies within it and is well
+     * formed before parsing any of them */
+    maps = p;
+    for (i = 0; i < psbt->num_inputs + psbt->num_outputs; ++i) {
+        if (!view_check_map(&maps, end, i < psbt->num_inputs)) {
+            ret = WALLY_EINVAL;
+            goto done;
+        }
+    }
+    if (maps != end) {
+        ret = WALLY_EINVAL; /* Trailing data */
+        goto done;
+    }
+
+    for (i = 0; i < psbt->num_inputs; ++i) {
+        ret = psbt_input_from_bytes(p, end - p, &bytes_read, &delta->inputs[i]);
+        delta->num_inputs++; /* Count partial inputs so they are freed on failure */
+        if (ret != WALLY_OK) {
+            goto done;
+        }
+        p += bytes_read;
+    }
+    for (i = 0; i < psbt->num_outputs; ++i) {
+        ret = psbt_output_from_bytes(p, end - p, &bytes_read, &delta->outputs[i]);
+        delta->num_outputs++; /* Count partial outputs so they are freed on failure */
+        if (ret != WALLY_OK) {
+            goto done;
+        }
+        p += bytes_read;
+    }
+    if (p != end) {
+        ret = WALLY_EINVAL; /* Trailing data */
+        goto done;
+    }
+
+    /* Reserve room for every new item, and one index large enough for any
+     * map, so that running out of memory cannot leave psbt partly updated */
+    for (i = 0; i < psbt->num_inputs && ret == WALLY_OK; ++i) {
+        struct wally_psbt_input *dst = &psbt->inputs[i];
+        if ((ret = reserve_keypaths(&dst->keypaths, delta->inputs[i].keypaths, &max_items)) == WALLY_OK &&
+            (ret = reserve_partial_sigs(&dst->partial_sigs, delta->inputs[i].partial_sigs, &max_items)) == WALLY_OK) {
+            ret = reserve_unknowns(&dst->unknowns, delta->inputs[i].unknowns, &max_items);
+        }
+    }
+    for (i = 0; i < psbt->num_outputs && ret == WALLY_OK; ++i) {
+        struct wally_psbt_output *dst = &psbt->outputs[i];
+        if ((ret = reserve_keypaths(&dst->keypaths, delta->outputs[i].keypaths, &max_items)) == WALLY_OK) {
+            ret = reserve_unknowns(&dst->unknowns, delta->outputs[i].unknowns, &max_items);
+        }
+    }
+    if (ret == WALLY_OK &&
+        (ret = reserve_unknowns(&psbt->unknowns, delta->unknowns, &max_items)) == WALLY_OK) {
+        ret = map_index_init(&index, max_items);
+    }
+    if (ret != WALLY_OK) {
+        goto done;
+    }
+
+    /* Move the new items into psbt. This cannot fail */
+    for (i = 0; i < psbt->num_inputs; ++i) {
+        struct wally_psbt_input *dst = &psbt->inputs[i];
+        move_input_fields_into(dst, &delta->inputs[i]);
+        src = delta->inputs[i].keypaths;
+        move_keypaths_into(&dst->keypaths, &src, 1, &index);
+        src = delta->inputs[i].partial_sigs;
+        move_partial_sigs_into(&dst->partial_sigs, &src, 1, &index);
+        src = delta->inputs[i].unknowns;
+        move_unknowns_into(&dst->unknowns, &src, 1, &index);
+    }
+    for (i = 0; i < psbt->num_outputs; ++i) {
+        struct wally_psbt_output *dst = &psbt->outputs[i];
+        move_output_fields_into(dst, &delta->outputs[i]);
+        src = delta->outputs[i].keypaths;
+        move_keypaths_into(&dst->keypaths, &src, 1, &index);
+        src = delta->outputs[i].unknowns;
+        move_unknowns_into(&dst->unknowns, &src, 1, &index);
+    }
+    src = delta->unknowns;
+    move_unknowns_into(&psbt->unknowns, &src, 1, &index);
+
+done:
+    map_index_free(&index);
+    wally_psbt_free(delta);
+    return ret;
+}
+
+/* As when estimating tx fees, assume maximum length signatures so that the
+ * estimated vsize is never below the final vsize */
+#define PSBT_EST_SIG_LEN (EC_SIGNATURE_DER_MAX_LEN + 1) /* +1 for sighash */
+
+/* Get the number of signatures a multisig script requires */
+static bool get_multisig_threshold(const unsigned char *script, size_t script_len, size_t *threshold)
+{
+    size_t type;
+
+    return script && script_len &&
+           wally_scriptpubkey_get_type(script, script_len, &type) == WALLY_OK &&
+           type == WALLY_SCRIPT_TYPE_MULTISIG &&
+           script_is_op_n(script[0], false, threshold);
+}
+
+/* Get the final scriptSig and witness lengths of an input, estimating them
+ * from the UTXO and redeem/witness script types if it is not finalized.
+ * witness_len is 0 if the input has no witness */
+static bool psbt_input_get_final_lengths(
+    const struct wally_psbt_input *input,
+    const unsigned char *script,
+    size_t script_len,
+    size_t *script_sig_len,
+    size_t *witness_len)
+{
+    const size_t sig_len = varbuff_get_length(PSBT_EST_SIG_LEN);
+    size_t type, threshold, i;
+
+    *script_sig_len = 0;
+    *witness_len = 0;
+
+    if (input->final_script_sig || input->final_witness) {
+        *script_sig_len = input->final_script_sig_len;
+        if (input->final_witness) {
+            *witness_len = varint_get_length(input->final_witness->num_items);
+            for (i = 0; i < input->final_witness->num_items; ++i) {
+                *witness_len += varbuff_get_length(input->final_witness->items[i].witness_len);
+            }
+        }
+        return true;
+    }
+
+    if (wally_scriptpubkey_get_type(script, script_len, &type) != WALLY_OK) {
+        return false;
+    }
+    if (type == WALLY_SCRIPT_TYPE_P2SH) {
+        if (!input->redeem_script ||
+            wally_scriptpubkey_get_type(input->redeem_script, input->redeem_script_len, &type) != WALLY_OK) {
+            return false;
+        }
+        *script_sig_len = script_get_push_length(input->redeem_script_len);
+        if (type == WALLY_SCRIPT_TYPE_MULTISIG &&
+            get_multisig_threshold(input->redeem_script, input->redeem_script_len, &threshold)) {
+            /* OP_0 [sigs] [redeem script] */
+            *script_sig_len += 1 + threshold * script_get_push_length(PSBT_EST_SIG_LEN);
+            return true;
+        }
+        if (type != WALLY_SCRIPT_TYPE_P2WPKH && type != WALLY_SCRIPT_TYPE_P2WSH) {
+            return false;
+        }
+    }
+
+    switch (type) {
+    case WALLY_SCRIPT_TYPE_P2PKH:
+        /* [sig] [pubkey] */
+        *script_sig_len = script_get_push_length(PSBT_EST_SIG_LEN) +
+                          script_get_push_length(EC_PUBLIC_KEY_LEN);
+        return true;
+    case WALLY_SCRIPT_TYPE_P2WPKH:
+        *witness_len = varint_get_length(2) + sig_len + varbuff_get_length(EC_PUBLIC_KEY_LEN);
+        return true;
+    case WALLY_SCRIPT_TYPE_P2WSH:
+        if (!get_multisig_threshold(input->witness_script, input->witness_script_len, &threshold)) {
+            return false;
+        }
+        /* <empty> [sigs] [witness script] */
+        *witness_len = varint_get_length(threshold + 2) + 1 + threshold * sig_len +
+                       varbuff_get_length(input->witness_script_len);
+        return true;
+    }
+    return false;
+}
+
+/* Get the amount and script of the UTXO an input spends. A non witness
+ * UTXO must be the transaction the input spends, so its txid is checked */
+static int psbt_input_get_utxo(const struct wally_psbt *psbt, size_t index,
+                               uint64_t *satoshi,
+                               const unsigned char **script, size_t *script_len)
+{
+    const struct wally_psbt_input *input = &psbt->inputs[index];
+    const struct wally_tx_input *txin = &psbt->tx->inputs[index];
+    const struct wally_tx_output *utxo = input->witness_utxo;
+    unsigned char txid[SHA256_LEN];
+    int ret;
+
+    if (input->non_witness_utxo) {
+        if ((ret = get_txid(input->non_witness_utxo, txid, sizeof(txid))) != WALLY_OK) {
+            return ret;
+        }
+        if (memcmp(txid, txin->txhash, sizeof(txid))) {
+            return WALLY_EINVAL; /* Not the transaction being spent */
+        }
+        if (!utxo && txin->index < input->non_witness_utxo->num_outputs) {
+            utxo = &input->non_witness_utxo->outputs[txin->index];
+        }
+    }
+    if (!utxo) {
+        return WALLY_EINVAL;
+    }
+    *satoshi = utxo->satoshi;
+    *script = utxo->script;
+    *script_len = utxo->script_len;
+    return WALLY_OK;
+}
+
+int wally_psbt_get_summary(
+    const struct wally_psbt *psbt,
+    size_t *length,
+    size_t *vsize,
+    uint64_t *total_in,
+    uint64_t *total_out,
+    uint64_t *fee)
+{
+    const unsigned char *script;
+    size_t len, tx_len, item_len, script_len, script_sig_len, witness_len, i;
+    size_t base_size, witness_size = 0, weight;
+    uint64_t satoshi, in = 0, out = 0;
+    bool has_witness = false;
+    int ret;
+
+    if (length) {
+        *length = 0;
+    }
+    if (vsize) {
+        *vsize = 0;
+    }
+    if (total_in) {
+        *total_in = 0;
+    }
+    if (total_out) {
+        *total_out = 0;
+    }
+    if (fee) {
+        *fee = 0;
+    }
+    if (!psbt || !psbt->tx || psbt->num_inputs != psbt->tx->num_inputs ||
+        psbt->num_outputs != psbt->tx->num_outputs ||
+        !length || !vsize || !total_in || !total_out || !fee) {
+        return WALLY_EINVAL;
+    }
+
+    if ((ret = psbt_get_global_length(psbt, &len, &tx_len)) != WALLY_OK) {
+        return ret;
+    }
+    /* The unsigned tx has an empty scriptSig for each input */
+    base_size = tx_len - psbt->num_inputs;
+
+    for (i = 0; i < psbt->num_inputs; ++i) {
+        const struct wally_psbt_input *input = &psbt->inputs[i];
+
+        psbt_input_get_length(input, &item_len);
+        len += item_len;
+
+        if ((ret = psbt_input_get_utxo(psbt, i, &satoshi, &script, &script_len)) != WALLY_OK) {
+            return ret; /* Unknown or mismatched input UTXO */
+        }
+        if (satoshi > UINT64_MAX - in) {
+            return WALLY_EINVAL; /* Overflow */
+        }
+        in += satoshi;
+
+        if (!psbt_input_get_final_lengths(input, script, script_len, &script_sig_len, &witness_len)) {
+            return WALLY_EINVAL; /* Final size cannot be estimated */
+        }
+        base_size += varbuff_get_length(script_sig_len);
+        if (witness_len) {
+            has_witness = true;
+            witness_size += witness_len;
+        } else {
+            witness_size += 1; /* Empty witness stack */
+        }
+    }
+
+    for (i = 0; i < psbt->num_outputs; ++i) {
+        psbt_output_get_length(&psbt->outputs[i], &item_len);
+        len += item_len;
+
+        satoshi = psbt->tx->outputs[i].satoshi;
+        if (satoshi > UINT64_MAX - out) {
+            return WALLY_EINVAL;
+        }
+        out += satoshi;
+    }
+    if (out > in) {
+        return WALLY_EINVAL; /* Outputs exceed inputs */
+    }
+
+    weight = base_size * 4;
+    if (has_witness) {
+        weight += 2 + witness_size; /* Marker, flag and witnesses */
+    }
+    if ((ret = wally_tx_vsize_from_weight(weight, vsize)) != WALLY_OK) {
+        return ret;
+    }
+    *length = len;
+    *total_in = in;
+    *total_out = out;
+    *fee = in - out;
+    return WALLY_OK;
+}
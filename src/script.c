@@ -10,6 +10,7 @@
 #include <limits.h>
 #include <stdbool.h>
 #include "script_int.h"
+#include "script.h"
 
 /* varint tags and limits */
 #define VI_TAG_16 253
@@ -69,45 +70,63 @@ static size_t calc_push_opcode_size(size_t n)
     return 5;
 }
 
-static int get_push_size(const unsigned char *bytes, size_t bytes_len,
-                         bool get_opcode_size, size_t *size_out)
+size_t script_get_push_length(size_t n)
 {
-    size_t opcode_len;
+    return calc_push_opcode_size(n) + n;
+}
 
-    if (!bytes || !bytes_len || !size_out)
-        return WALLY_EINVAL;
+/* Decode the push opcode at the start of 'bytes' */
+static int get_push(const unsigned char *bytes, size_t bytes_len,
+                    size_t *opcode_len_out, size_t *push_len_out)
+{
+    size_t opcode_len, push_len;
 
     if (bytes[0] < 76) {
         opcode_len = 1;
-        *size_out = bytes[0];
+        push_len = bytes[0];
     } else if (bytes[0] == OP_PUSHDATA1) {
         opcode_len = 2;
         if (bytes_len < opcode_len)
             return WALLY_EINVAL;
-        *size_out = bytes[1];
+        push_len = bytes[1];
     } else if (bytes[0] == OP_PUSHDATA2) {
         leint16_t data_len;
         opcode_len = 3;
         if (bytes_len < opcode_len)
             return WALLY_EINVAL;
         memcpy(&data_len, &bytes[1], sizeof(data_len));
-        *size_out = le16_to_cpu(data_len);
+        push_len = le16_to_cpu(data_len);
     } else if (bytes[0] == OP_PUSHDATA4) {
         leint32_t data_len;
         opcode_len = 5;
         if (bytes_len < opcode_len)
             return WALLY_EINVAL;
         memcpy(&data_len, &bytes[1], sizeof(data_len));
-        *size_out = le32_to_cpu(data_len);
+        push_len = le32_to_cpu(data_len);
     } else
         return WALLY_EINVAL; /* Not a push */
-    if (bytes_len < opcode_len + *size_out)
+    if (bytes_len - opcode_len < push_len)
         return WALLY_EINVAL; /* Push is longer than current script bytes */
-    if (get_opcode_size)
-        *size_out = opcode_len;
+    *opcode_len_out = opcode_len;
+    *push_len_out = push_len;
     return WALLY_OK;
 }
 
+static int get_push_size(const unsigned char *bytes, size_t bytes_len,
+                         bool get_opcode_size, size_t *size_out)
+{
+    size_t opcode_len, push_len;
+    int ret;
+
+    if (!bytes || !bytes_len || !size_out)
+        return WALLY_EINVAL;
+
+    ret = get_push(bytes, bytes_len, &opcode_len, &push_len);
+    if (ret == WALLY_OK)
+        *size_out = get_opcode_size ? opcode_len : push_len;
+    return ret;
+}
+
 size_t varint_get_length(uint64_t v)
 {
     if (v <= VI_MAX_8)
@@ -357,50 +376,106 @@ static bool scriptpubkey_is_multisig(const unsigned char *bytes, size_t bytes_le
     return bytes_len == 2;
 }
 
+/* Classify a scriptPubKey, dispatching on its first byte and length.
+ * Returns the script type and sets 'offset_out' to the offset of the
+ * hash or witness program within the script, or 0 if the type has none */
+static size_t scriptpubkey_classify(const unsigned char *bytes, size_t bytes_len,
+                                    size_t *offset_out)
+{
+    *offset_out = 0;
+    if (!bytes_len)
+        return WALLY_SCRIPT_TYPE_UNKNOWN;
+
+    switch (bytes[0]) {
+    case OP_0:
+        if (scriptpubkey_is_p2wpkh(bytes, bytes_len)) {
+            *offset_out = 2;
+            return WALLY_SCRIPT_TYPE_P2WPKH;
+        }
+        if (scriptpubkey_is_p2wsh(bytes, bytes_len)) {
+            *offset_out = 2;
+            return WALLY_SCRIPT_TYPE_P2WSH;
+        }
+        break;
+    case OP_DUP:
+        if (scriptpubkey_is_p2pkh(bytes, bytes_len)) {
+            *offset_out = 3;
+            return WALLY_SCRIPT_TYPE_P2PKH;
+        }
+        break;
+    case OP_HASH160:
+        if (scriptpubkey_is_p2sh(bytes, bytes_len)) {
+            *offset_out = 2;
+            return WALLY_SCRIPT_TYPE_P2SH;
+        }
+        break;
+    case OP_RETURN:
+        if (scriptpubkey_is_op_return(bytes, bytes_len))
+            return WALLY_SCRIPT_TYPE_OP_RETURN;
+        break;
+    default:
+        if (scriptpubkey_is_multisig(bytes, bytes_len))
+            return WALLY_SCRIPT_TYPE_MULTISIG;
+        break;
+    }
+    return WALLY_SCRIPT_TYPE_UNKNOWN;
+}
+
 int wally_scriptpubkey_get_type(const unsigned char *bytes, size_t bytes_len,
                                 size_t *written)
 {
+    size_t offset;
+
     if (written)
         *written = WALLY_SCRIPT_TYPE_UNKNOWN;
 
     if (!bytes || !bytes_len || !written)
         return WALLY_EINVAL;
 
-    if (scriptpubkey_is_op_return(bytes, bytes_len)) {
-        *written = WALLY_SCRIPT_TYPE_OP_RETURN;
-        return WALLY_OK;
-    }
+    *written = scriptpubkey_classify(bytes, bytes_len, &offset);
+    return WALLY_OK;
+}
 
-    if (scriptpubkey_is_multisig(bytes, bytes_len)) {
-        *written = WALLY_SCRIPT_TYPE_MULTISIG;
-        return WALLY_OK;
+int wally_scriptpubkey_get_types(const unsigned char *const *scripts,
+                                 const size_t *script_lens,
+                                 size_t num_scripts,
+                                 size_t *types_out,
+                                 size_t *offsets_out,
+                                 size_t len)
+{
+    size_t i, offset;
+
+    if (!num_scripts || !scripts || !script_lens ||
+        !types_out || len < num_scripts)
+        return WALLY_EINVAL;
+
+    for (i = 0; i < num_scripts; ++i) {
+        if (!scripts[i] && script_lens[i])
+            return WALLY_EINVAL;
+        types_out[i] = scriptpubkey_classify(scripts[i], script_lens[i], &offset);
+        if (offsets_out)
+            offsets_out[i] = offset;
     }
+    return WALLY_OK;
+}
 
-    switch (bytes_len) {
-    case WALLY_SCRIPTPUBKEY_P2PKH_LEN:
-        if (scriptpubkey_is_p2pkh(bytes, bytes_len)) {
-            *written = WALLY_SCRIPT_TYPE_P2PKH;
-            return WALLY_OK;
-        }
-        break;
-    case WALLY_SCRIPTPUBKEY_P2SH_LEN:
-        if (scriptpubkey_is_p2sh(bytes, bytes_len)) {
-            *written = WALLY_SCRIPT_TYPE_P2SH;
-            return WALLY_OK;
-        }
-        break;
-    case WALLY_SCRIPTPUBKEY_P2WPKH_LEN:
-        if (scriptpubkey_is_p2wpkh(bytes, bytes_len)) {
-            *written = WALLY_SCRIPT_TYPE_P2WPKH;
-            return WALLY_OK;
-        }
-        break;
-    case WALLY_SCRIPTPUBKEY_P2WSH_LEN:
-        if (scriptpubkey_is_p2wsh(bytes, bytes_len)) {
-            *written = WALLY_SCRIPT_TYPE_P2WSH;
-            return WALLY_OK;
-        }
-        break;
+int wally_tx_get_output_script_types(const struct wally_tx *tx,
+                                     size_t *types_out,
+                                     size_t *offsets_out,
+                                     size_t len)
+{
+    size_t i, offset;
+
+    if (!tx || (tx->num_outputs && !tx->outputs) || !types_out ||
+        len < tx->num_outputs)
+        return WALLY_EINVAL;
+
+    for (i = 0; i < tx->num_outputs; ++i) {
+        const struct wally_tx_output *output = tx->outputs + i;
+        types_out[i] = scriptpubkey_classify(output->script, output->script_len,
+                                             &offset);
+        if (offsets_out)
+            offsets_out[i] = offset;
     }
     return WALLY_OK;
 }
@@ -885,6 +960,160 @@ int wally_witness_program_from_bytes(const unsigned char *bytes, size_t bytes_le
     return ret;
 }
 
+int wally_script_iter_init(struct wally_script_iter *iter,
+                           const unsigned char *bytes, size_t bytes_len)
+{
+    if (!iter || (bytes_len && !bytes))
+        return WALLY_EINVAL;
+
+    iter->script = bytes;
+    iter->script_len = bytes_len;
+    iter->offset = 0;
+    return WALLY_OK;
+}
+
+int wally_script_iter_next(struct wally_script_iter *iter,
+                           unsigned char *op_out,
+                           const unsigned char **push_out,
+                           size_t *push_len_out)
+{
+    const unsigned char *p;
+    size_t remaining, opcode_len = 1, push_len = 0;
+
+    if (op_out)
+        *op_out = OP_INVALIDOPCODE;
+    if (push_out)
+        *push_out = NULL;
+    if (push_len_out)
+        *push_len_out = 0;
+
+    if (!iter || (iter->script_len && !iter->script) ||
+        iter->offset > iter->script_len || !op_out)
+        return WALLY_EINVAL;
+
+    if (iter->offset == iter->script_len)
+        return WALLY_ERROR; /* No more opcodes */
+
+    p = iter->script + iter->offset;
+    remaining = iter->script_len - iter->offset;
+
+    if (*p <= OP_PUSHDATA4) {
+        if (get_push(p, remaining, &opcode_len, &push_len) != WALLY_OK)
+            return WALLY_EINVAL; /* Truncated push */
+        if (push_out)
+            *push_out = p + opcode_len;
+        if (push_len_out)
+            *push_len_out = push_len;
+    }
+
+    *op_out = *p;
+    iter->offset += opcode_len + push_len;
+    return WALLY_OK;
+}
+
+size_t script_get_sigop_count(const unsigned char *bytes, size_t bytes_len,
+                              bool accurate)
+{
+    struct wally_script_iter iter;
+    unsigned char op, last_op = OP_INVALIDOPCODE;
+    size_t n, count = 0;
+
+    if (wally_script_iter_init(&iter, bytes, bytes_len) != WALLY_OK)
+        return 0;
+
+    /* Like bitcoind, stop counting at the first truncated push */
+    while (wally_script_iter_next(&iter, &op, NULL, NULL) == WALLY_OK) {
+        switch (op) {
+        case OP_CHECKSIG:
+        case OP_CHECKSIGVERIFY:
+            ++count;
+            break;
+        case OP_CHECKMULTISIG:
+        case OP_CHECKMULTISIGVERIFY:
+            if (accurate && script_is_op_n(last_op, false, &n))
+                count += n;
+            else
+                count += 20; /* MAX_PUBKEYS_PER_MULTISIG */
+            break;
+        }
+        last_op = op;
+    }
+    return count;
+}
+
+bool script_is_push_only(const unsigned char *bytes, size_t bytes_len,
+                         const unsigned char **push_out, size_t *push_len_out)
+{
+    struct wally_script_iter iter;
+    const unsigned char *push;
+    unsigned char op;
+    size_t push_len;
+    int ret;
+
+    if (push_out)
+        *push_out = NULL;
+    if (push_len_out)
+        *push_len_out = 0;
+
+    if (wally_script_iter_init(&iter, bytes, bytes_len) != WALLY_OK)
+        return false;
+
+    while ((ret = wally_script_iter_next(&iter, &op, &push, &push_len)) == WALLY_OK) {
+        if (op > OP_16)
+            return false;
+        if (push_out)
+            *push_out = push;
+        if (push_len_out)
+            *push_len_out = push_len;
+    }
+    return ret == WALLY_ERROR; /* Fully parsed */
+}
+
+bool script_get_witness_program(const unsigned char *bytes, size_t bytes_len,
+                                size_t *version_out,
+                                const unsigned char **program_out,
+                                size_t *program_len_out)
+{
+    if (!bytes || bytes_len < 4 || bytes_len > 42 ||
+        !script_is_op_n(bytes[0], true, version_out) ||
+        (size_t)bytes[1] + 2 != bytes_len)
+        return false;
+
+    *program_out = bytes + 2;
+    *program_len_out = bytes[1];
+    return true;
+}
+
+bool scriptpubkey_is_standard(const unsigned char *bytes, size_t bytes_len,
+                              size_t *type_out)
+{
+    const unsigned char *program;
+    size_t offset, version, program_len, n_keys = 0;
+
+    *type_out = scriptpubkey_classify(bytes, bytes_len, &offset);
+    switch (*type_out) {
+    case WALLY_SCRIPT_TYPE_OP_RETURN:
+        return bytes_len <= WALLY_SCRIPTPUBKEY_OP_RETURN_MAX_LEN;
+    case WALLY_SCRIPT_TYPE_MULTISIG:
+        /* Bare multisig is only relayed for up to 3 keys */
+        script_is_op_n(bytes[bytes_len - 2], false, &n_keys);
+        return n_keys <= 3;
+    case WALLY_SCRIPT_TYPE_UNKNOWN:
+        break;
+    default:
+        return true;
+    }
+
+    /* P2PK */
+    if (bytes_len && is_pk_len(bytes_len - 2) &&
+        bytes[0] == bytes_len - 2 && bytes[bytes_len - 1] == OP_CHECKSIG)
+        return true;
+
+    /* Future witness versions are standard to allow soft forks */
+    return script_get_witness_program(bytes, bytes_len, &version,
+                                      &program, &program_len) && version != 0;
+}
+
 int wally_elements_pegout_script_size(size_t parent_genesis_blockhash_len,
                                       size_t mainchain_script_len,
                                       size_t sub_pubkey_len,
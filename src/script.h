@@ -15,7 +15,39 @@ int script_get_push_opcode_size_from_bytes(
     size_t bytes_len,
     size_t *size);
 
+/* Get the length of a script push of n bytes, including its opcode(s) */
+size_t script_get_push_length(size_t n);
+
 /* Get OP_N */
 bool script_is_op_n(unsigned char op, bool allow_zero, size_t *n);
 
+/* Count the signature operations in a script. If 'accurate' is true,
+ * use the preceding OP_N as the key count for multisig operations */
+size_t script_get_sigop_count(
+    const unsigned char *bytes,
+    size_t bytes_len,
+    bool accurate);
+
+/* Determine if a script contains only pushes. If so, optionally return
+ * the data pushed by its last opcode */
+bool script_is_push_only(
+    const unsigned char *bytes,
+    size_t bytes_len,
+    const unsigned char **push_out,
+    size_t *push_len_out);
+
+/* Get the version and program of a segwit witness program script */
+bool script_get_witness_program(
+    const unsigned char *bytes,
+    size_t bytes_len,
+    size_t *version_out,
+    const unsigned char **program_out,
+    size_t *program_len_out);
+
+/* Determine if a scriptPubKey is standard, returning its script type */
+bool scriptpubkey_is_standard(
+    const unsigned char *bytes,
+    size_t bytes_len,
+    size_t *type_out);
+
 #endif /* LIBWALLY_CORE_SCRIPT_INTERNAL_H */
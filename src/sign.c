@@ -1,14 +1,14 @@
 #include "internal.h"
 #include <include/wally_crypto.h>
+#include <include/wally_script.h>
 #include "script_int.h"
-#if 0
-#include "secp256k1/include/secp256k1_schnorr.h"
-#endif
+#include "secp256k1/include/secp256k1_schnorrsig.h"
 #include "ccan/ccan/build_assert/build_assert.h"
+#include "ccan/ccan/crypto/sha256/sha256.h"
 #include <stdbool.h>
 
-#define EC_FLAGS_TYPES (EC_FLAG_ECDSA | EC_FLAG_SCHNORR)
-#define EC_FLAGS_ALL (EC_FLAG_ECDSA | EC_FLAG_SCHNORR | EC_FLAG_GRIND_R | EC_FLAG_RECOVERABLE)
+#define EC_FLAGS_TYPES (EC_FLAG_ECDSA | EC_FLAG_SCHNORR_DRAFT)
+#define EC_FLAGS_ALL (EC_FLAG_ECDSA | EC_FLAG_SCHNORR_DRAFT | EC_FLAG_GRIND_R | EC_FLAG_RECOVERABLE)
 
 #define MSG_ALL_FLAGS (BITCOIN_MESSAGE_FLAG_HASH)
 
@@ -25,7 +25,7 @@ static void assert_sign_assumptions(void)
 static bool is_valid_ec_type(uint32_t flags)
 {
     return ((flags & EC_FLAGS_TYPES) == EC_FLAG_ECDSA) ||
-           ((flags & EC_FLAGS_TYPES) == EC_FLAG_SCHNORR);
+           ((flags & EC_FLAGS_TYPES) == EC_FLAG_SCHNORR_DRAFT);
 }
 
 
@@ -81,6 +81,80 @@ int wally_ec_public_key_from_private_key(const unsigned char *priv_key, size_t p
     return ok ? WALLY_OK : WALLY_EINVAL;
 }
 
+struct pub_key_batch {
+    const secp256k1_context *ctx;
+    const unsigned char *priv_keys;
+    unsigned int flags;
+    size_t pub_key_len;
+    unsigned char *bytes_out;
+};
+
+static void pub_key_batch_job(void *p, size_t begin, size_t end)
+{
+    const struct pub_key_batch *batch = p;
+    secp256k1_pubkey pub;
+    size_t i, len_in_out;
+
+    for (i = begin; i < end; ++i) {
+        unsigned char *out = batch->bytes_out + i * batch->pub_key_len;
+        len_in_out = batch->pub_key_len;
+        /* A zero prefix byte marks a failed key, since no valid
+         * serialization starts with one */
+        if (!pubkey_create(batch->ctx, &pub, batch->priv_keys + i * EC_PRIVATE_KEY_LEN) ||
+            !pubkey_serialize(batch->ctx, out, &len_in_out, &pub, batch->flags))
+            wally_clear(out, batch->pub_key_len);
+    }
+    wally_clear(&pub, sizeof(pub));
+}
+
+int wally_ec_public_key_from_private_key_batch(const unsigned char *priv_key,
+                                               size_t priv_key_len,
+                                               uint32_t num_threads,
+                                               unsigned char *bytes_out,
+                                               size_t len)
+{
+    const secp256k1_context *ctx = secp_ctx();
+    const size_t num_keys = priv_key_len / EC_PRIVATE_KEY_LEN;
+    struct pub_key_batch batch;
+    size_t i;
+    int ret;
+
+    if (!ctx)
+        return WALLY_ENOMEM;
+
+    if (!priv_key || !num_keys || priv_key_len % EC_PRIVATE_KEY_LEN || !bytes_out)
+        return WALLY_EINVAL;
+
+    if (len == num_keys * EC_PUBLIC_KEY_LEN) {
+        batch.flags = PUBKEY_COMPRESSED;
+        batch.pub_key_len = EC_PUBLIC_KEY_LEN;
+    } else if (len == num_keys * EC_PUBLIC_KEY_UNCOMPRESSED_LEN) {
+        batch.flags = PUBKEY_UNCOMPRESSED;
+        batch.pub_key_len = EC_PUBLIC_KEY_UNCOMPRESSED_LEN;
+    } else
+        return WALLY_EINVAL;
+
+    /* Check every key up front so no work is wasted on an invalid batch */
+    for (i = 0; i < num_keys; ++i)
+        if (!secp256k1_ec_seckey_verify(ctx, priv_key + i * EC_PRIVATE_KEY_LEN)) {
+            wally_clear(bytes_out, len);
+            return WALLY_EINVAL;
+        }
+
+    /* Key generation does not modify the context, so workers can share ours */
+    batch.ctx = ctx;
+    batch.priv_keys = priv_key;
+    batch.bytes_out = bytes_out;
+    ret = wally_run_parallel(pub_key_batch_job, &batch, num_keys, 16, num_threads);
+    for (i = 0; ret == WALLY_OK && i < num_keys; ++i)
+        if (!bytes_out[i * batch.pub_key_len])
+            ret = WALLY_ERROR;
+
+    if (ret != WALLY_OK)
+        wally_clear(bytes_out, len);
+    return ret;
+}
+
 int wally_ec_public_key_decompress(const unsigned char *pub_key, size_t pub_key_len,
                                    unsigned char *bytes_out, size_t len)
 {
@@ -128,6 +202,57 @@ int wally_ec_public_key_negate(const unsigned char *pub_key, size_t pub_key_len,
     return ok ? WALLY_OK : WALLY_EINVAL;
 }
 
+int wally_ec_public_key_combine(const unsigned char *pub_key, size_t pub_key_len,
+                                const unsigned char *bytes, size_t bytes_len,
+                                unsigned char *bytes_out, size_t len)
+{
+    const size_t num_keys = pub_key_len / EC_PUBLIC_KEY_LEN;
+    const secp256k1_context *ctx = secp_ctx();
+    secp256k1_pubkey *pubs, combined;
+    const secp256k1_pubkey **pub_ptrs;
+    size_t i, alloc_len, len_in_out = EC_PUBLIC_KEY_LEN;
+    bool ok = true;
+    int ret;
+
+    if (!pub_key || !num_keys || pub_key_len % EC_PUBLIC_KEY_LEN ||
+        (bytes && bytes_len != num_keys * EC_PRIVATE_KEY_LEN) || (!bytes && bytes_len) ||
+        !bytes_out || len != EC_PUBLIC_KEY_LEN)
+        return WALLY_EINVAL;
+
+    if (!ctx)
+        return WALLY_ENOMEM;
+
+    if (bytes) {
+        /* Multiply and sum in a single multi-scalar multiplication */
+        ret = pubkey_multi_mul(pub_key, bytes, num_keys, bytes_out);
+        if (ret != WALLY_OK)
+            wally_clear(bytes_out, len);
+        return ret;
+    }
+
+    alloc_len = num_keys * (sizeof(*pubs) + sizeof(*pub_ptrs));
+    if (!(pubs = wally_malloc(alloc_len)))
+        return WALLY_ENOMEM;
+    pub_ptrs = (const secp256k1_pubkey **)(pubs + num_keys);
+
+    for (i = 0; ok && i < num_keys; ++i) {
+        ok = pubkey_parse(ctx, pubs + i, pub_key + i * EC_PUBLIC_KEY_LEN, EC_PUBLIC_KEY_LEN);
+        pub_ptrs[i] = pubs + i;
+    }
+
+    /* Add all points at once, normalizing only the final result */
+    ok = ok && pubkey_combine(ctx, &combined, pub_ptrs, num_keys) &&
+         pubkey_serialize(ctx, bytes_out, &len_in_out, &combined, PUBKEY_COMPRESSED) &&
+         len_in_out == EC_PUBLIC_KEY_LEN;
+
+    if (!ok)
+        wally_clear(bytes_out, len);
+    wally_clear(&combined, sizeof(combined));
+    wally_clear(pubs, alloc_len);
+    wally_free(pubs);
+    return ok ? WALLY_OK : WALLY_EINVAL;
+}
+
 int wally_ec_sig_normalize(const unsigned char *sig, size_t sig_len,
                            unsigned char *bytes_out, size_t len)
 {
@@ -204,6 +329,33 @@ int wally_ec_sig_from_der(const unsigned char *bytes, size_t bytes_len,
     return ok ? WALLY_OK : WALLY_EINVAL;
 }
 
+/* Create a compact ECDSA signature, only computing the recovery id if asked */
+static bool ecdsa_sign(const secp256k1_context *ctx,
+                       const unsigned char *priv_key, const unsigned char *bytes,
+                       wally_ec_nonce_t nonce_fn, const unsigned char *entropy,
+                       bool recoverable, unsigned char *bytes_out, int *recid)
+{
+    bool ok;
+
+    /* Note serializing is documented as never failing */
+    if (recoverable) {
+        secp256k1_ecdsa_recoverable_signature sig_secp;
+        ok = secp256k1_ecdsa_sign_recoverable(ctx, &sig_secp, bytes, priv_key,
+                                              nonce_fn, entropy);
+        if (ok)
+            secp256k1_ecdsa_recoverable_signature_serialize_compact(ctx, bytes_out,
+                                                                    recid, &sig_secp);
+        wally_clear(&sig_secp, sizeof(sig_secp));
+    } else {
+        secp256k1_ecdsa_signature sig_secp;
+        ok = secp256k1_ecdsa_sign(ctx, &sig_secp, bytes, priv_key, nonce_fn, entropy);
+        if (ok)
+            secp256k1_ecdsa_signature_serialize_compact(ctx, bytes_out, &sig_secp);
+        wally_clear(&sig_secp, sizeof(sig_secp));
+    }
+    return ok;
+}
+
 int wally_ec_sig_from_bytes(const unsigned char *priv_key, size_t priv_key_len,
                             const unsigned char *bytes, size_t bytes_len,
                             uint32_t flags,
@@ -215,7 +367,7 @@ int wally_ec_sig_from_bytes(const unsigned char *priv_key, size_t priv_key_len,
     if (!priv_key || priv_key_len != EC_PRIVATE_KEY_LEN ||
         !bytes || bytes_len != EC_MESSAGE_HASH_LEN ||
         !is_valid_ec_type(flags) || flags & ~EC_FLAGS_ALL ||
-        (flags & EC_FLAG_SCHNORR && flags & EC_FLAG_RECOVERABLE) ||
+        (flags & EC_FLAG_SCHNORR_DRAFT && flags & EC_FLAG_RECOVERABLE) ||
         !bytes_out ||
         (len != EC_SIGNATURE_LEN && len != EC_SIGNATURE_RECOVERABLE_LEN) ||
         (len == EC_SIGNATURE_LEN && flags & EC_FLAG_RECOVERABLE) ||
@@ -225,33 +377,33 @@ int wally_ec_sig_from_bytes(const unsigned char *priv_key, size_t priv_key_len,
     if (!ctx)
         return WALLY_ENOMEM;
 
-    if (flags & EC_FLAG_SCHNORR) {
-        return WALLY_EINVAL;
-#if 0 /*FIXME: Schnorr is unavailable in secp for now*/
-        if (!secp256k1_schnorr_sign(ctx, bytes_out, bytes,
-                                    priv_key, nonce_fn, NULL))
-            return WALLY_EINVAL; /* Failed to sign */
+    if (flags & EC_FLAG_SCHNORR_DRAFT) {
+        secp256k1_schnorrsig sig_secp;
+        /* BIP-schnorr mandates its own deterministic nonce derivation */
+        if (!secp256k1_schnorrsig_sign(ctx, &sig_secp, NULL, bytes, priv_key,
+                                       secp256k1_nonce_function_bipschnorr, NULL)) {
+            wally_clear(&sig_secp, sizeof(sig_secp));
+            return WALLY_EINVAL; /* invalid priv_key */
+        }
+        /* Note this function is documented as never failing */
+        secp256k1_schnorrsig_serialize(ctx, bytes_out, &sig_secp);
+        wally_clear(&sig_secp, sizeof(sig_secp));
         return WALLY_OK;
-#endif
     } else {
         unsigned char extra_entropy[32] = {0}, *entropy_p = NULL;
+        unsigned char *sig_out = flags & EC_FLAG_RECOVERABLE ? bytes_out + 1 : bytes_out;
         uint32_t counter = 0;
-        secp256k1_ecdsa_recoverable_signature sig_secp;
-        int recid;
+        int recid = 0;
 
         while (true) {
-            if (!secp256k1_ecdsa_sign_recoverable(ctx, &sig_secp, bytes, priv_key, nonce_fn, entropy_p)) {
-                wally_clear(&sig_secp, sizeof(sig_secp));
+            if (!ecdsa_sign(ctx, priv_key, bytes, nonce_fn, entropy_p,
+                            flags & EC_FLAG_RECOVERABLE, sig_out, &recid)) {
                 if (!secp256k1_ec_seckey_verify(ctx, priv_key))
                     return WALLY_EINVAL; /* invalid priv_key */
                 return WALLY_ERROR;     /* Nonce function failed */
             }
 
-            /* Note this function is documented as never failing */
-            secp256k1_ecdsa_recoverable_signature_serialize_compact(ctx, flags & EC_FLAG_RECOVERABLE ? bytes_out + 1 : bytes_out, &recid, &sig_secp);
-
-            if (!(flags & EC_FLAG_GRIND_R) || bytes_out[0] < 0x80) {
-                wally_clear(&sig_secp, sizeof(sig_secp));
+            if (!(flags & EC_FLAG_GRIND_R) || sig_out[0] < 0x80) {
                 /* Note the following assumes the key is compressed */
                 if (flags & EC_FLAG_RECOVERABLE) {
                     bytes_out[0] = 27 + recid + 4;
@@ -259,7 +411,11 @@ int wally_ec_sig_from_bytes(const unsigned char *priv_key, size_t priv_key_len,
 
                 return WALLY_OK;
             }
-            /* Incremement nonce to grind for low-R */
+            /* Incremement nonce to grind for low-R. Like Bitcoin Core, we
+             * pass a counter as extra entropy so that our signatures match.
+             * This re-derives the nonce from scratch each time, but that is
+             * cheap compared to the point multiplication that follows.
+             */
             entropy_p = extra_entropy;
             ++counter;
             uint32_to_le_bytes(counter, entropy_p);
@@ -267,15 +423,214 @@ int wally_ec_sig_from_bytes(const unsigned char *priv_key, size_t priv_key_len,
     }
 }
 
+/* Signature verification cache.
+ * Entries are salted hashes of successfully verified (type, pubkey,
+ * message, signature) tuples, stored in a fixed size open addressed table.
+ * An entry whose first 8 bytes are zero marks an empty slot.
+ */
+#define SIG_CACHE_PROBES 8 /* Maximum slots examined per lookup */
+
+struct sig_cache {
+    struct sha256_ctx salted; /* Hash state after absorbing the salt */
+    struct sha256 *entries;
+    size_t mask; /* Number of entries - 1 */
+    size_t hits; /* Number of lookups served from the cache */
+};
+
+static struct sig_cache *sig_cache = NULL;
+static uint64_t sig_cache_generation = 0; /* Incremented on each change */
+WALLY_MUTEX_DEFINE(sig_cache_mutex);
+
+static void sig_cache_free(struct sig_cache *cache)
+{
+    if (cache) {
+        wally_clear(cache->entries, (cache->mask + 1) * sizeof(*cache->entries));
+        wally_free(cache->entries);
+        wally_clear(cache, sizeof(*cache));
+        wally_free(cache);
+    }
+}
+
+int wally_ec_sig_cache_enable(const unsigned char *bytes, size_t bytes_len,
+                              size_t max_entries)
+{
+    struct sig_cache *cache, *old;
+    size_t num_entries = SIG_CACHE_PROBES;
+
+    if (!bytes || bytes_len != EC_SIG_CACHE_SALT_LEN ||
+        max_entries < SIG_CACHE_PROBES)
+        return WALLY_EINVAL;
+
+    while (num_entries * 2 <= max_entries)
+        num_entries *= 2;
+    if (num_entries > ((size_t)-1) / sizeof(struct sha256))
+        return WALLY_EINVAL;
+
+    if (!(cache = wally_malloc(sizeof(*cache))))
+        return WALLY_ENOMEM;
+    if (!(cache->entries = wally_malloc(num_entries * sizeof(*cache->entries)))) {
+        wally_free(cache);
+        return WALLY_ENOMEM;
+    }
+    wally_clear(cache->entries, num_entries * sizeof(*cache->entries));
+    cache->mask = num_entries - 1;
+    cache->hits = 0;
+
+    /* Fill a whole block with the salt so each lookup starts from a midstate */
+    sha256_init(&cache->salted);
+    sha256_update(&cache->salted, bytes, bytes_len);
+    sha256_update(&cache->salted, bytes, bytes_len);
+
+    wally_mutex_lock(&sig_cache_mutex);
+    old = sig_cache;
+    sig_cache = cache;
+    ++sig_cache_generation;
+    wally_mutex_unlock(&sig_cache_mutex);
+
+    sig_cache_free(old);
+    return WALLY_OK;
+}
+
+int wally_ec_sig_cache_disable(void)
+{
+    struct sig_cache *old;
+
+    wally_mutex_lock(&sig_cache_mutex);
+    old = sig_cache;
+    sig_cache = NULL;
+    ++sig_cache_generation;
+    wally_mutex_unlock(&sig_cache_mutex);
+
+    sig_cache_free(old);
+    return WALLY_OK;
+}
+
+int wally_ec_sig_cache_get_stats(size_t *hits, size_t *written)
+{
+    size_t i;
+
+    if (hits)
+        *hits = 0;
+    if (written)
+        *written = 0;
+    if (!hits || !written)
+        return WALLY_EINVAL;
+
+    wally_mutex_lock(&sig_cache_mutex);
+    if (sig_cache) {
+        *hits = sig_cache->hits;
+        for (i = 0; i <= sig_cache->mask; ++i) {
+            const struct sha256 *entry = sig_cache->entries + i;
+            if (entry->u.u32[0] || entry->u.u32[1])
+                ++*written;
+        }
+    }
+    wally_mutex_unlock(&sig_cache_mutex);
+    return WALLY_OK;
+}
+
+/* Compute the cache key for a signature. Returns false if caching is off */
+static bool sig_cache_get_key(uint32_t flags,
+                              const unsigned char *pub_key, size_t pub_key_len,
+                              const unsigned char *bytes,
+                              const unsigned char *sig, size_t sig_len,
+                              struct sha256 *key, uint64_t *generation)
+{
+    struct sha256_ctx ctx;
+    const unsigned char type = flags & EC_FLAGS_TYPES;
+    bool enabled;
+
+    wally_mutex_lock(&sig_cache_mutex);
+    if ((enabled = sig_cache != NULL)) {
+        memcpy(&ctx, &sig_cache->salted, sizeof(ctx));
+        *generation = sig_cache_generation;
+    }
+    wally_mutex_unlock(&sig_cache_mutex);
+    if (!enabled)
+        return false;
+
+    sha256_update(&ctx, &type, sizeof(type));
+    sha256_update(&ctx, pub_key, pub_key_len);
+    sha256_update(&ctx, bytes, EC_MESSAGE_HASH_LEN);
+    sha256_update(&ctx, sig, sig_len);
+    sha256_done(&ctx, key);
+    return true;
+}
+
+/* Look up a key in the cache, or insert it if 'insert' is true */
+static bool sig_cache_find(const struct sha256 *key, uint64_t generation,
+                           bool insert)
+{
+    size_t i, slot, home;
+    bool found = false;
+
+    wally_mutex_lock(&sig_cache_mutex);
+    if (sig_cache && generation == sig_cache_generation) {
+        home = key->u.u32[0] & sig_cache->mask;
+        for (i = 0; i < SIG_CACHE_PROBES && !found; ++i) {
+            struct sha256 *entry;
+            slot = (home + i) & sig_cache->mask;
+            entry = sig_cache->entries + slot;
+            if (!memcmp(entry, key, sizeof(*key)))
+                found = true;
+            else if (insert && !entry->u.u32[0] && !entry->u.u32[1]) {
+                memcpy(entry, key, sizeof(*key)); /* Empty slot */
+                found = true;
+            }
+        }
+        if (found && !insert)
+            ++sig_cache->hits;
+        else if (insert && !found) {
+            /* Evict a pseudo-randomly chosen entry from the probed slots */
+            slot = (home + key->u.u32[1] % SIG_CACHE_PROBES) & sig_cache->mask;
+            memcpy(sig_cache->entries + slot, key, sizeof(*key));
+            found = true;
+        }
+    }
+    wally_mutex_unlock(&sig_cache_mutex);
+    return found;
+}
+
+static bool ec_sig_verify(const secp256k1_context *ctx,
+                          const unsigned char *pub_key,
+                          const unsigned char *bytes, uint32_t flags,
+                          const unsigned char *sig)
+{
+    secp256k1_pubkey pub;
+    secp256k1_ecdsa_signature sig_secp;
+    struct sha256 cache_key;
+    uint64_t cache_generation;
+    bool cached, ok;
+
+    cached = sig_cache_get_key(flags, pub_key, EC_PUBLIC_KEY_LEN, bytes,
+                               sig, EC_SIGNATURE_LEN, &cache_key, &cache_generation);
+    if (cached && sig_cache_find(&cache_key, cache_generation, false))
+        return true; /* Previously verified */
+
+    ok = pubkey_parse(ctx, &pub, pub_key, EC_PUBLIC_KEY_LEN);
+
+    if (flags & EC_FLAG_SCHNORR_DRAFT) {
+        secp256k1_schnorrsig schnorr_sig;
+        ok = ok && secp256k1_schnorrsig_parse(ctx, &schnorr_sig, sig) &&
+             secp256k1_schnorrsig_verify(ctx, &schnorr_sig, bytes, &pub);
+        wally_clear(&schnorr_sig, sizeof(schnorr_sig));
+    } else
+        ok = ok && secp256k1_ecdsa_signature_parse_compact(ctx, &sig_secp, sig) &&
+             secp256k1_ecdsa_verify(ctx, &sig_secp, bytes, &pub);
+
+    if (ok && cached)
+        sig_cache_find(&cache_key, cache_generation, true);
+
+    wally_clear_2(&pub, sizeof(pub), &sig_secp, sizeof(sig_secp));
+    return ok;
+}
+
 int wally_ec_sig_verify(const unsigned char *pub_key, size_t pub_key_len,
                         const unsigned char *bytes, size_t bytes_len,
                         uint32_t flags,
                         const unsigned char *sig, size_t sig_len)
 {
-    secp256k1_pubkey pub;
-    secp256k1_ecdsa_signature sig_secp;
     const secp256k1_context *ctx = secp_ctx();
-    bool ok;
 
     if (!pub_key || pub_key_len != EC_PUBLIC_KEY_LEN ||
         !bytes || bytes_len != EC_MESSAGE_HASH_LEN ||
@@ -286,20 +641,141 @@ int wally_ec_sig_verify(const unsigned char *pub_key, size_t pub_key_len,
     if (!ctx)
         return WALLY_ENOMEM;
 
-    ok = pubkey_parse(ctx, &pub, pub_key, pub_key_len);
+    return ec_sig_verify(ctx, pub_key, bytes, flags, sig) ? WALLY_OK : WALLY_EINVAL;
+}
 
-    if (flags & EC_FLAG_SCHNORR)
-#if 0 /*FIXME: Schnorr is unavailable in secp for now*/
-        ok = ok && secp256k1_schnorr_verify(ctx, sig, bytes, &pub);
-#else
-        ok = false;
-#endif
-    else
-        ok = ok && secp256k1_ecdsa_signature_parse_compact(ctx, &sig_secp, sig) &&
-             secp256k1_ecdsa_verify(ctx, &sig_secp, bytes, &pub);
+struct sig_verify_batch {
+    const secp256k1_context *ctx;
+    const unsigned char *pub_key;
+    const unsigned char *bytes;
+    uint32_t flags;
+    const unsigned char *sig;
+    unsigned char *bits_out;
+};
+
+/* Verify a range of signatures. Ranges start on a byte boundary of the
+ * result bitmap, so concurrent jobs never write to the same byte.
+ */
+static void sig_verify_batch_job(void *p, size_t begin, size_t end)
+{
+    const struct sig_verify_batch *batch = p;
+    size_t i;
+
+    for (i = begin; i < end; ++i) {
+        if (ec_sig_verify(batch->ctx, batch->pub_key + i * EC_PUBLIC_KEY_LEN,
+                          batch->bytes + i * EC_MESSAGE_HASH_LEN, batch->flags,
+                          batch->sig + i * EC_SIGNATURE_LEN))
+            batch->bits_out[i / 8] |= 1 << (i % 8);
+    }
+}
 
-    wally_clear_2(&pub, sizeof(pub), &sig_secp, sizeof(sig_secp));
-    return ok ? WALLY_OK : WALLY_EINVAL;
+int wally_ec_sig_verify_batch(const unsigned char *pub_key, size_t pub_key_len,
+                              const unsigned char *bytes, size_t bytes_len,
+                              uint32_t flags,
+                              const unsigned char *sig, size_t sig_len,
+                              uint32_t num_threads,
+                              unsigned char *bytes_out, size_t len,
+                              size_t *written)
+{
+    const size_t num_sigs = pub_key_len / EC_PUBLIC_KEY_LEN;
+    struct sig_verify_batch batch;
+    size_t i, num_valid = 0;
+    int ret;
+
+    if (written)
+        *written = 0;
+
+    if (!pub_key || !num_sigs || pub_key_len % EC_PUBLIC_KEY_LEN ||
+        !bytes || bytes_len != num_sigs * EC_MESSAGE_HASH_LEN ||
+        !is_valid_ec_type(flags) || flags & ~EC_FLAGS_TYPES ||
+        !sig || sig_len != num_sigs * EC_SIGNATURE_LEN ||
+        !bytes_out || len < (num_sigs + 7) / 8 || !written)
+        return WALLY_EINVAL;
+
+    /* Verification does not modify the context, so workers can share ours */
+    if (!(batch.ctx = secp_ctx()))
+        return WALLY_ENOMEM;
+    batch.pub_key = pub_key;
+    batch.bytes = bytes;
+    batch.flags = flags;
+    batch.sig = sig;
+    batch.bits_out = bytes_out;
+
+    memset(bytes_out, 0, len);
+    ret = wally_run_parallel(sig_verify_batch_job, &batch, num_sigs, 8, num_threads);
+    if (ret == WALLY_OK) {
+        for (i = 0; i < num_sigs; ++i)
+            num_valid += (bytes_out[i / 8] >> (i % 8)) & 1;
+        *written = num_valid;
+    }
+    return ret;
+}
+
+/* Scratch space for batch verification. libsecp256k1 splits the
+ * multiplication into several when a batch does not fit.
+ */
+#define SCHNORR_BATCH_SCRATCH_SIZE (1024 * 1024)
+/* libsecp256k1 limits the number of signatures in one batch */
+#define SCHNORR_BATCH_MAX 0x7fffffff
+
+struct schnorr_batch_item {
+    secp256k1_pubkey pub;
+    secp256k1_schnorrsig sig;
+};
+
+int wally_schnorr_draft_sig_verify_batch(const unsigned char *pub_key, size_t pub_key_len,
+                                   const unsigned char *bytes, size_t bytes_len,
+                                   const unsigned char *sig, size_t sig_len)
+{
+    const secp256k1_context *ctx = secp_ctx();
+    const size_t num_sigs = pub_key_len / EC_PUBLIC_KEY_LEN;
+    secp256k1_scratch_space *scratch = NULL;
+    struct schnorr_batch_item *items;
+    const secp256k1_pubkey **pubs;
+    const secp256k1_schnorrsig **sigs;
+    const unsigned char **msgs;
+    size_t i, alloc_len;
+    bool ok = true;
+    int ret = WALLY_OK;
+
+    if (!pub_key || !num_sigs || pub_key_len % EC_PUBLIC_KEY_LEN ||
+        num_sigs > SCHNORR_BATCH_MAX ||
+        !bytes || bytes_len != num_sigs * EC_MESSAGE_HASH_LEN ||
+        !sig || sig_len != num_sigs * EC_SIGNATURE_LEN)
+        return WALLY_EINVAL;
+
+    if (!ctx)
+        return WALLY_ENOMEM;
+
+    alloc_len = num_sigs * (sizeof(*items) + sizeof(*pubs) + sizeof(*sigs) + sizeof(*msgs));
+    if (!(items = wally_malloc(alloc_len)))
+        return WALLY_ENOMEM;
+    pubs = (const secp256k1_pubkey **)(items + num_sigs);
+    sigs = (const secp256k1_schnorrsig **)(pubs + num_sigs);
+    msgs = (const unsigned char **)(sigs + num_sigs);
+
+    for (i = 0; ok && i < num_sigs; ++i) {
+        ok = pubkey_parse(ctx, &items[i].pub, pub_key + i * EC_PUBLIC_KEY_LEN, EC_PUBLIC_KEY_LEN) &&
+             secp256k1_schnorrsig_parse(ctx, &items[i].sig, sig + i * EC_SIGNATURE_LEN);
+        pubs[i] = &items[i].pub;
+        sigs[i] = &items[i].sig;
+        msgs[i] = bytes + i * EC_MESSAGE_HASH_LEN;
+    }
+
+    if (ok) {
+        scratch = secp256k1_scratch_space_create(ctx, SCHNORR_BATCH_SCRATCH_SIZE);
+        if (!scratch)
+            ret = WALLY_ENOMEM;
+        else {
+            ok = secp256k1_schnorrsig_verify_batch(ctx, scratch, sigs, msgs, pubs, num_sigs);
+            secp256k1_scratch_space_destroy(ctx, scratch);
+        }
+    }
+    if (ret == WALLY_OK && !ok)
+        ret = WALLY_EINVAL;
+
+    wally_free(items); /* No secrets to clear */
+    return ret;
 }
 
 int wally_ec_sig_to_public_key(const unsigned char *bytes, size_t bytes_len,
@@ -389,3 +865,150 @@ int wally_format_bitcoin_message(const unsigned char *bytes, size_t bytes_len,
     }
     return WALLY_OK;
 }
+
+/* Compute SHA256D of a message formatted as a bitcoin signed message,
+ * streaming the prefix and message into the hash without copying them */
+static void bitcoin_message_hash(const unsigned char *bytes, size_t bytes_len,
+                                 unsigned char *bytes_out)
+{
+    struct sha256_ctx sctx;
+    struct sha256 sha;
+    unsigned char len_buf[3];
+
+    len_buf[0] = bytes_len < 0xfd ? bytes_len : 0xfd;
+    len_buf[1] = bytes_len & 0xff;
+    len_buf[2] = bytes_len >> 8;
+
+    sha256_init(&sctx);
+    sha256_update(&sctx, MSG_PREFIX, sizeof(MSG_PREFIX) - 1);
+    if (bytes_len < 0xfd)
+        sha256_update(&sctx, len_buf, 1);
+    else
+        sha256_update(&sctx, len_buf, sizeof(len_buf));
+    sha256_update(&sctx, bytes, bytes_len);
+    sha256_done(&sctx, &sha);
+    sha256(&sha, &sha, sizeof(sha));
+    memcpy(bytes_out, &sha, sizeof(sha));
+}
+
+/* Check a recovered key against the address hash implied by the
+ * signature header byte */
+static bool recovered_hash_matches(const secp256k1_context *ctx,
+                                   const secp256k1_pubkey *pub,
+                                   unsigned char header,
+                                   const unsigned char *hash)
+{
+    unsigned char pub_key[EC_PUBLIC_KEY_UNCOMPRESSED_LEN];
+    unsigned char script[2 + HASH160_LEN], *hash160 = script + 2;
+    const bool compressed = header >= 31;
+    size_t pub_key_len = compressed ? EC_PUBLIC_KEY_LEN : sizeof(pub_key);
+
+    if (!pubkey_serialize(ctx, pub_key, &pub_key_len, pub,
+                          compressed ? PUBKEY_COMPRESSED : PUBKEY_UNCOMPRESSED) ||
+        wally_hash160(pub_key, pub_key_len, hash160, HASH160_LEN) != WALLY_OK)
+        return false;
+
+    if (header >= 35 && header <= 38) {
+        /* P2SH-P2WPKH: hash the witness program to get the script hash */
+        script[0] = OP_0;
+        script[1] = HASH160_LEN;
+        if (wally_hash160(script, sizeof(script), hash160, HASH160_LEN) != WALLY_OK)
+            return false;
+    }
+    return !memcmp(hash160, hash, HASH160_LEN);
+}
+
+struct message_recover_batch {
+    const secp256k1_context *ctx;
+    const unsigned char *const *messages;
+    const size_t *message_lens;
+    const unsigned char *sig;
+    const unsigned char *hashes;
+    unsigned char *pub_keys_out;
+    unsigned char *bits_out;
+};
+
+/* Hash and recover a range of messages. As for signature verification,
+ * ranges start on a byte boundary of the result bitmap.
+ */
+static void message_recover_batch_job(void *p, size_t begin, size_t end)
+{
+    const struct message_recover_batch *batch = p;
+    unsigned char msg_hash[SHA256_LEN];
+    secp256k1_pubkey pub;
+    secp256k1_ecdsa_recoverable_signature sig_secp;
+    size_t i, len_in_out;
+    bool ok;
+
+    for (i = begin; i < end; ++i) {
+        const unsigned char *sig = batch->sig + i * EC_SIGNATURE_RECOVERABLE_LEN;
+
+        bitcoin_message_hash(batch->messages[i], batch->message_lens[i], msg_hash);
+        ok = sig[0] >= 27 && sig[0] <= 42 &&
+             secp256k1_ecdsa_recoverable_signature_parse_compact(batch->ctx, &sig_secp,
+                                                                 &sig[1], (sig[0] - 27) & 3) &&
+             secp256k1_ecdsa_recover(batch->ctx, &pub, &sig_secp, msg_hash);
+
+        if (ok && batch->hashes)
+            ok = recovered_hash_matches(batch->ctx, &pub, sig[0],
+                                        batch->hashes + i * HASH160_LEN);
+        if (ok && batch->pub_keys_out) {
+            len_in_out = EC_PUBLIC_KEY_LEN;
+            ok = pubkey_serialize(batch->ctx, batch->pub_keys_out + i * EC_PUBLIC_KEY_LEN,
+                                  &len_in_out, &pub, PUBKEY_COMPRESSED);
+        }
+        if (ok)
+            batch->bits_out[i / 8] |= 1 << (i % 8);
+        else if (batch->pub_keys_out)
+            wally_clear(batch->pub_keys_out + i * EC_PUBLIC_KEY_LEN, EC_PUBLIC_KEY_LEN);
+    }
+    wally_clear_2(&pub, sizeof(pub), &sig_secp, sizeof(sig_secp));
+}
+
+int wally_bitcoin_message_recover_batch(const unsigned char *const *messages,
+                                        const size_t *message_lens,
+                                        size_t num_messages,
+                                        const unsigned char *sig, size_t sig_len,
+                                        const unsigned char *hashes, size_t hashes_len,
+                                        uint32_t num_threads,
+                                        unsigned char *pub_keys_out, size_t pub_keys_len,
+                                        unsigned char *bytes_out, size_t len,
+                                        size_t *written)
+{
+    struct message_recover_batch batch;
+    size_t i, num_valid = 0;
+    int ret;
+
+    if (written)
+        *written = 0;
+
+    if (!messages || !message_lens || !num_messages ||
+        !sig || sig_len != num_messages * EC_SIGNATURE_RECOVERABLE_LEN ||
+        (hashes ? hashes_len != num_messages * HASH160_LEN : hashes_len != 0) ||
+        (pub_keys_out ? pub_keys_len != num_messages * EC_PUBLIC_KEY_LEN : pub_keys_len != 0) ||
+        !bytes_out || len < (num_messages + 7) / 8 || !written)
+        return WALLY_EINVAL;
+
+    for (i = 0; i < num_messages; ++i)
+        if (!messages[i] || !message_lens[i] || message_lens[i] > BITCOIN_MESSAGE_MAX_LEN)
+            return WALLY_EINVAL;
+
+    /* Recovery does not modify the context, so workers can share ours */
+    if (!(batch.ctx = secp_ctx()))
+        return WALLY_ENOMEM;
+    batch.messages = messages;
+    batch.message_lens = message_lens;
+    batch.sig = sig;
+    batch.hashes = hashes;
+    batch.pub_keys_out = pub_keys_out;
+    batch.bits_out = bytes_out;
+
+    memset(bytes_out, 0, len);
+    ret = wally_run_parallel(message_recover_batch_job, &batch, num_messages, 8, num_threads);
+    if (ret == WALLY_OK) {
+        for (i = 0; i < num_messages; ++i)
+            num_valid += (bytes_out[i / 8] >> (i % 8)) & 1;
+        *written = num_valid;
+    }
+    return ret;
+}
@@ -369,6 +369,7 @@ static jbyteArray create_array(JNIEnv *jenv, const unsigned char* p, size_t len)
 %java_opaque_struct(wally_tx_input, 4);
 %java_opaque_struct(wally_tx_output, 5);
 %java_opaque_struct(wally_tx, 6);
+%java_opaque_struct(wally_musig_session, 7);
 
 /* Our wrapped functions return types */
 %returns_void__(bip32_key_free);
@@ -440,14 +441,29 @@ static jbyteArray create_array(JNIEnv *jenv, const unsigned char* p, size_t len)
 %returns_void__(wally_ec_public_key_verify);
 %returns_array_(wally_ec_public_key_decompress, 3, 4, EC_PUBLIC_KEY_UNCOMPRESSED_LEN);
 %returns_array_(wally_ec_public_key_negate, 3, 4, EC_PUBLIC_KEY_LEN);
+%returns_array_(wally_ec_public_key_combine, 5, 6, EC_PUBLIC_KEY_LEN);
 %returns_array_(wally_ec_public_key_from_private_key, 3, 4, EC_PUBLIC_KEY_LEN);
+%returns_void__(wally_ec_public_key_from_private_key_batch);
 %returns_array_check_flag(wally_ec_sig_from_bytes, 6, 7, jarg5, 8, EC_SIGNATURE_RECOVERABLE_LEN, EC_SIGNATURE_LEN);
 %returns_array_(wally_ec_sig_normalize, 3, 4, EC_SIGNATURE_LEN);
 %returns_array_(wally_ec_sig_from_der, 3, 4, EC_SIGNATURE_LEN);
 %returns_size_t(wally_ec_sig_to_der);
 %returns_array_(wally_ec_sig_to_public_key, 5, 6, EC_PUBLIC_KEY_LEN);
 %returns_void__(wally_ec_sig_verify);
+%returns_void__(wally_schnorr_draft_sig_verify_batch);
 %returns_array_(wally_ecdh, 5, 6, SHA256_LEN);
+%returns_void__(wally_ecdh_batch);
+%returns_array_(wally_musig_pubkey_combine, 3, 4, EC_PUBLIC_KEY_LEN);
+%returns_struct(wally_musig_session_init_alloc, wally_musig_session);
+%rename("musig_session_init") wally_musig_session_init_alloc;
+%returns_void__(wally_musig_session_free);
+%returns_array_(wally_musig_session_get_nonce_commitment, 2, 3, MUSIG_NONCE_COMMITMENT_LEN);
+%returns_array_(wally_musig_session_get_nonce, 4, 5, MUSIG_NONCE_LEN);
+%returns_void__(wally_musig_session_set_message);
+%returns_void__(wally_musig_session_set_nonces);
+%returns_array_(wally_musig_partial_sign, 2, 3, MUSIG_PARTIAL_SIG_LEN);
+%returns_void__(wally_musig_partial_sig_verify);
+%returns_array_(wally_musig_partial_sig_combine, 4, 5, EC_SIGNATURE_LEN);
 %returns_size_t(wally_format_bitcoin_message);
 %returns_array_(wally_hash160, 3, 4, HASH160_LEN);
 %returns_string(wally_hex_from_bytes);
@@ -478,6 +494,10 @@ static jbyteArray create_array(JNIEnv *jenv, const unsigned char* p, size_t len)
 %returns_size_t(wally_elements_pegin_contract_script_from_bytes);
 %returns_void__(wally_scrypt);
 %returns_void__(wally_secp_randomize);
+%returns_void__(wally_secp_thread_init);
+%returns_void__(wally_secp_thread_cleanup);
+%returns_size_t(wally_secp_get_ecmult_window);
+%returns_size_t(wally_secp_get_context_size);
 %returns_array_(wally_sha256, 3, 4, SHA256_LEN);
 %returns_array_(wally_sha256d, 3, 4, SHA256_LEN);
 %returns_array_(wally_sha256_midstate, 3, 4, SHA256_LEN);
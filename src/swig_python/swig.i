@@ -87,6 +87,7 @@ capsule_dtor(wally_tx, wally_tx_free)
 capsule_dtor(wally_tx_input, wally_tx_input_free)
 capsule_dtor(wally_tx_output, wally_tx_output_free)
 capsule_dtor(wally_tx_witness_stack, wally_tx_witness_stack_free)
+capsule_dtor(wally_musig_session, wally_musig_session_free)
 static void destroy_words(PyObject *obj) { (void)obj; }
 
 #define MAX_LOCAL_STACK 256u
@@ -333,6 +334,7 @@ static void destroy_words(PyObject *obj) { (void)obj; }
 %py_opaque_struct(wally_tx_input);
 %py_opaque_struct(wally_tx_output);
 %py_opaque_struct(wally_tx);
+%py_opaque_struct(wally_musig_session);
 
 %rename("bip32_key_from_parent") bip32_key_from_parent_alloc;
 %rename("bip32_key_from_parent_path") bip32_key_from_parent_path_alloc;
@@ -347,6 +349,7 @@ static void destroy_words(PyObject *obj) { (void)obj; }
 %rename("tx_init") wally_tx_init_alloc;
 %rename("tx_elements_input_init") wally_tx_elements_input_init_alloc;
 %rename("tx_elements_output_init") wally_tx_elements_output_init_alloc;
+%rename("musig_session_init") wally_musig_session_init_alloc;
 %rename("%(regex:/^wally_(.+)/\\1/)s", %$isfunction) "";
 
 %include "../include/wally_core.h"
@@ -375,6 +375,36 @@ class BIP32Tests(unittest.TestCase):
             self.assertEqual(bip32_key_serialize(key_out, flag, buf, buf_len), WALLY_OK)
             self.assertEqual(h(buf).upper(), exp_hex)
 
+    def test_base58_batch(self):
+        BIP32_BASE58_LEN, num_keys = 113, 5
+        master = self.create_master_pub_priv()[2]
+        keys = (ext_key * num_keys)()
+        for i in range(num_keys):
+            keys[i] = self.derive_key(master, i, FLAG_KEY_PRIVATE)
+        out, out_len = make_cbuffer('ff' * BIP32_BASE58_LEN * num_keys)
+
+        for flag in [FLAG_KEY_PRIVATE, FLAG_KEY_PUBLIC]:
+            ret = bip32_keys_to_base58(keys, num_keys, flag, out, out_len)
+            self.assertEqual(ret, WALLY_OK)
+            for i in range(num_keys):
+                ret, expected = bip32_key_to_base58(byref(keys[i]), flag)
+                self.assertEqual(ret, WALLY_OK)
+                slot = out[i * BIP32_BASE58_LEN:(i + 1) * BIP32_BASE58_LEN]
+                self.assertEqual(slot.split(b'\x00')[0], utf8(expected))
+
+        # Private serialization of a public key fails the whole batch
+        keys[2] = self.derive_key(master, 2, FLAG_KEY_PUBLIC)
+        for args in [
+            (keys, num_keys, FLAG_KEY_PRIVATE, out, out_len), # Public key in batch
+            (None, num_keys, FLAG_KEY_PUBLIC, out, out_len),  # Missing keys
+            (keys, 0, FLAG_KEY_PUBLIC, out, out_len),         # No keys
+            (keys, num_keys, 0x2, out, out_len),              # Unsupported flag
+            (keys, num_keys, FLAG_KEY_PUBLIC, None, out_len), # Missing output
+            (keys, num_keys, FLAG_KEY_PUBLIC, out, out_len - 1), # Bad output length
+        ]:
+            self.assertEqual(bip32_keys_to_base58(*args), WALLY_EINVAL)
+        self.assertEqual(out, b'\x00' * out_len)
+
     def test_strip_private_key(self):
         self.assertEqual(bip32_key_strip_private_key(None), WALLY_EINVAL)
 
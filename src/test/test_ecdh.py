@@ -44,6 +44,47 @@ class ECDHTests(unittest.TestCase):
             self.assertEqual(WALLY_EINVAL, wally_ecdh(*args))
             self.assertEqual(h(out), utf8('00'*32))
 
+    def test_ecdh_batch(self):
+        """Tests for batch ECDH"""
+        priv, _ = make_cbuffer('aa'*32)
+        pubs, expected = b'', b''
+        for i in range(1, 20):
+            pub = self.priv_to_pub(make_cbuffer('%02x' % i * 32)[0])
+            out, _ = make_cbuffer('00'*32)
+            ret = wally_ecdh(pub, len(pub), priv, len(priv), out, len(out))
+            self.assertEqual(ret, WALLY_OK)
+            pubs += pub
+            expected += out
+
+        for num_threads in [0, 1, 2, 4, 32]:
+            out, _ = make_cbuffer('00'*len(expected))
+            ret = wally_ecdh_batch(pubs, len(pubs), priv, len(priv), num_threads,
+                                   out, len(out))
+            self.assertEqual(ret, WALLY_OK)
+            self.assertEqual(out, expected)
+
+        out, _ = make_cbuffer('00'*len(expected))
+        priv_bad, _ = make_cbuffer('00'*32)
+        pubs_bad = pubs[:33] + make_cbuffer('02' + '00'*32)[0] + pubs[66:]
+        n = len(pubs)
+        for args in [
+            (None, n, priv, 32, 0, out, len(out)),       # Missing public keys
+            (pubs, 0, priv, 32, 0, out, len(out)),       # Empty public keys
+            (pubs, n - 1, priv, 32, 0, out, len(out)),   # Invalid public keys length
+            (pubs_bad, n, priv, 32, 0, out, len(out)),   # Invalid public key
+            (pubs, n, None, 32, 0, out, len(out)),       # Missing private key
+            (pubs, n, priv_bad, 32, 0, out, len(out)),   # Invalid private key
+            (pubs, n, priv, 31, 0, out, len(out)),       # Invalid private key length
+            (pubs, n, priv, 32, 0, None, len(out)),      # Missing output
+            (pubs, n, priv, 32, 0, out, len(out) - 32),  # Invalid output length
+        ]:
+            memmove(out, b'\xff' * len(out), len(out))
+            self.assertEqual(WALLY_EINVAL, wally_ecdh_batch(*args))
+            if args[5] is not None:
+                # The given output length is cleared on failure
+                cleared = '00' * args[6] + 'ff' * (len(out) - args[6])
+                self.assertEqual(h(out), utf8(cleared))
+
 
 if __name__ == '__main__':
     unittest.main()
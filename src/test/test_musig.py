@@ -0,0 +1,228 @@
+import unittest
+from util import *
+
+FLAG_SCHNORR_DRAFT = 2
+NUM_SIGNERS = 3
+MSG = '31' * 32
+
+
+class MuSigTests(unittest.TestCase):
+
+    def setUp(self):
+        self.privs, self.pubs = [], b''
+        for i in range(NUM_SIGNERS):
+            priv, _ = make_cbuffer('%02x' % (0x11 * (i + 1)) * 32)
+            pub, _ = make_cbuffer('00' * 33)
+            ret = wally_ec_public_key_from_private_key(priv, len(priv), pub, len(pub))
+            self.assertEqual(ret, WALLY_OK)
+            self.privs.append(priv)
+            self.pubs += pub
+
+    def combine(self, pubs):
+        out, _ = make_cbuffer('00' * 33)
+        ret = wally_musig_pubkey_combine(pubs, len(pubs), out, len(out))
+        return ret, out
+
+    def sha256(self, data):
+        out, _ = make_cbuffer('00' * 32)
+        self.assertEqual(wally_sha256(data, len(data), out, len(out)), WALLY_OK)
+        return out
+
+    def init_sessions(self, msg):
+        sessions = []
+        msg_len = 0 if msg is None else len(msg)
+        for i, priv in enumerate(self.privs):
+            session_id, _ = make_cbuffer('%02x' % (0xa0 + i) * 32)
+            session = c_void_p()
+            ret = wally_musig_session_init_alloc(self.pubs, len(self.pubs), i,
+                                                 priv, len(priv),
+                                                 session_id, len(session_id),
+                                                 msg, msg_len, byref(session))
+            self.assertEqual(ret, WALLY_OK)
+            sessions.append(session)
+        return sessions
+
+    def exchange_nonces(self, sessions):
+        commitments = b''
+        for session in sessions:
+            commitment, _ = make_cbuffer('00' * 32)
+            ret = wally_musig_session_get_nonce_commitment(session, commitment, len(commitment))
+            self.assertEqual(ret, WALLY_OK)
+            commitments += commitment
+        nonces = b''
+        for session in sessions:
+            nonce, _ = make_cbuffer('00' * 33)
+            ret = wally_musig_session_get_nonce(session, commitments, len(commitments),
+                                                nonce, len(nonce))
+            self.assertEqual(ret, WALLY_OK)
+            nonces += nonce
+        return commitments, nonces
+
+    def partial_sign(self, sessions):
+        partial_sigs = b''
+        for session in sessions:
+            partial_sig, _ = make_cbuffer('00' * 32)
+            ret = wally_musig_partial_sign(session, partial_sig, len(partial_sig))
+            self.assertEqual(ret, WALLY_OK)
+            partial_sigs += partial_sig
+        return partial_sigs
+
+    def test_pubkey_combine(self):
+        """Test MuSig key aggregation against the module's coefficient scheme"""
+        # ell = SHA256(pk_0 || ... || pk_n-1), coefficient_i =
+        # SHA256(tag || tag || ell || i as 4 bytes little endian)
+        # where tag = SHA256("MuSig coefficient")
+        tag = self.sha256(b'MuSig coefficient')
+        ell = self.sha256(self.pubs)
+        scalars = b''
+        for i in range(NUM_SIGNERS):
+            scalars += self.sha256(tag + tag + ell + bytes([i, 0, 0, 0]))
+        expected, _ = make_cbuffer('00' * 33)
+        ret = wally_ec_public_key_combine(self.pubs, len(self.pubs), scalars, len(scalars),
+                                          expected, len(expected))
+        self.assertEqual(ret, WALLY_OK)
+        ret, combined = self.combine(self.pubs)
+        self.assertEqual((ret, combined), (WALLY_OK, expected))
+
+        # The order of the keys changes the combined key
+        ret, reordered = self.combine(self.pubs[33:] + self.pubs[:33])
+        self.assertEqual(ret, WALLY_OK)
+        self.assertNotEqual(reordered, combined)
+
+        out, _ = make_cbuffer('00' * 33)
+        bad_pubs = self.pubs[:33] + make_cbuffer('02' + '00' * 32)[0]
+        for args in [
+            (None, len(self.pubs), out, len(out)),       # Missing public keys
+            (self.pubs, 0, out, len(out)),               # Empty public keys
+            (self.pubs, len(self.pubs) - 1, out, len(out)),  # Bad public keys length
+            (bad_pubs, len(bad_pubs), out, len(out)),    # Invalid public key
+            (self.pubs, len(self.pubs), None, len(out)), # Missing output
+            (self.pubs, len(self.pubs), out, len(out) - 1),  # Bad output length
+        ]:
+            self.assertEqual(wally_musig_pubkey_combine(*args), WALLY_EINVAL)
+
+    def test_sign(self):
+        """Test a full MuSig signing session"""
+        msg, _ = make_cbuffer(MSG)
+        ret, combined = self.combine(self.pubs)
+        self.assertEqual(ret, WALLY_OK)
+
+        for set_msg_later in [False, True]:
+            sessions = self.init_sessions(None if set_msg_later else msg)
+            _, nonces = self.exchange_nonces(sessions)
+            for session in sessions:
+                self.assertEqual(wally_musig_session_set_nonces(session, nonces, len(nonces)),
+                                 WALLY_OK)
+                if set_msg_later:
+                    ret = wally_musig_session_set_message(session, msg, len(msg))
+                    self.assertEqual(ret, WALLY_OK)
+                # The message can only be set once
+                ret = wally_musig_session_set_message(session, msg, len(msg))
+                self.assertEqual(ret, WALLY_EINVAL)
+
+            partial_sigs = self.partial_sign(sessions)
+            for i in range(NUM_SIGNERS):
+                partial_sig = partial_sigs[i * 32:(i + 1) * 32]
+                for session in sessions:
+                    ret = wally_musig_partial_sig_verify(session, i, partial_sig, 32)
+                    self.assertEqual(ret, WALLY_OK)
+                # A partial signature only verifies for its own signer
+                other = (i + 1) % NUM_SIGNERS
+                ret = wally_musig_partial_sig_verify(sessions[0], other, partial_sig, 32)
+                self.assertEqual(ret, WALLY_EINVAL)
+
+            sig, _ = make_cbuffer('00' * 64)
+            for session in sessions:
+                ret = wally_musig_partial_sig_combine(session, partial_sigs, len(partial_sigs),
+                                                      sig, len(sig))
+                self.assertEqual(ret, WALLY_OK)
+                ret = wally_ec_sig_verify(combined, len(combined), msg, len(msg),
+                                          FLAG_SCHNORR_DRAFT, sig, len(sig))
+                self.assertEqual(ret, WALLY_OK)
+
+            # A bad partial signature produces an invalid signature
+            bad_sigs = partial_sigs[:32] + partial_sigs[:32] + partial_sigs[64:]
+            ret = wally_musig_partial_sig_combine(sessions[0], bad_sigs, len(bad_sigs),
+                                                  sig, len(sig))
+            self.assertEqual(ret, WALLY_OK)
+            ret = wally_ec_sig_verify(combined, len(combined), msg, len(msg),
+                                      FLAG_SCHNORR_DRAFT, sig, len(sig))
+            self.assertEqual(ret, WALLY_EINVAL)
+
+            for session in sessions:
+                self.assertEqual(wally_musig_session_free(session), WALLY_OK)
+
+    def test_invalid(self):
+        """Test invalid MuSig session arguments and state"""
+        msg, _ = make_cbuffer(MSG)
+        priv, pubs = self.privs[0], self.pubs
+        session_id, _ = make_cbuffer('a0' * 32)
+        session = c_void_p()
+        for args in [
+            (None, len(pubs), 0, priv, 32, session_id, 32, msg, 32),        # Missing keys
+            (pubs, len(pubs) - 1, 0, priv, 32, session_id, 32, msg, 32),    # Bad keys length
+            (pubs, len(pubs), NUM_SIGNERS, priv, 32, session_id, 32, msg, 32), # Bad index
+            (pubs, len(pubs), 1, priv, 32, session_id, 32, msg, 32),        # Key not at index
+            (pubs, len(pubs), 0, None, 32, session_id, 32, msg, 32),        # Missing priv key
+            (pubs, len(pubs), 0, priv, 31, session_id, 32, msg, 32),        # Bad priv key length
+            (pubs, len(pubs), 0, priv, 32, None, 32, msg, 32),              # Missing session id
+            (pubs, len(pubs), 0, priv, 32, session_id, 31, msg, 32),        # Bad session id length
+            (pubs, len(pubs), 0, priv, 32, session_id, 32, msg, 31),        # Bad message length
+            (pubs, len(pubs), 0, priv, 32, session_id, 32, None, 32),       # Missing message
+        ]:
+            ret = wally_musig_session_init_alloc(*args, byref(session))
+            self.assertEqual((ret, session.value), (WALLY_EINVAL, None))
+        ret = wally_musig_session_init_alloc(pubs, len(pubs), 0, priv, 32, session_id, 32,
+                                             msg, 32, None)
+        self.assertEqual(ret, WALLY_EINVAL)
+
+        sessions = self.init_sessions(msg)
+        out, _ = make_cbuffer('00' * 33)
+        # Nonces cannot be fetched without every commitment
+        ret = wally_musig_session_get_nonce(sessions[0], out, 32, out, 33)
+        self.assertEqual(ret, WALLY_EINVAL)
+        # Signing requires combined nonces
+        self.assertEqual(wally_musig_partial_sign(sessions[0], out, 32), WALLY_EINVAL)
+
+        commitments, nonces = self.exchange_nonces(sessions)
+        # Nonces must match their commitments
+        bad_nonces = nonces[33:66] + nonces[33:]
+        ret = wally_musig_session_set_nonces(sessions[0], bad_nonces, len(bad_nonces))
+        self.assertEqual(ret, WALLY_EINVAL)
+        for args in [
+            (None, nonces, len(nonces)),             # Missing session
+            (sessions[1], None, len(nonces)),        # Missing nonces
+            (sessions[1], nonces, len(nonces) - 33), # Too few nonces
+        ]:
+            self.assertEqual(wally_musig_session_set_nonces(*args), WALLY_EINVAL)
+        self.assertEqual(wally_musig_session_set_nonces(sessions[1], nonces, len(nonces)),
+                         WALLY_OK)
+
+        partial_sig, _ = make_cbuffer('00' * 32)
+        self.assertEqual(wally_musig_partial_sign(sessions[1], partial_sig, 32), WALLY_OK)
+        for args in [
+            (None, 1, partial_sig, 32),                 # Missing session
+            (sessions[1], NUM_SIGNERS, partial_sig, 32), # Bad index
+            (sessions[1], 1, None, 32),                 # Missing partial sig
+            (sessions[1], 1, partial_sig, 31),          # Bad partial sig length
+        ]:
+            self.assertEqual(wally_musig_partial_sig_verify(*args), WALLY_EINVAL)
+
+        sig, _ = make_cbuffer('00' * 64)
+        partial_sigs = partial_sig * NUM_SIGNERS
+        for args in [
+            (None, partial_sigs, len(partial_sigs), sig, 64),           # Missing session
+            (sessions[1], None, len(partial_sigs), sig, 64),            # Missing partial sigs
+            (sessions[1], partial_sigs, len(partial_sigs) - 32, sig, 64), # Too few partial sigs
+            (sessions[1], partial_sigs, len(partial_sigs), None, 64),   # Missing output
+            (sessions[1], partial_sigs, len(partial_sigs), sig, 63),    # Bad output length
+        ]:
+            self.assertEqual(wally_musig_partial_sig_combine(*args), WALLY_EINVAL)
+
+        for session in sessions:
+            self.assertEqual(wally_musig_session_free(session), WALLY_OK)
+        self.assertEqual(wally_musig_session_free(None), WALLY_OK)
+
+
+if __name__ == '__main__':
+    unittest.main()
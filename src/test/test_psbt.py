@@ -1,10 +1,14 @@
 import binascii
 import base64
+import hashlib
 import json
 import os
 import unittest
 from util import *
 
+WALLY_PSBT_IN_PARTIAL_SIG = 0x02
+WALLY_PSBT_OUT_BIP32_DERIVATION = 0x02
+
 class PSBTTests(unittest.TestCase):
 
     def test_serialization(self):
@@ -107,5 +111,630 @@ class PSBTTests(unittest.TestCase):
             self.assertEqual(WALLY_OK, ret)
             self.assertEqual(extractor['result'], reser)
 
+    def test_from_bytes_bounds(self):
+        """Testing that parsing consumes exactly the serialized bytes"""
+        with open(os.path.join(os.path.dirname(os.path.realpath(__file__)), 'data/psbt.json')) as f:
+            valids = json.load(f)['valid']
+
+        for valid in valids:
+            raw = base64.b64decode(valid['psbt'])
+            psbt = pointer(wally_psbt())
+            self.assertEqual(WALLY_OK, wally_psbt_from_bytes(raw, len(raw), psbt))
+            ret, written = wally_psbt_to_bytes(psbt, raw, len(raw))
+            self.assertEqual((ret, written), (WALLY_OK, len(raw)))
+            self.assertEqual(WALLY_OK, wally_psbt_free(psbt))
+
+            extended = raw + b'\x00'
+            for data, data_len in [(extended, len(extended)), # Trailing data
+                                   (raw, len(raw) - 1)]:      # Truncated
+                self.assertEqual(WALLY_EINVAL, wally_psbt_from_bytes(data, data_len, psbt))
+
+            # Truncating anywhere must fail without reading past the end
+            for i in range(len(raw)):
+                truncated = raw[:i]
+                self.assertEqual(WALLY_EINVAL, wally_psbt_from_bytes(truncated, i, psbt))
+
+            # Corrupt each byte with large varint prefixes and garbage. The
+            # result may still parse, but must not read out of bounds
+            for i in range(5, len(raw)):
+                for b in [0xfd, 0xfe, 0xff, 0x00, raw[i] ^ 0x80]:
+                    corrupt = raw[:i] + bytes([b]) + raw[i + 1:]
+                    if wally_psbt_from_bytes(corrupt, len(corrupt), psbt) == WALLY_OK:
+                        self.assertEqual(WALLY_OK, wally_psbt_free(psbt))
+
+    def test_base64(self):
+        """Testing base64 encoding and decoding"""
+        with open(os.path.join(os.path.dirname(os.path.realpath(__file__)), 'data/psbt.json')) as f:
+            valids = json.load(f)['valid']
+
+        for valid in valids:
+            b64 = valid['psbt']
+            raw = base64.b64decode(b64)
+            self.assertEqual(base64.b64encode(raw).decode('utf-8'), b64)
+            # Trailing padding is optional
+            for s in [b64, b64.rstrip('=')]:
+                psbt = pointer(wally_psbt())
+                self.assertEqual(WALLY_OK, wally_psbt_from_base64(s.encode('utf-8'), psbt))
+                ret, reser = wally_psbt_to_base64(psbt)
+                self.assertEqual((ret, reser), (WALLY_OK, b64))
+            # Invalid characters and padding are rejected wherever they occur
+            # Cover each position within a group, including the last group
+            mid = len(b64) // 8 * 4
+            end = len(b64.rstrip('=')) - 1
+            for i in [0, 1, 2, 3, mid, mid + 1, mid + 2, mid + 3, end]:
+                for c in '=*\n':
+                    bad = b64[:i] + c + b64[i + 1:]
+                    self.assertEqual(WALLY_EINVAL, wally_psbt_from_base64(bad.encode('utf-8'), psbt))
+
+    def test_base64_chunks(self):
+        """Testing base64 decoding of PSBTs spanning several decode chunks"""
+        CHUNK_LEN = 4096 # Characters decoded at a time
+        raw = self._make_signed_psbt(40)
+        b64 = base64.b64encode(raw).decode('utf-8')
+        self.assertGreater(len(b64), CHUNK_LEN * 2)
+
+        psbt = pointer(wally_psbt())
+        for s in [b64, b64.rstrip('=')]:
+            self.assertEqual(WALLY_OK, wally_psbt_from_base64(s.encode('utf-8'), psbt))
+            self.assertEqual((WALLY_OK, b64), wally_psbt_to_base64(psbt))
+            self.assertEqual(WALLY_OK, wally_psbt_free(psbt))
+
+        # Truncation, invalid characters and padding are rejected around
+        # chunk boundaries as well as at the end
+        boundaries = [CHUNK_LEN, CHUNK_LEN * 2, len(b64)]
+        for i in [n + d for n in boundaries for d in range(-5, 5) if n + d < len(b64)]:
+            truncated = b64[:i]
+            ret = wally_psbt_from_base64(truncated.encode('utf-8'), psbt)
+            self.assertEqual(ret, WALLY_OK if truncated.rstrip('=') == b64.rstrip('=') else WALLY_EINVAL)
+            if i >= len(b64.rstrip('=')):
+                continue
+            for c in '=*':
+                bad = b64[:i] + c + b64[i + 1:]
+                self.assertEqual(WALLY_EINVAL, wally_psbt_from_base64(bad.encode('utf-8'), psbt))
+
+        # Trailing data after the last map is rejected
+        extended = base64.b64encode(raw + b'\x00').decode('utf-8')
+        self.assertEqual(WALLY_EINVAL, wally_psbt_from_base64(extended.encode('utf-8'), psbt))
+
+    def test_sign_keys(self):
+        """Testing signing with several keys at once"""
+        with open(os.path.join(os.path.dirname(os.path.realpath(__file__)), 'data/psbt.json')) as f:
+            d = json.load(f)
+
+        def get_keys(privkeys):
+            keys = b''
+            for priv in privkeys:
+                buf, buf_len = make_cbuffer('00'*32)
+                self.assertEqual(WALLY_OK, wally_wif_to_bytes(priv.encode('utf-8'), 0xEF, 0, buf, buf_len))
+                keys += buf
+            return keys
+
+        for signer in d['signer']:
+            keys = get_keys(signer['privkeys'])
+            # Signing with repeated keys adds each signature only once
+            for k in [keys, keys + keys]:
+                psbt = pointer(wally_psbt())
+                self.assertEqual(WALLY_OK, wally_psbt_from_base64(signer['psbt'].encode('utf-8'), psbt))
+                self.assertEqual(WALLY_OK, wally_sign_psbt_keys(psbt, k, len(k)))
+                ret, reser = wally_psbt_to_base64(psbt)
+                self.assertEqual((ret, reser), (WALLY_OK, signer['result']))
+
+        for inval_signer in d['inval_signer']:
+            keys = get_keys(inval_signer['privkeys'])
+            psbt = pointer(wally_psbt())
+            self.assertEqual(WALLY_OK, wally_psbt_from_base64(inval_signer['psbt'].encode('utf-8'), psbt))
+            self.assertEqual(WALLY_EINVAL, wally_sign_psbt_keys(psbt, keys, len(keys)))
+
+        keys = get_keys(d['signer'][0]['privkeys'])
+        for k, k_len in [(None, 32),         # NULL keys
+                         (keys, 0),          # Empty keys
+                         (keys, 33),         # Length not a multiple of the key length
+                         (b'\x00' * 32, 32)]: # Invalid private key
+            self.assertEqual(WALLY_EINVAL, wally_sign_psbt_keys(psbt, k, k_len))
+
+    def test_finalize_and_extract(self):
+        """Testing finalizing and extracting in one call"""
+        with open(os.path.join(os.path.dirname(os.path.realpath(__file__)), 'data/psbt.json')) as f:
+            d = json.load(f)
+
+        cases = [(f['finalize'], None) for f in d['finalizer']] + \
+                [(e['extract'], e['result']) for e in d['extractor']]
+        for b64, expected in cases:
+            if expected is None:
+                # Compare to finalizing and extracting separately
+                psbt, tx = pointer(wally_psbt()), pointer(wally_tx())
+                self.assertEqual(WALLY_OK, wally_psbt_from_base64(b64.encode('utf-8'), psbt))
+                self.assertEqual(WALLY_OK, wally_finalize_psbt(psbt))
+                self.assertEqual(WALLY_OK, wally_extract_psbt(psbt, tx))
+                ret, expected = wally_tx_to_hex(tx, 1)
+                self.assertEqual(WALLY_OK, ret)
+
+            for num_threads in [0, 1, 4]:
+                psbt, tx = pointer(wally_psbt()), pointer(wally_tx())
+                self.assertEqual(WALLY_OK, wally_psbt_from_base64(b64.encode('utf-8'), psbt))
+                self.assertEqual(WALLY_OK, wally_finalize_and_extract_psbt(psbt, num_threads, tx))
+                ret, reser = wally_tx_to_hex(tx, 1)
+                self.assertEqual((ret, reser), (WALLY_OK, expected))
+                # The final scripts were moved into the tx
+                for i in range(psbt.contents.num_inputs):
+                    self.assertFalse(psbt.contents.inputs[i].final_script_sig)
+                    self.assertFalse(psbt.contents.inputs[i].final_witness)
+
+        # Unsigned inputs cannot be finalized
+        psbt, tx = pointer(wally_psbt()), pointer(wally_tx())
+        self.assertEqual(WALLY_OK, wally_psbt_from_base64(d['signer'][0]['psbt'].encode('utf-8'), psbt))
+        self.assertEqual(WALLY_EINVAL, wally_finalize_and_extract_psbt(psbt, 1, tx))
+        self.assertEqual(WALLY_EINVAL, wally_finalize_and_extract_psbt(None, 1, tx))
+
+    def _make_signed_psbt(self, num_inputs, non_witness=False, signed=True):
+        """Return a serialized PSBT spending num_inputs signed outputs.
+           Input i spends output i of its prevout, so most spend an output
+           index larger than the number of outputs in the PSBT tx.
+           If signed is False, inputs have a keypath instead of a signature"""
+        priv_key, pub_key, sig, der = make_cbuffer('11' * 32)[0], *[make_cbuffer('00' * n)[0] for n in [33, 64, 72]]
+        self.assertEqual(WALLY_OK, wally_ec_public_key_from_private_key(priv_key, 32, pub_key, 33))
+        self.assertEqual(WALLY_OK, wally_ec_sig_from_bytes(priv_key, 32, b'\x22' * 32, 32, 1, sig, 64))
+        ret, der_len = wally_ec_sig_to_der(sig, 64, der, 72)
+        self.assertEqual(WALLY_OK, ret)
+        pkh = make_cbuffer('00' * 20)[0]
+        self.assertEqual(WALLY_OK, wally_hash160(pub_key, 33, pkh, 20))
+        sig_value = der[:der_len] + b'\x01'
+
+        varint = lambda n: bytes([n]) if n < 0xfd else b'\xfd' + n.to_bytes(2, 'little')
+        varbuff = lambda b: varint(len(b)) + b
+        u32, u64 = lambda v: v.to_bytes(4, 'little'), lambda v: v.to_bytes(8, 'little')
+        if non_witness:
+            script = b'\x76\xa9\x14' + pkh + b'\x88\xac' # P2PKH
+        else:
+            script = b'\x00\x14' + pkh # P2WPKH
+        # A prevout tx with a single output
+        prev_tx = u32(2) + b'\x01' + b'\x00' * 36 + b'\x00' + u32(0xffffffff) + \
+                  b'\x01' + u64(1000) + varbuff(script) + u32(0)
+        prev_txid = hashlib.sha256(hashlib.sha256(prev_tx).digest()).digest()
+        tx = u32(2) + bytes([num_inputs])
+        for i in range(num_inputs):
+            txhash = prev_txid if non_witness else bytes([i]) * 32
+            tx += txhash + u32(i) + b'\x00' + u32(0xffffffff)
+        tx += b'\x01' + u64(500) + varbuff(script) + u32(0)
+
+        raw = b'psbt\xff' + varbuff(b'\x00') + varbuff(tx) + b'\x00'
+        for i in range(num_inputs):
+            if non_witness:
+                raw += varbuff(b'\x00') + varbuff(prev_tx)
+            else:
+                raw += varbuff(b'\x01') + varbuff(u64(1000) + varbuff(script))
+            if signed:
+                raw += varbuff(b'\x02' + bytes(pub_key)) + varbuff(sig_value)
+            else:
+                raw += varbuff(b'\x06' + bytes(pub_key)) + varbuff(b'\x00' * 4 + u32(0))
+            raw += b'\x00'
+        return raw + b'\x00'
+
+    def test_finalize_and_extract_threads(self):
+        """Testing finalizing and extracting enough inputs to use threads"""
+        raw = self._make_signed_psbt(40)
+        psbt, tx = pointer(wally_psbt()), pointer(wally_tx())
+        self.assertEqual(WALLY_OK, wally_psbt_from_bytes(raw, len(raw), psbt))
+        self.assertEqual(WALLY_OK, wally_finalize_psbt(psbt))
+        self.assertEqual(WALLY_OK, wally_extract_psbt(psbt, tx))
+        ret, expected = wally_tx_to_hex(tx, 1)
+        self.assertEqual(WALLY_OK, ret)
+
+        for num_threads in [0, 1, 2, 4, 64]:
+            psbt, tx = pointer(wally_psbt()), pointer(wally_tx())
+            self.assertEqual(WALLY_OK, wally_psbt_from_bytes(raw, len(raw), psbt))
+            self.assertEqual(WALLY_OK, wally_finalize_and_extract_psbt(psbt, num_threads, tx))
+            ret, reser = wally_tx_to_hex(tx, 1)
+            self.assertEqual((ret, reser), (WALLY_OK, expected))
+
+        # Non-witness utxos that don't have the spent output can't be finalized
+        raw = self._make_signed_psbt(40, non_witness=True)
+        for num_threads in [1, 4]:
+            psbt, tx = pointer(wally_psbt()), pointer(wally_tx())
+            self.assertEqual(WALLY_OK, wally_psbt_from_bytes(raw, len(raw), psbt))
+            self.assertEqual(WALLY_EINVAL, wally_finalize_and_extract_psbt(psbt, num_threads, tx))
+        self.assertEqual(WALLY_EINVAL, wally_finalize_psbt(psbt))
+
+    def test_sign_prevout_index(self):
+        """Testing signing inputs whose prevout index is out of range"""
+        # Input 0 spends the only output of its non witness UTXO, input 1
+        # spends a non-existent second output
+        raw = self._make_signed_psbt(2, non_witness=True, signed=False)
+        key = make_cbuffer('11' * 32)[0]
+        for sign_fn in [wally_sign_psbt, wally_sign_psbt_keys]:
+            psbt = pointer(wally_psbt())
+            self.assertEqual(WALLY_OK, wally_psbt_from_bytes(raw, len(raw), psbt))
+            self.assertEqual(WALLY_EINVAL, sign_fn(psbt, key, len(key)))
+            self.assertEqual(WALLY_OK, wally_psbt_free(psbt))
+
+        # With only the valid input, signing succeeds
+        raw = self._make_signed_psbt(1, non_witness=True, signed=False)
+        for sign_fn in [wally_sign_psbt, wally_sign_psbt_keys]:
+            psbt = pointer(wally_psbt())
+            self.assertEqual(WALLY_OK, wally_psbt_from_bytes(raw, len(raw), psbt))
+            self.assertEqual(WALLY_OK, sign_fn(psbt, key, len(key)))
+            self.assertEqual(psbt.contents.inputs[0].partial_sigs.contents.num_items, 1)
+            self.assertEqual(WALLY_OK, wally_psbt_free(psbt))
+
+    def _get_partial_sigs(self, psbt):
+        """Return the partial signatures of each input as a dict of pubkey to sig"""
+        sigs = []
+        for i in range(psbt.contents.num_inputs):
+            m = psbt.contents.inputs[i].partial_sigs
+            items = [m.contents.items[j] for j in range(m.contents.num_items)] if m else []
+            sigs.append({bytes(item.pubkey): string_at(item.sig, item.sig_len) for item in items})
+        return sigs
+
+    def test_sign_bip32(self):
+        """Testing signing with keys derived from a BIP32 root"""
+        with open(os.path.join(os.path.dirname(os.path.realpath(__file__)), 'data/psbt.json')) as f:
+            signers = json.load(f)['signer']
+
+        # The master key the BIP 174 test vector keys are derived from
+        master = ext_key()
+        self.assertEqual(WALLY_OK, bip32_key_from_base58(('tprv8ZgxMBicQKsPd9TeAdPADNnSyH9SSUUbTVeFszDE23Ki6TBB5nCefAdHkK8Fm3qMQR6sHwA56zqRmKmxnHk37JkiFzvncDqoKmPWubu7hDF').encode('utf-8'), byref(master)))
+
+        # Signing with the master key produces the signatures of both signers
+        expected = [{}, {}]
+        for signer in signers[:2]:
+            psbt = pointer(wally_psbt())
+            self.assertEqual(WALLY_OK, wally_psbt_from_base64(signer['result'].encode('utf-8'), psbt))
+            for i, sigs in enumerate(self._get_partial_sigs(psbt)):
+                expected[i].update(sigs)
+
+        psbt = pointer(wally_psbt())
+        self.assertEqual(WALLY_OK, wally_psbt_from_base64(signers[0]['psbt'].encode('utf-8'), psbt))
+        self.assertEqual(WALLY_OK, wally_sign_psbt_bip32(psbt, byref(master)))
+        self.assertEqual(self._get_partial_sigs(psbt), expected)
+        self.assertEqual([len(sigs) for sigs in expected], [2, 2])
+
+        # A key with a different fingerprint signs nothing (0x04358394 is
+        # the testnet private version)
+        seed, seed_len = make_cbuffer('01' * 32)
+        other = ext_key()
+        self.assertEqual(WALLY_OK, bip32_key_from_seed(seed, seed_len, 0x04358394, 0, byref(other)))
+        psbt = pointer(wally_psbt())
+        self.assertEqual(WALLY_OK, wally_psbt_from_base64(signers[0]['psbt'].encode('utf-8'), psbt))
+        self.assertEqual(WALLY_OK, wally_sign_psbt_bip32(psbt, byref(other)))
+        self.assertEqual(self._get_partial_sigs(psbt), [{}, {}])
+
+        # Public keys cannot sign (0x1 is BIP32_FLAG_KEY_PUBLIC)
+        public = ext_key()
+        self.assertEqual(WALLY_OK, bip32_key_from_parent(byref(master), 0, 0x1, byref(public)))
+        # Only master keys can be matched to keypath origins
+        account = ext_key()
+        self.assertEqual(WALLY_OK, bip32_key_from_parent(byref(master), 0, 0x0, byref(account)))
+        for p, k in [(None, byref(master)), (psbt, None), (psbt, byref(public)), (psbt, byref(account))]:
+            self.assertEqual(WALLY_EINVAL, wally_sign_psbt_bip32(p, k))
+
+        # A key listed in both its compressed and uncompressed forms signs
+        # each input only once, as does signing again, so the result parses
+        psbt = pointer(wally_psbt())
+        self.assertEqual(WALLY_OK, wally_psbt_from_base64(signers[0]['psbt'].encode('utf-8'), psbt))
+        keypaths = psbt.contents.inputs[0].keypaths
+        item = keypaths.contents.items[0]
+        path = cast(item.origin.items, POINTER(c_uint))
+        uncomp_pubkey = make_cbuffer('00' * 65)[0]
+        self.assertEqual(WALLY_OK, wally_ec_public_key_decompress(bytes(item.pubkey[:33]), 33, uncomp_pubkey, 65))
+        self.assertEqual(WALLY_OK, wally_add_new_keypath(keypaths, uncomp_pubkey, 65,
+                                                         bytes(item.origin.fingerprint), 4,
+                                                         path, item.origin.path_len))
+        for _ in range(2):
+            self.assertEqual(WALLY_OK, wally_sign_psbt_bip32(psbt, byref(master)))
+            self.assertEqual([psbt.contents.inputs[i].partial_sigs.contents.num_items for i in range(2)], [2, 2])
+        ret, b64 = wally_psbt_to_base64(psbt)
+        self.assertEqual(WALLY_OK, ret)
+        self.assertEqual(WALLY_OK, wally_psbt_from_base64(b64.encode('utf-8'), pointer(wally_psbt())))
+
+    def _set_input_maps(self, psbt, key_range):
+        """Set keypaths and partial sigs for the given keys on the first input"""
+        keypaths, sigs = pointer(keypath_map()), pointer(partial_sigs_map())
+        self.assertEqual(WALLY_OK, wally_keypath_map_init_alloc(0, keypaths))
+        self.assertEqual(WALLY_OK, wally_partial_sigs_map_init_alloc(0, sigs))
+        for i in key_range:
+            pub_key = bytes([2]) + i.to_bytes(32, 'big')
+            self.assertEqual(WALLY_OK, wally_add_new_keypath(keypaths, pub_key, len(pub_key),
+                                                             pub_key[-4:], 4, None, 0))
+            self.assertEqual(WALLY_OK, wally_add_new_partial_sig(sigs, pub_key, len(pub_key),
+                                                                 pub_key, len(pub_key)))
+        input = psbt.contents.inputs[0]
+        self.assertEqual(WALLY_OK, wally_psbt_input_set_keypaths(input, keypaths))
+        self.assertEqual(WALLY_OK, wally_psbt_input_set_partial_sigs(input, sigs))
+        wally_keypath_map_free(keypaths)
+        wally_partial_sigs_map_free(sigs)
+
+    def test_combine_maps(self):
+        """Testing combining and parsing large keypath and partial sig maps"""
+        with open(os.path.join(os.path.dirname(os.path.realpath(__file__)), 'data/psbt.json')) as f:
+            base = json.load(f)['creator'][0]['result'].encode('utf-8')
+
+        psbts = []
+        for key_range in [range(0, 60), range(30, 90), range(0, 90, 3)]:
+            psbt = pointer(wally_psbt())
+            self.assertEqual(WALLY_OK, wally_psbt_from_base64(base, psbt))
+            self._set_input_maps(psbt, key_range)
+            psbts.append(psbt.contents)
+
+        combined = pointer(wally_psbt())
+        self.assertEqual(WALLY_OK, wally_combine_psbts((wally_psbt * 3)(*psbts), 3, combined))
+        input = combined.contents.inputs[0]
+        for m in [input.keypaths.contents, input.partial_sigs.contents]:
+            # Each key appears once, in the order it was first seen
+            keys = [bytes(m.items[i].pubkey[:33]) for i in range(m.num_items)]
+            self.assertEqual(keys, [bytes([2]) + i.to_bytes(32, 'big') for i in range(90)])
+
+        # Round-tripping the combined PSBT preserves the maps
+        ret, b64 = wally_psbt_to_base64(combined)
+        self.assertEqual(WALLY_OK, ret)
+        parsed = pointer(wally_psbt())
+        self.assertEqual(WALLY_OK, wally_psbt_from_base64(b64.encode('utf-8'), parsed))
+        self.assertEqual(parsed.contents.inputs[0].keypaths.contents.num_items, 90)
+
+        # A map with a duplicate key fails to parse
+        self._set_input_maps(combined, list(range(40)) + [7])
+        ret, b64 = wally_psbt_to_base64(combined)
+        self.assertEqual(WALLY_OK, ret)
+        self.assertEqual(WALLY_EINVAL, wally_psbt_from_base64(b64.encode('utf-8'), parsed))
+
+    def test_combine_consume(self):
+        """Testing combining PSBTs by consuming them"""
+        with open(os.path.join(os.path.dirname(os.path.realpath(__file__)), 'data/psbt.json')) as f:
+            d = json.load(f)
+
+        def parse_all(b64s):
+            psbts = []
+            for b64 in b64s:
+                psbt = pointer(wally_psbt())
+                self.assertEqual(WALLY_OK, wally_psbt_from_base64(b64.encode('utf-8'), psbt))
+                psbts.append(psbt)
+            return (POINTER(wally_psbt) * len(psbts))(*psbts)
+
+        for combiner in d['combiner']:
+            psbts = parse_all(combiner['combine'])
+            combined = pointer(wally_psbt())
+            self.assertEqual(WALLY_OK, wally_combine_psbts_consume(psbts, len(psbts), combined))
+            self.assertEqual([bool(p) for p in psbts], [False] * len(psbts))
+            self.assertEqual((WALLY_OK, combiner['result']), wally_psbt_to_base64(combined))
+            self.assertEqual(WALLY_OK, wally_psbt_free(combined))
+
+        # Large overlapping maps combine in first-seen order
+        base = d['creator'][0]['result']
+        psbts = parse_all([base] * 3)
+        for psbt, key_range in zip(psbts, [range(0, 60), range(30, 90), range(0, 90, 3)]):
+            self._set_input_maps(psbt, key_range)
+        self.assertEqual(WALLY_OK, wally_combine_psbts_consume(psbts, len(psbts), combined))
+        input = combined.contents.inputs[0]
+        for m in [input.keypaths.contents, input.partial_sigs.contents]:
+            keys = [bytes(m.items[i].pubkey[:33]) for i in range(m.num_items)]
+            self.assertEqual(keys, [bytes([2]) + i.to_bytes(32, 'big') for i in range(90)])
+        self.assertEqual(WALLY_OK, wally_psbt_free(combined))
+
+        # PSBTs with different transactions are rejected and left untouched
+        psbts = parse_all([base, d['valid'][0]['psbt']])
+        self.assertEqual(WALLY_EINVAL, wally_combine_psbts_consume(psbts, len(psbts), combined))
+        self.assertEqual(WALLY_EINVAL, wally_combine_psbts_consume(psbts, 0, combined))
+        self.assertEqual(WALLY_EINVAL, wally_combine_psbts_consume(None, 1, combined))
+        self.assertEqual((WALLY_OK, base), wally_psbt_to_base64(psbts[0]))
+
+        # The same PSBT passed more than once is rejected and left untouched
+        p = parse_all([base])[0]
+        for dups in [[p, p], [p, psbts[0], p], [psbts[0], p, p]]:
+            arr = (POINTER(wally_psbt) * len(dups))(*dups)
+            self.assertEqual(WALLY_EINVAL, wally_combine_psbts_consume(arr, len(arr), combined))
+            self.assertEqual([bool(x) for x in arr], [True] * len(arr))
+        self.assertEqual((WALLY_OK, base), wally_psbt_to_base64(p))
+        self.assertEqual(WALLY_OK, wally_psbt_free(p))
+        for psbt in psbts:
+            self.assertEqual(WALLY_OK, wally_psbt_free(psbt))
+
+    def test_delta(self):
+        """Testing producing and applying PSBT deltas"""
+        with open(os.path.join(os.path.dirname(os.path.realpath(__file__)), 'data/psbt.json')) as f:
+            d = json.load(f)
+
+        def parse(b64):
+            psbt = pointer(wally_psbt())
+            self.assertEqual(WALLY_OK, wally_psbt_from_base64(b64.encode('utf-8'), psbt))
+            return psbt
+
+        def get_delta(base, psbt):
+            ret, delta_len = wally_psbt_get_delta_length(base, psbt)
+            self.assertEqual(WALLY_OK, ret)
+            delta, delta_buf_len = make_cbuffer('00' * delta_len)
+            self.assertEqual(WALLY_EINVAL, wally_psbt_get_delta(base, psbt, delta, delta_len - 1)[0])
+            self.assertEqual((WALLY_OK, delta_len), wally_psbt_get_delta(base, psbt, delta, delta_len))
+            return delta, delta_len
+
+        cases = [(s['psbt'], s['result']) for s in d['signer']] + \
+                [(c['combine'][0], c['combine'][1], c['result']) for c in d['combiner']]
+        for case in cases:
+            base_b64, expected = case[0], case[-1]
+            base, psbt = parse(base_b64), parse(case[1])
+            delta, delta_len = get_delta(base, psbt)
+            self.assertLess(delta_len, len(base64.b64decode(case[1])))
+
+            # Applying the delta to the base gives the updated PSBT
+            self.assertEqual(WALLY_OK, wally_psbt_apply_delta(base, delta, delta_len))
+            self.assertEqual((WALLY_OK, expected), wally_psbt_to_base64(base))
+
+            # There is nothing left to send once the delta is applied
+            num_maps = psbt.contents.num_inputs + psbt.contents.num_outputs
+            self.assertEqual((WALLY_OK, 5 + 32 + 1 + num_maps), wally_psbt_get_delta_length(base, psbt))
+
+            # Malformed deltas leave the PSBT unchanged
+            base = parse(base_b64)
+            bad = bytearray(delta)
+            bad[5] ^= 1 # Different txid
+            for data, data_len in [(delta, delta_len - 1), (delta + b'\x00', delta_len + 1),
+                                   (bytes(bad), delta_len), (delta, 5)]:
+                self.assertEqual(WALLY_EINVAL, wally_psbt_apply_delta(base, data, data_len))
+            self.assertEqual(wally_psbt_to_base64(parse(base_b64)), wally_psbt_to_base64(base))
+
+            # Running out of memory at any point also leaves it unchanged
+            for fail_at in range(1, 64):
+                set_fail_malloc_at(fail_at)
+                ret = wally_psbt_apply_delta(base, delta, delta_len)
+                set_fail_malloc_at(0)
+                if ret == WALLY_OK:
+                    self.assertEqual((WALLY_OK, expected), wally_psbt_to_base64(base))
+                    base = parse(base_b64)
+                else:
+                    self.assertEqual(WALLY_ENOMEM, ret)
+                    self.assertEqual(wally_psbt_to_base64(parse(base_b64)), wally_psbt_to_base64(base))
+
+            # Truncating anywhere fails without reading past the end
+            raw = bytes(delta)
+            for i in range(delta_len):
+                self.assertEqual(WALLY_EINVAL, wally_psbt_apply_delta(base, raw[:i], i))
+            self.assertEqual(wally_psbt_to_base64(parse(base_b64)), wally_psbt_to_base64(base))
+
+            # Corrupt each byte after the txid with large varint prefixes and
+            # garbage. The result may still apply, but if not must leave the
+            # PSBT unchanged and must never read out of bounds
+            for i in range(5 + 32, delta_len):
+                for b in [0xfd, 0xfe, 0xff, 0x00, raw[i] ^ 0x80]:
+                    corrupt = raw[:i] + bytes([b]) + raw[i + 1:]
+                    if wally_psbt_apply_delta(base, corrupt, len(corrupt)) == WALLY_OK:
+                        base = parse(base_b64)
+                    else:
+                        self.assertEqual(wally_psbt_to_base64(parse(base_b64)), wally_psbt_to_base64(base))
+
+        # PSBTs must share the same unsigned tx
+        base, other = parse(d['creator'][0]['result']), parse(d['valid'][0]['psbt'])
+        self.assertEqual(WALLY_EINVAL, wally_psbt_get_delta_length(base, other)[0])
+        self.assertEqual(WALLY_EINVAL, wally_psbt_get_delta_length(None, other)[0])
+
+    def test_summary(self):
+        """Testing PSBT length and fee summaries"""
+        with open(os.path.join(os.path.dirname(os.path.realpath(__file__)), 'data/psbt.json')) as f:
+            d = json.load(f)
+
+        def get_summary(psbt):
+            length, vsize = c_ulong(), c_ulong()
+            total_in, total_out, fee = c_ulonglong(), c_ulonglong(), c_ulonglong()
+            ret = wally_psbt_get_summary(psbt, byref(length), byref(vsize),
+                                         byref(total_in), byref(total_out), byref(fee))
+            return ret, length.value, vsize.value, total_in.value, total_out.value, fee.value
+
+        for finalizer in d['finalizer']:
+            psbt, final = pointer(wally_psbt()), pointer(wally_psbt())
+            self.assertEqual(WALLY_OK, wally_psbt_from_base64(finalizer['finalize'].encode('utf-8'), psbt))
+            self.assertEqual(WALLY_OK, wally_psbt_from_base64(finalizer['result'].encode('utf-8'), final))
+            ret, length, est_vsize, total_in, total_out, fee = get_summary(psbt)
+            self.assertEqual(WALLY_OK, ret)
+            self.assertEqual((WALLY_OK, length), wally_psbt_get_length(psbt))
+            self.assertEqual(fee, total_in - total_out)
+            self.assertGreater(fee, 0)
+
+            # Finalized inputs give the exact vsize of the extracted tx
+            ret, length, vsize, final_in, final_out, final_fee = get_summary(final)
+            self.assertEqual(WALLY_OK, ret)
+            self.assertEqual((WALLY_OK, length), wally_psbt_get_length(final))
+            self.assertEqual((final_in, final_out, final_fee), (total_in, total_out, fee))
+            tx = pointer(wally_tx())
+            self.assertEqual(WALLY_OK, wally_extract_psbt(final, tx))
+            self.assertEqual((WALLY_OK, vsize), wally_tx_get_vsize(tx))
+
+            # Estimates assume maximum length signatures
+            num_sigs = 4
+            self.assertGreaterEqual(est_vsize, vsize)
+            self.assertLessEqual(est_vsize, vsize + num_sigs * 2)
+
+            # A non witness UTXO that is not the tx being spent is rejected
+            prev_tx = psbt.contents.inputs[0].non_witness_utxo.contents
+            prev_tx.locktime ^= 1
+            self.assertEqual(WALLY_EINVAL, get_summary(psbt)[0])
+            prev_tx.locktime ^= 1
+            self.assertEqual(WALLY_OK, get_summary(psbt)[0])
+
+        # Inputs without UTXOs have unknown amounts
+        psbt = pointer(wally_psbt())
+        self.assertEqual(WALLY_OK, wally_psbt_from_base64(d['creator'][0]['result'].encode('utf-8'), psbt))
+        self.assertEqual(WALLY_EINVAL, get_summary(psbt)[0])
+        self.assertEqual(WALLY_EINVAL, get_summary(None)[0])
+
+    def test_view(self):
+        """Testing read-only PSBT views"""
+        with open(os.path.join(os.path.dirname(os.path.realpath(__file__)), 'data/psbt.json')) as f:
+            d = json.load(f)
+
+        def as_bytes(p, p_len):
+            return bytes(cast(p, POINTER(c_ubyte * p_len)).contents) if p_len else b''
+
+        def get_items(view, get_fn, index, item_type, num_items):
+            items, item = [], wally_psbt_view_item()
+            for i in range(num_items):
+                self.assertEqual(WALLY_OK, get_fn(view, index, item_type, i, byref(item)))
+                items.append((as_bytes(item.key, item.key_len), as_bytes(item.value, item.value_len)))
+            self.assertEqual(WALLY_EINVAL, get_fn(view, index, item_type, num_items, byref(item)))
+            return items
+
+        satoshi, script = c_ulonglong(), POINTER(c_ubyte)()
+        for valid in d['valid']:
+            raw = base64.b64decode(valid['psbt'])
+            psbt = pointer(wally_psbt())
+            self.assertEqual(WALLY_OK, wally_psbt_from_bytes(raw, len(raw), psbt))
+            psbt, tx = psbt.contents, psbt.contents.tx.contents
+            view = c_void_p()
+            self.assertEqual(WALLY_OK, wally_psbt_view_init_alloc(raw, len(raw), byref(view)))
+            self.assertEqual((WALLY_OK, tx.num_inputs), wally_psbt_view_get_num_inputs(view))
+            self.assertEqual((WALLY_OK, tx.num_outputs), wally_psbt_view_get_num_outputs(view))
+
+            for i in range(tx.num_outputs):
+                ret, script_len = wally_psbt_view_get_tx_output(view, i, byref(satoshi), byref(script))
+                self.assertEqual(WALLY_OK, ret)
+                expected = tx.outputs[i]
+                self.assertEqual(satoshi.value, expected.satoshi)
+                self.assertEqual(as_bytes(script, script_len), as_bytes(expected.script, expected.script_len))
+                output = psbt.outputs[i]
+                num_keypaths = output.keypaths.contents.num_items if output.keypaths else 0
+                self.assertEqual((WALLY_OK, num_keypaths),
+                                 wally_psbt_view_get_output_num_items(view, i, WALLY_PSBT_OUT_BIP32_DERIVATION))
+                items = get_items(view, wally_psbt_view_get_output_item, i,
+                                  WALLY_PSBT_OUT_BIP32_DERIVATION, num_keypaths)
+                for (key, value), item in zip(items, output.keypaths.contents.items[:num_keypaths] if num_keypaths else []):
+                    self.assertEqual(key, bytes(item.pubkey[:len(key)]))
+                    self.assertEqual(value[:4], bytes(item.origin.fingerprint))
+
+            for i in range(tx.num_inputs):
+                input = psbt.inputs[i]
+                expected = None
+                if input.witness_utxo:
+                    expected = input.witness_utxo.contents
+                elif input.non_witness_utxo:
+                    expected = input.non_witness_utxo.contents.outputs[tx.inputs[i].index]
+                ret, script_len = wally_psbt_view_get_input_utxo(view, i, byref(satoshi), byref(script))
+                self.assertEqual(ret, WALLY_OK if expected else WALLY_EINVAL)
+                if expected:
+                    self.assertEqual(satoshi.value, expected.satoshi)
+                    self.assertEqual(as_bytes(script, script_len), as_bytes(expected.script, expected.script_len))
+                num_sigs = input.partial_sigs.contents.num_items if input.partial_sigs else 0
+                self.assertEqual((WALLY_OK, num_sigs),
+                                 wally_psbt_view_get_input_num_items(view, i, WALLY_PSBT_IN_PARTIAL_SIG))
+                items = get_items(view, wally_psbt_view_get_input_item, i,
+                                  WALLY_PSBT_IN_PARTIAL_SIG, num_sigs)
+                for (key, value), item in zip(items, input.partial_sigs.contents.items[:num_sigs] if num_sigs else []):
+                    self.assertEqual(key, bytes(item.pubkey[:len(key)]))
+                    self.assertEqual(value, as_bytes(item.sig, item.sig_len))
+
+            self.assertEqual(WALLY_EINVAL, wally_psbt_view_get_tx_output(view, tx.num_outputs, byref(satoshi), byref(script))[0])
+            self.assertEqual(WALLY_EINVAL, wally_psbt_view_get_input_utxo(view, tx.num_inputs, byref(satoshi), byref(script))[0])
+            self.assertEqual(WALLY_OK, wally_psbt_view_free(view))
+
+            extended = raw + b'\x00'
+            for data, data_len in [(extended, len(extended)), # Trailing data
+                                   (raw, len(raw) - 1)]:      # Truncated
+                self.assertEqual(WALLY_EINVAL, wally_psbt_view_init_alloc(data, data_len, byref(view)))
+
+        # Invalid PSBTs are rejected
+        accepted = []
+        for i, invalid in enumerate(d['invalid']):
+            raw = base64.b64decode(invalid)
+            view = c_void_p()
+            if wally_psbt_view_init_alloc(raw, len(raw), byref(view)) == WALLY_OK:
+                accepted.append(i)
+                wally_psbt_view_free(view)
+        self.assertEqual(accepted, [])
+
 if __name__ == '__main__':
     unittest.main()
@@ -1,9 +1,12 @@
 import unittest
 from util import *
 
+SCRIPT_TYPE_UNKNOWN = 0x0
 SCRIPT_TYPE_OP_RETURN = 0x1
 SCRIPT_TYPE_P2PKH = 0x2
 SCRIPT_TYPE_P2SH = 0x4
+SCRIPT_TYPE_P2WPKH = 0x8
+SCRIPT_TYPE_P2WSH = 0x10
 SCRIPT_TYPE_MULTISIG = 0x20
 
 WALLY_SCRIPT_MULTISIG_SORTED = 0x8
@@ -376,5 +379,112 @@ class ScriptTests(unittest.TestCase):
             ret, written = wally_witness_program_from_bytes(in_, in_len, flags, out, out_len)
             self.assertEqual(ret, WALLY_EINVAL)
 
+    def test_script_iter(self):
+        """Tests for iterating script opcodes"""
+        def iterate(script_hex):
+            script, script_len = make_cbuffer(script_hex)
+            it = wally_script_iter()
+            self.assertEqual(wally_script_iter_init(byref(it), script, script_len), WALLY_OK)
+            op, push, push_len, ops = c_ubyte(), c_void_p(), c_ulong(), []
+            while True:
+                ret = wally_script_iter_next(byref(it), byref(op), byref(push), byref(push_len))
+                if ret != WALLY_OK:
+                    return ret, ops
+                data = None
+                if push.value is not None:
+                    data = h(string_at(push.value, push_len.value))
+                ops.append((op.value, data))
+
+        cases = [
+            ('', []),
+            ('00', [(0x00, utf8(''))]),
+            ('76a914' + '11' * 20 + '88ac',
+             [(0x76, None), (0xa9, None), (0x14, utf8('11' * 20)), (0x88, None), (0xac, None)]),
+            ('4c02abcd51', [(0x4c, utf8('abcd')), (0x51, None)]),
+            ('4d0300aabbcc', [(0x4d, utf8('aabbcc'))]),
+            ('4e01000000ff6a', [(0x4e, utf8('ff')), (0x6a, None)]),
+        ]
+        for script_hex, expected in cases:
+            ret, ops = iterate(script_hex)
+            self.assertEqual(ret, WALLY_ERROR) # End of script
+            self.assertEqual(ops, expected)
+
+        # Truncated pushes stop iteration with an error
+        for script_hex, expected in [('51' + '02ab', [(0x51, None)]),
+                                     ('4c', []), ('4c02ab', []),
+                                     ('4d01', []), ('4e010000', [])]:
+            ret, ops = iterate(script_hex)
+            self.assertEqual(ret, WALLY_EINVAL)
+            self.assertEqual(ops, expected)
+
+        # Invalid args
+        it, op = wally_script_iter(), c_ubyte()
+        self.assertEqual(wally_script_iter_init(None, None, 0), WALLY_EINVAL)
+        self.assertEqual(wally_script_iter_init(byref(it), None, 1), WALLY_EINVAL)
+        self.assertEqual(wally_script_iter_init(byref(it), None, 0), WALLY_OK)
+        self.assertEqual(wally_script_iter_next(None, byref(op), None, None), WALLY_EINVAL)
+        self.assertEqual(wally_script_iter_next(byref(it), None, None, None), WALLY_EINVAL)
+        self.assertEqual(wally_script_iter_next(byref(it), byref(op), None, None), WALLY_ERROR)
+
+    def test_scriptpubkey_get_types(self):
+        """Tests for batch script classification"""
+        cases = [
+            ('76a914' + '11' * 20 + '88ac', SCRIPT_TYPE_P2PKH, 3),
+            ('a914' + '11' * 20 + '87', SCRIPT_TYPE_P2SH, 2),
+            ('0014' + '11' * 20, SCRIPT_TYPE_P2WPKH, 2),
+            ('0020' + '11' * 32, SCRIPT_TYPE_P2WSH, 2),
+            ('6a04deadbeef', SCRIPT_TYPE_OP_RETURN, 0),
+            (h(RS_1of2).decode('ascii'), SCRIPT_TYPE_MULTISIG, 0),
+            ('0014' + '11' * 19, SCRIPT_TYPE_UNKNOWN, 0), # Short program
+            ('a914' + '11' * 20 + '88', SCRIPT_TYPE_UNKNOWN, 0), # Bad P2SH
+            ('51', SCRIPT_TYPE_UNKNOWN, 0),
+            ('', SCRIPT_TYPE_UNKNOWN, 0),
+        ]
+        num_scripts = len(cases)
+        bufs = [make_cbuffer(script_hex)[0] for script_hex, _, _ in cases]
+        scripts = (c_void_p * num_scripts)(*[cast(c_char_p(b), c_void_p) for b in bufs])
+        lens = (c_ulong * num_scripts)(*[len(b) for b in bufs])
+        types, offsets = (c_ulong * num_scripts)(), (c_ulong * num_scripts)()
+
+        ret = wally_scriptpubkey_get_types(scripts, lens, num_scripts,
+                                           types, offsets, num_scripts)
+        self.assertEqual(ret, WALLY_OK)
+        for i, (script_hex, script_type, offset) in enumerate(cases):
+            self.assertEqual(types[i], script_type)
+            self.assertEqual(offsets[i], offset)
+            if script_hex:
+                ret, single_type = wally_scriptpubkey_get_type(bufs[i], lens[i])
+                self.assertEqual((ret, single_type), (WALLY_OK, script_type))
+
+        # Offsets are optional
+        ret = wally_scriptpubkey_get_types(scripts, lens, num_scripts,
+                                           types, None, num_scripts)
+        self.assertEqual(ret, WALLY_OK)
+
+        # Same results when classifying the outputs of a transaction
+        num_outputs = num_scripts - 1 # Outputs cannot have empty scripts
+        tx = pointer(wally_tx())
+        self.assertEqual(wally_tx_init_alloc(2, 0, 0, num_outputs, tx), WALLY_OK)
+        for b in bufs[:num_outputs]:
+            self.assertEqual(wally_tx_add_raw_output(tx, 1000, b, len(b), 0), WALLY_OK)
+        tx_types, tx_offsets = (c_ulong * num_outputs)(), (c_ulong * num_outputs)()
+        ret = wally_tx_get_output_script_types(tx, tx_types, tx_offsets, num_outputs)
+        self.assertEqual(ret, WALLY_OK)
+        self.assertEqual(list(tx_types), list(types)[:num_outputs])
+        self.assertEqual(list(tx_offsets), list(offsets)[:num_outputs])
+
+        # Invalid args
+        for args in [(None, lens, num_scripts, types, offsets, num_scripts),
+                     (scripts, None, num_scripts, types, offsets, num_scripts),
+                     (scripts, lens, 0, types, offsets, num_scripts),
+                     (scripts, lens, num_scripts, None, offsets, num_scripts),
+                     (scripts, lens, num_scripts, types, offsets, num_scripts - 1)]:
+            self.assertEqual(wally_scriptpubkey_get_types(*args), WALLY_EINVAL)
+        for args in [(None, tx_types, tx_offsets, num_outputs),
+                     (tx, None, tx_offsets, num_outputs),
+                     (tx, tx_types, tx_offsets, num_outputs - 1)]:
+            self.assertEqual(wally_tx_get_output_script_types(*args), WALLY_EINVAL)
+        wally_tx_free(tx)
+
 if __name__ == '__main__':
     unittest.main()
@@ -1,8 +1,10 @@
 import unittest
 from util import *
 from hashlib import sha256
+from os import urandom
+import threading
 
-FLAG_ECDSA, FLAG_SCHNORR, FLAG_GRIND_R, FLAG_RECOVERABLE = 1, 2, 4, 8
+FLAG_ECDSA, FLAG_SCHNORR_DRAFT, FLAG_GRIND_R, FLAG_RECOVERABLE = 1, 2, 4, 8
 EX_PRIV_KEY_LEN, EC_PUBLIC_KEY_LEN, EC_PUBLIC_KEY_UNCOMPRESSED_LEN = 32, 33, 65
 EC_SIGNATURE_LEN, EC_SIGNATURE_DER_MAX_LEN = 64, 72
 BITCOIN_MESSAGE_HASH_FLAG = 1
@@ -86,7 +88,7 @@ class SignTests(unittest.TestCase):
 
         priv_key, msg = self.cbufferize(['11' * 32, '22' * 32])
         priv_bad, msg_bad = self.cbufferize(['FF' * 32, '22' * 33])
-        FLAGS_BOTH = FLAG_ECDSA | FLAG_SCHNORR
+        FLAGS_BOTH = FLAG_ECDSA | FLAG_SCHNORR_DRAFT
 
         # Signing
         cases = [(None,         msg,     FLAG_ECDSA),   # Null priv_key
@@ -223,12 +225,23 @@ class SignTests(unittest.TestCase):
         self.assertEqual(WALLY_EINVAL, wally_ec_sig_verify(pub_key, 33, msg, 32, FLAG_ECDSA, out1, 65))
         self.assertEqual(WALLY_OK, wally_ec_sig_verify(pub_key, 33, msg, 32, FLAG_ECDSA, out1[1:], 64))
 
+        # Grinding produces the same low-R signature with or without recovery
+        for i in range(16):
+            msg, = self.cbufferize(['%02x' % i * 32])
+            flags = FLAG_ECDSA | FLAG_GRIND_R
+            self.assertEqual(WALLY_OK, self.sign(priv_key, msg, flags | FLAG_RECOVERABLE, out1))
+            self.assertEqual(WALLY_OK, self.sign(priv_key, msg, flags, out2))
+            self.assertLess(out2[0], 0x80)
+            self.assertEqual(out1[1:], out2)
+            self.assertEqual(WALLY_OK, wally_ec_sig_to_public_key(msg, 32, out1, 65, pub_key_rec, 33))
+            self.assertEqual(pub_key, pub_key_rec)
+
         # Invalid cases
         for args in [
             (priv_key, msg, FLAG_RECOVERABLE, out1, 65),                 # Singing algorithm not specified
             (priv_key, msg, FLAG_ECDSA, out1, 65),                       # Incorrect length
             (priv_key, msg, FLAG_ECDSA | FLAG_RECOVERABLE, out1, 64),    # Incorrect length
-            (priv_key, msg, FLAG_SCHNORR | FLAG_RECOVERABLE, out1, 65),  # Mutually exclusive
+            (priv_key, msg, FLAG_SCHNORR_DRAFT | FLAG_RECOVERABLE, out1, 65), # Mutually exclusive
             ]:
             self.assertEqual(WALLY_EINVAL, self.sign(*args))
 
@@ -243,6 +256,437 @@ class SignTests(unittest.TestCase):
             ]:
             self.assertEqual(WALLY_EINVAL, wally_ec_sig_to_public_key(*args))
 
+    def test_public_key_from_private_key_batch(self):
+        """Test batch public key creation"""
+        num_keys = 37
+        privs, pubs, full_pubs = b'', b'', b''
+        for i in range(num_keys):
+            priv_key, pub_key, full_pub_key = self.cbufferize(
+                ['%02x' % (i + 1) * 32, '00' * 33, '00' * 65])
+            ret = wally_ec_public_key_from_private_key(priv_key, 32, pub_key, 33)
+            self.assertEqual(ret, WALLY_OK)
+            ret = wally_ec_public_key_decompress(pub_key, 33, full_pub_key, 65)
+            self.assertEqual(ret, WALLY_OK)
+            privs, pubs, full_pubs = privs + priv_key, pubs + pub_key, full_pubs + full_pub_key
+
+        for num_threads in [0, 1, 2, 4, 32]:
+            for expected in [pubs, full_pubs]:
+                out, _ = make_cbuffer('00' * len(expected))
+                ret = wally_ec_public_key_from_private_key_batch(privs, len(privs), num_threads,
+                                                                 out, len(out))
+                self.assertEqual((ret, out), (WALLY_OK, expected))
+
+        out, _ = make_cbuffer('00' * len(pubs))
+        bad_privs = privs[:32] + make_cbuffer('ff' * 32)[0] + privs[64:]
+        n = len(privs)
+        for args in [
+            (None, n, 0, out, len(out)),           # Missing private keys
+            (privs, 0, 0, out, len(out)),          # Empty private keys
+            (privs, n - 1, 0, out, len(out)),      # Bad private keys length
+            (bad_privs, n, 0, out, len(out)),      # Invalid private key
+            (privs, n, 0, None, len(out)),         # Missing output
+            (privs, n, 0, out, len(out) - 33),     # Bad output length
+            (privs, n, 0, out, len(out) + 1),      # Bad output length
+        ]:
+            self.assertEqual(WALLY_EINVAL, wally_ec_public_key_from_private_key_batch(*args))
+            self.assertEqual(out, b'\x00' * len(pubs))
+
+    def test_bitcoin_message_recover_batch(self):
+        """Test batch public key recovery from signed messages"""
+        def hash160(data):
+            out, _ = make_cbuffer('00' * 20)
+            self.assertEqual(wally_hash160(data, len(data), out, len(out)), WALLY_OK)
+            return out
+
+        num_msgs = 19
+        msgs, sigs, pubs, hashes = [], b'', b'', b''
+        for i in range(num_msgs):
+            # Include messages long enough to need a 3 byte length prefix
+            msg = utf8('message %d ' % i) * (i * 3) + utf8('.')
+            msg_hash, _ = make_cbuffer('00' * 32)
+            ret, written = wally_format_bitcoin_message(msg, len(msg), BITCOIN_MESSAGE_HASH_FLAG,
+                                                        msg_hash, len(msg_hash))
+            self.assertEqual((ret, written), (WALLY_OK, 32))
+            priv_key, sig, pub_key = self.cbufferize(['%02x' % (i + 1) * 32, '00' * 65, '00' * 33])
+            self.assertEqual(WALLY_OK, self.sign(priv_key, msg_hash, FLAG_ECDSA | FLAG_RECOVERABLE, sig))
+            self.assertEqual(WALLY_OK, wally_ec_public_key_from_private_key(priv_key, 32, pub_key, 33))
+
+            # Vary the header to cover each address type
+            header, expected_hash = sig[0], hash160(pub_key)
+            if i % 4 == 1:
+                header -= 4 # Uncompressed P2PKH
+                full_pub_key, _ = make_cbuffer('00' * 65)
+                ret = wally_ec_public_key_decompress(pub_key, 33, full_pub_key, 65)
+                self.assertEqual(ret, WALLY_OK)
+                expected_hash = hash160(full_pub_key)
+            elif i % 4 == 2:
+                header += 4 # P2SH-P2WPKH
+                expected_hash = hash160(make_cbuffer('0014')[0] + expected_hash)
+            elif i % 4 == 3:
+                header += 8 # P2WPKH
+            msgs.append(msg)
+            sigs += bytes([header]) + sig[1:]
+            pubs += pub_key
+            hashes += expected_hash
+
+        c_msgs = (c_void_p * num_msgs)(*[cast(c_char_p(m), c_void_p) for m in msgs])
+        c_lens = (c_ulong * num_msgs)(*[len(m) for m in msgs])
+        bits_len = (num_msgs + 7) // 8
+        all_bits = ((1 << num_msgs) - 1).to_bytes(bits_len, 'little')
+
+        def recover(sigs, hashes, num_threads, with_pubs=True):
+            pubs_out, _ = make_cbuffer('ff' * len(pubs))
+            bits, _ = make_cbuffer('ff' * bits_len)
+            hashes_len = 0 if hashes is None else len(hashes)
+            ret, written = wally_bitcoin_message_recover_batch(
+                c_msgs, c_lens, num_msgs, sigs, len(sigs), hashes, hashes_len,
+                num_threads, pubs_out if with_pubs else None,
+                len(pubs_out) if with_pubs else 0, bits, len(bits))
+            self.assertEqual(ret, WALLY_OK)
+            return written, bits, pubs_out
+
+        for num_threads in [0, 1, 2, 4, 32]:
+            for expected in [None, hashes]:
+                written, bits, pubs_out = recover(sigs, expected, num_threads)
+                self.assertEqual((written, bits, pubs_out), (num_msgs, all_bits, pubs))
+            written, bits, _ = recover(sigs, hashes, num_threads, False)
+            self.assertEqual((written, bits), (num_msgs, all_bits))
+
+        # A mismatched hash or bad header clears the bit and zeroes the key
+        bad_hashes = hashes[:20] + hashes[:20] + hashes[40:]
+        bad_sigs = sigs[:65 * 5] + bytes([43]) + sigs[65 * 5 + 1:]
+        for bad, bad_index in [(recover(sigs, bad_hashes, 2), 1),
+                               (recover(bad_sigs, None, 2), 5)]:
+            written, bits, pubs_out = bad
+            self.assertEqual(written, num_msgs - 1)
+            self.assertEqual(int.from_bytes(bits, 'little'), ((1 << num_msgs) - 1) & ~(1 << bad_index))
+            start = bad_index * 33
+            self.assertEqual(pubs_out[start:start + 33], b'\x00' * 33)
+            self.assertEqual(pubs_out[:start] + pubs_out[start + 33:],
+                             pubs[:start] + pubs[start + 33:])
+
+        # Invalid args
+        bits, _ = make_cbuffer('00' * bits_len)
+        pubs_out, _ = make_cbuffer('00' * len(pubs))
+        empty_lens = (c_ulong * num_msgs)(*([0] + list(c_lens)[1:]))
+        n, sl, hl, pl = num_msgs, len(sigs), len(hashes), len(pubs)
+        for args in [
+            (None, c_lens, n, sigs, sl, hashes, hl, 0, pubs_out, pl, bits, bits_len),       # Missing messages
+            (c_msgs, None, n, sigs, sl, hashes, hl, 0, pubs_out, pl, bits, bits_len),       # Missing lengths
+            (c_msgs, empty_lens, n, sigs, sl, hashes, hl, 0, pubs_out, pl, bits, bits_len), # Empty message
+            (c_msgs, c_lens, 0, sigs, sl, hashes, hl, 0, pubs_out, pl, bits, bits_len),     # No messages
+            (c_msgs, c_lens, n, None, sl, hashes, hl, 0, pubs_out, pl, bits, bits_len),     # Missing sigs
+            (c_msgs, c_lens, n, sigs, sl - 1, hashes, hl, 0, pubs_out, pl, bits, bits_len), # Bad sigs length
+            (c_msgs, c_lens, n, sigs, sl, hashes, hl - 1, 0, pubs_out, pl, bits, bits_len), # Bad hashes length
+            (c_msgs, c_lens, n, sigs, sl, None, hl, 0, pubs_out, pl, bits, bits_len),       # Missing hashes
+            (c_msgs, c_lens, n, sigs, sl, hashes, hl, 0, pubs_out, pl - 1, bits, bits_len), # Bad pubs length
+            (c_msgs, c_lens, n, sigs, sl, hashes, hl, 0, None, pl, bits, bits_len),         # Missing pubs
+            (c_msgs, c_lens, n, sigs, sl, hashes, hl, 0, pubs_out, pl, None, bits_len),     # Missing bitmap
+            (c_msgs, c_lens, n, sigs, sl, hashes, hl, 0, pubs_out, pl, bits, bits_len - 1), # Short bitmap
+        ]:
+            ret, written = wally_bitcoin_message_recover_batch(*args)
+            self.assertEqual((ret, written), (WALLY_EINVAL, 0))
+
+
+    def test_public_key_combine(self):
+        ORDER = 0xFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFEBAAEDCE6AF48A03BBFD25E8CD0364141
+        to_bytes = lambda v: bytes.fromhex('%064x' % v)
+
+        def pub_key_for(k):
+            pub_key, = self.cbufferize(['00' * 33])
+            self.assertEqual(WALLY_OK, wally_ec_public_key_from_private_key(
+                to_bytes(k), 32, pub_key, 33))
+            return pub_key
+
+        # Large enough to use Pippenger's algorithm for the multiplication,
+        # smaller counts use Strauss' algorithm
+        keys = [0x1111 * (i + 1) for i in range(170)]
+        scalars = [ORDER - 7, 1] + [0x12345678 * (i + 3) for i in range(168)]
+        pub_keys = b''.join([pub_key_for(k) for k in keys])
+        scalar_bytes = b''.join([to_bytes(a) for a in scalars])
+        out, = self.cbufferize(['00' * 33])
+
+        for n in [1, 2, 10, 100, len(keys)]:
+            # sum(P_i) == sum(k_i) * G
+            ret = wally_ec_public_key_combine(pub_keys, n * 33, None, 0, out, 33)
+            self.assertEqual(WALLY_OK, ret)
+            self.assertEqual(out, pub_key_for(sum(keys[:n]) % ORDER))
+            # sum(a_i * P_i) == sum(a_i * k_i) * G
+            ret = wally_ec_public_key_combine(pub_keys, n * 33, scalar_bytes, n * 32, out, 33)
+            self.assertEqual(WALLY_OK, ret)
+            expected = sum([a * k for a, k in zip(scalars[:n], keys[:n])]) % ORDER
+            self.assertEqual(out, pub_key_for(expected))
+
+        # Sum to infinity: P + (n - 1) * P
+        cancel = to_bytes(1) + to_bytes(ORDER - 1)
+        bad_pub_key, = self.cbufferize(['02' + '00' * 32])
+        for args in [(None, 33, None, 0, out, 33),                  # Null pubkeys
+                     (pub_keys, 0, None, 0, out, 33),               # No pubkeys
+                     (pub_keys, 32, None, 0, out, 33),              # Bad pubkeys length
+                     (bad_pub_key, 33, None, 0, out, 33),           # Invalid pubkey
+                     (bad_pub_key, 33, to_bytes(1), 32, out, 33),   # Invalid scaled pubkey
+                     (pub_keys, 66, scalar_bytes, 32, out, 33),     # Bad scalars length
+                     (pub_keys, 66, None, 64, out, 33),             # Null scalars with length
+                     (pub_keys, 33, to_bytes(0), 32, out, 33),      # Zero scalar
+                     (pub_keys, 33, to_bytes(ORDER), 32, out, 33),  # Scalar out of range
+                     (pub_keys[:33] * 2, 66, cancel, 64, out, 33),  # Sum is infinity
+                     (pub_keys, 33, None, 0, None, 33),             # Null output
+                     (pub_keys, 33, None, 0, out, 32)]:             # Bad output length
+            self.assertEqual(WALLY_EINVAL, wally_ec_public_key_combine(*args))
+
+    def test_schnorr(self):
+        # BIP-schnorr test vectors 1-3 from the secp256k1 schnorrsig module
+        cases = [
+            ('00' * 31 + '01',
+             '0279BE667EF9DCBBAC55A06295CE870B07029BFCDB2DCE28D959F2815B16F81798',
+             '00' * 32,
+             '787A848E71043D280C50470E8E1532B2DD5D20EE912A45DBDD2BD1DFBF187EF6'
+             '7031A98831859DC34DFFEEDDA86831842CCD0079E1F92AF177F7F22CC1DCED05'),
+            ('B7E151628AED2A6ABF7158809CF4F3C762E7160F38B4DA56A784D9045190CFEF',
+             '02DFF1D77F2A671C5F36183726DB2341BE58FEAE1DA2DECED843240F7B502BA659',
+             '243F6A8885A308D313198A2E03707344A4093822299F31D0082EFA98EC4E6C89',
+             None),
+            ('C90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74020BBEA63B14E5C7',
+             '03FAC2114C2FBB091527EB7C64ECB11F8021CB45E8E7809D3C0938E4B8C0E5F84B',
+             '5E2D58D8B3BCDF1ABADEC7829054F90DDA9805AAB56C77333024B9D0A508B75C',
+             None),
+        ]
+        pub_keys, msgs, sigs = b'', b'', b''
+        for priv_key, expected_pub_key, msg, expected_sig in cases:
+            priv_key, msg, pub_key, sig = self.cbufferize([priv_key, msg,
+                                                           '00' * 33, '00' * 64])
+            self.assertEqual(WALLY_OK, wally_ec_public_key_from_private_key(
+                priv_key, 32, pub_key, 33))
+            self.assertEqual(h(pub_key).upper(), utf8(expected_pub_key))
+            self.assertEqual(WALLY_OK, self.sign(priv_key, msg, FLAG_SCHNORR_DRAFT, sig))
+            if expected_sig:
+                self.assertEqual(h(sig).upper(), utf8(expected_sig))
+            ret = wally_ec_sig_verify(pub_key, 33, msg, 32, FLAG_SCHNORR_DRAFT, sig, 64)
+            self.assertEqual(ret, WALLY_OK)
+            # ECDSA verification of a Schnorr signature fails
+            ret = wally_ec_sig_verify(pub_key, 33, msg, 32, FLAG_ECDSA, sig, 64)
+            self.assertEqual(ret, WALLY_EINVAL)
+            pub_keys, msgs, sigs = pub_keys + pub_key, msgs + msg, sigs + sig
+
+        # Batch verification
+        n = len(cases)
+        for i in range(1, n + 1):
+            ret = wally_schnorr_draft_sig_verify_batch(pub_keys, i * 33, msgs, i * 32, sigs, i * 64)
+            self.assertEqual(ret, WALLY_OK)
+        bad_sigs = sigs[:-1] + bytes([sigs[-1] ^ 1])
+        bad_msgs = msgs[32:64] + msgs[:32] + msgs[64:]
+        for args in [(None, n * 33, msgs, n * 32, sigs, n * 64),        # Null pubkeys
+                     (pub_keys, 0, msgs, 0, sigs, 0),                   # Empty batch
+                     (pub_keys, n * 33 - 1, msgs, n * 32, sigs, n * 64),  # Bad pubkeys len
+                     (pub_keys, n * 33, None, n * 32, sigs, n * 64),    # Null msgs
+                     (pub_keys, n * 33, msgs, n * 32 - 1, sigs, n * 64),  # Bad msgs len
+                     (pub_keys, n * 33, msgs, n * 32, None, n * 64),    # Null sigs
+                     (pub_keys, n * 33, msgs, n * 32, sigs, n * 64 - 1),  # Bad sigs len
+                     (b'\x02' * n * 33, n * 33, msgs, n * 32, sigs, n * 64),  # Bad pubkeys
+                     (pub_keys, n * 33, bad_msgs, n * 32, sigs, n * 64),  # Wrong msgs
+                     (pub_keys, n * 33, msgs, n * 32, bad_sigs, n * 64)]:  # Bad sig
+            self.assertEqual(WALLY_EINVAL, wally_schnorr_draft_sig_verify_batch(*args))
+
+    def test_sig_verify_batch(self):
+        n = 21 # Not a multiple of 8
+        pub_keys, msgs, sigs = b'', b'', b''
+        for i in range(n):
+            priv_key, msg, pub_key, sig = self.cbufferize(['%02x' % (i + 1) * 32,
+                                                           '%02x' % i * 32,
+                                                           '00' * 33, '00' * 64])
+            self.assertEqual(WALLY_OK, wally_ec_public_key_from_private_key(
+                priv_key, 32, pub_key, 33))
+            self.assertEqual(WALLY_OK, self.sign(priv_key, msg, FLAG_ECDSA, sig))
+            if i % 5 == 2:
+                sig = sig[:-1] + bytes([sig[-1] ^ 1]) # Invalidate
+            pub_keys, msgs, sigs = pub_keys + pub_key, msgs + msg, sigs + sig
+
+        expected = [i % 5 != 2 for i in range(n)]
+        bits, bits_len = make_cbuffer('ff' * 4)
+        for num_threads in [0, 1, 2, 3, 64, 1000]:
+            ret, written = wally_ec_sig_verify_batch(pub_keys, n * 33, msgs, n * 32,
+                                                     FLAG_ECDSA, sigs, n * 64,
+                                                     num_threads, bits, bits_len)
+            self.assertEqual((ret, written), (WALLY_OK, expected.count(True)))
+            results = [bool(bits[i // 8] & (1 << (i % 8))) for i in range(n)]
+            self.assertEqual(results, expected)
+            self.assertEqual(bits[3], 0) # Unused bytes are zeroed
+
+        args = [pub_keys, n * 33, msgs, n * 32, FLAG_ECDSA, sigs, n * 64, 2, bits, 3]
+        for i, bad in [(0, None),        # Null pubkeys
+                       (1, n * 33 - 1),  # Bad pubkeys length
+                       (2, None),        # Null messages
+                       (3, n * 32 + 1),  # Bad messages length
+                       (4, 0),           # No flags
+                       (4, FLAG_ECDSA | FLAG_RECOVERABLE), # Unsupported flag
+                       (5, None),        # Null sigs
+                       (6, n * 64 - 64), # Bad sigs length
+                       (8, None),        # Null output
+                       (9, 2)]:          # Output too short
+            bad_args = args[:]
+            bad_args[i] = bad
+            ret, written = wally_ec_sig_verify_batch(*bad_args)
+            self.assertEqual((ret, written), (WALLY_EINVAL, 0))
+
+    def test_sig_cache(self):
+        salt, salt_len = make_cbuffer('ab' * 32)
+        for args in [(None, salt_len, 8),    # Missing salt
+                     (salt, 31, 8),          # Incorrect salt length
+                     (salt, salt_len, 7)]:   # Too few entries
+            self.assertEqual(WALLY_EINVAL, wally_ec_sig_cache_enable(*args))
+
+        priv_key, pub_key, sig = self.cbufferize(['11' * 32, '00' * 33, '00' * 64])
+        self.assertEqual(WALLY_OK, wally_ec_public_key_from_private_key(
+            priv_key, 32, pub_key, 33))
+
+        def get_stats():
+            hits = c_ulong()
+            ret, written = wally_ec_sig_cache_get_stats(byref(hits))
+            self.assertEqual(ret, WALLY_OK)
+            return hits.value, written
+
+        self.assertEqual(wally_ec_sig_cache_get_stats(None), (WALLY_EINVAL, 0))
+        self.assertEqual(get_stats(), (0, 0)) # Disabled
+
+        for num_entries in [8, 1000]:
+            self.assertEqual(WALLY_OK, wally_ec_sig_cache_enable(salt, salt_len, num_entries))
+            self.assertEqual(get_stats(), (0, 0))
+            for i in range(32):
+                msg, bad_msg = self.cbufferize(['%02x' % i * 32, '%02x' % (i + 1) * 32])
+                self.assertEqual(WALLY_OK, self.sign(priv_key, msg, FLAG_ECDSA, sig))
+                for n in range(2):
+                    # The second verification is served from the cache
+                    ret = wally_ec_sig_verify(pub_key, 33, msg, 32, FLAG_ECDSA, sig, 64)
+                    self.assertEqual(ret, WALLY_OK)
+                    self.assertEqual(get_stats()[0], i + n)
+                    ret = wally_ec_sig_verify(pub_key, 33, bad_msg, 32, FLAG_ECDSA, sig, 64)
+                    self.assertEqual(ret, WALLY_EINVAL)
+                    self.assertEqual(get_stats()[0], i + n)
+            hits, written = get_stats()
+            # The cache never grows beyond its size
+            self.assertEqual(written, min(num_entries, 32))
+        self.assertEqual(WALLY_OK, wally_ec_sig_cache_disable())
+        self.assertEqual(WALLY_OK, wally_ec_sig_cache_disable())
+        self.assertEqual(get_stats(), (0, 0))
+
+    def test_sig_cache_keys(self):
+        """A cached verification is only returned for the exact same inputs"""
+        salt, salt_len = make_cbuffer('cd' * 32)
+        priv_key, pub_key, other_pub_key, msg, other_msg, sig, other_sig = self.cbufferize(
+            ['11' * 32, '00' * 33, '00' * 33, '22' * 32, '33' * 32, '00' * 64, '00' * 64])
+        self.assertEqual(WALLY_OK, wally_ec_public_key_from_private_key(
+            priv_key, 32, pub_key, 33))
+        other_priv_key, _ = make_cbuffer('44' * 32)
+        self.assertEqual(WALLY_OK, wally_ec_public_key_from_private_key(
+            other_priv_key, 32, other_pub_key, 33))
+        self.assertEqual(WALLY_OK, self.sign(priv_key, msg, FLAG_ECDSA, sig))
+        # A valid signature by another key, and by this key for another message
+        self.assertEqual(WALLY_OK, self.sign(other_priv_key, msg, FLAG_ECDSA, other_sig))
+        other_msg_sig, _ = make_cbuffer('00' * 64)
+        self.assertEqual(WALLY_OK, self.sign(priv_key, other_msg, FLAG_ECDSA, other_msg_sig))
+
+        self.assertEqual(WALLY_OK, wally_ec_sig_cache_enable(salt, salt_len, 8))
+        for _ in range(2):
+            # Prime the cache, then verify the result is now served from it
+            ret = wally_ec_sig_verify(pub_key, 33, msg, 32, FLAG_ECDSA, sig, 64)
+            self.assertEqual(ret, WALLY_OK)
+        hits = c_ulong()
+        self.assertEqual(wally_ec_sig_cache_get_stats(byref(hits)), (WALLY_OK, 1))
+        self.assertEqual(hits.value, 1)
+
+        for args in [(other_pub_key, msg, FLAG_ECDSA, sig),  # Different key
+                     (pub_key, other_msg, FLAG_ECDSA, sig),  # Different message
+                     (pub_key, msg, FLAG_ECDSA, other_sig),  # Different sig
+                     (pub_key, msg, FLAG_ECDSA, other_msg_sig),
+                     (pub_key, msg, FLAG_SCHNORR_DRAFT, sig)]:  # Different type
+            pk, m, flags, s = args
+            ret = wally_ec_sig_verify(pk, 33, m, 32, flags, s, 64)
+            self.assertEqual(ret, WALLY_EINVAL)
+        self.assertEqual(wally_ec_sig_cache_get_stats(byref(hits)), (WALLY_OK, 1))
+        self.assertEqual(hits.value, 1) # No lookup matched the cached entry
+        self.assertEqual(WALLY_OK, wally_ec_sig_cache_disable())
+
+    def test_secp_thread_ctx(self):
+        for args in [(None, 32),          # Missing entropy
+                     (urandom(31), 31)]:  # Incorrect entropy length
+            self.assertEqual(WALLY_EINVAL, wally_secp_thread_init(*args))
+
+        results = []
+        def worker(n):
+            ok = wally_secp_thread_init(urandom(32), 32) == WALLY_OK
+            # Re-randomizing an existing thread context is allowed
+            ok = ok and wally_secp_thread_init(urandom(32), 32) == WALLY_OK
+            priv_key, pub_key, sig = self.cbufferize(['%02x' % (n + 1) * 32,
+                                                      '00' * 33, '00' * 64])
+            msg, _ = make_cbuffer('%02x' % n * 32)
+            for _ in range(16):
+                ok = ok and wally_ec_public_key_from_private_key(
+                    priv_key, 32, pub_key, 33) == WALLY_OK
+                ok = ok and self.sign(priv_key, msg, FLAG_ECDSA, sig) == WALLY_OK
+                ok = ok and wally_ec_sig_verify(pub_key, 33, msg, 32,
+                                                FLAG_ECDSA, sig, 64) == WALLY_OK
+            if n % 2:
+                # Odd threads clean up explicitly, even threads on exit
+                ok = ok and wally_secp_thread_cleanup() == WALLY_OK
+                ok = ok and wally_secp_thread_cleanup() == WALLY_OK
+            results.append(ok)
+
+        threads = [threading.Thread(target=worker, args=(i,)) for i in range(8)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        self.assertEqual(results, [True] * len(threads))
+
+    def test_secp_randomize_threads(self):
+        for args in [(None, 32),          # Missing entropy
+                     (urandom(31), 31)]:  # Incorrect entropy length
+            self.assertEqual(WALLY_EINVAL, wally_secp_randomize(*args))
+
+        # Threads signing with the shared context while another thread
+        # randomizes must be unaffected by it
+        priv_key, pub_key, expected = self.cbufferize(['11' * 32, '00' * 33, '00' * 64])
+        msg, _ = make_cbuffer('22' * 32)
+        self.assertEqual(WALLY_OK, wally_ec_public_key_from_private_key(priv_key, 32, pub_key, 33))
+        self.assertEqual(WALLY_OK, self.sign(priv_key, msg, FLAG_ECDSA, expected))
+
+        results = []
+        def signer():
+            ok = True
+            sig, = self.cbufferize(['00' * 64])
+            for _ in range(64):
+                ok = ok and self.sign(priv_key, msg, FLAG_ECDSA, sig) == WALLY_OK
+                ok = ok and sig == expected
+                ok = ok and wally_ec_sig_verify(pub_key, 33, msg, 32,
+                                                FLAG_ECDSA, sig, 64) == WALLY_OK
+            results.append(ok)
+
+        def randomizer():
+            ok = True
+            for _ in range(64):
+                ok = ok and wally_secp_randomize(urandom(32), 32) == WALLY_OK
+            ok = ok and wally_secp_thread_cleanup() == WALLY_OK
+            results.append(ok)
+
+        threads = [threading.Thread(target=signer) for i in range(4)]
+        threads += [threading.Thread(target=randomizer) for i in range(2)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        self.assertEqual(results, [True] * len(threads))
+
+    def test_secp_precomputation(self):
+        ret, window = wally_secp_get_ecmult_window()
+        self.assertEqual(ret, WALLY_OK)
+        self.assertTrue(2 <= window <= 24)
+
+        # The context holds at least the verification table of
+        # 2^(window - 2) points of 64 bytes each
+        ret, size = wally_secp_get_context_size()
+        self.assertEqual(ret, WALLY_OK)
+        self.assertTrue(size >= 64 << (window - 2))
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -204,6 +204,210 @@ class TransactionTests(unittest.TestCase):
             self.assertEqual(WALLY_OK, wally_tx_get_btc_signature_hash(*args))
             self.assertEqual(expected, h(out[:out_len]))
 
+    def test_policy(self):
+        """Testing sigop counting and relay policy checks"""
+        def prevouts(*scripts_hex):
+            bufs = [make_cbuffer(s)[0] for s in scripts_hex]
+            scripts = (c_void_p * len(bufs))(*[cast(c_char_p(b), c_void_p) for b in bufs])
+            lens = (c_ulong * len(bufs))(*[len(b) for b in bufs])
+            return bufs, scripts, lens
+
+        P2PKH = '76a914' + '11' * 20 + '88ac'
+        P2WSH = '0020' + '11' * 32
+
+        # Dust thresholds
+        for script_hex, fee_rate, expected in [
+            (P2PKH, 3000, 546),
+            ('0014' + '11' * 20, 3000, 294),
+            (P2WSH, 3000, 330),
+            ('6a04deadbeef', 3000, 0), # Unspendable
+            (P2PKH, 1, 1),
+            (P2PKH, 0, 0),
+            ]:
+            script, script_len = make_cbuffer(script_hex)
+            output = pointer(wally_tx_output())
+            self.assertEqual(WALLY_OK, wally_tx_output_init_alloc(1000, script, script_len, output))
+            threshold = c_ulonglong()
+            self.assertEqual(WALLY_OK, wally_tx_output_get_dust_threshold(output, fee_rate, byref(threshold)))
+            self.assertEqual(threshold.value, expected)
+            self.assertEqual(WALLY_EINVAL, wally_tx_output_get_dust_threshold(None, fee_rate, byref(threshold)))
+            self.assertEqual(WALLY_EINVAL, wally_tx_output_get_dust_threshold(output, fee_rate, None))
+            wally_tx_output_free(output)
+
+        # Legacy: one OP_CHECKSIG in the P2PKH output
+        tx = self.tx_deserialize_hex(TX_HEX)
+        _, scripts, lens = prevouts(P2PKH)
+        self.assertEqual((WALLY_OK, 4), wally_tx_get_sigop_cost(tx, None, None, 0))
+        self.assertEqual((WALLY_OK, 4), wally_tx_get_sigop_cost(tx, scripts, lens, 1))
+        self.assertEqual((WALLY_OK, 0), wally_tx_get_policy_failures(tx, scripts, lens, 1, 3000))
+
+        # P2WSH: the 2of2 witness script is counted accurately and unscaled
+        tx = self.tx_deserialize_hex(TX_WITNESS_HEX)
+        _, scripts, lens = prevouts(P2WSH)
+        self.assertEqual((WALLY_OK, 0), wally_tx_get_sigop_cost(tx, None, None, 0))
+        self.assertEqual((WALLY_OK, 2), wally_tx_get_sigop_cost(tx, scripts, lens, 1))
+        self.assertEqual((WALLY_OK, 0), wally_tx_get_policy_failures(tx, scripts, lens, 1, 3000))
+
+        # P2SH-P2WSH: the witness program is taken from the redeem script
+        script, script_len = make_cbuffer('22' + P2WSH)
+        self.assertEqual(WALLY_OK, wally_tx_set_input_script(tx, 0, script, script_len))
+        _, scripts, lens = prevouts('a914' + '11' * 20 + '87')
+        self.assertEqual((WALLY_OK, 2), wally_tx_get_sigop_cost(tx, scripts, lens, 1))
+
+        # P2SH: the redeem script sigops are counted accurately and scaled
+        script, script_len = make_cbuffer('00' + '47' + '5121' + '11' * 33 + '21' + '11' * 33 + '52ae')
+        self.assertEqual(WALLY_OK, wally_tx_set_input_script(tx, 0, script, script_len))
+        self.assertEqual((WALLY_OK, 8), wally_tx_get_sigop_cost(tx, scripts, lens, 1))
+
+        # Policy failures
+        tx = self.tx_deserialize_hex(TX_HEX)
+        tx.version = 3
+        self.assertEqual((WALLY_OK, 0x1), wally_tx_get_policy_failures(tx, None, None, 0, 3000))
+        tx = self.tx_deserialize_hex(TX_HEX)
+        script, script_len = make_cbuffer('76')
+        self.assertEqual(WALLY_OK, wally_tx_set_input_script(tx, 0, script, script_len))
+        self.assertEqual((WALLY_OK, 0x8), wally_tx_get_policy_failures(tx, None, None, 0, 3000))
+        tx = self.tx_deserialize_hex(TX_HEX)
+        tx.outputs[0].satoshi = 545
+        self.assertEqual((WALLY_OK, 0x40), wally_tx_get_policy_failures(tx, None, None, 0, 3000))
+        self.assertEqual((WALLY_OK, 0), wally_tx_get_policy_failures(tx, None, None, 0, 0))
+        for script_hex, expected in [
+            ('6a04deadbeef', 0), # One OP_RETURN is standard
+            ('6a04deadbeef', 0x20), # But two are not
+            ('51', 0x30), # Non-standard output
+            ('ae' * 201, 0xb0), # Too many sigops
+            ]:
+            script, script_len = make_cbuffer(script_hex)
+            self.assertEqual(WALLY_OK, wally_tx_add_raw_output(tx, 0, script, script_len, 0))
+            self.assertEqual((WALLY_OK, expected), wally_tx_get_policy_failures(tx, None, None, 0, 0))
+
+        # Invalid args
+        tx = self.tx_deserialize_hex(TX_HEX)
+        _, scripts, lens = prevouts(P2PKH, P2PKH)
+        for args in [(None, None, None, 0), # Null tx
+                     (tx, scripts, lens, 2), # Wrong number of prevouts
+                     (tx, scripts, None, 1), # Missing prevout lengths
+                     (tx, None, None, 1)]: # Missing prevouts
+            self.assertEqual((WALLY_EINVAL, 0), wally_tx_get_sigop_cost(*args))
+            self.assertEqual((WALLY_EINVAL, 0), wally_tx_get_policy_failures(*(args + (0,))))
+
+
+    def test_sign_inputs(self):
+        """Testing signing multiple inputs at once"""
+        FLAG_ECDSA, FLAG_GRIND_R, SCRIPT_HASH160 = 0x1, 0x4, 0x1
+        P2PKH, P2WPKH, P2SH_P2WPKH = range(3)
+        buf = lambda n: make_cbuffer('00' * n)[0]
+
+        def make_tx(spends):
+            tx_p = pointer(wally_tx())
+            self.assertEqual(WALLY_OK, wally_tx_init_alloc(2, 0, len(spends), 2, tx_p))
+            for i in range(len(spends)):
+                txhash, _ = make_cbuffer('%02x' % (i + 1) * 32)
+                self.assertEqual(WALLY_OK, wally_tx_add_raw_input(tx_p, txhash, 32, i, 0xfffffffe,
+                                                                  None, 0, None, 0))
+            for satoshi in [12345, 67890]:
+                script, script_len = make_cbuffer('0014' + '%02x' % (satoshi % 256) * 20)
+                self.assertEqual(WALLY_OK, wally_tx_add_raw_output(tx_p, satoshi, script,
+                                                                   script_len, 0))
+            return tx_p
+
+        def scripts_for(priv_key):
+            pub_key, h160, redeem = [buf(n) for n in (33, 20, 22)]
+            spks = [buf(25), buf(22), buf(23)]
+            self.assertEqual(WALLY_OK, wally_ec_public_key_from_private_key(priv_key, 32, pub_key, 33))
+            self.assertEqual(WALLY_OK, wally_hash160(pub_key, 33, h160, 20))
+            for fn, args, out in [(wally_scriptpubkey_p2pkh_from_bytes, (h160, 20, 0), spks[0]),
+                                  (wally_witness_program_from_bytes, (pub_key, 33, SCRIPT_HASH160), spks[1]),
+                                  (wally_witness_program_from_bytes, (pub_key, 33, SCRIPT_HASH160), redeem),
+                                  (wally_scriptpubkey_p2sh_from_bytes, (redeem, 22, SCRIPT_HASH160), spks[2])]:
+                self.assertEqual((WALLY_OK, len(out)), fn(*(args + (out, len(out)))))
+            return pub_key, redeem, spks
+
+        # (script type, satoshi, sighash) for each input
+        spends = [(P2PKH, 10000, 0x01), (P2WPKH, 20000, 0x01), (P2SH_P2WPKH, 30000, 0x01),
+                  (P2WPKH, 40000, 0x83), (P2PKH, 50000, 0x02), (P2WPKH, 60000, 0x02)]
+        priv_keys = [bytes([i + 1] * 32) for i in range(len(spends))]
+
+        # Sign each input manually to compare against
+        expected = make_tx(spends)
+        for i, (script_type, satoshi, sighash) in enumerate(spends):
+            pub_key, redeem, spks = scripts_for(priv_keys[i])
+            script_code = spks[P2PKH]
+            flags = 0 if script_type == P2PKH else 1
+            msg, sig, der = buf(32), buf(64), buf(72)
+            self.assertEqual(WALLY_OK, wally_tx_get_btc_signature_hash(
+                expected, i, script_code, len(script_code), satoshi, sighash, flags, msg, 32))
+            self.assertEqual(WALLY_OK, wally_ec_sig_from_bytes(priv_keys[i], 32, msg, 32,
+                                                               FLAG_ECDSA, sig, 64))
+            ret, der_len = wally_ec_sig_to_der(sig, 64, der, 72)
+            self.assertEqual(ret, WALLY_OK)
+            der = der[:der_len] + bytes([sighash])
+            if script_type == P2PKH:
+                script_sig = buf(140)
+                ret, written = wally_scriptsig_p2pkh_from_der(pub_key, 33, der, len(der),
+                                                              script_sig, len(script_sig))
+                self.assertEqual(ret, WALLY_OK)
+                self.assertEqual(WALLY_OK, wally_tx_set_input_script(expected, i, script_sig[:written], written))
+            else:
+                witness = pointer(wally_tx_witness_stack())
+                self.assertEqual(WALLY_OK, wally_witness_p2wpkh_from_der(pub_key, 33, der, len(der), witness))
+                self.assertEqual(WALLY_OK, wally_tx_set_input_witness(expected, i, witness))
+                wally_tx_witness_stack_free(witness)
+                if script_type == P2SH_P2WPKH:
+                    script_sig = bytes([len(redeem)]) + redeem
+                    self.assertEqual(WALLY_OK, wally_tx_set_input_script(expected, i, script_sig, len(script_sig)))
+        expected_hex = self.tx_serialize_hex(expected)
+
+        def sign_inputs(spends, order, flags=0, threads=1, index_offset=0):
+            bufs = []
+            inputs = (wally_tx_sign_input * len(order))()
+            for n, i in enumerate(order):
+                script_type, satoshi, sighash = spends[i]
+                spk = scripts_for(priv_keys[i])[2][script_type]
+                bufs.append(spk)
+                inputs[n] = wally_tx_sign_input(i + index_offset, cast(c_char_p(priv_keys[i]), c_void_p),
+                                                cast(c_char_p(spk), c_void_p), len(spk),
+                                                satoshi, sighash)
+            return bufs, inputs
+
+        # Signing order and thread count do not affect the result
+        for order, threads in [(range(len(spends)), 1),
+                               (reversed(range(len(spends))), 0),
+                               (range(len(spends)), 4)]:
+            tx = make_tx(spends)
+            _, inputs = sign_inputs(spends, list(order))
+            self.assertEqual(WALLY_OK, wally_tx_sign_inputs(tx, inputs, len(spends), 0, threads))
+            self.assertEqual(self.tx_serialize_hex(tx), expected_hex)
+
+        # Low-R grinding
+        tx = make_tx(spends)
+        _, inputs = sign_inputs(spends, range(len(spends)))
+        self.assertEqual(WALLY_OK, wally_tx_sign_inputs(tx, inputs, len(spends), FLAG_GRIND_R, 2))
+
+        # Invalid arguments leave the tx untouched
+        tx = make_tx(spends)
+        unsigned_hex = self.tx_serialize_hex(tx)
+        _, inputs = sign_inputs(spends, range(len(spends)))
+        _, dup_inputs = sign_inputs(spends, [0, 1, 1])
+        _, bad_index = sign_inputs(spends, [0], index_offset=len(spends))
+        _, wrong_key = sign_inputs(spends, [0, 1])
+        wrong_key[1].priv_key = wrong_key[0].priv_key
+        p2wsh, _ = make_cbuffer('0020' + '11' * 32)
+        _, bad_script = sign_inputs(spends, [0])
+        bad_script[0].script, bad_script[0].script_len = cast(c_char_p(p2wsh), c_void_p), len(p2wsh)
+        _, bad_sighash = sign_inputs(spends, [0])
+        bad_sighash[0].sighash = 0x100
+        for args in [(None, inputs, len(spends), 0, 1),   # Null tx
+                     (tx, None, len(spends), 0, 1),       # Null inputs
+                     (tx, inputs, 0, 0, 1),               # No inputs
+                     (tx, inputs, len(spends), 0x1, 1),   # Unsupported flags
+                     (tx, dup_inputs, 3, 0, 1),           # Duplicate input index
+                     (tx, bad_index, 1, 0, 1),            # Input index out of range
+                     (tx, wrong_key, 2, 0, 1),            # Key doesn't match prevout
+                     (tx, bad_script, 1, 0, 1),           # Unsupported prevout
+                     (tx, bad_sighash, 1, 0, 1)]:         # Invalid sighash
+            self.assertEqual(WALLY_EINVAL, wally_tx_sign_inputs(*args))
+            self.assertEqual(self.tx_serialize_hex(tx), unsigned_hex)
 
 if __name__ == '__main__':
     unittest.main()
@@ -33,6 +33,15 @@ class operations(Structure):
                 ('bzero_fn', _bzero_fn_t),
                 ('ec_nonce_fn', _ec_nonce_fn_t)]
 
+# Some structures have extra members in Elements builds. Size them to match
+# the library so that arrays of them have the same layout as in C
+def _is_elements_build():
+    ret = c_uint64()
+    libwally.wally_is_elements_build(byref(ret))
+    return ret.value != 0
+
+_IS_ELEMENTS_BUILD = _is_elements_build()
+
 class ext_key(Structure):
     _fields_ = [('chain_code', c_ubyte * 32),
                 ('parent160', c_ubyte * 20),
@@ -43,8 +52,8 @@ class ext_key(Structure):
                 ('hash160', c_ubyte * 20),
                 ('version', c_uint),
                 ('pad2', c_ubyte * 3),
-                ('pub_key', c_ubyte * 33),
-                ('pub_key_tweak_sum', c_ubyte * 32)]
+                ('pub_key', c_ubyte * 33)] + \
+                ([('pub_key_tweak_sum', c_ubyte * 32)] if _IS_ELEMENTS_BUILD else [])
 
 # Sentinel classes for returning output parameters
 class c_char_p_p_class(object):
@@ -73,34 +82,34 @@ class wally_tx_input(Structure):
                 ('script', c_void_p),
                 ('script_len', c_ulong),
                 ('witness',  POINTER(wally_tx_witness_stack)),
-                ('features', c_ubyte),
-                ('blinding_nonce', c_ubyte * 32),
-                ('entropy', c_ubyte * 32),
-                ('issuance_amount', c_void_p),
-                ('issuance_amount_len', c_ulong),
-                ('inflation_keys', c_void_p),
-                ('inflation_keys_len', c_ulong),
-                ('issuance_amount_rangeproof', c_void_p),
-                ('issuance_amount_rangeproof_len', c_ulong),
-                ('inflation_keys_rangeproof', c_void_p),
-                ('inflation_keys_rangeproof_len', c_ulong),
-                ('pegin_witness', POINTER(wally_tx_witness_stack))]
+                ('features', c_ubyte)] + \
+                ([('blinding_nonce', c_ubyte * 32),
+                  ('entropy', c_ubyte * 32),
+                  ('issuance_amount', c_void_p),
+                  ('issuance_amount_len', c_ulong),
+                  ('inflation_keys', c_void_p),
+                  ('inflation_keys_len', c_ulong),
+                  ('issuance_amount_rangeproof', c_void_p),
+                  ('issuance_amount_rangeproof_len', c_ulong),
+                  ('inflation_keys_rangeproof', c_void_p),
+                  ('inflation_keys_rangeproof_len', c_ulong),
+                  ('pegin_witness', POINTER(wally_tx_witness_stack))] if _IS_ELEMENTS_BUILD else [])
 
 class wally_tx_output(Structure):
     _fields_ = [('satoshi', c_ulonglong),
                 ('script', c_void_p),
                 ('script_len', c_ulong),
-                ('features', c_ubyte),
-                ('asset', c_void_p),
-                ('asset_len', c_ulong),
-                ('value', c_void_p),
-                ('value_len', c_ulong),
-                ('nonce', c_void_p),
-                ('nonce_len', c_ulong),
-                ('surjectionproof', c_void_p),
-                ('surjectionproof_len', c_ulong),
-                ('rangeproof', c_void_p),
-                ('rangeproof_len', c_ulong)]
+                ('features', c_ubyte)] + \
+                ([('asset', c_void_p),
+                  ('asset_len', c_ulong),
+                  ('value', c_void_p),
+                  ('value_len', c_ulong),
+                  ('nonce', c_void_p),
+                  ('nonce_len', c_ulong),
+                  ('surjectionproof', c_void_p),
+                  ('surjectionproof_len', c_ulong),
+                  ('rangeproof', c_void_p),
+                  ('rangeproof_len', c_ulong)] if _IS_ELEMENTS_BUILD else [])
 
 class wally_tx(Structure):
     _fields_ = [('version', c_uint),
@@ -180,6 +189,25 @@ class wally_psbt(Structure):
                 ('outputs_allocation_len', c_ulong),
                 ('unknowns', POINTER(unknowns_map))]
 
+class wally_psbt_view_item(Structure):
+    _fields_ = [('key', POINTER(c_ubyte)),
+                ('key_len', c_ulong),
+                ('value', POINTER(c_ubyte)),
+                ('value_len', c_ulong)]
+
+class wally_tx_sign_input(Structure):
+    _fields_ = [('index', c_ulong),
+                ('priv_key', c_void_p),
+                ('script', c_void_p),
+                ('script_len', c_ulong),
+                ('satoshi', c_ulonglong),
+                ('sighash', c_uint)]
+
+class wally_script_iter(Structure):
+    _fields_ = [('script', c_void_p),
+                ('script_len', c_ulong),
+                ('offset', c_ulong)]
+
 for f in (
     ('wally_init', c_int, [c_uint]),
     ('wally_cleanup', c_int, [c_uint]),
@@ -201,6 +229,7 @@ for f in (
     ('bip32_key_from_parent_path', c_int, [c_void_p, c_uint_p, c_ulong, c_uint, POINTER(ext_key)]),
     ('bip32_key_with_tweak_from_parent_path', c_int, [POINTER(ext_key), c_uint_p, c_ulong, c_uint, POINTER(ext_key)]),
     ('bip32_key_to_base58', c_int, [POINTER(ext_key), c_uint, c_char_p_p]),
+    ('bip32_keys_to_base58', c_int, [POINTER(ext_key), c_ulong, c_uint, c_void_p, c_ulong]),
     ('bip32_key_from_base58', c_int, [c_char_p, POINTER(ext_key)]),
     ('bip32_key_from_base58_alloc', c_int, [c_char_p, POINTER(POINTER(ext_key))]),
     ('bip32_key_strip_private_key', c_int, [POINTER(ext_key)]),
@@ -246,18 +275,41 @@ for f in (
     ('wally_pbkdf2_hmac_sha512', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_uint, c_ulong, c_void_p, c_ulong]),
     ('wally_scrypt', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_uint, c_uint, c_uint, c_void_p, c_ulong]),
     ('wally_secp_randomize', c_int, [c_void_p, c_ulong]),
+    ('wally_secp_thread_init', c_int, [c_void_p, c_ulong]),
+    ('wally_secp_thread_cleanup', c_int, []),
+    ('wally_secp_get_ecmult_window', c_int, [c_ulong_p]),
+    ('wally_secp_get_context_size', c_int, [c_ulong_p]),
     ('wally_ec_private_key_verify', c_int, [c_void_p, c_ulong]),
     ('wally_ec_public_key_verify', c_int, [c_void_p, c_ulong]),
     ('wally_ec_public_key_decompress', c_int, [c_void_p, c_ulong, c_void_p, c_ulong]),
     ('wally_ec_public_key_negate', c_int, [c_void_p, c_ulong, c_void_p, c_ulong]),
+    ('wally_ec_public_key_combine', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_void_p, c_ulong]),
     ('wally_ec_public_key_from_private_key', c_int, [c_void_p, c_ulong, c_void_p, c_ulong]),
+    ('wally_ec_public_key_from_private_key_batch', c_int, [c_void_p, c_ulong, c_uint, c_void_p, c_ulong]),
     ('wally_ec_sig_from_bytes', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_uint, c_void_p, c_ulong]),
     ('wally_ec_sig_from_der', c_int, [c_void_p, c_ulong, c_void_p, c_ulong]),
     ('wally_ec_sig_normalize', c_int, [c_void_p, c_ulong, c_void_p, c_ulong]),
     ('wally_ec_sig_to_der', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_ulong_p]),
     ('wally_ec_sig_to_public_key', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_void_p]),
+    ('wally_bitcoin_message_recover_batch', c_int, [POINTER(c_void_p), POINTER(c_ulong), c_ulong, c_void_p, c_ulong, c_void_p, c_ulong, c_uint, c_void_p, c_ulong, c_void_p, c_ulong, c_ulong_p]),
     ('wally_ec_sig_verify', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_uint, c_void_p, c_ulong]),
+    ('wally_ec_sig_verify_batch', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_uint, c_void_p, c_ulong, c_uint, c_void_p, c_ulong, c_ulong_p]),
+    ('wally_schnorr_draft_sig_verify_batch', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_void_p, c_ulong]),
+    ('wally_ec_sig_cache_enable', c_int, [c_void_p, c_ulong, c_ulong]),
+    ('wally_ec_sig_cache_disable', c_int, []),
+    ('wally_ec_sig_cache_get_stats', c_int, [POINTER(c_ulong), c_ulong_p]),
     ('wally_ecdh', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_void_p]),
+    ('wally_ecdh_batch', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_uint, c_void_p, c_ulong]),
+    ('wally_musig_pubkey_combine', c_int, [c_void_p, c_ulong, c_void_p, c_ulong]),
+    ('wally_musig_session_init_alloc', c_int, [c_void_p, c_ulong, c_uint, c_void_p, c_ulong, c_void_p, c_ulong, c_void_p, c_ulong, POINTER(c_void_p)]),
+    ('wally_musig_session_free', c_int, [c_void_p]),
+    ('wally_musig_session_get_nonce_commitment', c_int, [c_void_p, c_void_p, c_ulong]),
+    ('wally_musig_session_get_nonce', c_int, [c_void_p, c_void_p, c_ulong, c_void_p, c_ulong]),
+    ('wally_musig_session_set_message', c_int, [c_void_p, c_void_p, c_ulong]),
+    ('wally_musig_session_set_nonces', c_int, [c_void_p, c_void_p, c_ulong]),
+    ('wally_musig_partial_sign', c_int, [c_void_p, c_void_p, c_ulong]),
+    ('wally_musig_partial_sig_verify', c_int, [c_void_p, c_uint, c_void_p, c_ulong]),
+    ('wally_musig_partial_sig_combine', c_int, [c_void_p, c_void_p, c_ulong, c_void_p, c_ulong]),
     ('wally_get_operations', c_int, [POINTER(operations)]),
     ('wally_set_operations', c_int, [POINTER(operations)]),
     ('wally_format_bitcoin_message', c_int, [c_void_p, c_ulong, c_uint, c_void_p, c_ulong, c_ulong_p]),
@@ -270,11 +322,16 @@ for f in (
     ('wally_scriptpubkey_csv_2of2_then_1_from_bytes', c_int, [c_void_p, c_ulong, c_uint, c_uint, c_void_p, c_ulong, c_ulong_p]),
     ('wally_scriptpubkey_csv_2of3_then_2_from_bytes', c_int, [c_void_p, c_ulong, c_uint, c_uint, c_void_p, c_ulong, c_ulong_p]),
     ('wally_scriptsig_p2pkh_from_der', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_void_p, c_ulong, c_ulong_p]),
+    ('wally_witness_p2wpkh_from_der', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, POINTER(POINTER(wally_tx_witness_stack))]),
     ('wally_scriptsig_p2pkh_from_sig', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_uint, c_void_p, c_ulong, c_ulong_p]),
     ('wally_scriptsig_multisig_from_bytes', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_uint_p, c_ulong, c_uint, c_void_p, c_ulong, c_ulong_p]),
     ('wally_elements_pegout_script_from_bytes', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_void_p, c_ulong, c_void_p, c_ulong, c_uint, c_void_p, c_ulong, c_ulong_p]),
     ('wally_elements_pegin_contract_script_from_bytes', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, c_uint, c_void_p, c_ulong, c_ulong_p]),
     ('wally_witness_program_from_bytes', c_int, [c_void_p, c_ulong, c_uint, c_void_p, c_ulong, c_ulong_p]),
+    ('wally_script_iter_init', c_int, [POINTER(wally_script_iter), c_void_p, c_ulong]),
+    ('wally_script_iter_next', c_int, [POINTER(wally_script_iter), POINTER(c_ubyte), POINTER(c_void_p), POINTER(c_ulong)]),
+    ('wally_scriptpubkey_get_types', c_int, [POINTER(c_void_p), POINTER(c_ulong), c_ulong, POINTER(c_ulong), POINTER(c_ulong), c_ulong]),
+    ('wally_tx_get_output_script_types', c_int, [POINTER(wally_tx), POINTER(c_ulong), POINTER(c_ulong), c_ulong]),
     ('wally_tx_to_hex', c_int, [POINTER(wally_tx), c_uint, c_char_p_p]),
     ('wally_tx_from_hex', c_int, [c_char_p, c_uint, POINTER(POINTER(wally_tx))]),
     ('wally_tx_to_bytes', c_int, [POINTER(wally_tx), c_uint, c_void_p, c_ulong, c_ulong_p]),
@@ -287,6 +344,10 @@ for f in (
     ('wally_tx_vsize_from_weight', c_int, [c_ulong, c_ulong_p]),
     ('wally_tx_get_total_output_satoshi', c_int, [POINTER(wally_tx), POINTER(c_ulonglong)]),
     ('wally_tx_get_witness_count', c_int, [POINTER(wally_tx), c_ulong_p]),
+    ('wally_tx_output_get_dust_threshold', c_int, [POINTER(wally_tx_output), c_ulonglong, POINTER(c_ulonglong)]),
+    ('wally_tx_get_sigop_cost', c_int, [POINTER(wally_tx), POINTER(c_void_p), POINTER(c_ulong), c_ulong, c_ulong_p]),
+    ('wally_tx_sign_inputs', c_int, [POINTER(wally_tx), POINTER(wally_tx_sign_input), c_ulong, c_uint, c_uint]),
+    ('wally_tx_get_policy_failures', c_int, [POINTER(wally_tx), POINTER(c_void_p), POINTER(c_ulong), c_ulong, c_ulonglong, c_ulong_p]),
     ('wally_tx_get_btc_signature_hash', c_int, [POINTER(wally_tx), c_ulong, c_void_p, c_ulong, c_ulonglong, c_uint, c_uint, c_void_p, c_ulong]),
     ('wally_tx_get_elements_signature_hash', c_int, [POINTER(wally_tx), c_ulong, c_void_p, c_ulong, c_void_p, c_ulong, c_uint, c_uint, c_void_p, c_ulong]),
     ('wally_tx_witness_stack_init_alloc', c_int, [c_ulong, POINTER(POINTER(wally_tx_witness_stack))]),
@@ -315,6 +376,14 @@ for f in (
     ('wally_wif_to_bytes', c_int, [c_char_p, c_uint, c_uint, c_void_p, c_ulong]),
     ('wally_wif_to_public_key', c_int, [c_char_p, c_uint, c_void_p, c_ulong, c_ulong_p]),
     ('wally_wif_is_uncompressed', c_int, [c_char_p, c_ulong_p]),
+    ('wally_keypath_map_init_alloc', c_int, [c_ulong, POINTER(POINTER(keypath_map))]),
+    ('wally_keypath_map_free', c_int, [POINTER(keypath_map)]),
+    ('wally_add_new_keypath', c_int, [POINTER(keypath_map), c_void_p, c_ulong, c_void_p, c_ulong, POINTER(c_uint), c_ulong]),
+    ('wally_partial_sigs_map_init_alloc', c_int, [c_ulong, POINTER(POINTER(partial_sigs_map))]),
+    ('wally_partial_sigs_map_free', c_int, [POINTER(partial_sigs_map)]),
+    ('wally_add_new_partial_sig', c_int, [POINTER(partial_sigs_map), c_void_p, c_ulong, c_void_p, c_ulong]),
+    ('wally_psbt_input_set_keypaths', c_int, [POINTER(wally_psbt_input), POINTER(keypath_map)]),
+    ('wally_psbt_input_set_partial_sigs', c_int, [POINTER(wally_psbt_input), POINTER(partial_sigs_map)]),
     ('wally_psbt_input_init_alloc', c_int, [POINTER(wally_tx), POINTER(wally_tx_output), c_void_p, c_ulong, c_void_p, c_ulong, c_void_p, c_ulong, POINTER(wally_tx_witness_stack), POINTER(keypath_map), POINTER(partial_sigs_map), POINTER(unknowns_map), c_ulong, POINTER(POINTER(wally_psbt_input))]),
     ('wally_psbt_input_free', c_int, [POINTER(wally_psbt_input)]),
     ('wally_psbt_output_init_alloc', c_int, [c_void_p, c_ulong, c_void_p, c_ulong, POINTER(keypath_map), POINTER(unknowns_map), c_ulong, POINTER(POINTER(wally_psbt_output))]),
@@ -328,9 +397,27 @@ for f in (
     ('wally_psbt_to_base64', c_int, [POINTER(wally_psbt), c_char_p_p]),
     ('wally_psbt_set_global_tx', c_int, [POINTER(wally_psbt), POINTER(wally_tx)]),
     ('wally_combine_psbts', c_int, [POINTER(wally_psbt), c_ulong, POINTER(POINTER(wally_psbt))]),
+    ('wally_combine_psbts_consume', c_int, [POINTER(POINTER(wally_psbt)), c_ulong, POINTER(POINTER(wally_psbt))]),
     ('wally_sign_psbt', c_int, [POINTER(wally_psbt), c_void_p, c_ulong]),
+    ('wally_sign_psbt_keys', c_int, [POINTER(wally_psbt), c_void_p, c_ulong]),
+    ('wally_sign_psbt_bip32', c_int, [POINTER(wally_psbt), POINTER(ext_key)]),
     ('wally_finalize_psbt', c_int, [POINTER(wally_psbt)]),
-    ('wally_extract_psbt', c_int, [POINTER(wally_psbt), POINTER(POINTER(wally_tx))])
+    ('wally_extract_psbt', c_int, [POINTER(wally_psbt), POINTER(POINTER(wally_tx))]),
+    ('wally_finalize_and_extract_psbt', c_int, [POINTER(wally_psbt), c_uint, POINTER(POINTER(wally_tx))]),
+    ('wally_psbt_get_delta_length', c_int, [POINTER(wally_psbt), POINTER(wally_psbt), c_ulong_p]),
+    ('wally_psbt_get_delta', c_int, [POINTER(wally_psbt), POINTER(wally_psbt), c_void_p, c_ulong, c_ulong_p]),
+    ('wally_psbt_apply_delta', c_int, [POINTER(wally_psbt), c_void_p, c_ulong]),
+    ('wally_psbt_get_summary', c_int, [POINTER(wally_psbt), POINTER(c_ulong), POINTER(c_ulong), POINTER(c_ulonglong), POINTER(c_ulonglong), POINTER(c_ulonglong)]),
+    ('wally_psbt_view_init_alloc', c_int, [c_void_p, c_ulong, POINTER(c_void_p)]),
+    ('wally_psbt_view_free', c_int, [c_void_p]),
+    ('wally_psbt_view_get_num_inputs', c_int, [c_void_p, c_ulong_p]),
+    ('wally_psbt_view_get_num_outputs', c_int, [c_void_p, c_ulong_p]),
+    ('wally_psbt_view_get_tx_output', c_int, [c_void_p, c_ulong, POINTER(c_ulonglong), POINTER(POINTER(c_ubyte)), c_ulong_p]),
+    ('wally_psbt_view_get_input_utxo', c_int, [c_void_p, c_ulong, POINTER(c_ulonglong), POINTER(POINTER(c_ubyte)), c_ulong_p]),
+    ('wally_psbt_view_get_input_num_items', c_int, [c_void_p, c_ulong, c_uint, c_ulong_p]),
+    ('wally_psbt_view_get_input_item', c_int, [c_void_p, c_ulong, c_uint, c_ulong, POINTER(wally_psbt_view_item)]),
+    ('wally_psbt_view_get_output_num_items', c_int, [c_void_p, c_ulong, c_uint, c_ulong_p]),
+    ('wally_psbt_view_get_output_item', c_int, [c_void_p, c_ulong, c_uint, c_ulong, POINTER(wally_psbt_view_item)])
     ):
 
     def bind_fn(name, res, args):
@@ -450,6 +537,11 @@ def malloc_fail(failures):
         return wrapped
     return decorator
 
+def set_fail_malloc_at(fail_at):
+    """Fail the fail_at'th allocation from now on, or none if fail_at is 0"""
+    global _fail_malloc_at, _fail_malloc_counter
+    _fail_malloc_at, _fail_malloc_counter = fail_at, 0
+
 # Support for signing testing
 _fake_ec_nonce = None
 
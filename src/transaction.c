@@ -3,6 +3,7 @@
 #include "ccan/ccan/build_assert/build_assert.h"
 
 #include <include/wally_crypto.h>
+#include <include/wally_script.h>
 #include <include/wally_transaction.h>
 
 #include <limits.h>
@@ -10,6 +11,7 @@
 #include "transaction_int.h"
 #include "transaction_shared.h"
 #include "script_int.h"
+#include "script.h"
 
 #define WALLY_TX_ALL_FLAGS (WALLY_TX_FLAG_USE_WITNESS | WALLY_TX_FLAG_USE_ELEMENTS)
 
@@ -37,6 +39,14 @@ static const unsigned char DUMMY_SIG[EC_SIGNATURE_DER_MAX_LEN + 1]; /* +1 for si
 
 #define MAX_INVALID_SATOSHI ((uint64_t) -1)
 
+/* BIP143 hashes that are common to all SIGHASH_ALL inputs of a tx */
+struct tx_bip143_hashes
+{
+    unsigned char prevouts[SHA256_LEN];  /* hashPrevouts */
+    unsigned char sequences[SHA256_LEN]; /* hashSequence */
+    unsigned char outputs[SHA256_LEN];   /* hashOutputs */
+};
+
 /* Extra options when serializing for hashing */
 struct tx_serialize_opts
 {
@@ -49,6 +59,7 @@ struct tx_serialize_opts
     bool bip143;                     /* Serialize for BIP143 hash */
     const unsigned char *value;      /* Confidential value of the input we are signing */
     size_t value_len;                /* length of 'value' in bytes */
+    const struct tx_bip143_hashes *hashes; /* Precomputed BIP143 hashes, or NULL */
 };
 
 static const unsigned char EMPTY_OUTPUT[9] = {
@@ -57,6 +68,17 @@ static const unsigned char EMPTY_OUTPUT[9] = {
 
 #define WALLY_SATOSHI_MAX ((uint64_t)WALLY_BTC_MAX * WALLY_SATOSHI_PER_BTC)
 
+/* Relay policy limits, as per bitcoind's defaults */
+#define MAX_STANDARD_TX_VERSION WALLY_TX_VERSION_2
+#define MAX_STANDARD_SCRIPTSIG_LEN 1650
+#define MAX_STANDARD_P2SH_SIGOPS 15
+#define MAX_SCRIPT_LEN 10000
+#define WITNESS_SCALE_FACTOR 4
+/* Size of an input spending an output: outpoint, scriptSig length,
+ * P2PKH scriptSig and sequence */
+#define SPEND_INPUT_LEN (WALLY_TXHASH_LEN + 4 + 1 + 107 + 4)
+#define WITNESS_SPEND_INPUT_LEN (WALLY_TXHASH_LEN + 4 + 1 + 107 / WITNESS_SCALE_FACTOR + 4)
+
 /* LCOV_EXCL_START */
 /* Check assumptions we expect to hold true */
 static void assert_tx_assumptions(void)
@@ -1830,6 +1852,13 @@ static inline int tx_to_bip143_bytes(const struct wally_tx *tx,
     }
 #endif
 
+    if (opts->hashes) {
+        /* Only a SIGHASH_SINGLE output needs hashing */
+        inputs_size = 0;
+        if (!sh_single)
+            outputs_size = 0;
+    }
+
     if (inputs_size > buff_len || outputs_size > buff_len || issuances_size > buff_len) {
         buff_len = inputs_size > outputs_size ? inputs_size : outputs_size;
         buff_len = buff_len > issuances_size ? buff_len : issuances_size;
@@ -1841,6 +1870,8 @@ static inline int tx_to_bip143_bytes(const struct wally_tx *tx,
     /* Inputs */
     if (anyonecanpay)
         memset(p, 0, SHA256_LEN);
+    else if (opts->hashes)
+        memcpy(p, opts->hashes->prevouts, SHA256_LEN);
     else {
         for (i = 0; i < tx->num_inputs; ++i) {
             unsigned char *tmp_p = buff_p + i * (WALLY_TXHASH_LEN + sizeof(uint32_t));
@@ -1856,6 +1887,8 @@ static inline int tx_to_bip143_bytes(const struct wally_tx *tx,
     /* Sequences */
     if (anyonecanpay || sh_single || sh_none)
         memset(p, 0, SHA256_LEN);
+    else if (opts->hashes)
+        memcpy(p, opts->hashes->sequences, SHA256_LEN);
     else {
         for (i = 0; i < tx->num_inputs; ++i)
             uint32_to_le_bytes(tx->inputs[i].sequence, buff_p + i * sizeof(uint32_t));
@@ -1924,6 +1957,8 @@ static inline int tx_to_bip143_bytes(const struct wally_tx *tx,
     /* Outputs */
     if (sh_none || (sh_single && opts->index >= tx->num_outputs))
         memset(p, 0, SHA256_LEN);
+    else if (opts->hashes && !sh_single)
+        memcpy(p, opts->hashes->outputs, SHA256_LEN);
     else {
         output_p = buff_p;
         for (i = 0; i < tx->num_outputs; ++i) {
@@ -2624,6 +2659,7 @@ static int tx_get_signature_hash(const struct wally_tx *tx,
                                  const unsigned char *value,
                                  size_t value_len,
                                  uint32_t sighash, uint32_t tx_sighash, uint32_t flags,
+                                 const struct tx_bip143_hashes *hashes,
                                  unsigned char *bytes_out, size_t len)
 {
     unsigned char buff[TX_STACK_SIZE], *buff_p = buff;
@@ -2633,7 +2669,7 @@ static int tx_get_signature_hash(const struct wally_tx *tx,
     const struct tx_serialize_opts opts = {
         sighash, tx_sighash, index, script, script_len, satoshi,
         (flags & WALLY_TX_FLAG_USE_WITNESS) ? true : false,
-        value, value_len
+        value, value_len, hashes
     };
 
     if (!is_valid_tx(tx) || BYTES_INVALID(script, script_len) ||
@@ -2693,7 +2729,8 @@ int wally_tx_get_signature_hash(const struct wally_tx *tx,
 {
     return tx_get_signature_hash(tx, index, script, script_len,
                                  extra, extra_len, extra_offset, satoshi,
-                                 NULL, 0, sighash, tx_sighash, flags, bytes_out, len);
+                                 NULL, 0, sighash, tx_sighash, flags, NULL,
+                                 bytes_out, len);
 }
 
 int wally_tx_get_btc_signature_hash(const struct wally_tx *tx, size_t index,
@@ -2715,7 +2752,7 @@ int wally_tx_get_elements_signature_hash(const struct wally_tx *tx,
 {
     return tx_get_signature_hash(tx, index, script, script_len,
                                  NULL, 0, 0, 0, value, value_len,
-                                 sighash, sighash, flags, bytes_out, len);
+                                 sighash, sighash, flags, NULL, bytes_out, len);
 }
 
 int wally_tx_confidential_value_from_satoshi(uint64_t satoshi,
@@ -2853,6 +2890,468 @@ int wally_tx_get_total_output_satoshi(const struct wally_tx *tx, uint64_t *value
     return WALLY_OK;
 }
 
+static uint64_t tx_output_get_dust_threshold(const struct wally_tx_output *output,
+                                             uint64_t fee_rate)
+{
+    const unsigned char *program;
+    size_t version, program_len;
+    uint64_t n;
+
+    if ((output->script_len && output->script[0] == OP_RETURN) ||
+        output->script_len > MAX_SCRIPT_LEN)
+        return 0; /* Unspendable outputs are never dust */
+
+    n = sizeof(output->satoshi) + varbuff_get_length(output->script_len);
+    if (script_get_witness_program(output->script, output->script_len,
+                                   &version, &program, &program_len))
+        n += WITNESS_SPEND_INPUT_LEN;
+    else
+        n += SPEND_INPUT_LEN;
+
+    n = n * fee_rate / 1000;
+    return !n && fee_rate ? 1 : n;
+}
+
+int wally_tx_output_get_dust_threshold(const struct wally_tx_output *output,
+                                       uint64_t fee_rate, uint64_t *value_out)
+{
+    if (value_out)
+        *value_out = 0;
+
+    if (!is_valid_tx_output(output) || !value_out)
+        return WALLY_EINVAL;
+
+    *value_out = tx_output_get_dust_threshold(output, fee_rate);
+    return WALLY_OK;
+}
+
+/* Get the P2SH and witness sigop cost of spending 'script' with 'input' */
+static size_t tx_input_get_sigop_cost(const struct wally_tx_input *input,
+                                      const unsigned char *script, size_t script_len,
+                                      bool push_only,
+                                      const unsigned char *redeem_script,
+                                      size_t redeem_script_len,
+                                      size_t *p2sh_sigops)
+{
+    const unsigned char *program;
+    size_t type, version, program_len, cost = 0;
+
+    *p2sh_sigops = 0;
+    if (wally_scriptpubkey_get_type(script, script_len, &type) == WALLY_OK &&
+        type == WALLY_SCRIPT_TYPE_P2SH) {
+        if (!push_only)
+            return 0; /* Not a valid P2SH spend */
+        *p2sh_sigops = script_get_sigop_count(redeem_script, redeem_script_len, true);
+        cost = *p2sh_sigops * WITNESS_SCALE_FACTOR;
+        /* Nested segwit: the redeem script holds the witness program */
+        script = redeem_script;
+        script_len = redeem_script_len;
+    }
+
+    if (script_get_witness_program(script, script_len,
+                                   &version, &program, &program_len) && !version) {
+        if (program_len == HASH160_LEN)
+            cost += 1;
+        else if (program_len == SHA256_LEN && input->witness &&
+                 input->witness->num_items) {
+            const struct wally_tx_witness_item *item;
+            item = input->witness->items + input->witness->num_items - 1;
+            cost += script_get_sigop_count(item->witness, item->witness_len, true);
+        }
+    }
+    return cost;
+}
+
+/* Compute the sigop cost and (optionally) the policy failures of a tx in
+ * a single pass over its inputs and outputs */
+static int tx_get_policy(const struct wally_tx *tx,
+                         const unsigned char *const *prevout_scripts,
+                         const size_t *prevout_script_lens,
+                         size_t num_prevouts, uint64_t dust_fee_rate,
+                         size_t *sigop_cost, size_t *failures)
+{
+    size_t i, is_coinbase, legacy_sigops = 0, num_op_returns = 0;
+    size_t base_size, witness_size, witness_count, p2sh_sigops, type;
+
+    *sigop_cost = 0;
+    if (failures)
+        *failures = 0;
+
+    if (!is_valid_tx(tx) ||
+        (prevout_scripts && (!prevout_script_lens || num_prevouts != tx->num_inputs)) ||
+        (!prevout_scripts && num_prevouts))
+        return WALLY_EINVAL;
+
+#ifdef BUILD_ELEMENTS
+    {
+        size_t is_elements;
+        if (wally_tx_is_elements(tx, &is_elements) != WALLY_OK || is_elements)
+            return WALLY_EINVAL; /* Policy checks apply to Bitcoin txs only */
+    }
+#endif
+    wally_tx_is_coinbase(tx, &is_coinbase);
+
+    for (i = 0; i < tx->num_inputs; ++i) {
+        const struct wally_tx_input *input = tx->inputs + i;
+        const unsigned char *redeem_script;
+        size_t redeem_script_len;
+        bool push_only;
+
+        push_only = script_is_push_only(input->script, input->script_len,
+                                        &redeem_script, &redeem_script_len);
+        legacy_sigops += script_get_sigop_count(input->script, input->script_len, false);
+
+        if (prevout_scripts && !is_coinbase) {
+            if (!prevout_scripts[i] && prevout_script_lens[i])
+                return WALLY_EINVAL;
+            *sigop_cost += tx_input_get_sigop_cost(input, prevout_scripts[i],
+                                                   prevout_script_lens[i],
+                                                   push_only, redeem_script,
+                                                   redeem_script_len, &p2sh_sigops);
+            if (failures && p2sh_sigops > MAX_STANDARD_P2SH_SIGOPS)
+                *failures |= WALLY_TX_POLICY_SIGOPS;
+        }
+
+        if (failures) {
+            if (input->script_len > MAX_STANDARD_SCRIPTSIG_LEN)
+                *failures |= WALLY_TX_POLICY_SCRIPTSIG_SIZE;
+            if (!push_only)
+                *failures |= WALLY_TX_POLICY_SCRIPTSIG_NOT_PUSHONLY;
+        }
+    }
+
+    for (i = 0; i < tx->num_outputs; ++i) {
+        const struct wally_tx_output *output = tx->outputs + i;
+
+        legacy_sigops += script_get_sigop_count(output->script, output->script_len, false);
+
+        if (!failures)
+            continue;
+        if (!scriptpubkey_is_standard(output->script, output->script_len, &type))
+            *failures |= WALLY_TX_POLICY_SCRIPTPUBKEY;
+        else if (type == WALLY_SCRIPT_TYPE_OP_RETURN)
+            ++num_op_returns;
+        else if (output->satoshi < tx_output_get_dust_threshold(output, dust_fee_rate))
+            *failures |= WALLY_TX_POLICY_DUST;
+    }
+
+    *sigop_cost += legacy_sigops * WITNESS_SCALE_FACTOR;
+
+    if (failures) {
+        if (tx->version < WALLY_TX_VERSION_1 || tx->version > MAX_STANDARD_TX_VERSION)
+            *failures |= WALLY_TX_POLICY_VERSION;
+        if (tx_get_lengths(tx, NULL, WALLY_TX_FLAG_USE_WITNESS, &base_size,
+                           &witness_size, &witness_count, false) != WALLY_OK)
+            return WALLY_EINVAL;
+        if (base_size * WITNESS_SCALE_FACTOR + (witness_count ? witness_size : 0) >
+            WALLY_TX_MAX_STANDARD_WEIGHT)
+            *failures |= WALLY_TX_POLICY_WEIGHT;
+        if (num_op_returns > 1)
+            *failures |= WALLY_TX_POLICY_MULTI_OP_RETURN;
+        if (*sigop_cost > WALLY_TX_MAX_STANDARD_SIGOP_COST)
+            *failures |= WALLY_TX_POLICY_SIGOPS;
+    }
+    return WALLY_OK;
+}
+
+int wally_tx_get_sigop_cost(const struct wally_tx *tx,
+                            const unsigned char *const *prevout_scripts,
+                            const size_t *prevout_script_lens,
+                            size_t num_prevouts,
+                            size_t *written)
+{
+    int ret;
+
+    if (written)
+        *written = 0;
+
+    if (!written)
+        return WALLY_EINVAL;
+
+    ret = tx_get_policy(tx, prevout_scripts, prevout_script_lens, num_prevouts,
+                        0, written, NULL);
+    if (ret != WALLY_OK)
+        *written = 0;
+    return ret;
+}
+
+int wally_tx_get_policy_failures(const struct wally_tx *tx,
+                                 const unsigned char *const *prevout_scripts,
+                                 const size_t *prevout_script_lens,
+                                 size_t num_prevouts,
+                                 uint64_t dust_fee_rate,
+                                 size_t *written)
+{
+    size_t sigop_cost;
+    int ret;
+
+    if (written)
+        *written = 0;
+
+    if (!written)
+        return WALLY_EINVAL;
+
+    ret = tx_get_policy(tx, prevout_scripts, prevout_script_lens, num_prevouts,
+                        dust_fee_rate, &sigop_cost, written);
+    if (ret != WALLY_OK)
+        *written = 0;
+    return ret;
+}
+
+/* Compute the BIP143 hashes that SIGHASH_ALL inputs have in common */
+static int tx_get_bip143_hashes(const struct wally_tx *tx,
+                                struct tx_bip143_hashes *hashes)
+{
+    const struct tx_serialize_opts opts = {
+        WALLY_SIGHASH_ALL, WALLY_SIGHASH_ALL, 0, NULL, 0, 0, true, NULL, 0, NULL
+    };
+    unsigned char buff[4 + SHA256_LEN * 2 + WALLY_TXHASH_LEN + 4 + 1 + 8 + 4 + SHA256_LEN + 4 + 4];
+    size_t written;
+    int ret;
+
+    /* Serialize a preimage and extract the hashes from it */
+    ret = tx_to_bip143_bytes(tx, &opts, 0, buff, sizeof(buff), &written);
+    if (ret == WALLY_OK && written != sizeof(buff))
+        ret = WALLY_ERROR; /* Should not happen! */
+    if (ret == WALLY_OK) {
+        memcpy(hashes->prevouts, buff + 4, SHA256_LEN);
+        memcpy(hashes->sequences, buff + 4 + SHA256_LEN, SHA256_LEN);
+        memcpy(hashes->outputs, buff + sizeof(buff) - 8 - SHA256_LEN, SHA256_LEN);
+    }
+    wally_clear(buff, sizeof(buff));
+    return ret;
+}
+
+struct tx_sign_item {
+    const struct wally_tx_sign_input *input;
+    size_t script_type;
+    unsigned char pub_key[EC_PUBLIC_KEY_LEN];
+    unsigned char hash160[HASH160_LEN];
+    unsigned char sig[EC_SIGNATURE_DER_MAX_LEN + 1]; /* +1 for sighash */
+    size_t sig_len;
+    unsigned char *script; /* The signed scriptSig, if any */
+    size_t script_len;
+    struct wally_tx_witness_stack *witness; /* The signed witness, if any */
+    int ret;
+};
+
+struct tx_sign_job {
+    const struct wally_tx *tx;
+    const struct tx_bip143_hashes *hashes;
+    uint32_t flags;
+    struct tx_sign_item *items;
+};
+
+static int tx_sign_item(const struct tx_sign_job *job, struct tx_sign_item *item)
+{
+    const struct wally_tx_sign_input *input = item->input;
+    unsigned char script_code[WALLY_SCRIPTPUBKEY_P2PKH_LEN];
+    unsigned char redeem_script[WALLY_SCRIPTPUBKEY_P2WPKH_LEN];
+    unsigned char buff[SHA256_LEN], sig[EC_SIGNATURE_LEN];
+    const unsigned char *hash_p;
+    size_t written;
+    uint32_t flags = 0;
+    int ret;
+
+    ret = wally_ec_public_key_from_private_key(input->priv_key, EC_PRIVATE_KEY_LEN,
+                                               item->pub_key, sizeof(item->pub_key));
+    if (ret == WALLY_OK)
+        ret = wally_hash160(item->pub_key, sizeof(item->pub_key),
+                            item->hash160, sizeof(item->hash160));
+    if (ret == WALLY_OK)
+        ret = wally_scriptpubkey_p2pkh_from_bytes(item->hash160, HASH160_LEN, 0,
+                                                  script_code, sizeof(script_code),
+                                                  &written);
+    if (ret != WALLY_OK)
+        return ret;
+
+    /* Check that the key can spend the prevout */
+    switch (item->script_type) {
+    case WALLY_SCRIPT_TYPE_P2PKH:
+        hash_p = input->script + 3;
+        break;
+    case WALLY_SCRIPT_TYPE_P2WPKH:
+        hash_p = input->script + 2;
+        flags = WALLY_TX_FLAG_USE_WITNESS;
+        break;
+    default: /* P2SH-wrapped P2WPKH */
+        ret = wally_witness_program_from_bytes(item->pub_key, sizeof(item->pub_key),
+                                               WALLY_SCRIPT_HASH160,
+                                               redeem_script, sizeof(redeem_script),
+                                               &written);
+        if (ret == WALLY_OK)
+            ret = wally_hash160(redeem_script, sizeof(redeem_script),
+                                buff, HASH160_LEN);
+        if (ret != WALLY_OK)
+            return ret;
+        hash_p = input->script + 2;
+        flags = WALLY_TX_FLAG_USE_WITNESS;
+        break;
+    }
+    if (memcmp(hash_p, item->script_type == WALLY_SCRIPT_TYPE_P2SH ? buff : item->hash160,
+               HASH160_LEN))
+        return WALLY_EINVAL; /* Key doesn't match the prevout */
+
+    ret = tx_get_signature_hash(job->tx, input->index,
+                                item->script_type == WALLY_SCRIPT_TYPE_P2PKH ?
+                                input->script : script_code,
+                                item->script_type == WALLY_SCRIPT_TYPE_P2PKH ?
+                                input->script_len : sizeof(script_code),
+                                NULL, 0, 0, input->satoshi, NULL, 0,
+                                input->sighash, input->sighash, flags,
+                                flags ? job->hashes : NULL, buff, sizeof(buff));
+    if (ret == WALLY_OK)
+        ret = wally_ec_sig_from_bytes(input->priv_key, EC_PRIVATE_KEY_LEN,
+                                      buff, sizeof(buff),
+                                      EC_FLAG_ECDSA | job->flags,
+                                      sig, sizeof(sig));
+    if (ret == WALLY_OK)
+        ret = wally_ec_sig_to_der(sig, sizeof(sig), item->sig,
+                                  sizeof(item->sig), &item->sig_len);
+    if (ret == WALLY_OK)
+        item->sig[item->sig_len++] = input->sighash & 0xff;
+
+    wally_clear_2(buff, sizeof(buff), sig, sizeof(sig));
+    return ret;
+}
+
+static void tx_sign_job_run(void *p, size_t begin, size_t end)
+{
+    const struct tx_sign_job *job = p;
+    size_t i;
+
+    for (i = begin; i < end; ++i)
+        job->items[i].ret = tx_sign_item(job, job->items + i);
+}
+
+/* Create the scriptSig and witness for a signed input */
+static int tx_sign_item_finalize(struct tx_sign_item *item)
+{
+    unsigned char script[WALLY_SCRIPTSIG_P2PKH_MAX_LEN];
+    unsigned char redeem_script[WALLY_SCRIPTPUBKEY_P2WPKH_LEN];
+    size_t written = 0;
+    int ret;
+
+    if (item->script_type == WALLY_SCRIPT_TYPE_P2PKH)
+        ret = wally_scriptsig_p2pkh_from_der(item->pub_key, sizeof(item->pub_key),
+                                             item->sig, item->sig_len,
+                                             script, sizeof(script), &written);
+    else {
+        ret = wally_witness_p2wpkh_from_der(item->pub_key, sizeof(item->pub_key),
+                                            item->sig, item->sig_len, &item->witness);
+        if (ret == WALLY_OK && item->script_type == WALLY_SCRIPT_TYPE_P2SH) {
+            ret = wally_witness_program_from_bytes(item->pub_key, sizeof(item->pub_key),
+                                                   WALLY_SCRIPT_HASH160,
+                                                   redeem_script, sizeof(redeem_script),
+                                                   &written);
+            if (ret == WALLY_OK)
+                ret = wally_script_push_from_bytes(redeem_script, sizeof(redeem_script), 0,
+                                                   script, sizeof(script), &written);
+        }
+    }
+
+    if (ret == WALLY_OK)
+        ret = replace_script(written ? script : NULL, written,
+                             &item->script, &item->script_len);
+    wally_clear(script, sizeof(script));
+    return ret;
+}
+
+/* Move a signed scriptSig and witness into their input. Cannot fail */
+static void tx_sign_item_install(struct wally_tx *tx, struct tx_sign_item *item)
+{
+    struct wally_tx_input *input = tx->inputs + item->input->index;
+
+    clear_and_free(input->script, input->script_len);
+    input->script = item->script;
+    input->script_len = item->script_len;
+    item->script = NULL;
+    item->script_len = 0;
+    tx_witness_stack_free(input->witness, true);
+    input->witness = item->witness;
+    item->witness = NULL;
+}
+
+int wally_tx_sign_inputs(struct wally_tx *tx,
+                         const struct wally_tx_sign_input *inputs,
+                         size_t num_inputs,
+                         uint32_t flags,
+                         uint32_t num_threads)
+{
+    struct tx_bip143_hashes hashes;
+    struct tx_sign_job job = { NULL, NULL, 0, NULL };
+    bool *seen = NULL, have_segwit = false;
+    size_t i;
+    int ret = WALLY_OK;
+
+    if (!is_valid_tx(tx) || !tx->num_inputs || !inputs || !num_inputs ||
+        (flags & ~EC_FLAG_GRIND_R))
+        return WALLY_EINVAL;
+
+#ifdef BUILD_ELEMENTS
+    if (is_valid_elements_tx(tx))
+        return WALLY_EINVAL; /* Elements signing is not supported */
+#endif
+
+    if (!(seen = wally_malloc(tx->num_inputs * sizeof(*seen))) ||
+        !(job.items = wally_malloc(num_inputs * sizeof(*job.items)))) {
+        wally_free(seen);
+        return WALLY_ENOMEM;
+    }
+    memset(seen, 0, tx->num_inputs * sizeof(*seen));
+    memset(job.items, 0, num_inputs * sizeof(*job.items));
+
+    for (i = 0; i < num_inputs && ret == WALLY_OK; ++i) {
+        const struct wally_tx_sign_input *input = inputs + i;
+        struct tx_sign_item *item = job.items + i;
+
+        item->input = input;
+        if (input->index >= tx->num_inputs || seen[input->index] ||
+            !input->priv_key || !input->script ||
+            wally_scriptpubkey_get_type(input->script, input->script_len,
+                                        &item->script_type) != WALLY_OK ||
+            (item->script_type != WALLY_SCRIPT_TYPE_P2PKH &&
+             item->script_type != WALLY_SCRIPT_TYPE_P2WPKH &&
+             item->script_type != WALLY_SCRIPT_TYPE_P2SH))
+            ret = WALLY_EINVAL;
+        else {
+            seen[input->index] = true;
+            if (item->script_type != WALLY_SCRIPT_TYPE_P2PKH)
+                have_segwit = true;
+        }
+    }
+    wally_free(seen);
+
+    /* Compute the hashes shared by all segwit inputs once up front */
+    if (ret == WALLY_OK && have_segwit &&
+        (ret = tx_get_bip143_hashes(tx, &hashes)) == WALLY_OK)
+        job.hashes = &hashes;
+
+    if (ret == WALLY_OK) {
+        job.tx = tx;
+        job.flags = flags;
+        ret = wally_run_parallel(tx_sign_job_run, &job, num_inputs, 1, num_threads);
+    }
+
+    for (i = 0; i < num_inputs && ret == WALLY_OK; ++i)
+        ret = job.items[i].ret;
+
+    for (i = 0; i < num_inputs && ret == WALLY_OK; ++i)
+        ret = tx_sign_item_finalize(job.items + i);
+
+    /* Only modify the tx once every input has been signed and finalized */
+    for (i = 0; i < num_inputs && ret == WALLY_OK; ++i)
+        tx_sign_item_install(tx, job.items + i);
+
+    for (i = 0; i < num_inputs; ++i) {
+        clear_and_free(job.items[i].script, job.items[i].script_len);
+        wally_tx_witness_stack_free(job.items[i].witness);
+    }
+    clear_and_free(job.items, num_inputs * sizeof(*job.items));
+    wally_clear(&hashes, sizeof(hashes));
+    return ret;
+}
+
 static struct wally_tx_input *tx_get_input(const struct wally_tx *tx, size_t index)
 {
     return is_valid_tx(tx) && index < tx->num_inputs ? &tx->inputs[index] : NULL;
@@ -13,6 +13,7 @@
 #include "hex.c"
 #include "hmac.c"
 #include "mnemonic.c"
+#include "musig.c"
 #include "pbkdf2.c"
 #include "script.c"
 #include "scrypt.c"
@@ -28,6 +29,7 @@
 #undef PACKAGE_VERSION
 #undef VERSION
 #include "src/secp256k1/src/secp256k1.c"
+#include "ec_multi_mul.c"
 #include "ccan/ccan/crypto/sha256/sha256.c"
 
 void wally_silence_unused_warnings(void)